@@ -19,6 +19,7 @@
 #include "view_scene.h"
 #include "viewrender.h"
 #include "vprof.h"
+#include "engine/ivdebugoverlay.h"
 
 CLIENTEFFECT_REGISTER_BEGIN( PrecachePortalDrawingMaterials )
 CLIENTEFFECT_MATERIAL( "shadertest/wireframe" )
@@ -26,14 +27,21 @@ CLIENTEFFECT_MATERIAL( "engine/writez_model" )
 CLIENTEFFECT_MATERIAL( "engine/TranslucentVertexColor" )
 CLIENTEFFECT_REGISTER_END()
 
-#define TEMP_DISABLE_PORTAL_VIS_QUERY
-
 static ConVar r_forcecheapwater( "r_forcecheapwater", "0", FCVAR_CLIENTDLL | FCVAR_CHEAT, "Force all water to be cheap water, will show old renders if enabled after water has been seen" );
 
 
 ConVar r_portal_use_stencils( "r_portal_use_stencils", "1", FCVAR_CLIENTDLL, "Render portal views using stencils (if available)" ); //draw portal views using stencil rendering
 ConVar r_portal_stencil_depth( "r_portal_stencil_depth", "2", FCVAR_CLIENTDLL | FCVAR_ARCHIVE, "When using stencil views, this changes how many views within views we see" );
 
+ConVar r_portal_lod( "r_portal_lod", "1", FCVAR_CLIENTDLL, "Scale back recursion depth, water quality and texture refresh rate for portals that cover little of the screen" );
+ConVar r_portal_lod_reduced_coverage( "r_portal_lod_reduced_coverage", "0.05", FCVAR_CLIENTDLL, "Portals covering less than this fraction of the screen see at most one more portal deep and use simple water" );
+ConVar r_portal_lod_minimal_coverage( "r_portal_lod_minimal_coverage", "0.01", FCVAR_CLIENTDLL, "Portals covering less than this fraction of the screen don't recurse and don't draw expensive water" );
+
+ConVar r_portal_vis_cache( "r_portal_vis_cache", "0", FCVAR_CLIENTDLL, "Skip rendering portal views that pixel visibility queries have found invisible several frames in a row" );
+ConVar r_portal_vis_cache_frames( "r_portal_vis_cache_frames", "3", FCVAR_CLIENTDLL, "How many frames in a row a portal view has to be invisible before the visibility cache skips it" );
+ConVar r_portal_vis_cache_max_skip( "r_portal_vis_cache_max_skip", "10", FCVAR_CLIENTDLL, "Render a portal view skipped by the visibility cache anyways after this many frames, in case the queries have gone stale" );
+ConVar r_portal_vis_cache_debug( "r_portal_vis_cache_debug", "0", FCVAR_CLIENTDLL | FCVAR_CHEAT, "Show which portal views were rendered, skipped or culled this frame" );
+
 //-----------------------------------------------------------------------------
 //
 // Portal rendering management class
@@ -64,13 +72,14 @@ PortalViewIDNode_t *AllocPortalViewIDNode( int iChildLinkCount )
 		iNewAllocationCounter += 2; //2 to make room for skybox view ids
 	}
 
-	CMatRenderContextPtr pRenderContext( materials );	
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-	pNode->occlusionQueryHandle = pRenderContext->CreateOcclusionQueryObject();
-#endif
+	pNode->occlusionQueryHandle = INVALID_OCCLUSION_QUERY_OBJECT_HANDLE; //created the first time the vis cache wants a query
 	pNode->iOcclusionQueryPixelsRendered = -5;
 	pNode->iWindowPixelsAtQueryTime = 0;
 	pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = -1.0f;
+	pNode->fScreenCoverage = -1.0f;
+	pNode->iLOD = PORTAL_VIEW_LOD_FULL;
+	pNode->iFramesInvisible = 0;
+	pNode->iFramesSkipped = 0;
 
 	if( iChildLinkCount != 0 )
 	{
@@ -91,14 +100,33 @@ void FreePortalViewIDNode( PortalViewIDNode_t *pNode )
 
 	s_iFreedViewIDs.AddToTail( pNode->iPrimaryViewID );
 
-	CMatRenderContextPtr pRenderContext( materials );
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-	pRenderContext->DestroyOcclusionQueryObject( pNode->occlusionQueryHandle );
-#endif
+	if( pNode->occlusionQueryHandle != INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+	{
+		CMatRenderContextPtr pRenderContext( materials );
+		pRenderContext->DestroyOcclusionQueryObject( pNode->occlusionQueryHandle );
+	}
 
 	delete pNode; //for now we just new/delete
 }
 
+//pixel visibility queries only feed the vis cache. With r_portal_vis_cache off none are issued, every view's visibility stays unknown and portals render just like they did without the cache
+static bool BeginPortalViewPixelVisibilityQuery( PortalViewIDNode_t *pNode, IMatRenderContext *pRenderContext, int iWindowPixels )
+{
+	if( !r_portal_vis_cache.GetBool() )
+		return false;
+
+	if( pNode->occlusionQueryHandle == INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+	{
+		pNode->occlusionQueryHandle = pRenderContext->CreateOcclusionQueryObject();
+		if( pNode->occlusionQueryHandle == INVALID_OCCLUSION_QUERY_OBJECT_HANDLE )
+			return false;
+	}
+
+	pRenderContext->BeginOcclusionQueryDrawing( pNode->occlusionQueryHandle );
+	pNode->iWindowPixelsAtQueryTime = iWindowPixels;
+	return true;
+}
+
 void IncreasePortalViewIDChildLinkCount( PortalViewIDNode_t *pNode )
 {
 	for( int i = pNode->ChildNodes.Count(); --i >= 0; )
@@ -162,10 +190,6 @@ CPortalRenderable::~CPortalRenderable( void )
 
 void CPortalRenderable::BeginPortalPixelVisibilityQuery( void )
 {
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-	return;
-#endif
-
 	if( g_pPortalRender->ShouldUseStencilsToRenderPortals() ) //this function exists because we require help in texture mode, we need no assistance in stencil mode. Moreover, doing the query twice will probably fubar the results
 		return;
 
@@ -174,27 +198,22 @@ void CPortalRenderable::BeginPortalPixelVisibilityQuery( void )
 	if( pCurrentPortalViewNode )
 	{
 		CMatRenderContextPtr pRenderContext( materials );
-		pRenderContext->BeginOcclusionQueryDrawing( pCurrentPortalViewNode->occlusionQueryHandle );
 
 		int iX, iY, iWidth, iHeight;
 		pRenderContext->GetViewport( iX, iY, iWidth, iHeight );
 
-		pCurrentPortalViewNode->iWindowPixelsAtQueryTime = iWidth * iHeight;
+		BeginPortalViewPixelVisibilityQuery( pCurrentPortalViewNode, pRenderContext, iWidth * iHeight );
 	}
 }
 
 void CPortalRenderable::EndPortalPixelVisibilityQuery( void )
 {
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-	return;
-#endif
-
 	if( g_pPortalRender->ShouldUseStencilsToRenderPortals() ) //this function exists because we require help in texture mode, we need no assistance in stencil mode. Moreover, doing the query twice will probably fubar the results
 		return;
 
 	PortalViewIDNode_t *pCurrentPortalViewNode = g_pPortalRender->m_PortalViewIDNodeChain[g_pPortalRender->m_iViewRecursionLevel]->ChildNodes[m_iPortalViewIDNodeIndex];
 	
-	if( pCurrentPortalViewNode )
+	if( pCurrentPortalViewNode && (pCurrentPortalViewNode->iWindowPixelsAtQueryTime != 0) ) //only set when the begin call above started a query
 	{
 		CMatRenderContextPtr pRenderContext( materials );
 		pRenderContext->EndOcclusionQueryDrawing( pCurrentPortalViewNode->occlusionQueryHandle );
@@ -209,9 +228,17 @@ CPortalRender::CPortalRender()
 {
 	m_iRemainingPortalViewDepth = 1; //let's portals know that they should do "end of the line" kludges to cover up that portals don't go infinitely recursive
 	m_iViewRecursionLevel = 0;
+	m_iLODMaxViewDepth = MAX_PORTAL_RECURSIVE_VIEWS;
 	m_pRenderingViewForPortal = NULL;
 	m_pRenderingViewExitPortal = NULL;
 
+	m_HeadPortalViewIDNode.fScreenCoverage = -1.0f;
+	m_HeadPortalViewIDNode.iLOD = PORTAL_VIEW_LOD_FULL;
+	m_HeadPortalViewIDNode.iFramesInvisible = 0;
+	m_HeadPortalViewIDNode.iFramesSkipped = 0;
+
+	memset( m_iPortalViewDrawResults, 0, sizeof( m_iPortalViewDrawResults ) );
+
 	m_PortalViewIDNodeChain[0] = &m_HeadPortalViewIDNode;
 }
 
@@ -255,6 +282,9 @@ int CPortalRender::ShouldForceCheaperWaterLevel() const
 			return 0;
 
 		PortalViewIDNode_t *pPixelVisNode = m_PortalViewIDNodeChain[m_iViewRecursionLevel - 1]->ChildNodes[m_pRenderingViewForPortal->m_iPortalViewIDNodeIndex];
+
+		if( pPixelVisNode->iLOD == PORTAL_VIEW_LOD_MINIMAL )
+			return 0;
 		
 		if( pPixelVisNode->fScreenFilledByPortalSurfaceLastFrame_Normalized >= 0.0f )
 		{
@@ -267,6 +297,9 @@ int CPortalRender::ShouldForceCheaperWaterLevel() const
 			if( pPixelVisNode->fScreenFilledByPortalSurfaceLastFrame_Normalized < 0.05f )
 				return 2;
 		}
+
+		if( pPixelVisNode->iLOD == PORTAL_VIEW_LOD_REDUCED )
+			return 1;
 	}
 
 	return 3;
@@ -326,8 +359,17 @@ void Recursive_UpdatePortalPixelVisibility( PortalViewIDNode_t *pNode, IMatRende
 		}
 		else
 		{
-			pNode->iOcclusionQueryPixelsRendered = pRenderContext->OcclusionQuery_GetNumPixelsRendered( pNode->occlusionQueryHandle );
-			pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = ((float)pNode->iOcclusionQueryPixelsRendered) / ((float)pNode->iWindowPixelsAtQueryTime);
+			int iPixelsRendered = pRenderContext->OcclusionQuery_GetNumPixelsRendered( pNode->occlusionQueryHandle );
+			if( iPixelsRendered >= 0 )
+			{
+				pNode->iOcclusionQueryPixelsRendered = iPixelsRendered;
+				pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = ((float)iPixelsRendered) / ((float)pNode->iWindowPixelsAtQueryTime);
+			}
+			else
+			{
+				//still pending or failed, don't know anything about this frame
+				pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = -1.0f;
+			}
 		}
 	}
 	else
@@ -335,6 +377,12 @@ void Recursive_UpdatePortalPixelVisibility( PortalViewIDNode_t *pNode, IMatRende
 		pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = -1.0f;
 	}
 
+	//anything but a definite zero breaks the invisible streak
+	if( pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized == 0.0f )
+		++pNode->iFramesInvisible;
+	else
+		pNode->iFramesInvisible = 0;
+
 	pNode->iWindowPixelsAtQueryTime = 0;
 
 	for( int i = pNode->ChildNodes.Count(); --i >= 0; )
@@ -347,10 +395,6 @@ void Recursive_UpdatePortalPixelVisibility( PortalViewIDNode_t *pNode, IMatRende
 
 void CPortalRender::UpdatePortalPixelVisibility( void )
 {
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-	return;
-#endif
-
 	if( m_iViewRecursionLevel != 0 )
 		return;
 
@@ -373,6 +417,8 @@ void Recursive_InvalidatePortalPixelVis( PortalViewIDNode_t *pNode )
 	pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized = -1.0f;
 	pNode->iOcclusionQueryPixelsRendered = -5;
 	pNode->iWindowPixelsAtQueryTime = 0;
+	pNode->iFramesInvisible = 0;
+	pNode->iFramesSkipped = 0;
 	
 	for( int i = pNode->ChildNodes.Count(); --i >= 0; )
 	{
@@ -495,7 +541,8 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 	if( iNumRenderablePortals == 0 )
 		return false;
 
-	const int iMaxDepth = MIN( r_portal_stencil_depth.GetInt(), MIN( MAX_PORTAL_RECURSIVE_VIEWS, (1 << materials->StencilBufferBits()) ) - 1 );
+	int iMaxDepth = MIN( r_portal_stencil_depth.GetInt(), MIN( MAX_PORTAL_RECURSIVE_VIEWS, (1 << materials->StencilBufferBits()) ) - 1 );
+	iMaxDepth = MIN( iMaxDepth, m_iLODMaxViewDepth ); //a low detail portal view further up the chain doesn't want to see this deep
 
 	if( m_iViewRecursionLevel >= iMaxDepth ) //can't support any more views	
 	{
@@ -529,9 +576,7 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 
 	int iX, iY, iWidth, iHeight;
 	pRenderContext->GetViewport( iX, iY, iWidth, iHeight );
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
 	int iScreenPixelCount = iWidth * iHeight;
-#endif
 
 	bool bRebuildDrawListsWhenDone = false;
 
@@ -551,6 +596,8 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 		pRenderContext->SetStencilReferenceValue( 0 );
 
         m_RecursiveViewComplexFrustums[0].RemoveAll(); //clear any garbage leftover in the complex frustums from last frame
+
+		memset( m_iPortalViewDrawResults, 0, sizeof( m_iPortalViewDrawResults ) );
 	}
 
 	if( m_RecursiveViewComplexFrustums[m_iViewRecursionLevel].Count() == 0 )
@@ -569,6 +616,9 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 			(pCurrentPortal == m_pRenderingViewExitPortal) ||
 			(pCurrentPortal->ShouldUpdatePortalView_BasedOnView( *pViewSetup, m_RecursiveViewComplexFrustums[m_iViewRecursionLevel] ) == false) )
 		{
+			if( pCurrentPortal != m_pRenderingViewExitPortal )
+				RecordPortalViewDrawResult( pCurrentPortal, NULL, PORTAL_VIEW_CULLED );
+
 			//can't see through the portal, free up it's view id node for use elsewhere
 			if( m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex] != NULL )
 			{
@@ -584,6 +634,8 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 			m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex] = AllocPortalViewIDNode( m_HeadPortalViewIDNode.ChildNodes.Count() );
 
 		PortalViewIDNode_t *pCurrentPortalViewNode = m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex];
+
+		const int iPortalLOD = UpdatePortalViewLOD( pCurrentPortal, pCurrentPortalViewNode, *pViewSetup );
 		
 		// Step 0, Allow for special effects to happen before cutting a hole
 		{
@@ -604,22 +656,23 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 			//pRenderContext->SetStencilZFailOperation( STENCILOPERATION_KEEP );
 			//pRenderContext->SetStencilReferenceValue( iParentLevelStencilReferenceValue );
 
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-			pRenderContext->BeginOcclusionQueryDrawing( pCurrentPortalViewNode->occlusionQueryHandle );
-			pCurrentPortalViewNode->iWindowPixelsAtQueryTime = iScreenPixelCount;
-#endif
+			bool bQueryingPixelVisibility = BeginPortalViewPixelVisibilityQuery( pCurrentPortalViewNode, pRenderContext, iScreenPixelCount );
 
 			pCurrentPortal->DrawStencilMask();
 
-#ifndef TEMP_DISABLE_PORTAL_VIS_QUERY
-			pRenderContext->EndOcclusionQueryDrawing( pCurrentPortalViewNode->occlusionQueryHandle );
-#endif
+			if( bQueryingPixelVisibility )
+				pRenderContext->EndOcclusionQueryDrawing( pCurrentPortalViewNode->occlusionQueryHandle );
 		}
 
-		//see if we can skip the heavy lifting due to low visibility
-		if ( bIsQueuedMode || //don't use pixel visibly as a skip check in queued mode, the data is simply too old.
-			pCurrentPortal->ShouldUpdatePortalView_BasedOnPixelVisibility( pCurrentPortalViewNode->fScreenFilledByPortalSurfaceLastFrame_Normalized ) )
+		//see if we can skip the heavy lifting due to low visibility.
+		//The vis cache only skips while it's on, and then the stencil mask above always ran its query, so a skipped view finds out as soon as it's visible again
+		bool bSkipFromVisCache = ShouldSkipPortalViewFromVisCache( pCurrentPortalViewNode );
+		if ( !bSkipFromVisCache &&
+			( bIsQueuedMode || //don't use pixel visibly as a skip check in queued mode, the data is simply too old. A streak of invisible frames is still good enough for the vis cache
+			pCurrentPortal->ShouldUpdatePortalView_BasedOnPixelVisibility( pCurrentPortalViewNode->fScreenFilledByPortalSurfaceLastFrame_Normalized ) ) )
 		{
+			RecordPortalViewDrawResult( pCurrentPortal, pCurrentPortalViewNode, PORTAL_VIEW_RENDERED );
+
 			//step 2, clear the depth buffer in stencil areas so we can render a new scene to them
 			{
 				pRenderContext->SetStencilPassOperation( STENCILOPERATION_KEEP );
@@ -642,8 +695,24 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 				Assert( m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes.Count() > pCurrentPortal->m_iPortalViewIDNodeIndex );
 
 				m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex];
+
+				//small portals don't get to see as far into themselves
+				int iLODMaxViewDepthBackup = m_iLODMaxViewDepth;
+				int iRemainingPortalViewDepthBackup = m_iRemainingPortalViewDepth;
+				if( iPortalLOD != PORTAL_VIEW_LOD_FULL )
+				{
+					int iLODDepth = m_iViewRecursionLevel + ((iPortalLOD == PORTAL_VIEW_LOD_MINIMAL) ? 1 : 2);
+					if( iLODDepth < iMaxDepth )
+					{
+						m_iLODMaxViewDepth = iLODDepth;
+						m_iRemainingPortalViewDepth = (iLODDepth - m_iViewRecursionLevel) - 1;
+					}
+				}
 				
 				pCurrentPortal->RenderPortalViewToBackBuffer( pViewRender, *pViewSetup );
+
+				m_iLODMaxViewDepth = iLODMaxViewDepthBackup;
+				m_iRemainingPortalViewDepth = iRemainingPortalViewDepthBackup;
 				
 				m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = NULL;
 
@@ -673,6 +742,10 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 				pCurrentPortal->DrawPostStencilFixes();
 			}
 		}
+		else
+		{
+			RecordPortalViewDrawResult( pCurrentPortal, pCurrentPortalViewNode, bSkipFromVisCache ? PORTAL_VIEW_SKIPPED_VIS_CACHE : PORTAL_VIEW_SKIPPED_PIXEL_VIS );
+		}
 
 		//step 5, restore the stencil mask to the parent level
 		{
@@ -704,6 +777,13 @@ bool CPortalRender::DrawPortalsUsingStencils( CViewRender *pViewRender )
 		pRenderContext->SetStencilReferenceValue( 0 );
 
 		m_RecursiveViewComplexFrustums[0].RemoveAll();
+
+		if( r_portal_vis_cache_debug.GetBool() )
+		{
+			engine->Con_NPrintf( 0, "Portal views: %d rendered, %d skipped by vis cache, %d skipped by pixel vis, %d culled", 
+				m_iPortalViewDrawResults[PORTAL_VIEW_RENDERED], m_iPortalViewDrawResults[PORTAL_VIEW_SKIPPED_VIS_CACHE], 
+				m_iPortalViewDrawResults[PORTAL_VIEW_SKIPPED_PIXEL_VIS], m_iPortalViewDrawResults[PORTAL_VIEW_CULLED] );
+		}
 	}
 	else
 	{
@@ -758,6 +838,8 @@ void CPortalRender::DrawPortalsToTextures( CViewRender *pViewRender, const CView
 	m_RecursiveViewComplexFrustums[0].RemoveAll(); //clear any garbage leftover in the complex frustums from last frame
 	m_RecursiveViewComplexFrustums[0].AddMultipleToTail( FRUSTUM_NUMPLANES, pViewRender->GetFrustum() );
 
+	memset( m_iPortalViewDrawResults, 0, sizeof( m_iPortalViewDrawResults ) );
+
 
 #ifdef _DEBUG
 	g_bRenderingCameraView = true;
@@ -777,6 +859,8 @@ void CPortalRender::DrawPortalsToTextures( CViewRender *pViewRender, const CView
 		if( (pCurrentPortal->ShouldUpdatePortalView_BasedOnView( cameraView, m_RecursiveViewComplexFrustums[m_iViewRecursionLevel] ) == false) ||
 			(pCurrentPortal->GetLinkedPortal() == NULL) )
 		{
+			RecordPortalViewDrawResult( pCurrentPortal, NULL, PORTAL_VIEW_CULLED );
+
 			//can't see through the portal, free up it's view id node for use elsewhere
 			if( m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex] != NULL )
 			{
@@ -791,8 +875,12 @@ void CPortalRender::DrawPortalsToTextures( CViewRender *pViewRender, const CView
 		if( m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex] == NULL )
 			m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex] = AllocPortalViewIDNode( m_HeadPortalViewIDNode.ChildNodes.Count() );
 
+		UpdatePortalViewLOD( pCurrentPortal, m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex], cameraView );
+
 		m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pCurrentPortal->m_iPortalViewIDNodeIndex];
 
+		RecordPortalViewDrawResult( pCurrentPortal, m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1], PORTAL_VIEW_RENDERED );
+
 		pCurrentPortal->RenderPortalViewToTexture( pViewRender, cameraView );
 
 		m_PortalViewIDNodeChain[m_iViewRecursionLevel + 1] = NULL;		
@@ -800,6 +888,11 @@ void CPortalRender::DrawPortalsToTextures( CViewRender *pViewRender, const CView
 
 	render->PopView( pViewRender->GetFrustum() );
 
+	if( r_portal_vis_cache_debug.GetBool() )
+	{
+		engine->Con_NPrintf( 0, "Portal views: %d rendered, %d culled", m_iPortalViewDrawResults[PORTAL_VIEW_RENDERED], m_iPortalViewDrawResults[PORTAL_VIEW_CULLED] );
+	}
+
 	m_iRemainingPortalViewDepth = 1;
 	m_iViewRecursionLevel = 0;
 
@@ -866,6 +959,92 @@ float CPortalRender::GetPixelVisilityForPortalSurface( const CPortalRenderable *
 	return -1.0f;
 }
 
+int CPortalRender::GetPortalViewLOD( const CPortalRenderable *pPortal ) const
+{
+	PortalViewIDNode_t *pNode = m_PortalViewIDNodeChain[m_iViewRecursionLevel]->ChildNodes[pPortal->m_iPortalViewIDNodeIndex];
+	if( pNode )
+		return pNode->iLOD;
+
+	return PORTAL_VIEW_LOD_FULL;
+}
+
+//-----------------------------------------------------------------------------
+// Picks how much effort to spend on a portal's view this frame. Last frame's pixel visibility is
+// the best measure of how big the portal is on screen, if the queries are off we ask the portal for an estimate
+//-----------------------------------------------------------------------------
+int CPortalRender::UpdatePortalViewLOD( CPortalRenderable *pPortal, PortalViewIDNode_t *pNode, const CViewSetup &currentView )
+{
+	pNode->fScreenCoverage = -1.0f;
+	pNode->iLOD = PORTAL_VIEW_LOD_FULL;
+
+	if( !r_portal_lod.GetBool() )
+		return pNode->iLOD;
+
+	float fCoverage = pNode->fScreenFilledByPortalSurfaceLastFrame_Normalized;
+	if( fCoverage < 0.0f )
+		fCoverage = pPortal->GetApproximateScreenCoverage( currentView, m_RecursiveViewComplexFrustums[m_iViewRecursionLevel] );
+
+	pNode->fScreenCoverage = fCoverage;
+
+	if( fCoverage < 0.0f )
+		return pNode->iLOD; //no idea how big it is, assume it's important
+
+	if( fCoverage < r_portal_lod_minimal_coverage.GetFloat() )
+		pNode->iLOD = PORTAL_VIEW_LOD_MINIMAL;
+	else if( fCoverage < r_portal_lod_reduced_coverage.GetFloat() )
+		pNode->iLOD = PORTAL_VIEW_LOD_REDUCED;
+
+	return pNode->iLOD;
+}
+
+//-----------------------------------------------------------------------------
+// A single zero from last frame's query is a fine reason to skip a view in the synchronous case, but queued rendering
+// makes the results too old to trust on their own. A streak of them isn't, so skip until the streak breaks or we've
+// skipped long enough that it's worth drawing the view once to make sure the queries haven't gone stale
+//-----------------------------------------------------------------------------
+bool CPortalRender::ShouldSkipPortalViewFromVisCache( PortalViewIDNode_t *pNode )
+{
+	if( !r_portal_vis_cache.GetBool() || (pNode->iFramesInvisible < r_portal_vis_cache_frames.GetInt()) )
+	{
+		pNode->iFramesSkipped = 0;
+		return false;
+	}
+
+	if( pNode->iFramesSkipped >= r_portal_vis_cache_max_skip.GetInt() )
+	{
+		pNode->iFramesSkipped = 0;
+		return false;
+	}
+
+	++pNode->iFramesSkipped;
+	return true;
+}
+
+void CPortalRender::RecordPortalViewDrawResult( CPortalRenderable *pPortal, PortalViewIDNode_t *pNode, PortalViewDrawResult_t result )
+{
+	++m_iPortalViewDrawResults[result];
+
+	if( !r_portal_vis_cache_debug.GetBool() )
+		return;
+
+	C_BaseEntity *pPairedEntity = pPortal->PortalRenderable_GetPairedEntity();
+	if( pPairedEntity == NULL )
+		return;
+
+	static const char *s_szDrawResultNames[PORTAL_VIEW_DRAW_RESULT_COUNT] = { "rendered", "skipped (vis cache)", "skipped (pixel vis)", "culled" };
+
+	//one line per recursion level, stacked on the portal itself
+	if( pNode )
+	{
+		debugoverlay->AddTextOverlay( pPairedEntity->GetAbsOrigin(), m_iViewRecursionLevel, 0.0f, "depth %d: %s, invisible %d frames, coverage %.3f, lod %d",
+			m_iViewRecursionLevel + 1, s_szDrawResultNames[result], pNode->iFramesInvisible, pNode->fScreenCoverage, pNode->iLOD );
+	}
+	else
+	{
+		debugoverlay->AddTextOverlay( pPairedEntity->GetAbsOrigin(), m_iViewRecursionLevel, 0.0f, "depth %d: %s", m_iViewRecursionLevel + 1, s_szDrawResultNames[result] );
+	}
+}
+
 
 //-----------------------------------------------------------------------------
 // Methods to query about the exit portal associated with the currently rendering portal
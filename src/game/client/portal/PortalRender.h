@@ -63,6 +63,12 @@ public:
 	//Stencil mode only: You stated the portal was visible based on view, and this is how much of the screen your stencil mask took up last frame. Still want to draw this frame? Values less than zero indicate a lack of data from last frame
 	virtual bool	ShouldUpdatePortalView_BasedOnPixelVisibility( float fScreenFilledByStencilMaskLastFrame_Normalized ) { return (fScreenFilledByStencilMaskLastFrame_Normalized != 0.0f); }; // < 0 is unknown visibility, > 0 is known to be partially visible
 
+	//Rough normalized fraction of the screen the portal surface covers in this view. Used to pick a level of detail when there's no pixel visibility data. Less than zero means the portal can't tell
+	virtual float	GetApproximateScreenCoverage( const CViewSetup &currentView, const CUtlVector<VPlane> &currentComplexFrustum ) { return -1.0f; };
+
+	//The plane the portal surface lies on, facing out of the portal. Views exiting through this portal clip away everything behind it
+	virtual bool	GetPortalPlane( VPlane &planeOut ) const { return false; };
+
 
 	//-----------------------------------------------------------------------------
 	// Misc
@@ -138,6 +144,15 @@ struct PortalRenderableCreationFunction_t
 	PortalRenderableCreationFunc creationFunc;
 };
 
+enum PortalViewLOD_t
+{
+	PORTAL_VIEW_LOD_FULL = 0,	//recurse as deep as the stencil depth allows, refresh every frame
+	PORTAL_VIEW_LOD_REDUCED,	//at most one more recursion inside this view, simple water
+	PORTAL_VIEW_LOD_MINIMAL,	//no recursion inside this view, no expensive water, texture views may be refreshed at a reduced rate
+
+	PORTAL_VIEW_LOD_COUNT,
+};
+
 struct PortalViewIDNode_t
 {
 	CUtlVector<PortalViewIDNode_t *> ChildNodes; //links will only be non-null if they're useful (can see through the portal at that depth and view setup)
@@ -150,6 +165,13 @@ struct PortalViewIDNode_t
 	int iWindowPixelsAtQueryTime;
 	int iOcclusionQueryPixelsRendered;
 	float fScreenFilledByPortalSurfaceLastFrame_Normalized;
+
+	float fScreenCoverage; //what the LOD was based on this frame. Pixel visibility when we have it, projected portal area otherwise
+	int iLOD; //PortalViewLOD_t
+
+	//temporal visibility cache. Views that have been invisible for a while get skipped without trusting any single (possibly stale) query
+	int iFramesInvisible; //consecutive occlusion query results with no pixels drawn
+	int iFramesSkipped; //consecutive frames we've skipped rendering the view because of iFramesInvisible
 };
 
 //-----------------------------------------------------------------------------
@@ -176,6 +198,8 @@ public:
 
 	float GetPixelVisilityForPortalSurface( const CPortalRenderable *pPortal ) const; //normalized for how many of the screen's possible pixels it takes up, less than zero indicates a lack of data from last frame
 
+	int GetPortalViewLOD( const CPortalRenderable *pPortal ) const; //PortalViewLOD_t picked for the portal's view from the current recursion level this frame
+
 	// Returns the remaining number of portals to render within other portals
 	// lets portals know that they should do "end of the line" kludges to cover up that portals don't go infinitely recursive
 	int	GetRemainingPortalViewDepth() const;
@@ -243,6 +267,22 @@ private:
 	
 	void UpdatePortalPixelVisibility( void ); //updates pixel visibility for portal surfaces
 
+	int UpdatePortalViewLOD( CPortalRenderable *pPortal, PortalViewIDNode_t *pNode, const CViewSetup &currentView ); //picks a PortalViewLOD_t for the portal from how much of the screen it covers
+
+	bool ShouldSkipPortalViewFromVisCache( PortalViewIDNode_t *pNode ); //true if the view has been invisible long enough to skip it this frame
+
+	enum PortalViewDrawResult_t
+	{
+		PORTAL_VIEW_RENDERED = 0,
+		PORTAL_VIEW_SKIPPED_VIS_CACHE,
+		PORTAL_VIEW_SKIPPED_PIXEL_VIS,
+		PORTAL_VIEW_CULLED,
+
+		PORTAL_VIEW_DRAW_RESULT_COUNT,
+	};
+	void RecordPortalViewDrawResult( CPortalRenderable *pPortal, PortalViewIDNode_t *pNode, PortalViewDrawResult_t result ); //r_portal_vis_cache_debug overlay
+	int m_iPortalViewDrawResults[PORTAL_VIEW_DRAW_RESULT_COUNT]; //counted across every recursion level each frame
+
 	// Handles a portal update message
 	void HandlePortalUpdateMessage( KeyValues *pKeyValues );
 
@@ -256,6 +296,7 @@ private:
 	PortalRenderingMaterials_t	m_Materials;
 	int							m_iViewRecursionLevel;
 	int							m_iRemainingPortalViewDepth; //let's portals know that they should do "end of the line" kludges to cover up that portals don't go infinitely recursive
+	int							m_iLODMaxViewDepth; //stencil depth limit imposed by the LOD of the portal views we're currently inside of
 		
 	CPortalRenderable			*m_pRenderingViewForPortal; //the specific pointer for the portal that we're rending a view for
 	CPortalRenderable			*m_pRenderingViewExitPortal; //the specific pointer for the portal that our view exits from
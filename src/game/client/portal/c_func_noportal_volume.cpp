@@ -13,6 +13,7 @@
 #include "portal_shareddefs.h"
 #include "portal_util_shared.h"
 #include "collisionutils.h"
+#include "portal_placement.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -51,11 +52,13 @@ C_FuncNoPortalVolume::C_FuncNoPortalVolume()
 {
 	// Add me to the global list
 	g_FuncNoPortalVolumeList.Insert( this );
+	InvalidateNoPortalVolumeTree();
 }
 
 C_FuncNoPortalVolume::~C_FuncNoPortalVolume()
 {
 	g_FuncNoPortalVolumeList.Remove( this );
+	InvalidateNoPortalVolumeTree();
 }
 
 
@@ -78,6 +81,9 @@ void C_FuncNoPortalVolume::Spawn()
 	SetSolid( SOLID_VPHYSICS );	// we may want slanted walls, so we'll use OBB
 	AddSolidFlags( FSOLID_NOT_SOLID );
 	AddSolidFlags( FSOLID_TRIGGER ); // This is needed to fix the client sided bumping entities check
+
+	// Our bounds are known now
+	InvalidateNoPortalVolumeTree();
 }
 
 void C_FuncNoPortalVolume::OnActivate( void )
@@ -160,6 +160,7 @@ C_Prop_Portal::C_Prop_Portal( void )
 
 	TransformedLighting.m_LightShadowHandle = CLIENTSHADOW_INVALID_HANDLE;
 	CProp_Portal_Shared::AllPortals.AddToTail( this );
+	UTIL_Portal_InvalidateQueryTable();
 
 	SetPredictionEligible(true);
 }
@@ -169,6 +170,7 @@ C_Prop_Portal::~C_Prop_Portal( void )
 	DestroyAttachedParticles();
 
 	CProp_Portal_Shared::AllPortals.FindAndRemove( this );
+	UTIL_Portal_InvalidateQueryTable();
 	g_pPortalRender->RemovePortal( this );
 
 	for( int i = m_GhostRenderables.Count(); --i >= 0; )
@@ -858,6 +860,18 @@ void C_Prop_Portal::OnRestore( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Prediction puts back m_ptOrigin, m_qAbsAngle and the plane, so the packed
+// portal query table has to be rebuilt from them
+//-----------------------------------------------------------------------------
+int C_Prop_Portal::RestoreData( const char *context, int slot, int type )
+{
+	int retVal = BaseClass::RestoreData( context, slot, type );
+	UTIL_Portal_InvalidateQueryTable();
+	return retVal;
+}
+
+
 void C_Prop_Portal::OnNewParticleEffect( const char *pszParticleName, CNewParticleEffect *pNewParticleEffect )
 {
 	if ( Q_stricmp( pszParticleName, "portal_1_overlap" ) == 0 || Q_stricmp( pszParticleName, "portal_2_overlap" ) == 0 )
@@ -1080,6 +1094,7 @@ void C_Prop_Portal::UpdateTeleportMatrix( void )
 	m_plane_Origin.z = m_vForward.z;
 	//GetVectors( &m_plane_Origin.AsVector3D(), NULL, NULL );
 	m_plane_Origin.w = m_plane_Origin.AsVector3D().Dot( m_ptOrigin );
+	UTIL_Portal_InvalidateQueryTable();
 
 	UTIL_Portal_ComputeMatrix( this, m_pLinkedPortal );
 }
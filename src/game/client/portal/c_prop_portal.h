@@ -63,6 +63,7 @@ public:
 	virtual void			ClientThink( void );
 	virtual void			UpdateOnRemove( void );
 	virtual void			OnRestore( void );
+	virtual int				RestoreData( const char *context, int slot, int type );
 	
 
 	virtual void			Simulate();
@@ -110,6 +110,10 @@ CPortalRenderable_FlatBasic::CPortalRenderable_FlatBasic( void )
 		m_InternallyMaintainedData.m_ptCorners[2] =
 		m_InternallyMaintainedData.m_ptCorners[3] =
 		Vector( 0.0f, 0.0f, 0.0f );
+
+	m_iLastTextureUpdateFrame = -1;
+	m_ptLastTextureUpdateOrigin.Init();
+	m_qLastTextureUpdateAngles.Init();
 }
 
 void CPortalRenderable_FlatBasic::GetToolRecordingState( bool bActive, KeyValues *msg )
@@ -139,6 +143,8 @@ void CPortalRenderable_FlatBasic::PortalMoved( void )
 	m_InternallyMaintainedData.m_ptForwardOrigin = m_ptOrigin + m_vForward;
 	m_InternallyMaintainedData.m_fPlaneDist = m_vForward.Dot( m_ptOrigin );
 
+	m_iLastTextureUpdateFrame = -1; //whatever is in our render target is from the old spot
+
 	// Update the points on the portal which we add to PVS
 	{
 		Vector vScaledRight = m_vRight * PORTAL_HALF_WIDTH;
@@ -225,6 +231,10 @@ bool CPortalRenderable_FlatBasic::WillUseDepthDoublerThisDraw( void ) const
 
 
 ConVar r_portal_use_complex_frustums( "r_portal_use_complex_frustums", "1", FCVAR_CLIENTDLL, "View optimization, turn this off if you get odd visual bugs." );
+ConVar r_portal_lod_texture_refresh_interval( "r_portal_lod_texture_refresh_interval", "4", FCVAR_CLIENTDLL, "Texture mode: frames between refreshes of minimal detail portal views, reduced detail views refresh twice as often" );
+ConVar r_portal_lod_texture_refresh_tolerance( "r_portal_lod_texture_refresh_tolerance", "1.0", FCVAR_CLIENTDLL, "Texture mode: low detail portal views are refreshed anyways when the view through them moves more than this many units or degrees" );
+
+static CPortalRenderable_FlatBasic *s_pPortalTextureOwners[2] = { NULL, NULL }; //last portal to draw into each of the two portal render targets
 
 bool CPortalRenderable_FlatBasic::CalcFrustumThroughPortal( const Vector &ptCurrentViewOrigin, Frustum OutputFrustum )
 {
@@ -579,6 +589,32 @@ void CPortalRenderable_FlatBasic::RenderPortalViewToTexture( CViewRender *pViewR
 
 	QAngle qPOVAngles = TransformAnglesToWorldSpace( cameraView.angles, m_matrixThisToLinked.As3x4() );	
 
+	//small portals can get by with a view that's a few frames old, so long as the view through them hasn't really changed
+	//and nobody else has drawn into our render target since
+	int iLOD = g_pPortalRender->GetPortalViewLOD( this );
+	if( (iLOD != PORTAL_VIEW_LOD_FULL) && (m_iLastTextureUpdateFrame >= 0) && (s_pPortalTextureOwners[m_bIsPortal2 ? 1 : 0] == this) )
+	{
+		int iRefreshInterval = r_portal_lod_texture_refresh_interval.GetInt();
+		if( iLOD == PORTAL_VIEW_LOD_REDUCED )
+			iRefreshInterval /= 2;
+
+		float fTolerance = r_portal_lod_texture_refresh_tolerance.GetFloat();
+
+		if( ((gpGlobals->framecount - m_iLastTextureUpdateFrame) < iRefreshInterval) &&
+			(ptPOVOrigin.DistToSqr( m_ptLastTextureUpdateOrigin ) < (fTolerance * fTolerance)) &&
+			(fabs( AngleDiff( qPOVAngles.x, m_qLastTextureUpdateAngles.x ) ) < fTolerance) &&
+			(fabs( AngleDiff( qPOVAngles.y, m_qLastTextureUpdateAngles.y ) ) < fTolerance) &&
+			(fabs( AngleDiff( qPOVAngles.z, m_qLastTextureUpdateAngles.z ) ) < fTolerance) )
+		{
+			return;
+		}
+	}
+
+	s_pPortalTextureOwners[m_bIsPortal2 ? 1 : 0] = this;
+	m_iLastTextureUpdateFrame = gpGlobals->framecount;
+	m_ptLastTextureUpdateOrigin = ptPOVOrigin;
+	m_qLastTextureUpdateAngles = qPOVAngles;
+
 	portalView.width = pRenderTarget->GetActualWidth();
 	portalView.height = pRenderTarget->GetActualHeight();
 	portalView.x = 0;
@@ -1285,6 +1321,38 @@ bool CPortalRenderable_FlatBasic::DoesExitViewIntersectWaterPlane( float waterZ,
 	return (bAboveWater && bBelowWater);
 }
 
+//-----------------------------------------------------------------------------
+// Clips the portal quad by every plane of the frustum. pVerts and pScratchVerts need room for 6 + plane count vertices each.
+// Returns whichever of the two buffers ended up holding the clipped polygon, or NULL if nothing is left in the frustum
+//-----------------------------------------------------------------------------
+static const Vector *ClipPortalQuadToFrustum( const Vector *pQuad, const CUtlVector<VPlane> &frustum, Vector *pVerts, Vector *pScratchVerts, int *pVertCountOut = NULL )
+{
+	const VPlane *pFrustum = frustum.Base();
+	int iFrustumPlanes = frustum.Count();
+	Vector *pTempVerts;
+
+	//clip by first plane and put output into pVerts
+	int iVertCount = ClipPolyToPlane( (Vector *)pQuad, 4, pVerts, pFrustum[0].m_Normal, pFrustum[0].m_Dist, 0.01f );
+
+	//clip by other planes and flipflop in and out pointers
+	for( int i = 1; i != iFrustumPlanes; ++i )
+	{
+		if( iVertCount < 3 )
+			return NULL; //nothing left in the frustum
+
+		iVertCount = ClipPolyToPlane( pVerts, iVertCount, pScratchVerts, pFrustum[i].m_Normal, pFrustum[i].m_Dist, 0.01f );
+		pTempVerts = pVerts; pVerts = pScratchVerts; pScratchVerts = pTempVerts; //swap vertex pointers
+	}
+
+	if( iVertCount < 3 )
+		return NULL; //nothing left in the frustum
+
+	if( pVertCountOut )
+		*pVertCountOut = iVertCount;
+
+	return pVerts;
+}
+
 bool CPortalRenderable_FlatBasic::ShouldUpdatePortalView_BasedOnView( const CViewSetup &currentView, CUtlVector<VPlane> &currentComplexFrustum  )
 {
 	if( m_pLinkedPortal == NULL )
@@ -1304,31 +1372,89 @@ bool CPortalRenderable_FlatBasic::ShouldUpdatePortalView_BasedOnView( const CVie
 	if( m_vForward.Dot( vCameraPos ) <= m_InternallyMaintainedData.m_fPlaneDist )
 		return false; //looking at portal backface
 
-	VPlane *currentFrustum = currentComplexFrustum.Base();
-	int iCurrentFrustmPlanes = currentComplexFrustum.Count();
+	//Views through portals clip away everything behind their exit portal. The complex frustum already does the same, but it can be turned off
+	//and it's a lot cheaper to reject here than to find out after setting up the nested view
+	CPortalRenderable *pExitPortal = g_pPortalRender->GetCurrentViewExitPortal();
+	VPlane exitPlane;
+	if( (pExitPortal != NULL) && pExitPortal->GetPortalPlane( exitPlane ) )
+	{
+		int i;
+		for( i = 0; i != 4; ++i )
+		{
+			if( exitPlane.DistTo( m_InternallyMaintainedData.m_ptCorners[i] ) > -0.5f ) //matches the clip plane offset used when drawing the view
+				break;
+		}
+
+		if( i == 4 )
+			return false; //entirely behind the exit portal
+	}
 
 	//now slice up the portal quad and see if any is visible within the frustum
 	int allocSize = (6 + currentComplexFrustum.Count()); //possible to add 1 point per cut, 4 starting points, N plane cuts, 2 extra because I'm paranoid
-	Vector *pInVerts = (Vector *)stackalloc( sizeof( Vector ) * allocSize * 2 );
-	Vector *pOutVerts = pInVerts + allocSize;
-	Vector *pTempVerts;
+	Vector *pVerts = (Vector *)stackalloc( sizeof( Vector ) * allocSize * 2 );
 
-	//clip by first plane and put output into pInVerts
-	int iVertCount = ClipPolyToPlane( m_InternallyMaintainedData.m_ptCorners, 4, pInVerts, currentFrustum[0].m_Normal, currentFrustum[0].m_Dist, 0.01f );
+	if( ClipPortalQuadToFrustum( m_InternallyMaintainedData.m_ptCorners, currentComplexFrustum, pVerts, pVerts + allocSize ) == NULL )
+		return false; //nothing left in the frustum
 
-	//clip by other planes and flipflop in and out pointers
-	for( int i = 1; i != iCurrentFrustmPlanes; ++i )
+	return true;
+}
+
+float CPortalRenderable_FlatBasic::GetApproximateScreenCoverage( const CViewSetup &currentView, const CUtlVector<VPlane> &currentComplexFrustum )
+{
+	if( currentView.m_bOrtho || (currentView.width <= 0) || (currentView.height <= 0) )
+		return -1.0f;
+
+	if( (m_ptOrigin - currentView.origin).LengthSqr() < (PORTAL_HALF_HEIGHT * PORTAL_HALF_HEIGHT) )
+		return 1.0f; //close enough that the render fix mesh is likely all over the screen
+
+	int allocSize = (6 + currentComplexFrustum.Count());
+	Vector *pVerts = (Vector *)stackalloc( sizeof( Vector ) * allocSize * 2 );
+	int iVertCount = 0;
+	const Vector *pClippedVerts = ClipPortalQuadToFrustum( m_InternallyMaintainedData.m_ptCorners, currentComplexFrustum, pVerts, pVerts + allocSize, &iVertCount );
+	if( pClippedVerts == NULL )
+		return 0.0f;
+
+	Vector vCameraForward, vCameraRight, vCameraUp;
+	AngleVectors( currentView.angles, &vCameraForward, &vCameraRight, &vCameraUp );
+
+	float fAspectRatio = (currentView.m_flAspectRatio > 0.0f) ? currentView.m_flAspectRatio : ((float)currentView.width / (float)currentView.height);
+	float fTanHalfFOVX = tanf( DEG2RAD( currentView.fov * 0.5f ) );
+	float fTanHalfFOVY = fTanHalfFOVX / fAspectRatio;
+
+	//project into normalized screen space (-1 to 1 on both axes) and take the area of the resulting polygon
+	float fArea = 0.0f;
+	float fPrevX = 0.0f, fPrevY = 0.0f, fFirstX = 0.0f, fFirstY = 0.0f;
+	for( int i = 0; i != iVertCount; ++i )
 	{
-		if( iVertCount < 3 )
-			return false; //nothing left in the frustum
+		Vector vCameraToVert = pClippedVerts[i] - currentView.origin;
+		float fDepth = vCameraToVert.Dot( vCameraForward );
+		if( fDepth < 0.1f )
+			return 1.0f; //straddling the camera plane, we won't get a meaningful projection
 
-		iVertCount = ClipPolyToPlane( pInVerts, iVertCount, pOutVerts, currentFrustum[i].m_Normal, currentFrustum[i].m_Dist, 0.01f );
-		pTempVerts = pInVerts; pInVerts = pOutVerts; pOutVerts = pTempVerts; //swap vertex pointers
+		float fX = vCameraToVert.Dot( vCameraRight ) / (fDepth * fTanHalfFOVX);
+		float fY = vCameraToVert.Dot( vCameraUp ) / (fDepth * fTanHalfFOVY);
+
+		if( i == 0 )
+		{
+			fFirstX = fX;
+			fFirstY = fY;
+		}
+		else
+		{
+			fArea += (fPrevX * fY) - (fX * fPrevY);
+		}
+
+		fPrevX = fX;
+		fPrevY = fY;
 	}
+	fArea += (fPrevX * fFirstY) - (fFirstX * fPrevY);
 
-	if( iVertCount < 3 )
-		return false; //nothing left in the frustum
+	return clamp( fabs( fArea ) * 0.5f * 0.25f, 0.0f, 1.0f ); //normalized screen space is 2x2
+}
 
+bool CPortalRenderable_FlatBasic::GetPortalPlane( VPlane &planeOut ) const
+{
+	planeOut.Init( m_vForward, m_InternallyMaintainedData.m_fPlaneDist );
 	return true;
 }
 
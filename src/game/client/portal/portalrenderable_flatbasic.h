@@ -66,6 +66,8 @@ public:
 
 	virtual bool	ShouldUpdatePortalView_BasedOnView( const CViewSetup &currentView, CUtlVector<VPlane> &currentComplexFrustum ); //portal is both visible, and will display at least some portion of a remote view
 	virtual bool	ShouldUpdatePortalView_BasedOnPixelVisibility( float fScreenFilledByStencilMaskLastFrame_Normalized );
+	virtual float	GetApproximateScreenCoverage( const CViewSetup &currentView, const CUtlVector<VPlane> &currentComplexFrustum ); //projected area of the frustum clipped portal quad
+	virtual bool	GetPortalPlane( VPlane &planeOut ) const;
 	virtual bool	ShouldUpdateDepthDoublerTexture( const CViewSetup &viewSetup );
 
 	virtual void	GetToolRecordingState( bool bActive, KeyValues *msg );
@@ -111,6 +113,11 @@ protected:
 
 	FlatBasicPortal_InternalData_t m_InternallyMaintainedData;
 
+	//texture mode only, what our render target was last filled with so low detail views can skip refreshing it
+	int				m_iLastTextureUpdateFrame;
+	Vector			m_ptLastTextureUpdateOrigin;
+	QAngle			m_qLastTextureUpdateAngles;
+
 public:
 
 	CPortalRenderable_FlatBasic	*m_pLinkedPortal;
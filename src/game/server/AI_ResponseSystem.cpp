@@ -22,6 +22,7 @@
 #include "stringpool.h"
 #include "fmtstr.h"
 #include "multiplay_gamerules.h"
+#include "tier1/generichash.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -29,6 +30,8 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_indexrules( "rr_indexrules", "1", FCVAR_NONE, "Only score the rules whose concept (or other required criterion) matches the query." );
+ConVar rr_capturecriteria( "rr_capturecriteria", "0", FCVAR_NONE, "Keep copies of the last N criteria sets queried, for replaying with rr_matchbench." );
 
 static CUtlSymbolTable g_RS;
 
@@ -59,6 +62,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		numval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -110,6 +114,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	numval;			// token as a number, for numeric (in)equality
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -683,6 +688,10 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	float		GetBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules );
+
+	int			FindRuleIndexCriterion( Rule *rule );
+	void		BuildRuleIndex();
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -710,6 +719,13 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rules bucketed by the value of one required string criterion (usually the concept)
+	CUtlVector< CUtlSymbol >			m_RuleIndexKeys;	// criterion names the buckets are keyed on
+	CUtlMap< unsigned int, int >		m_RuleBuckets;		// criterion name + value hash -> bucket
+	CUtlVector< CUtlVector< int > >		m_RuleBucketRules;
+	CUtlVector< int >					m_UnindexedRules;	// rules without such a criterion, always scored
+	int									m_nIndexedRules;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -762,6 +778,8 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_nIndexedRules = -1;
+	SetDefLessFunc( m_RuleBuckets );
 }
 
 //-----------------------------------------------------------------------------
@@ -817,6 +835,12 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+
+	m_RuleIndexKeys.Purge();
+	m_RuleBuckets.Purge();
+	m_RuleBucketRules.Purge();
+	m_UnindexedRules.Purge();
+	m_nIndexedRules = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -988,6 +1012,7 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 
 	matcher.SetToken( token );
 	matcher.SetRaw( rawtoken );
+	matcher.numval = (float)atof( token );
 	matcher.valid = true;
 }
 
@@ -996,11 +1021,19 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	if ( !m.valid )
 		return false;
 
-	float v = (float)atof( setValue );
-	if ( setValue[0] == '[' )
+	// Plain string criteria, the common case, never need the value as a number
+	float v = 0.0f;
+	if ( m.isnumeric || m.usemin || m.usemax )
 	{
-		bool found = false;
-		v = LookupEnumeration( setValue, found );
+		if ( setValue[0] == '[' )
+		{
+			bool found = false;
+			v = LookupEnumeration( setValue, found );
+		}
+		else
+		{
+			v = (float)atof( setValue );
+		}
 	}
 	
 	int minmaxcount = 0;
@@ -1047,7 +1080,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.numval )
 				return false;
 		}
 		else
@@ -1066,7 +1099,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.numval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
@@ -1684,13 +1717,94 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 //-----------------------------------------------------------------------------
 int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
 {
+	// Debugging a rule wants to see it scored even when it can't match
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bool bUseIndex = rr_indexrules.GetBool() && !verbose && !( pszDebugRule && pszDebugRule[0] );
+
 	CUtlVector< int >	bestrules;
+	GetBestMatchingRules( set, verbose, bUseIndex, bestrules );
+
+	int bestCount = bestrules.Count();
+	if ( bestCount <= 0 )
+		return -1;
+
+	if ( bestCount == 1 )
+		return bestrules[ 0 ];
+
+	// Randomly pick one of the tied matching rules
+	int idx = random->RandomInt( 0, bestCount - 1 );
+	if ( verbose )
+	{
+		DevMsg( "Found %i matching rules, selecting slot %i\n", bestCount, idx );
+	}
+	return bestrules[ idx ];
+}
+
+static int __cdecl RuleIndexCompare( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+static unsigned int RuleBucketKey( const char *pszCriterion, const char *pszValue )
+{
+	return HashStringCaseless( pszCriterion ) * 31 + HashStringCaseless( pszValue );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Scores the rules against the criteria set
+// Input  : bUseIndex - only score the rules the index says could match
+//			bestrules - filled with all the rules tied for the best score, in rule order
+// Output : the best score
+//-----------------------------------------------------------------------------
+float CResponseSystem::GetBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules )
+{
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
+	CUtlVectorFixedGrowable< int, 128 > candidates;
+	if ( bUseIndex )
 	{
+		if ( m_nIndexedRules != m_Rules.Count() )
+		{
+			BuildRuleIndex();
+		}
+
+		if ( m_UnindexedRules.Count() )
+		{
+			candidates.AddMultipleToTail( m_UnindexedRules.Count(), m_UnindexedRules.Base() );
+		}
+
+		for ( int k = 0; k < m_RuleIndexKeys.Count(); k++ )
+		{
+			const char *pszCriterion = g_RS.String( m_RuleIndexKeys[ k ] );
+			int found = set.FindCriterionIndex( pszCriterion );
+			if ( found == -1 )
+				continue;
+
+			int iBucket = m_RuleBuckets.Find( RuleBucketKey( pszCriterion, set.GetValue( found ) ) );
+			if ( iBucket == m_RuleBuckets.InvalidIndex() )
+				continue;
+
+			CUtlVector< int > &bucket = m_RuleBucketRules[ m_RuleBuckets[ iBucket ] ];
+			candidates.AddMultipleToTail( bucket.Count(), bucket.Base() );
+		}
+
+		// Score in rule order so ties come out the same as scoring every rule
+		candidates.Sort( RuleIndexCompare );
+	}
+
+	int c = bUseIndex ? candidates.Count() : m_Rules.Count();
+	for ( int j = 0; j < c; j++ )
+	{
+		int i = j;
+		if ( bUseIndex )
+		{
+			// Hash collisions between buckets can list a rule twice
+			if ( j > 0 && candidates[ j ] == candidates[ j - 1 ] )
+				continue;
+
+			i = candidates[ j ];
+		}
+
 		float score = ScoreCriteriaAgainstRule( set, i, verbose );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
@@ -1707,20 +1821,111 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 		}
 	}
 
-	int bestCount = bestrules.Count();
-	if ( bestCount <= 0 )
-		return -1;
+	return bestscore;
+}
 
-	if ( bestCount == 1 )
-		return bestrules[ 0 ];
+//-----------------------------------------------------------------------------
+// Purpose: Finds a criterion the rule can't score without: a required, plain
+//			string equality against a non-empty value. Prefers the concept, since
+//			nearly every rule has one.
+// Output : index into m_Criteria, or -1
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindRuleIndexCriterion( Rule *rule )
+{
+	int iBest = -1;
 
-	// Randomly pick one of the tied matching rules
-	int idx = random->RandomInt( 0, bestCount - 1 );
-	if ( verbose )
+	int count = rule->m_Criteria.Count();
+	for ( int i = 0; i < count; i++ )
 	{
-		DevMsg( "Found %i matching rules, selecting slot %i\n", bestCount, idx );
+		int icriterion = rule->m_Criteria[ i ];
+		Criteria *c = &m_Criteria[ icriterion ];
+		if ( c->IsSubCriteriaType() || !c->required )
+			continue;
+
+		Matcher &m = c->matcher;
+		if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+			continue;
+
+		// An empty token also matches a query that doesn't have the criterion at all, which no bucket can find
+		if ( !m.GetToken()[ 0 ] )
+			continue;
+
+		if ( !Q_stricmp( c->name, "concept" ) )
+			return icriterion;
+
+		if ( iBest == -1 )
+		{
+			iBest = icriterion;
+		}
 	}
-	return bestrules[ idx ];
+
+	return iBest;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Buckets the rules by the value of their index criterion, so a query
+//			only scores the rules that could match it
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RuleIndexKeys.Purge();
+	m_RuleBuckets.Purge();
+	m_RuleBucketRules.Purge();
+	m_UnindexedRules.Purge();
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		int icriterion = FindRuleIndexCriterion( &m_Rules[ i ] );
+		if ( icriterion == -1 )
+		{
+			m_UnindexedRules.AddToTail( i );
+			continue;
+		}
+
+		Criteria *criterion = &m_Criteria[ icriterion ];
+
+		int k;
+		for ( k = 0; k < m_RuleIndexKeys.Count(); k++ )
+		{
+			if ( !Q_stricmp( g_RS.String( m_RuleIndexKeys[ k ] ), criterion->name ) )
+				break;
+		}
+
+		if ( k == m_RuleIndexKeys.Count() )
+		{
+			m_RuleIndexKeys.AddToTail( g_RS.AddString( criterion->name ) );
+		}
+
+		unsigned int key = RuleBucketKey( criterion->name, criterion->matcher.GetToken() );
+		int iBucket = m_RuleBuckets.Find( key );
+		if ( iBucket == m_RuleBuckets.InvalidIndex() )
+		{
+			iBucket = m_RuleBuckets.Insert( key, m_RuleBucketRules.AddToTail() );
+		}
+
+		m_RuleBucketRules[ m_RuleBuckets[ iBucket ] ].AddToTail( i );
+	}
+
+	m_nIndexedRules = c;
+
+	DevMsg( 2, "CResponseSystem:  indexed %i rules in %i buckets on %i criteria, %i always scored\n",
+		c, m_RuleBucketRules.Count(), m_RuleIndexKeys.Count(), m_UnindexedRules.Count() );
+}
+
+// Criteria sets kept for rr_matchbench
+static CUtlVector< AI_CriteriaSet * > s_CapturedCriteria;
+
+static void CaptureCriteriaSet( const AI_CriteriaSet& set )
+{
+	int nMax = rr_capturecriteria.GetInt();
+	while ( s_CapturedCriteria.Count() > 0 && s_CapturedCriteria.Count() >= nMax )
+	{
+		delete s_CapturedCriteria[ 0 ];
+		s_CapturedCriteria.Remove( 0 );
+	}
+
+	s_CapturedCriteria.AddToTail( new AI_CriteriaSet( set ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -1732,6 +1937,11 @@ bool CResponseSystem::FindBestResponse( const AI_CriteriaSet& set, AI_Response&
 {
 	bool valid = false;
 
+	if ( rr_capturecriteria.GetInt() > 0 )
+	{
+		CaptureCriteriaSet( set );
+	}
+
 	int iDbgResponse = rr_debugresponses.GetInt();
 	bool showRules = ( iDbgResponse == 2 );
 	bool showResult = ( iDbgResponse == 1 || iDbgResponse == 2 );
@@ -2004,6 +2214,8 @@ void CResponseSystem::LoadRuleSet( const char *basescript )
 	UTIL_FreeFile( buffer );
 
 	Assert( m_ScriptStack.Count() == 0 );
+
+	BuildRuleIndex();
 }
 
 static ResponseType_t ComputeResponseType( const char *s )
@@ -3051,6 +3263,81 @@ CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 #endif
 }
 
+CON_COMMAND( rr_matchbench, "Replays the criteria sets kept by rr_capturecriteria against the default response rules, scoring every rule and then only the indexed ones.\n\tArguments:	[passes | clear]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "clear" ) )
+	{
+		s_CapturedCriteria.PurgeAndDeleteElements();
+		Msg( "rr_matchbench: cleared captured criteria sets\n" );
+		return;
+	}
+
+	int nSets = s_CapturedCriteria.Count();
+	if ( nSets <= 0 )
+	{
+		Msg( "rr_matchbench: no criteria sets captured, set rr_capturecriteria and let some NPCs talk first\n" );
+		return;
+	}
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 100;
+
+	CDefaultResponseSystem &rs = defaultresponsesytem;
+	CUtlVector< int > bestRules;
+	CUtlVector< int > indexedRules;
+
+	// Both ways must pick the same rules before the timings mean anything
+	int nMatched = 0;
+	int nMismatched = 0;
+	for ( int i = 0; i < nSets; i++ )
+	{
+		bestRules.RemoveAll();
+		indexedRules.RemoveAll();
+
+		float flScore = rs.GetBestMatchingRules( *s_CapturedCriteria[ i ], false, false, bestRules );
+		float flIndexedScore = rs.GetBestMatchingRules( *s_CapturedCriteria[ i ], false, true, indexedRules );
+
+		if ( flScore != flIndexedScore || bestRules.Count() != indexedRules.Count() ||
+			 ( bestRules.Count() && V_memcmp( bestRules.Base(), indexedRules.Base(), bestRules.Count() * sizeof( int ) ) ) )
+		{
+			nMismatched++;
+		}
+
+		if ( bestRules.Count() )
+		{
+			nMatched++;
+		}
+	}
+
+	double flElapsed[ 2 ];
+	for ( int iMode = 0; iMode < 2; iMode++ )
+	{
+		double flStart = Plat_FloatTime();
+		for ( int iPass = 0; iPass < nPasses; iPass++ )
+		{
+			for ( int i = 0; i < nSets; i++ )
+			{
+				bestRules.RemoveAll();
+				rs.GetBestMatchingRules( *s_CapturedCriteria[ i ], false, ( iMode == 1 ), bestRules );
+			}
+		}
+		flElapsed[ iMode ] = Plat_FloatTime() - flStart;
+	}
+
+	int nQueries = nSets * nPasses;
+	Msg( "rr_matchbench: %d criteria sets x %d passes against %d rules, %d sets match a rule\n", nSets, nPasses, rs.m_Rules.Count(), nMatched );
+	Msg( "    all rules: %.3f ms, %.2f us/query\n", flElapsed[ 0 ] * 1000.0, flElapsed[ 0 ] * 1000000.0 / nQueries );
+	Msg( "    indexed:   %.3f ms, %.2f us/query (%d buckets, %d rules always scored)\n", flElapsed[ 1 ] * 1000.0, flElapsed[ 1 ] * 1000000.0 / nQueries,
+		rs.m_RuleBucketRules.Count(), rs.m_UnindexedRules.Count() );
+
+	if ( nMismatched )
+	{
+		Warning( "rr_matchbench: %d criteria sets picked different rules through the index!\n", nMismatched );
+	}
+}
+
 static short RESPONSESYSTEM_SAVE_RESTORE_VERSION = 1;
 
 // note:  this won't save/restore settings from instanced response systems.  Could add that with a CDefSaveRestoreOps implementation if needed
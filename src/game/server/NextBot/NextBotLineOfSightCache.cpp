@@ -0,0 +1,160 @@
+// NextBotLineOfSightCache.cpp
+// Per-tick cache of line-of-sight traces shared by all bots
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#include "cbase.h"
+
+#include "NextBotLineOfSightCache.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar nb_los_cache( "nb_los_cache", "1", FCVAR_CHEAT, "Share bot line-of-sight trace results for the rest of the tick" );
+
+
+//----------------------------------------------------------------------------------------------------------------
+NextBotLineOfSightCache &TheLineOfSightCache( void )
+{
+	static NextBotLineOfSightCache theCache;
+	return theCache;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+NextBotLineOfSightCache::NextBotLineOfSightCache( void ) : m_cache( 0, 0, EntryLessFunc )
+{
+	m_tick = -1;
+	m_hitCount = 0;
+	m_missCount = 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSightCache::Reset( void )
+{
+	AUTO_LOCK( m_mutex );
+
+	m_cache.Purge();
+	m_tick = -1;
+	m_hitCount = 0;
+	m_missCount = 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+static int CompareVectors( const Vector &lhs, const Vector &rhs )
+{
+	for( int i=0; i<3; ++i )
+	{
+		if ( lhs[i] < rhs[i] )
+			return -1;
+
+		if ( lhs[i] > rhs[i] )
+			return 1;
+	}
+
+	return 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+bool NextBotLineOfSightCache::EntryLessFunc( const Entry &lhs, const Entry &rhs )
+{
+	if ( lhs.m_mask != rhs.m_mask )
+		return lhs.m_mask < rhs.m_mask;
+
+	if ( lhs.m_filterFunc != rhs.m_filterFunc )
+		return (uintp)lhs.m_filterFunc < (uintp)rhs.m_filterFunc;
+
+	if ( lhs.m_passEntity != rhs.m_passEntity )
+		return lhs.m_passEntity < rhs.m_passEntity;
+
+	int cmp = CompareVectors( lhs.m_from, rhs.m_from );
+	if ( cmp != 0 )
+		return cmp < 0;
+
+	return CompareVectors( lhs.m_to, rhs.m_to ) < 0;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+bool NextBotLineOfSightCache::IsClear( const Vector &from, const Vector &to, unsigned int mask, const CBaseEntity *passEntity, ShouldHitFunc_t filterFunc )
+{
+	VPROF_BUDGET( "NextBotLineOfSightCache::IsClear", "NextBot" );
+
+	if ( nb_los_cache.GetBool() )
+	{
+		Entry key;
+		if ( CompareVectors( from, to ) <= 0 )
+		{
+			key.m_from = from;
+			key.m_to = to;
+		}
+		else
+		{
+			key.m_from = to;
+			key.m_to = from;
+		}
+		key.m_mask = mask;
+		key.m_filterFunc = filterFunc;
+		key.m_passEntity = passEntity;
+
+		{
+			AUTO_LOCK( m_mutex );
+
+			if ( m_tick != gpGlobals->tickcount )
+			{
+				m_cache.RemoveAll();
+				m_tick = gpGlobals->tickcount;
+			}
+
+			unsigned short it = m_cache.Find( key );
+			if ( it != m_cache.InvalidIndex() )
+			{
+				++m_hitCount;
+				return m_cache[ it ].m_isClear;
+			}
+
+			++m_missCount;
+		}
+
+		trace_t result;
+		CTraceFilterSimple filter( passEntity, COLLISION_GROUP_NONE, filterFunc );
+		UTIL_TraceLine( from, to, mask, &filter, &result );
+
+		key.m_isClear = ( result.fraction >= 1.0f && !result.startsolid );
+
+		{
+			AUTO_LOCK( m_mutex );
+
+			// another thread may have traced the same segment meanwhile
+			if ( m_tick == gpGlobals->tickcount && m_cache.Find( key ) == m_cache.InvalidIndex() )
+			{
+				m_cache.Insert( key );
+			}
+		}
+
+		return key.m_isClear;
+	}
+
+	trace_t result;
+	CTraceFilterSimple filter( passEntity, COLLISION_GROUP_NONE, filterFunc );
+	UTIL_TraceLine( from, to, mask, &filter, &result );
+
+	return ( result.fraction >= 1.0f && !result.startsolid );
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nb_los_cache_stats, "Show how many bot line-of-sight traces were answered by the cache", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	NextBotLineOfSightCache &cache = TheLineOfSightCache();
+
+	int total = cache.GetHitCount() + cache.GetMissCount();
+	Msg( "Line-of-sight cache: %d queries, %d hits (%.1f%%), %d traces\n", total, cache.GetHitCount(), total ? 100.0f * cache.GetHitCount() / total : 0.0f, cache.GetMissCount() );
+}
@@ -0,0 +1,64 @@
+// NextBotLineOfSightCache.h
+// Per-tick cache of line-of-sight traces shared by all bots
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#ifndef _NEXT_BOT_LINE_OF_SIGHT_CACHE_H_
+#define _NEXT_BOT_LINE_OF_SIGHT_CACHE_H_
+
+#include "utlrbtree.h"
+#include "tier0/threadtools.h"
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Many bots looking at the same few subjects end up tracing the same segments
+ * several times per tick. This remembers each trace result until the tick ends.
+ * A segment and its reverse share one entry, since they hit the same geometry.
+ *
+ * Lookups and inserts are guarded by a lock so the cache can be used from the
+ * job threads during NextBotManager::SenseInParallel(). The traces themselves
+ * run outside the lock.
+ */
+class NextBotLineOfSightCache
+{
+public:
+	NextBotLineOfSightCache( void );
+
+	/**
+	 * Return true if the segment is unobstructed. The pass entity is part of the key,
+	 * so pass NULL when the filter function already skips it (ie: combat characters
+	 * with IgnoreActorsTraceFilterFunction).
+	 */
+	bool IsClear( const Vector &from, const Vector &to, unsigned int mask, const CBaseEntity *passEntity, ShouldHitFunc_t filterFunc );
+
+	void Reset( void );								// forget everything, ie: on map change
+
+	int GetHitCount( void ) const					{ return m_hitCount; }
+	int GetMissCount( void ) const					{ return m_missCount; }
+
+private:
+	struct Entry
+	{
+		Vector m_from;								// endpoints are stored in sorted order
+		Vector m_to;
+		unsigned int m_mask;
+		ShouldHitFunc_t m_filterFunc;
+		const CBaseEntity *m_passEntity;
+		bool m_isClear;
+	};
+
+	static bool EntryLessFunc( const Entry &lhs, const Entry &rhs );
+
+	CUtlRBTree< Entry > m_cache;
+	int m_tick;										// tick the cached results are from
+	CThreadFastMutex m_mutex;
+
+	int m_hitCount;
+	int m_missCount;
+};
+
+
+extern NextBotLineOfSightCache &TheLineOfSightCache( void );
+
+
+#endif // _NEXT_BOT_LINE_OF_SIGHT_CACHE_H_
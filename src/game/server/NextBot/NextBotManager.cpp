@@ -14,6 +14,11 @@
 #endif
 
 #include "SharedFunctorUtils.h"
+#include "NextBotVisionInterface.h"
+#include "NextBotLineOfSightCache.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/vprof.h"
 //#include "../../common/blackbox_helper.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -25,6 +30,7 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_parallel_sense( "nb_parallel_sense", "0", FCVAR_CHEAT, "Run the line-of-sight traces of bots due to update this tick in parallel, before they think. Their vision uses the results when they update." );
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -409,6 +415,70 @@ void NextBotManager::Update( void )
 			g_nRun = g_nSlid = g_nBlockedSlides = 0;
 		}
 
+		if ( nb_parallel_sense.GetBool() )
+		{
+			SenseInParallel();
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+static void SenseBotInParallel( INextBot *&bot )
+{
+	bot->GetVisionInterface()->ComputeParallelSense();
+}
+
+static void PreSenseInParallel( void )
+{
+	mdlcache->BeginLock();
+}
+
+static void PostSenseInParallel( void )
+{
+	mdlcache->EndLock();
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Phase one of a two-phase bot update. The bots scheduled above run their
+ * line-of-sight traces on the job threads now, writing only to their own
+ * vision component and the line-of-sight cache. Nothing but the traces runs
+ * there. Phase two is the bot's own full update on the main thread, which
+ * does the visibility tests as usual and finds the traces already done. Bots
+ * that end up not updating this tick (frame budget, etc) just leave them
+ * unused.
+ */
+void NextBotManager::SenseInParallel( void )
+{
+	VPROF_BUDGET( "NextBotManager::SenseInParallel", "NextBot" );
+
+	CUtlVector< INextBot * > sensing;
+
+	{
+		VPROF_BUDGET( "NextBotManager::SenseInParallel( prepare )", "NextBot" );
+
+		for( int i = m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+		{
+			INextBot *pBot = m_botList[i];
+
+			if ( IsDead( pBot ) || pBot->GetVisionInterface() == NULL )
+				continue;
+
+			// with time-slicing on only the bots flagged above are going to update
+			if ( m_iUpdateTickrate > 0 && !pBot->IsFlaggedForUpdate() )
+				continue;
+
+			pBot->GetVisionInterface()->PrepareParallelSense();
+			sensing.AddToTail( pBot );
+		}
+	}
+
+	{
+		VPROF_BUDGET( "NextBotManager::SenseInParallel( sense )", "NextBot" );
+
+		ParallelProcess( "NextBotManager::SenseInParallel", sensing.Base(), sensing.Count(), &SenseBotInParallel, &PreSenseInParallel, &PostSenseInParallel );
 	}
 }
 
@@ -490,6 +560,8 @@ void NextBotManager::NotifyEndUpdate( INextBot *bot )
 void NextBotManager::OnMapLoaded( void )
 {
 	Reset();
+
+	TheLineOfSightCache().Reset();
 }
 
 
@@ -145,6 +145,8 @@ protected:
 	int Register( INextBot *bot );
 	void UnRegister( INextBot *bot );
 
+	void SenseInParallel( void );					// run the read-only part of this tick's bot updates on the job threads
+
 	CUtlLinkedList< INextBot * > m_botList;				// list of all active NextBots
 
 	int m_iUpdateTickrate;
@@ -12,6 +12,7 @@
 #include "NextBotVisionInterface.h"
 #include "NextBotBodyInterface.h"
 #include "NextBotUtil.h"
+#include "NextBotLineOfSightCache.h"
 
 #ifdef TERROR
 #include "querycache.h"
@@ -46,6 +47,9 @@ void IVision::Reset( void )
 	m_lastVisionUpdateTimestamp = 0.0f;
 	m_primaryThreat = NULL;
 
+	m_parallelSenseTargets.RemoveAll();
+	m_parallelSenseTick = -1;
+
 	m_FOV = GetDefaultFieldOfView();
 	m_cosHalfFOV = cos( 0.5f * m_FOV * M_PI / 180.0f );
 	
@@ -534,6 +538,92 @@ void IVision::UpdateKnownEntities( void )
 }
 
 
+//------------------------------------------------------------------------------------------
+/**
+ * Main thread, before the parallel phase. Everything that touches the bot, the
+ * subjects, or the nav mesh happens here: the same early outs as IsAbleToSee(),
+ * and copies of the trace endpoints IsLineOfSightClearToEntity() is going to use.
+ * Reading the positions here also brings the bot's and the subjects' abs
+ * transforms up to date, so the traces don't compute them lazily on a job thread.
+ */
+void IVision::PrepareParallelSense( void )
+{
+	m_parallelSenseTargets.RemoveAll();
+	m_parallelSenseTick = -1;
+
+	if ( nb_blind.GetBool() )
+		return;
+
+	CUtlVector< CBaseEntity * > potentiallyVisible;
+	CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+	CBaseCombatCharacter *me = GetBot()->GetEntity();
+	CNavArea *myArea = me->GetLastKnownArea();
+
+	m_parallelSenseEye = GetBot()->GetBodyInterface()->GetEyePosition();
+
+	FOR_EACH_VEC( potentiallyVisible, it )
+	{
+		CBaseEntity *subject = potentiallyVisible[ it ];
+
+		if ( !subject || subject == me || IsIgnored( subject ) || !subject->IsAlive() )
+			continue;
+
+		if ( GetBot()->IsRangeGreaterThan( subject, GetMaxVisionRange() ) || me->IsHiddenByFog( subject ) || !IsInFieldOfView( subject ) )
+			continue;
+
+		CBaseCombatCharacter *combat = subject->MyCombatCharacterPointer();
+		if ( combat && myArea && combat->GetLastKnownArea() && !myArea->IsPotentiallyVisible( combat->GetLastKnownArea() ) )
+			continue;
+
+		ParallelSenseTarget &target = m_parallelSenseTargets[ m_parallelSenseTargets.AddToTail() ];
+		target.m_subject = subject;
+		target.m_passEntity = combat ? NULL : subject;
+		target.m_spot[0] = subject->WorldSpaceCenter();
+		target.m_spot[1] = subject->EyePosition();
+		target.m_spot[2] = subject->GetAbsOrigin();
+		target.m_isClear = false;
+	}
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Job thread. Only runs the line-of-sight traces between the positions copied
+ * above, and writes nothing but their results. IsAbleToSee() and the known
+ * entity update run on the main thread in UpdateKnownEntities() as usual, and find
+ * their traces already done.
+ */
+void IVision::ComputeParallelSense( void )
+{
+	FOR_EACH_VEC( m_parallelSenseTargets, it )
+	{
+		ParallelSenseTarget &target = m_parallelSenseTargets[ it ];
+		target.m_isClear = IsLineOfSightClearToSpots( m_parallelSenseEye, target.m_spot, target.m_passEntity );
+	}
+
+	m_parallelSenseTick = gpGlobals->tickcount;
+}
+
+
+//------------------------------------------------------------------------------------------
+/**
+ * Trace from the eye to each of the subject's spots through the line-of-sight
+ * cache, stopping at the first clear one. The cache is locked, and the traces and
+ * CTraceFilterSimple only read entity state, which is what makes this safe to run
+ * on the job threads.
+ */
+bool IVision::IsLineOfSightClearToSpots( const Vector &eye, const Vector spot[ 3 ], const CBaseEntity *passEntity )
+{
+	NextBotLineOfSightCache &cache = TheLineOfSightCache();
+	const unsigned int mask = MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE;
+
+	return cache.IsClear( eye, spot[0], mask, passEntity, IgnoreActorsTraceFilterFunction ) ||
+		   cache.IsClear( eye, spot[1], mask, passEntity, IgnoreActorsTraceFilterFunction ) ||
+		   cache.IsClear( eye, spot[2], mask, passEntity, IgnoreActorsTraceFilterFunction );
+}
+
+
 //------------------------------------------------------------------------------------------
 /**
  * Update internal state
@@ -698,12 +788,8 @@ bool IVision::IsLineOfSightClear( const Vector &pos ) const
 	VPROF_BUDGET( "IVision::IsLineOfSightClear", "NextBot" );
 	VPROF_INCREMENT_COUNTER( "IVision::IsLineOfSightClear", 1 );
 
-	trace_t result;
-	NextBotVisionTraceFilter filter( GetBot()->GetEntity(), COLLISION_GROUP_NONE );
-	
-	UTIL_TraceLine( GetBot()->GetBodyInterface()->GetEyePosition(), pos, MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
-	
-	return ( result.fraction >= 1.0f && !result.startsolid );
+	// the vision filter already skips us, since we're a combat character
+	return TheLineOfSightCache().IsClear( GetBot()->GetBodyInterface()->GetEyePosition(), pos, MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, NULL, VisionTraceFilterFunction );
 }
 
 
@@ -749,6 +835,29 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 	// TODO: Use plain-old traces until querycache/etc gets integrated
 	VPROF_BUDGET( "IVision::IsLineOfSightClearToEntity", "NextBot" );
 
+	if ( !visibleSpot )
+	{
+		const CBaseEntity *pass = const_cast< CBaseEntity * >( subject )->MyCombatCharacterPointer() ? NULL : subject;
+		const Vector &eye = GetBot()->GetBodyInterface()->GetEyePosition();
+		Vector spot[ 3 ] = { subject->WorldSpaceCenter(), subject->EyePosition(), subject->GetAbsOrigin() };
+
+		// use the parallel phase's result if it traced exactly these segments this tick,
+		// otherwise share the traces with other bots looking at the same subject
+		if ( m_parallelSenseTick == gpGlobals->tickcount && eye == m_parallelSenseEye )
+		{
+			FOR_EACH_VEC( m_parallelSenseTargets, it )
+			{
+				const ParallelSenseTarget &target = m_parallelSenseTargets[ it ];
+				if ( target.m_subject == subject && target.m_spot[0] == spot[0] && target.m_spot[1] == spot[1] && target.m_spot[2] == spot[2] )
+				{
+					return target.m_isClear;
+				}
+			}
+		}
+
+		return IsLineOfSightClearToSpots( eye, spot, pass );
+	}
+
 	trace_t result;
 	NextBotTraceFilterIgnoreActors filter( subject, COLLISION_GROUP_NONE );
 
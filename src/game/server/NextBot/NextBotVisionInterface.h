@@ -108,6 +108,19 @@ public:
 	virtual bool IsLookingAt( const Vector &pos, float cosTolerance = 0.95f ) const;					// are we looking at the given position
 	virtual bool IsLookingAt( const CBaseCombatCharacter *actor, float cosTolerance = 0.95f ) const;	// are we looking at the given actor
 
+	//-- two-phase update support ---------------------------------------------------------------
+
+	/**
+	 * When nb_parallel_sense is set, the NextBotManager runs the line-of-sight traces for all bots
+	 * due to update this tick on the job threads before any bot thinks. PrepareParallelSense()
+	 * is called on the main thread, decides what to trace and copies every position involved.
+	 * ComputeParallelSense() is called on a job thread while the main thread waits, traces between
+	 * those copies and writes only to this object. IsAbleToSee() and everything it calls stay on
+	 * the main thread, in Update(), where IsLineOfSightClearToEntity() picks up the results.
+	 */
+	virtual void PrepareParallelSense( void );
+	virtual void ComputeParallelSense( void );
+
 private:
 	CountdownTimer m_scanTimer;			// for throttling update rate
 	
@@ -121,6 +134,19 @@ private:
 
 	float m_lastVisionUpdateTimestamp;
 	IntervalTimer m_notVisibleTimer[ MAX_TEAMS ];		// for tracking interval since last saw a member of the given team
+
+	static bool IsLineOfSightClearToSpots( const Vector &eye, const Vector spot[ 3 ], const CBaseEntity *passEntity );
+
+	struct ParallelSenseTarget
+	{
+		const CBaseEntity *m_subject;
+		const CBaseEntity *m_passEntity;
+		Vector m_spot[ 3 ];									// center, eyes, and feet, as traced by IsLineOfSightClearToEntity()
+		bool m_isClear;										// result of the parallel phase traces
+	};
+	Vector m_parallelSenseEye;								// our eye position when the parallel phase was prepared
+	CUtlVector< ParallelSenseTarget > m_parallelSenseTargets;	// subjects to trace to in the parallel phase
+	int m_parallelSenseTick;								// tick the results are for, -1 if none
 };
 
 inline void IVision::CollectKnownEntities( CUtlVector< CKnownEntity > *knownVector )
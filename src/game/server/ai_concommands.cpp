@@ -860,6 +860,8 @@ CON_COMMAND( ai_clear_bad_links, "Clears bits set on nav links indicating link i
 			pNode->GetLinkByIndex( j )->m_LinkInfo &= ~bits_LINK_STALE_SUGGESTED;
 		}
 	}
+
+	g_pBigAINet->OnLinksChanged();
 }
 
 CON_COMMAND( ai_test_los, "Test AI LOS from the player's POV" )
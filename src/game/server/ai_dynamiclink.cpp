@@ -15,6 +15,7 @@
 #include "ai_link.h"
 #include "ai_network.h"
 #include "ai_networkmanager.h"
+#include "ai_networkclusters.h"
 #include "saverestore_utlvector.h"
 #include "editor_sendcommand.h"
 #include "bitstring.h"
@@ -494,6 +495,9 @@ void CAI_DynamicLink::SetLinkState(void)
 			{
 				pLink->m_LinkInfo &= ~bits_LINK_OFF;
 			}
+
+			g_pBigAINet->GetClusters()->OnLinkStateChanged();
+			g_pBigAINet->OnLinksChanged();
 		}
 		else
 		{
@@ -721,6 +725,7 @@ void CAI_RadialLinkController::ModifyNodeLinks( bool bMakeStale )
 							{
 								pLink->m_LinkInfo &= ~bits_LINK_STALE_SUGGESTED;
 							}
+							g_pBigAINet->OnLinksChanged();
 						}
 					}
 				}
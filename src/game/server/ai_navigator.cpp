@@ -3502,7 +3502,7 @@ bool CAI_Navigator::MarkCurWaypointFailedLink( void )
 				pLink->m_timeStaleExpires = gpGlobals->curtime + 4.0;
 				didMark = true;
 			}
-
+			GetNetwork()->OnLinksChanged();
 		}
 		else if ( startID != NO_NODE )
 		{
@@ -3514,6 +3514,7 @@ bool CAI_Navigator::MarkCurWaypointFailedLink( void )
 				pLink->m_LinkInfo |= bits_LINK_STALE_SUGGESTED;
 				pLink->m_timeStaleExpires = gpGlobals->curtime + 4.0;
 				didMark = true;
+				GetNetwork()->OnLinksChanged();
 			}
 		}
 	}
@@ -16,6 +16,8 @@
 #include "ai_navigator.h"
 #include "world.h"
 #include "ai_moveprobe.h"
+#include "ai_networkclusters.h"
+#include "ai_routecache.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -108,6 +110,9 @@ CAI_Network::CAI_Network()
 {
 	m_iNumNodes				= 0;		// Number of nodes in this network
 	m_pAInode				= NULL;		// Array of all nodes in this network
+	m_pClusters				= new CAI_NetworkClusters;
+	m_pRouteCache			= new CAI_RouteCache;
+	m_iLinkVersion			= 0;
 
 	m_iNearestCacheNext	= NEARNODE_CACHE_SIZE - 1;
 	// Force empty node caches to be rebuild
@@ -126,6 +131,9 @@ CAI_Network::CAI_Network()
 
 CAI_Network::~CAI_Network()
 {
+	delete m_pClusters;
+	delete m_pRouteCache;
+
 #ifdef AI_NODE_TREE
 	if ( m_pNodeTree )
 	{
@@ -593,6 +601,8 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 	pSrcNode->AddLink(pLink);
 	pDestNode->AddLink(pLink);
 
+	OnLinksChanged();
+
 	return pLink;
 }
 
@@ -25,6 +25,8 @@ struct AI_Waypoint_t;
 class CAI_BaseNPC;
 class CAI_Link;
 class CAI_DynamicLink;
+class CAI_NetworkClusters;
+class CAI_RouteCache;
 
 //-----------------------------------------------------------------------------
 
@@ -127,6 +129,13 @@ public:
 	}
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
+
+	CAI_NetworkClusters *GetClusters()		{ return m_pClusters; }
+	CAI_RouteCache *GetRouteCache()			{ return m_pRouteCache; }
+
+	// Bumped whenever links are created, turned on or off, or marked stale, so cached routes can tell they're out of date
+	int				GetLinkVersion() const	{ return m_iLinkVersion; }
+	void			OnLinksChanged()		{ m_iLinkVersion++; }
 	
 private:
 	friend class CAI_NetworkManager;
@@ -158,6 +167,9 @@ private:
 
 	int					m_iNumNodes;				// Number of nodes in this network
 	CAI_Node**			m_pAInode;					// Array of all nodes in this network
+	CAI_NetworkClusters *m_pClusters;				// Coarse graph used to plan long routes
+	CAI_RouteCache *	m_pRouteCache;				// Recently found node routes
+	int					m_iLinkVersion;
 
 	enum
 	{
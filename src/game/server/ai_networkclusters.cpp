@@ -0,0 +1,511 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Coarse cluster graph over an AI node network
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "utlbuffer.h"
+#include "utlpriorityqueue.h"
+#include "bitstring.h"
+
+#include "ai_networkclusters.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_link.h"
+#include "ai_dynamiclink.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Clusters are grown from a seed node until they reach either limit
+#define AI_CLUSTER_MAX_NODES		24
+#define AI_CLUSTER_MAX_RADIUS		768.0f
+
+//-----------------------------------------------------------------------------
+
+struct AI_ClusterLink_t
+{
+	int			iSrcCluster;
+	int			iDestCluster;
+	CAI_Link *	pLink;
+	int			iSrcNode;	// the end of the link in the source cluster
+};
+
+static int __cdecl ClusterLinkCompare( const AI_ClusterLink_t *pLeft, const AI_ClusterLink_t *pRight )
+{
+	if ( pLeft->iSrcCluster != pRight->iSrcCluster )
+		return pLeft->iSrcCluster - pRight->iSrcCluster;
+	return pLeft->iDestCluster - pRight->iDestCluster;
+}
+
+//-------------------------------------
+
+struct AI_ClusterOpen_t
+{
+	int		iCluster;
+	float	f;
+};
+
+static bool ClusterOpenIsLowerPriority( const AI_ClusterOpen_t &left, const AI_ClusterOpen_t &right )
+{
+	return left.f > right.f;
+}
+
+//-----------------------------------------------------------------------------
+// CAI_NetworkClusters
+//-----------------------------------------------------------------------------
+
+CAI_NetworkClusters::CAI_NetworkClusters()
+ :	m_pNetwork( NULL ),
+	m_bLinkStateDirty( true )
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Clear()
+{
+	m_NodeCluster.Purge();
+	m_Clusters.Purge();
+	m_Edges.Purge();
+	m_EdgeLinks.Purge();
+	m_bLinkStateDirty = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Groups nodes into clusters by flood filling from each unassigned
+//			node within its zone, then connects clusters that share links.
+//			Node order is fixed, so the same graph always gives the same clusters.
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Build( CAI_Network *pNetwork )
+{
+	Clear();
+	m_pNetwork = pNetwork;
+
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+
+	m_NodeCluster.SetCount( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+		m_NodeCluster[i] = AI_NO_CLUSTER;
+
+	CUtlVector<int> members;
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		if ( m_NodeCluster[i] != AI_NO_CLUSTER )
+			continue;
+
+		int iCluster = m_Clusters.AddToTail();
+		Vector vecSeed = ppNodes[i]->GetOrigin();
+		int zone = ppNodes[i]->GetZone();
+
+		members.RemoveAll();
+		members.AddToTail( i );
+		m_NodeCluster[i] = iCluster;
+
+		for ( int iMember = 0; iMember < members.Count() && members.Count() < AI_CLUSTER_MAX_NODES; iMember++ )
+		{
+			int nodeID = members[iMember];
+			CAI_Node *pNode = ppNodes[nodeID];
+
+			for ( int link = 0; link < pNode->NumLinks() && members.Count() < AI_CLUSTER_MAX_NODES; link++ )
+			{
+				CAI_Link *pLink = pNode->GetLinkByIndex( link );
+				int destID = pLink->DestNodeID( nodeID );
+
+				if ( m_NodeCluster[destID] != AI_NO_CLUSTER || ppNodes[destID]->GetZone() != zone )
+					continue;
+
+				if ( ( ppNodes[destID]->GetOrigin() - vecSeed ).LengthSqr() > AI_CLUSTER_MAX_RADIUS * AI_CLUSTER_MAX_RADIUS )
+					continue;
+
+				bool bAnyHull = false;
+				for ( int hull = 0; hull < NUM_HULLS; hull++ )
+				{
+					if ( pLink->m_iAcceptedMoveTypes[hull] )
+					{
+						bAnyHull = true;
+						break;
+					}
+				}
+
+				if ( !bAnyHull )
+					continue;
+
+				m_NodeCluster[destID] = iCluster;
+				members.AddToTail( destID );
+			}
+		}
+
+		Vector vecCenter = vec3_origin;
+		for ( int iMember = 0; iMember < members.Count(); iMember++ )
+		{
+			vecCenter += ppNodes[members[iMember]]->GetOrigin();
+		}
+		m_Clusters[iCluster].vecCenter = vecCenter / members.Count();
+	}
+
+	BuildEdges( true );
+
+	DevMsg( "AI network clusters: %d nodes in %d clusters, %d connections\n", nNodes, m_Clusters.Count(), m_Edges.Count() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Gathers the links between clusters into edges. Costs are either
+//			computed from the links, or kept from the edges that were loaded
+//			with the graph.
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::BuildEdges( bool bComputeCosts )
+{
+	int nNodes = m_pNetwork->NumNodes();
+	CAI_Node **ppNodes = m_pNetwork->AccessNodes();
+
+	CUtlVector<AI_ClusterLink_t> clusterLinks;
+	for ( int nodeID = 0; nodeID < nNodes; nodeID++ )
+	{
+		CAI_Node *pNode = ppNodes[nodeID];
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			CAI_Link *pLink = pNode->GetLinkByIndex( link );
+			int destID = pLink->DestNodeID( nodeID );
+
+			if ( m_NodeCluster[nodeID] == m_NodeCluster[destID] )
+				continue;
+
+			// Each node sees the link from its own side, so this adds both directions
+			AI_ClusterLink_t &clusterLink = clusterLinks[clusterLinks.AddToTail()];
+			clusterLink.iSrcCluster = m_NodeCluster[nodeID];
+			clusterLink.iDestCluster = m_NodeCluster[destID];
+			clusterLink.pLink = pLink;
+			clusterLink.iSrcNode = nodeID;
+		}
+	}
+
+	clusterLinks.Sort( ClusterLinkCompare );
+
+	CUtlVector<ClusterEdge_t> loadedEdges;
+	if ( !bComputeCosts )
+	{
+		loadedEdges.Swap( m_Edges );
+	}
+	m_Edges.RemoveAll();
+	m_EdgeLinks.RemoveAll();
+
+	for ( int iCluster = 0; iCluster < m_Clusters.Count(); iCluster++ )
+	{
+		m_Clusters[iCluster].iFirstEdge = 0;
+		m_Clusters[iCluster].nEdges = 0;
+	}
+
+	int iLoaded = 0;
+	for ( int i = 0; i < clusterLinks.Count(); )
+	{
+		int iSrcCluster = clusterLinks[i].iSrcCluster;
+		int iDestCluster = clusterLinks[i].iDestCluster;
+
+		int iEdge = m_Edges.AddToTail();
+		ClusterEdge_t &edge = m_Edges[iEdge];
+		edge.iSrcCluster = iSrcCluster;
+		edge.iDestCluster = iDestCluster;
+		edge.iFirstLink = m_EdgeLinks.Count();
+		edge.nLinks = 0;
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			edge.iAcceptedMoveTypes[hull] = 0;
+			edge.flCost[hull] = FLT_MAX;
+		}
+
+		if ( m_Clusters[iSrcCluster].nEdges == 0 )
+		{
+			m_Clusters[iSrcCluster].iFirstEdge = iEdge;
+		}
+		m_Clusters[iSrcCluster].nEdges++;
+
+		const Vector &vecSrcCenter = m_Clusters[iSrcCluster].vecCenter;
+		const Vector &vecDestCenter = m_Clusters[iDestCluster].vecCenter;
+
+		for ( ; i < clusterLinks.Count() && clusterLinks[i].iSrcCluster == iSrcCluster && clusterLinks[i].iDestCluster == iDestCluster; i++ )
+		{
+			CAI_Link *pLink = clusterLinks[i].pLink;
+			m_EdgeLinks.AddToTail( pLink );
+			edge.nLinks++;
+
+			const Vector &vecSrc = ppNodes[clusterLinks[i].iSrcNode]->GetOrigin();
+			const Vector &vecDest = ppNodes[pLink->DestNodeID( clusterLinks[i].iSrcNode )]->GetOrigin();
+
+			// Straight-line distance center -> link -> center, not a path cost through the
+			// nodes inside each cluster. The edge keeps the smallest over the links a hull can use.
+			float flCost = ( vecSrc - vecSrcCenter ).Length() + ( vecDest - vecSrc ).Length() + ( vecDestCenter - vecDest ).Length();
+
+			for ( int hull = 0; hull < NUM_HULLS; hull++ )
+			{
+				if ( !pLink->m_iAcceptedMoveTypes[hull] )
+					continue;
+
+				edge.iAcceptedMoveTypes[hull] |= pLink->m_iAcceptedMoveTypes[hull];
+				if ( bComputeCosts && flCost < edge.flCost[hull] )
+				{
+					edge.flCost[hull] = flCost;
+				}
+			}
+		}
+
+		if ( !bComputeCosts )
+		{
+			// Both lists are sorted the same way
+			while ( iLoaded < loadedEdges.Count() &&
+					( loadedEdges[iLoaded].iSrcCluster < iSrcCluster ||
+					  ( loadedEdges[iLoaded].iSrcCluster == iSrcCluster && loadedEdges[iLoaded].iDestCluster < iDestCluster ) ) )
+			{
+				iLoaded++;
+			}
+
+			if ( iLoaded < loadedEdges.Count() && loadedEdges[iLoaded].iSrcCluster == iSrcCluster && loadedEdges[iLoaded].iDestCluster == iDestCluster )
+			{
+				for ( int hull = 0; hull < NUM_HULLS; hull++ )
+				{
+					if ( edge.iAcceptedMoveTypes[hull] )
+						edge.flCost[hull] = loadedEdges[iLoaded].flCost[hull];
+				}
+			}
+			else
+			{
+				// Not in the saved graph, fall back on the straight line between clusters
+				for ( int hull = 0; hull < NUM_HULLS; hull++ )
+				{
+					if ( edge.iAcceptedMoveTypes[hull] )
+						edge.flCost[hull] = ( vecDestCenter - vecSrcCenter ).Length();
+				}
+			}
+		}
+	}
+
+	m_bLinkStateDirty = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Recomputes which move types can cross each edge right now. Links
+//			that are off but may be used by specific NPCs are still counted,
+//			the node search sorts those out.
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::UpdateLinkState()
+{
+	for ( int iEdge = 0; iEdge < m_Edges.Count(); iEdge++ )
+	{
+		ClusterEdge_t &edge = m_Edges[iEdge];
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			edge.iOpenMoveTypes[hull] = 0;
+		}
+
+		for ( int i = 0; i < edge.nLinks; i++ )
+		{
+			CAI_Link *pLink = m_EdgeLinks[edge.iFirstLink + i];
+			if ( pLink->m_LinkInfo & bits_LINK_OFF )
+			{
+				if ( !pLink->m_pDynamicLink || pLink->m_pDynamicLink->m_strAllowUse == NULL_STRING )
+					continue;
+			}
+
+			for ( int hull = 0; hull < NUM_HULLS; hull++ )
+			{
+				edge.iOpenMoveTypes[hull] |= pLink->m_iAcceptedMoveTypes[hull];
+			}
+		}
+	}
+
+	m_bLinkStateDirty = false;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::FindCorridor( int startID, int endID, Hull_t hull, int capabilities, CVarBitVec *pCorridor )
+{
+	if ( !m_pNetwork || m_NodeCluster.Count() != m_pNetwork->NumNodes() )
+		return false;
+
+	int iStartCluster = GetNodeCluster( startID );
+	int iEndCluster = GetNodeCluster( endID );
+	if ( iStartCluster == AI_NO_CLUSTER || iEndCluster == AI_NO_CLUSTER )
+		return false;
+
+	if ( m_bLinkStateDirty )
+	{
+		UpdateLinkState();
+	}
+
+	int nClusters = m_Clusters.Count();
+	pCorridor->Resize( nClusters, true );
+
+	if ( iStartCluster == iEndCluster )
+	{
+		pCorridor->Set( iStartCluster );
+		return true;
+	}
+
+	// Jump links may be usable from hints even without the capability, see CAI_Pathfinder::IsLinkUsable
+	int usableMoveTypes = capabilities | bits_CAP_MOVE_JUMP;
+
+	float *clusterG = (float *)stackalloc( nClusters * sizeof(float) );
+	int *clusterParent = (int *)stackalloc( nClusters * sizeof(int) );
+	for ( int i = 0; i < nClusters; i++ )
+	{
+		clusterG[i] = FLT_MAX;
+		clusterParent[i] = AI_NO_CLUSTER;
+	}
+
+	const Vector &vecGoal = m_Clusters[iEndCluster].vecCenter;
+
+	CUtlPriorityQueue<AI_ClusterOpen_t> open( 0, 64, ClusterOpenIsLowerPriority );
+	AI_ClusterOpen_t start = { iStartCluster, ( m_Clusters[iStartCluster].vecCenter - vecGoal ).Length() };
+	clusterG[iStartCluster] = 0;
+	open.Insert( start );
+
+	bool bFound = false;
+	while ( open.Count() )
+	{
+		AI_ClusterOpen_t current = open.ElementAtHead();
+		open.RemoveAtHead();
+
+		int iCluster = current.iCluster;
+		if ( iCluster == iEndCluster )
+		{
+			bFound = true;
+			break;
+		}
+
+		// Stale entry, the cluster was reached more cheaply since it was queued
+		float h = ( m_Clusters[iCluster].vecCenter - vecGoal ).Length();
+		if ( current.f > clusterG[iCluster] + h + 0.01f )
+			continue;
+
+		const Cluster_t &cluster = m_Clusters[iCluster];
+		for ( int iEdge = cluster.iFirstEdge; iEdge < cluster.iFirstEdge + cluster.nEdges; iEdge++ )
+		{
+			const ClusterEdge_t &edge = m_Edges[iEdge];
+			if ( !( edge.iOpenMoveTypes[hull] & usableMoveTypes ) )
+				continue;
+
+			float g = clusterG[iCluster] + edge.flCost[hull];
+			if ( g >= clusterG[edge.iDestCluster] )
+				continue;
+
+			clusterG[edge.iDestCluster] = g;
+			clusterParent[edge.iDestCluster] = iCluster;
+
+			AI_ClusterOpen_t next = { edge.iDestCluster, g + ( m_Clusters[edge.iDestCluster].vecCenter - vecGoal ).Length() };
+			open.Insert( next );
+		}
+	}
+
+	if ( !bFound )
+		return false;
+
+	for ( int iCluster = iEndCluster; iCluster != AI_NO_CLUSTER; iCluster = clusterParent[iCluster] )
+	{
+		pCorridor->Set( iCluster );
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Written after the rest of the node graph in the .ain
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Save( CUtlBuffer &buf ) const
+{
+	buf.PutInt( m_Clusters.Count() );
+	buf.PutInt( m_NodeCluster.Count() );
+	for ( int i = 0; i < m_NodeCluster.Count(); i++ )
+	{
+		buf.PutShort( m_NodeCluster[i] );
+	}
+
+	for ( int iCluster = 0; iCluster < m_Clusters.Count(); iCluster++ )
+	{
+		buf.PutFloat( m_Clusters[iCluster].vecCenter.x );
+		buf.PutFloat( m_Clusters[iCluster].vecCenter.y );
+		buf.PutFloat( m_Clusters[iCluster].vecCenter.z );
+	}
+
+	buf.PutInt( m_Edges.Count() );
+	for ( int iEdge = 0; iEdge < m_Edges.Count(); iEdge++ )
+	{
+		const ClusterEdge_t &edge = m_Edges[iEdge];
+		buf.PutShort( edge.iSrcCluster );
+		buf.PutShort( edge.iDestCluster );
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			buf.PutFloat( edge.flCost[hull] );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::Load( CUtlBuffer &buf, CAI_Network *pNetwork )
+{
+	Clear();
+	m_pNetwork = pNetwork;
+
+	int nClusters = buf.GetInt();
+	int nNodes = buf.GetInt();
+	if ( !buf.IsValid() || nNodes != pNetwork->NumNodes() || nClusters < 0 || nClusters > MAX( nNodes, 1 ) )
+	{
+		Clear();
+		return false;
+	}
+
+	m_NodeCluster.SetCount( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		m_NodeCluster[i] = buf.GetShort();
+		if ( m_NodeCluster[i] < 0 || m_NodeCluster[i] >= nClusters )
+		{
+			Clear();
+			return false;
+		}
+	}
+
+	m_Clusters.SetCount( nClusters );
+	for ( int iCluster = 0; iCluster < nClusters; iCluster++ )
+	{
+		m_Clusters[iCluster].vecCenter.x = buf.GetFloat();
+		m_Clusters[iCluster].vecCenter.y = buf.GetFloat();
+		m_Clusters[iCluster].vecCenter.z = buf.GetFloat();
+	}
+
+	int nEdges = buf.GetInt();
+	if ( !buf.IsValid() || nEdges < 0 || nEdges > nClusters * nClusters )
+	{
+		Clear();
+		return false;
+	}
+
+	m_Edges.SetCount( nEdges );
+	for ( int iEdge = 0; iEdge < nEdges; iEdge++ )
+	{
+		ClusterEdge_t &edge = m_Edges[iEdge];
+		edge.iSrcCluster = buf.GetShort();
+		edge.iDestCluster = buf.GetShort();
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			edge.flCost[hull] = buf.GetFloat();
+		}
+	}
+
+	if ( !buf.IsValid() )
+	{
+		Clear();
+		return false;
+	}
+
+	// Links aren't saved with the clusters, so hook them back up from the loaded graph
+	BuildEdges( false );
+	return true;
+}
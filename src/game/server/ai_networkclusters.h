@@ -0,0 +1,84 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Coarse cluster graph over an AI node network. Nodes are grouped
+//			into small spatially compact clusters when the graph is built, with
+//			per hull costs between neighboring clusters. Long node routes are
+//			first planned across clusters and then refined on the node graph
+//			restricted to the clusters along the way.
+//
+//=============================================================================//
+
+#ifndef AI_NETWORKCLUSTERS_H
+#define AI_NETWORKCLUSTERS_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+#include "ai_hull.h"
+#include "utlvector.h"
+
+class CAI_Network;
+class CAI_Link;
+class CUtlBuffer;
+class CVarBitVec;
+
+#define AI_NO_CLUSTER	-1
+
+//-----------------------------------------------------------------------------
+// CAI_NetworkClusters
+//-----------------------------------------------------------------------------
+
+class CAI_NetworkClusters
+{
+public:
+	CAI_NetworkClusters();
+
+	void			Build( CAI_Network *pNetwork );
+	void			Clear();
+
+	void			Save( CUtlBuffer &buf ) const;
+	bool			Load( CUtlBuffer &buf, CAI_Network *pNetwork );
+
+	int				NumClusters() const					{ return m_Clusters.Count(); }
+	int				GetNodeCluster( int nodeID ) const	{ return ( nodeID >= 0 && nodeID < m_NodeCluster.Count() ) ? m_NodeCluster[nodeID] : AI_NO_CLUSTER; }
+
+	// Called when a link is turned on or off, the usable cluster connections are recomputed on the next query
+	void			OnLinkStateChanged()				{ m_bLinkStateDirty = true; }
+
+	// Plans a cluster route for the hull and marks the clusters along it. Returns false if there is
+	// no cluster route, or the nodes aren't covered by the clusters, in which case the caller should
+	// search the full node graph.
+	bool			FindCorridor( int startID, int endID, Hull_t hull, int capabilities, CVarBitVec *pCorridor );
+
+private:
+	struct Cluster_t
+	{
+		Vector	vecCenter;
+		int		iFirstEdge;
+		int		nEdges;
+	};
+
+	struct ClusterEdge_t
+	{
+		int		iSrcCluster;
+		int		iDestCluster;
+		byte	iAcceptedMoveTypes[NUM_HULLS];	// union over all links between the two clusters
+		byte	iOpenMoveTypes[NUM_HULLS];		// as above, less links that are currently turned off
+		float	flCost[NUM_HULLS];					// straight-line estimate, see BuildEdges()
+		int		iFirstLink;
+		int		nLinks;
+	};
+
+	void			BuildEdges( bool bComputeCosts );
+	void			UpdateLinkState();
+
+	CAI_Network *				m_pNetwork;
+	CUtlVector<short>			m_NodeCluster;
+	CUtlVector<Cluster_t>		m_Clusters;
+	CUtlVector<ClusterEdge_t>	m_Edges;		// sorted by source cluster, each connection appears once per direction
+	CUtlVector<CAI_Link *>		m_EdgeLinks;	// the links crossing each edge
+	bool						m_bLinkStateDirty;
+};
+
+#endif // AI_NETWORKCLUSTERS_H
@@ -24,13 +24,15 @@
 #include "ai_hull.h"
 #include "ndebugoverlay.h"
 #include "ai_hint.h"
+#include "ai_networkclusters.h"
+#include "ai_routecache.h"
 #include "tier0/icommandline.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 // Increment this to force rebuilding of all networks
-#define	 AINET_VERSION_NUMBER	37
+#define	 AINET_VERSION_NUMBER	38
 
 //-----------------------------------------------------------------------------
 
@@ -344,6 +346,11 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 		buf.PutInt( GetEditOps()->m_pNodeIndexTable[node] );
 	}
 
+	// -------------------------------
+	// Dump the cluster graph
+	// -------------------------------
+	m_pNetwork->GetClusters()->Save( buf );
+
 	// -------------------------------
 	// Write the file out
 	// -------------------------------
@@ -673,6 +680,15 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		GetEditOps()->m_pNodeIndexTable[node] = buf.GetInt();
 	}
 
+	// -------------------------------
+	// Load the cluster graph
+	// -------------------------------
+	if ( !m_pNetwork->GetClusters()->Load( buf, m_pNetwork ) )
+	{
+		DevWarning( "AI node graph %s has bad cluster data, rebuilding clusters\n", szNrpFilename );
+		m_pNetwork->GetClusters()->Build( m_pNetwork );
+	}
+
 	
 #if 1
 	CUtlRBTree<int> usedIds;
@@ -1962,8 +1978,12 @@ void CAI_NetworkEditTools::DrawAINetworkOverlay(void)
 #ifdef AI_PERF_MON
 		if (m_fNextPerfStatTime < gpGlobals->curtime)
 		{
+			const AI_RouteCacheStats_t &routeCacheStats = m_pNetwork->GetRouteCache()->GetStats();
+			int nRouteCacheLookups = routeCacheStats.nHits + routeCacheStats.nMisses + routeCacheStats.nExpired;
+
 			char temp[512];
-			Q_snprintf(temp,sizeof(temp),"%3.2f NN/m\n%3.2f P/m\n",(m_nPerfStatNN/1.0),(m_nPerfStatPB/1.0));
+			Q_snprintf(temp,sizeof(temp),"%3.2f NN/m\n%3.2f P/m\n%3.1f%% RC\n",(m_nPerfStatNN/1.0),(m_nPerfStatPB/1.0),
+				nRouteCacheLookups ? 100.0f * routeCacheStats.nHits / nRouteCacheLookups : 0.0f);
 			UTIL_CenterPrintAll(temp);
 
 			m_fNextPerfStatTime = gpGlobals->curtime + 1;
@@ -2091,6 +2111,10 @@ void CAI_NetworkBuilder::InitZones( CAI_Network *pNetwork )
 		Assert( ppNodes[i]->GetZone() != AI_NODE_ZONE_UNKNOWN );
 	}
 #endif
+
+	// Clusters don't cross zones, so they follow any change in connectivity
+	pNetwork->GetClusters()->Build( pNetwork );
+	pNetwork->OnLinksChanged();
 }
 
 
@@ -2108,6 +2132,10 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 		return;
 
 	BeginBuild();
+
+	// Links are about to change, node routes fall back to the full graph until the next full build
+	pNetwork->GetClusters()->Clear();
+	pNetwork->OnLinksChanged();
 	
 	// ------------------------------------------------------------
 	//  First mark all nodes around vecPos as having to be rebuilt
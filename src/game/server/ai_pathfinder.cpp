@@ -20,7 +20,10 @@
 #include "ai_moveprobe.h"
 #include "ai_dynamiclink.h"
 #include "ai_hint.h"
+#include "ai_networkclusters.h"
+#include "ai_routecache.h"
 #include "bitstring.h"
+#include "vstdlib/random.h"
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -33,6 +36,11 @@
 const float MAX_LOCAL_NAV_DIST_GROUND[2] = { (50*12), (25*12) };
 const float MAX_LOCAL_NAV_DIST_FLY[2] = { (750*12), (750*12) };
 
+ConVar ai_pathfind_clusters( "ai_pathfind_clusters", "1", 0, "Plan long node routes across the network's clusters first, then search only the nodes in those clusters" );
+ConVar ai_pathfind_clusters_min_dist( "ai_pathfind_clusters_min_dist", "1024", 0, "Node routes shorter than this search the full node graph" );
+
+extern ConVar ai_route_cache;
+
 //-----------------------------------------------------------------------------
 // CAI_Pathfinder
 //
@@ -249,6 +257,7 @@ bool CAI_Pathfinder::IsLinkStillStale(int moveType, CAI_Link *nodeLink)
 		GetNetwork()->GetNode(nodeLink->m_iDestID)->GetPosition(GetHullType()), moveType))
 	{
 		nodeLink->m_LinkInfo &= ~bits_LINK_STALE_SUGGESTED;
+		GetNetwork()->OnLinksChanged();
 		return false;
 	}
 
@@ -272,6 +281,171 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 	return GetNetwork()->NearestNodeToPoint( GetOuter(), vecOrigin );
 }
 
+//-----------------------------------------------------------------------------
+// CAI_PathfindSearch
+//
+// Purpose: Per node bookkeeping for FindBestPath, kept between searches so a
+//			search doesn't have to allocate or clear anything proportional to the
+//			size of the network. A node's values are only meaningful if its
+//			generation matches the current search, and the open list is an
+//			indexed binary heap on the node's estimated total cost.
+//-----------------------------------------------------------------------------
+
+class CAI_PathfindSearch
+{
+public:
+	CAI_PathfindSearch()
+	 :	m_iGeneration( 0 )
+	{
+	}
+
+	void Begin( int nNodes )
+	{
+		if ( m_Generation.Count() < nNodes )
+		{
+			int nOld = m_Generation.Count();
+			m_Generation.SetCount( nNodes );
+			m_NodeG.SetCount( nNodes );
+			m_NodeF.SetCount( nNodes );
+			m_NodeParent.SetCount( nNodes );
+			m_HeapIndex.SetCount( nNodes );
+			for ( int i = nOld; i < nNodes; i++ )
+				m_Generation[i] = 0;
+		}
+
+		if ( ++m_iGeneration == 0 )
+		{
+			// Wrapped, so old stamps could match again
+			for ( int i = 0; i < m_Generation.Count(); i++ )
+				m_Generation[i] = 0;
+			m_iGeneration = 1;
+		}
+
+		m_Heap.RemoveAll();
+	}
+
+	bool IsVisited( int iNode ) const	{ return ( m_Generation[iNode] == m_iGeneration ); }
+	float GetG( int iNode ) const		{ Assert( IsVisited( iNode ) ); return m_NodeG[iNode]; }
+	int *GetParents()					{ return m_NodeParent.Base(); }
+
+	// Records a new best cost for the node and puts it in the open list, or moves it up if it's already there
+	void Open( int iNode, int iParent, float g, float f )
+	{
+		if ( !IsVisited( iNode ) )
+		{
+			m_Generation[iNode] = m_iGeneration;
+			m_HeapIndex[iNode] = -1;
+		}
+
+		m_NodeParent[iNode] = iParent;
+		m_NodeG[iNode] = g;
+		m_NodeF[iNode] = f;
+
+		int iHeap = m_HeapIndex[iNode];
+		if ( iHeap == -1 )
+		{
+			iHeap = m_Heap.AddToTail( iNode );
+			m_HeapIndex[iNode] = iHeap;
+		}
+		SiftUp( iHeap );
+	}
+
+	// Records a parent without opening the node, for rebuilding a known route
+	void SetParent( int iNode, int iParent )
+	{
+		m_Generation[iNode] = m_iGeneration;
+		m_HeapIndex[iNode] = -1;
+		m_NodeParent[iNode] = iParent;
+	}
+
+	bool IsOpenEmpty() const { return ( m_Heap.Count() == 0 ); }
+
+	int PopSmallest()
+	{
+		Assert( !IsOpenEmpty() );
+		int iNode = m_Heap[0];
+		m_HeapIndex[iNode] = -1;
+
+		int iLast = m_Heap.Count() - 1;
+		if ( iLast > 0 )
+		{
+			m_Heap[0] = m_Heap[iLast];
+			m_HeapIndex[m_Heap[0]] = 0;
+			m_Heap.RemoveMultipleFromTail( 1 );
+			SiftDown( 0 );
+		}
+		else
+		{
+			m_Heap.RemoveAll();
+		}
+		return iNode;
+	}
+
+private:
+	void Swap( int iHeapA, int iHeapB )
+	{
+		int iNodeA = m_Heap[iHeapA];
+		int iNodeB = m_Heap[iHeapB];
+		m_Heap[iHeapA] = iNodeB;
+		m_Heap[iHeapB] = iNodeA;
+		m_HeapIndex[iNodeB] = iHeapA;
+		m_HeapIndex[iNodeA] = iHeapB;
+	}
+
+	void SiftUp( int iHeap )
+	{
+		while ( iHeap > 0 )
+		{
+			int iParent = ( iHeap - 1 ) / 2;
+			if ( m_NodeF[m_Heap[iParent]] <= m_NodeF[m_Heap[iHeap]] )
+				break;
+			Swap( iParent, iHeap );
+			iHeap = iParent;
+		}
+	}
+
+	void SiftDown( int iHeap )
+	{
+		int nHeap = m_Heap.Count();
+		for ( ;; )
+		{
+			int iSmallest = iHeap;
+			int iLeft = iHeap * 2 + 1;
+			int iRight = iLeft + 1;
+			if ( iLeft < nHeap && m_NodeF[m_Heap[iLeft]] < m_NodeF[m_Heap[iSmallest]] )
+				iSmallest = iLeft;
+			if ( iRight < nHeap && m_NodeF[m_Heap[iRight]] < m_NodeF[m_Heap[iSmallest]] )
+				iSmallest = iRight;
+			if ( iSmallest == iHeap )
+				break;
+			Swap( iHeap, iSmallest );
+			iHeap = iSmallest;
+		}
+	}
+
+	unsigned				m_iGeneration;
+	CUtlVector<unsigned>	m_Generation;
+	CUtlVector<float>		m_NodeG;
+	CUtlVector<float>		m_NodeF;
+	CUtlVector<int>			m_NodeParent;
+	CUtlVector<int>			m_HeapIndex;	// -1 if not in the open list
+	CUtlVector<int>			m_Heap;
+};
+
+// One per thread that pathfinds, which in practice is just the main thread
+static CTHREADLOCALPTR( CAI_PathfindSearch ) g_pPathfindSearch;
+
+static CAI_PathfindSearch *GetPathfindSearch()
+{
+	CAI_PathfindSearch *pSearch = g_pPathfindSearch;
+	if ( !pSearch )
+	{
+		pSearch = new CAI_PathfindSearch;
+		g_pPathfindSearch = pSearch;
+	}
+	return pSearch;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
@@ -287,38 +461,133 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
+	CAI_RouteCache *pRouteCache = ( ai_route_cache.GetBool() ) ? GetNetwork()->GetRouteCache() : NULL;
+	if ( pRouteCache )
+	{
+		CUtlVector<int> nodes;
+		if ( pRouteCache->Find( startID, endID, GetHullType(), CapabilitiesGet(), GetNetwork()->GetLinkVersion(), &nodes ) )
+		{
+			AI_Waypoint_t *pRoute = MakeRouteFromCachedNodes( nodes );
+			if ( pRoute )
+				return pRoute;
+
+			pRouteCache->OnRejected();
+		}
+	}
+
+	AI_Waypoint_t *pRoute = NULL;
+
+	// Long routes are planned across clusters first. The corridor is only a guess, it doesn't know about
+	// NPC specific link and node restrictions, so if nothing is found inside it search the whole graph.
+	if ( ai_pathfind_clusters.GetBool() )
+	{
+		CAI_NetworkClusters *pClusters = GetNetwork()->GetClusters();
+		CAI_Node **pAInode = GetNetwork()->AccessNodes();
+		float flMinDist = ai_pathfind_clusters_min_dist.GetFloat();
+
+		if ( pClusters->GetNodeCluster( startID ) != pClusters->GetNodeCluster( endID ) &&
+			 ( pAInode[startID]->GetOrigin() - pAInode[endID]->GetOrigin() ).LengthSqr() > flMinDist * flMinDist )
+		{
+			CVarBitVec corridor;
+			if ( pClusters->FindCorridor( startID, endID, GetHullType(), CapabilitiesGet(), &corridor ) )
+			{
+				pRoute = FindBestPathInCorridor( startID, endID, pClusters, &corridor );
+			}
+		}
+	}
+
+	if ( !pRoute )
+	{
+		pRoute = FindBestPathInCorridor( startID, endID, NULL, NULL );
+	}
+
+	if ( pRoute && pRouteCache )
+	{
+		CUtlVector<int> nodes;
+		for ( AI_Waypoint_t *pWaypoint = pRoute; pWaypoint; pWaypoint = pWaypoint->GetNext() )
+		{
+			nodes.AddToTail( pWaypoint->iNodeID );
+		}
+
+		// The search may have cleared stale links, so stamp it with the version it ended on
+		pRouteCache->Add( startID, endID, GetHullType(), CapabilitiesGet(), GetNetwork()->GetLinkVersion(), nodes );
+	}
+
+	return pRoute;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuilds a route from the route cache. The route was found for
+//			another NPC with the same hull and movement, so check it against
+//			everything that's specific to this one before using it.
+//-----------------------------------------------------------------------------
+
+AI_Waypoint_t *CAI_Pathfinder::MakeRouteFromCachedNodes(const CUtlVector<int> &nodes)
+{
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
-	CVarBitVec	openBS(nNodes);
-	CVarBitVec	closeBS(nNodes);
+	if ( !nodes.Count() )
+		return NULL;
 
-	// ------------- INITIALIZE ------------------------
-	float* nodeG = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeH = (float *)stackalloc( nNodes * sizeof(float) );
-	float* nodeF = (float *)stackalloc( nNodes * sizeof(float) );
-	int*   nodeP = (int *)stackalloc( nNodes * sizeof(int) );		// Node parent 
+	for ( int i = 0; i < nodes.Count(); i++ )
+	{
+		int nodeID = nodes[i];
+		if ( nodeID < 0 || nodeID >= nNodes )
+			return NULL;
+
+		CAI_Node *pNode = pAInode[nodeID];
+		if ( GetOuter()->IsUnusableNode( nodeID, pNode->GetHint() ) )
+			return NULL;
+
+		if ( i == 0 )
+			continue;
+
+		int prevID = nodes[i - 1];
+		CAI_Link *pLink = pAInode[prevID]->GetLink( nodeID );
+		if ( !pLink || !IsLinkUsable( pLink, prevID ) )
+			return NULL;
+
+		int moveType = pLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+		Vector r1 = pAInode[prevID]->GetPosition(GetHullType());
+		Vector r2 = pNode->GetPosition(GetHullType());
+		if ( GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ) == FLT_MAX )
+			return NULL;
+	}
 
-	for (int node=0;node<nNodes;node++)
+	CAI_PathfindSearch *pSearch = GetPathfindSearch();
+	pSearch->Begin( nNodes );
+	for ( int i = 0; i < nodes.Count(); i++ )
 	{
-		nodeG[node] = FLT_MAX;
-		nodeP[node] = -1;
+		pSearch->SetParent( nodes[i], ( i > 0 ) ? nodes[i - 1] : NO_NODE );
 	}
 
-	nodeG[startID] = 0;
+	return MakeRouteFromParents( pSearch->GetParents(), nodes.Tail() );
+}
 
-	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
-	nodeF[startID] = nodeG[startID] + nodeH[startID];
+//-----------------------------------------------------------------------------
+// Purpose: A* over the node graph, optionally limited to the nodes in the
+//			clusters set in pCorridor
+//-----------------------------------------------------------------------------
 
-	openBS.Set(startID);
-	closeBS.Set( startID );
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathInCorridor(int startID, int endID, CAI_NetworkClusters *pClusters, const CVarBitVec *pCorridor) 
+{
+	int nNodes = GetNetwork()->NumNodes();
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+
+	// ------------- INITIALIZE ------------------------
+	CAI_PathfindSearch *pSearch = GetPathfindSearch();
+	pSearch->Begin( nNodes );
+
+	Vector vecEnd = pAInode[endID]->GetPosition(GetHullType());
+
+	float startH = 0.1*(pAInode[startID]->GetPosition(GetHullType())-vecEnd).Length(); // Don't want to over estimate
+	pSearch->Open( startID, NO_NODE, 0, startH );
 
 	// --------------- FIND BEST PATH ------------------
-	while (!openBS.IsAllClear()) 
+	while (!pSearch->IsOpenEmpty()) 
 	{
-		int smallestID = CAI_Network::FindBSSmallest(&openBS,nodeF,nNodes);
-	
-		openBS.Clear(smallestID);
+		int smallestID = pSearch->PopSmallest();
 
 		CAI_Node *pSmallestNode = pAInode[smallestID];
 		
@@ -327,10 +596,13 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 		if (smallestID == endID) 
 		{
-			AI_Waypoint_t* route = MakeRouteFromParents(&nodeP[0], endID);
+			AI_Waypoint_t* route = MakeRouteFromParents(pSearch->GetParents(), endID);
 			return route;
 		}
 
+		Vector r1 = pSmallestNode->GetPosition(GetHullType());
+		float smallestG = pSearch->GetG( smallestID );
+
 		// Check this if the node is immediately in the path after the startNode 
 		// that it isn't blocked
 		for (int link=0; link < pSmallestNode->NumLinks();link++) 
@@ -344,24 +616,21 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 			int moveType = nodeLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
 			int testID	 = nodeLink->DestNodeID(smallestID);
 
-			Vector r1 = pSmallestNode->GetPosition(GetHullType());
+			if ( pCorridor && !pCorridor->IsBitSet( pClusters->GetNodeCluster( testID ) ) )
+				continue;
+
 			Vector r2 = pAInode[testID]->GetPosition(GetHullType());
 			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
 
 			if ( dist == FLT_MAX )
 				continue;
 
-			float new_g  = nodeG[smallestID] + dist;
+			float new_g  = smallestG + dist;
 
-			if ( !closeBS.IsBitSet(testID) || (new_g < nodeG[testID]) ) 
+			if ( !pSearch->IsVisited(testID) || (new_g < pSearch->GetG(testID)) ) 
 			{
-				nodeP[testID] = smallestID;
-				nodeG[testID] = new_g;
-				nodeH[testID] = (pAInode[testID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length();
-				nodeF[testID] = nodeG[testID] + nodeH[testID];
-
-				closeBS.Set( testID );
-				openBS.Set( testID );
+				float new_h = (pAInode[testID]->GetPosition(GetHullType())-vecEnd).Length();
+				pSearch->Open( testID, smallestID, new_g, new_g + new_h );
 			}
 		}
 	}
@@ -2135,3 +2404,97 @@ void CAI_Pathfinder::CTriDebugOverlay::AddTriOverlayLine(const Vector &origin, c
 }
 
 //-----------------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times FindBestPath between random pairs of nodes, using the
+//			selected NPC (or the first one found) for hull and capabilities
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ai_pathfind_bench, "Runs node pathfinds between random pairs of nodes and reports searches per second.\n\tArguments:	[searches] [seed]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	CAI_BaseNPC *pNPC = NULL;
+	for ( CAI_BaseNPC *pTest = gEntList.NextEntByClass( (CAI_BaseNPC *)NULL ); pTest; pTest = gEntList.NextEntByClass( pTest ) )
+	{
+		if ( !pTest->GetPathfinder() || !pTest->GetNavigator() )
+			continue;
+		if ( !pNPC || ( pTest->m_debugOverlays & OVERLAY_NPC_SELECTED_BIT ) )
+		{
+			pNPC = pTest;
+			if ( pTest->m_debugOverlays & OVERLAY_NPC_SELECTED_BIT )
+				break;
+		}
+	}
+
+	if ( !pNPC )
+	{
+		Msg( "ai_pathfind_bench: needs an NPC to path for\n" );
+		return;
+	}
+
+	CAI_Network *pNetwork = pNPC->GetNavigator()->GetNetwork();
+	int nNodes = pNetwork ? pNetwork->NumNodes() : 0;
+	if ( nNodes < 2 )
+	{
+		Msg( "ai_pathfind_bench: no node graph loaded\n" );
+		return;
+	}
+
+	int nSearches = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 1000;
+	int iSeed = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0;
+
+	CUniformRandomStream random;
+	random.SetSeed( iSeed );
+
+	CAI_Pathfinder *pPathfinder = pNPC->GetPathfinder();
+	int nFound = 0;
+	int nWaypoints = 0;
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nSearches; i++ )
+	{
+		int startID = random.RandomInt( 0, nNodes - 1 );
+		int endID = random.RandomInt( 0, nNodes - 1 );
+
+		AI_Waypoint_t *pRoute = pPathfinder->FindBestPath( startID, endID );
+		if ( pRoute )
+		{
+			nFound++;
+			for ( AI_Waypoint_t *pWaypoint = pRoute; pWaypoint; pWaypoint = pWaypoint->GetNext() )
+				nWaypoints++;
+			DeleteAll( pRoute );
+		}
+	}
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	Msg( "ai_pathfind_bench: %d searches over %d nodes for %s (%s) in %.3f ms\n", nSearches, nNodes, pNPC->GetDebugName(), pNPC->GetClassname(), flElapsed * 1000.0 );
+	Msg( "    %d found (%.1f waypoints avg), %.1f searches/sec, %.3f ms/search\n", nFound, nFound ? (float)nWaypoints / nFound : 0.0f,
+		( flElapsed > 0 ) ? nSearches / flElapsed : 0.0, flElapsed * 1000.0 / nSearches );
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ai_route_cache_report, "Reports node route cache hits and misses since the last reset.\n\tArguments:	[reset]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !g_pBigAINet )
+		return;
+
+	CAI_RouteCache *pRouteCache = g_pBigAINet->GetRouteCache();
+	const AI_RouteCacheStats_t &stats = pRouteCache->GetStats();
+
+	int nLookups = stats.nHits + stats.nMisses + stats.nExpired;
+	Msg( "AI route cache: %d routes cached, link version %d\n", pRouteCache->Count(), g_pBigAINet->GetLinkVersion() );
+	Msg( "    %d lookups: %d hits (%.1f%%), %d unusable for the NPC, %d misses, %d expired, %d evicted\n",
+		nLookups, stats.nHits, nLookups ? 100.0f * stats.nHits / nLookups : 0.0f, stats.nRejected, stats.nMisses, stats.nExpired, stats.nEvictions );
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		pRouteCache->ResetStats();
+	}
+}
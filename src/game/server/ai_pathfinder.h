@@ -21,6 +21,8 @@ struct AI_Waypoint_t;
 class CAI_Link;
 class CAI_Network;
 class CAI_Node;
+class CAI_NetworkClusters;
+class CVarBitVec;
 
 
 //-----------------------------------------------------------------------------
@@ -116,6 +118,8 @@ private:
 
 	//---------------------------------
 	
+	AI_Waypoint_t*	FindBestPathInCorridor(int startID, int endID, CAI_NetworkClusters *pClusters, const CVarBitVec *pCorridor);
+	AI_Waypoint_t*	MakeRouteFromCachedNodes(const CUtlVector<int> &nodes);
 	AI_Waypoint_t*	MakeRouteFromParents(int *parentArray, int endID);
 	AI_Waypoint_t*	CreateNodeWaypoint( Hull_t hullType, int nodeID, int nodeFlags = 0 );
 	
@@ -0,0 +1,132 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Small LRU cache of node routes
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_routecache.h"
+#include "ai_link.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar ai_route_cache( "ai_route_cache", "1", 0, "Reuse recent node routes between the same nodes for the same hull and movement capabilities" );
+ConVar ai_route_cache_size( "ai_route_cache_size", "64", 0, "Number of node routes kept in the route cache" );
+ConVar ai_route_cache_lifetime( "ai_route_cache_lifetime", "2", 0, "Seconds a cached node route stays valid" );
+
+//-----------------------------------------------------------------------------
+
+CAI_RouteCache::CAI_RouteCache()
+{
+	SetDefLessFunc( m_Index );
+	ResetStats();
+}
+
+//-----------------------------------------------------------------------------
+
+uint64 CAI_RouteCache::MakeKey( int startID, int endID, Hull_t hull, int capabilities )
+{
+	// Only the movement capabilities decide which links can be used
+	return ( (uint64)(unsigned short)startID ) |
+		   ( (uint64)(unsigned short)endID << 16 ) |
+		   ( (uint64)(byte)hull << 32 ) |
+		   ( (uint64)(byte)( capabilities & AI_MOVE_TYPE_BITS ) << 40 );
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_RouteCache::Find( int startID, int endID, Hull_t hull, int capabilities, int linkVersion, CUtlVector<int> *pNodes )
+{
+	unsigned short iIndex = m_Index.Find( MakeKey( startID, endID, hull, capabilities ) );
+	if ( iIndex == m_Index.InvalidIndex() )
+	{
+		m_Stats.nMisses++;
+		return false;
+	}
+
+	unsigned short iEntry = m_Index[iIndex];
+	Entry_t &entry = m_Entries[iEntry];
+
+	if ( entry.linkVersion != linkVersion || gpGlobals->curtime - entry.flTime > ai_route_cache_lifetime.GetFloat() || entry.flTime > gpGlobals->curtime )
+	{
+		m_Stats.nExpired++;
+		Remove( iEntry );
+		return false;
+	}
+
+	m_Stats.nHits++;
+
+	m_Entries.Unlink( iEntry );
+	m_Entries.LinkToHead( iEntry );
+
+	pNodes->SetCount( entry.nodes.Count() );
+	for ( int i = 0; i < entry.nodes.Count(); i++ )
+	{
+		(*pNodes)[i] = entry.nodes[i];
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Add( int startID, int endID, Hull_t hull, int capabilities, int linkVersion, const CUtlVector<int> &nodes )
+{
+	int nMaxEntries = ai_route_cache_size.GetInt();
+	if ( nMaxEntries <= 0 )
+	{
+		Clear();
+		return;
+	}
+
+	uint64 key = MakeKey( startID, endID, hull, capabilities );
+
+	unsigned short iIndex = m_Index.Find( key );
+	if ( iIndex != m_Index.InvalidIndex() )
+	{
+		Remove( m_Index[iIndex] );
+	}
+
+	while ( m_Entries.Count() >= nMaxEntries )
+	{
+		Remove( m_Entries.Tail() );
+		m_Stats.nEvictions++;
+	}
+
+	unsigned short iEntry = m_Entries.AddToHead();
+	Entry_t &entry = m_Entries[iEntry];
+	entry.key = key;
+	entry.linkVersion = linkVersion;
+	entry.flTime = gpGlobals->curtime;
+	entry.nodes.SetCount( nodes.Count() );
+	for ( int i = 0; i < nodes.Count(); i++ )
+	{
+		entry.nodes[i] = nodes[i];
+	}
+
+	m_Index.Insert( key, iEntry );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Remove( unsigned short iEntry )
+{
+	m_Index.Remove( m_Entries[iEntry].key );
+	m_Entries.Remove( iEntry );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Clear()
+{
+	m_Entries.Purge();
+	m_Index.Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::ResetStats()
+{
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
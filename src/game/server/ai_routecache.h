@@ -0,0 +1,71 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Small LRU cache of node routes, shared by every NPC pathing on a
+//			network. Squad members tend to ask for the same route within a few
+//			moments of each other, so a hit saves a full node search.
+//
+//=============================================================================//
+
+#ifndef AI_ROUTECACHE_H
+#define AI_ROUTECACHE_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+#include "ai_hull.h"
+#include "utlvector.h"
+#include "utllinkedlist.h"
+#include "utlmap.h"
+
+//-----------------------------------------------------------------------------
+
+struct AI_RouteCacheStats_t
+{
+	int		nHits;
+	int		nMisses;
+	int		nRejected;		// found, but the NPC couldn't use it
+	int		nExpired;		// found, but too old or the links have changed since
+	int		nEvictions;
+};
+
+//-----------------------------------------------------------------------------
+// CAI_RouteCache
+//-----------------------------------------------------------------------------
+
+class CAI_RouteCache
+{
+public:
+	CAI_RouteCache();
+
+	// Fills pNodes with the route from start to end inclusive. Entries made under an older link version are dropped.
+	bool	Find( int startID, int endID, Hull_t hull, int capabilities, int linkVersion, CUtlVector<int> *pNodes );
+	void	Add( int startID, int endID, Hull_t hull, int capabilities, int linkVersion, const CUtlVector<int> &nodes );
+
+	// Called when a route from the cache turned out to be unusable for the NPC that asked
+	void	OnRejected()		{ m_Stats.nRejected++; }
+
+	void	Clear();
+
+	const AI_RouteCacheStats_t &GetStats() const	{ return m_Stats; }
+	void	ResetStats();
+	int		Count() const		{ return m_Entries.Count(); }
+
+private:
+	struct Entry_t
+	{
+		uint64				key;
+		int					linkVersion;
+		float				flTime;
+		CUtlVector<short>	nodes;
+	};
+
+	static uint64	MakeKey( int startID, int endID, Hull_t hull, int capabilities );
+	void			Remove( unsigned short iEntry );
+
+	CUtlLinkedList<Entry_t>			m_Entries;		// most recently used at the head
+	CUtlMap<uint64, unsigned short>	m_Index;
+	AI_RouteCacheStats_t			m_Stats;
+};
+
+#endif // AI_ROUTECACHE_H
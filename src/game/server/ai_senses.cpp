@@ -18,6 +18,10 @@
 	#include "portal_util_shared.h"
 #endif
 
+#ifdef NEXT_BOT
+	#include "nav_mesh.h"
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -35,6 +39,33 @@ const float AI_EFFICIENT_NPC_SEARCH_TIME = .35;
 const float AI_HIGH_PRIORITY_SEARCH_TIME = 0.15;
 const float AI_MISC_SEARCH_TIME  = 0.45;
 
+#ifdef NEXT_BOT
+ConVar ai_senses_nav_pvs( "ai_senses_nav_pvs", "1", 0, "Skip sight traces to combat characters standing in nav areas that are not potentially visible from the NPC's area" );
+
+//-----------------------------------------------------------------------------
+// Purpose: Return the character's last known nav area if it is still standing
+//			in it, NULL otherwise. Last known areas aren't refreshed for
+//			everything that moves, and are kept when leaving the mesh, so a
+//			stale one must not be used to cull sight.
+//-----------------------------------------------------------------------------
+static CNavArea *GetCurrentNavArea( CBaseCombatCharacter *pBCC )
+{
+	CNavArea *pArea = pBCC->GetLastKnownArea();
+	if ( !pArea )
+		return NULL;
+
+	const Vector &vecOrigin = pBCC->GetAbsOrigin();
+	if ( !pArea->IsOverlapping( vecOrigin ) )
+		return NULL;
+
+	float flDeltaZ = vecOrigin.z - pArea->GetZ( vecOrigin );
+	if ( flDeltaZ < -StepHeight || flDeltaZ > JumpCrouchHeight )
+		return NULL;
+
+	return pArea;
+}
+#endif
+
 //-----------------------------------------------------------------------------
 
 CAI_SensedObjectsManager g_AI_SensedObjectsManager;
@@ -171,7 +202,25 @@ bool CAI_Senses::ShouldSeeEntity( CBaseEntity *pSightEnt )
 
 bool CAI_Senses::CanSeeEntity( CBaseEntity *pSightEnt )
 {
-	return ( GetOuter()->FInViewCone( pSightEnt ) && GetOuter()->FVisible( pSightEnt ) );
+	if ( !GetOuter()->FInViewCone( pSightEnt ) )
+		return false;
+
+#ifdef NEXT_BOT
+	// Same cull as the NextBot vision, skip the trace when the nav mesh says it can't succeed
+	if ( ai_senses_nav_pvs.GetBool() )
+	{
+		CBaseCombatCharacter *pSightBCC = pSightEnt->MyCombatCharacterPointer();
+		if ( pSightBCC )
+		{
+			CNavArea *pMyArea = GetCurrentNavArea( GetOuter() );
+			CNavArea *pSightArea = GetCurrentNavArea( pSightBCC );
+			if ( pMyArea && pSightArea && !pMyArea->IsPotentiallyVisible( pSightArea ) )
+				return false;
+		}
+	}
+#endif
+
+	return GetOuter()->FVisible( pSightEnt );
 }
 
 #ifdef PORTAL
@@ -344,6 +393,14 @@ void CAI_Senses::Look( int iDistance )
 {
 	if ( m_TimeLastLook != gpGlobals->curtime || m_LastLookDist != iDistance )
 	{
+#ifdef NEXT_BOT
+		// NPCs don't track their nav area otherwise
+		if ( ai_senses_nav_pvs.GetBool() && TheNavMesh->IsLoaded() )
+		{
+			GetOuter()->UpdateLastKnownArea();
+		}
+#endif
+
 		//-----------------------------
 		
 		LookForHighPriorityEntities( iDistance );
@@ -63,6 +63,8 @@
 #include "tier1/utlstring.h"
 #include "utlhashtable.h"
 #include "vscript_server.h"
+#include "tier1/generichash.h"
+#include "utlmap.h"
 
 #if defined( TF_DLL )
 #include "tf_gamerules.h"
@@ -707,6 +709,13 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.UpdateEntityNameIndex( this );
+}
+
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.UpdateEntityNameIndex( this );
 }
 
 void CBaseEntity::SetModelIndex( int index )
@@ -3583,6 +3592,9 @@ int CBaseEntity::Restore( IRestore &restore )
 	// loops through the data description list, restoring each data desc block in order
 	int status = RestoreDataDescBlock( restore, GetDataDescMap() );
 
+	// names were written straight into the fields
+	gEntList.UpdateEntityNameIndex( this );
+
 	// ---------------------------------------------------------------
 	// HACKHACK: We don't know the space of these vectors until now
 	// if they are worldspace, fix them up.
@@ -4333,6 +4345,130 @@ void CBaseEntity::OnEntityEvent( EntityEvent_t event, void *pEventData )
 ConVar ent_messages_draw( "ent_messages_draw", "0", FCVAR_CHEAT, "Visualizes all entity input/output activity." );
 
 
+//-----------------------------------------------------------------------------
+// Input dispatch tables. The first time a class receives an input, every input
+// along its datamap chain goes into an open addressed table keyed by the caseless
+// hash of the input name, so later inputs cost a hash and one compare instead of
+// a compare against every field of every map in the chain.
+//-----------------------------------------------------------------------------
+class CInputDispatchTables
+{
+public:
+	CInputDispatchTables()
+	{
+		SetDefLessFunc( m_TableIndex );
+	}
+
+	const typedescription_t *Find( datamap_t *pMap, const char *szInputName )
+	{
+		unsigned short iIndex = m_TableIndex.Find( pMap );
+		if ( iIndex == m_TableIndex.InvalidIndex() )
+		{
+			iIndex = m_TableIndex.Insert( pMap, Build( pMap ) );
+		}
+
+		const CUtlVector<Entry_t> &table = m_Tables[ m_TableIndex[iIndex] ];
+		if ( !table.Count() )
+			return NULL;
+
+		unsigned int nHash = HashStringCaseless( szInputName );
+		unsigned int nMask = table.Count() - 1;
+		for ( unsigned int i = nHash & nMask; table[i].pDesc; i = ( i + 1 ) & nMask )
+		{
+			if ( table[i].nHash == nHash && !Q_stricmp( table[i].pDesc->externalName, szInputName ) )
+				return table[i].pDesc;
+		}
+
+		return NULL;
+	}
+
+private:
+	struct Entry_t
+	{
+		unsigned int				nHash;
+		const typedescription_t		*pDesc;		// NULL for an empty slot
+	};
+
+	int Build( datamap_t *pMap )
+	{
+		int nInputs = 0;
+		for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+		{
+			for ( int i = 0; i < dmap->dataNumFields; i++ )
+			{
+				if ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT )
+				{
+					nInputs++;
+				}
+			}
+		}
+
+		int iTable = m_Tables.AddToTail();
+		if ( !nInputs )
+			return iTable;
+
+		// keep the load at or under half
+		int nSize = 8;
+		while ( nSize < nInputs * 2 )
+		{
+			nSize *= 2;
+		}
+
+		CUtlVector<Entry_t> &table = m_Tables[iTable];
+		table.SetCount( nSize );
+		memset( table.Base(), 0, nSize * sizeof( Entry_t ) );
+
+		// most derived first, in field order, so duplicates resolve the way a linear search would
+		for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+		{
+			for ( int i = 0; i < dmap->dataNumFields; i++ )
+			{
+				const typedescription_t *pDesc = &dmap->dataDesc[i];
+				if ( !( pDesc->flags & FTYPEDESC_INPUT ) )
+					continue;
+
+				unsigned int nHash = HashStringCaseless( pDesc->externalName );
+				unsigned int j = nHash & ( nSize - 1 );
+				for ( ; table[j].pDesc; j = ( j + 1 ) & ( nSize - 1 ) )
+				{
+					if ( table[j].nHash == nHash && !Q_stricmp( table[j].pDesc->externalName, pDesc->externalName ) )
+						break;
+				}
+
+				if ( !table[j].pDesc )
+				{
+					table[j].nHash = nHash;
+					table[j].pDesc = pDesc;
+				}
+			}
+		}
+
+		return iTable;
+	}
+
+	CUtlMap< datamap_t *, int >			m_TableIndex;
+	CUtlVector< CUtlVector<Entry_t> >	m_Tables;
+};
+
+static CInputDispatchTables s_InputDispatchTables;
+
+static datamap_t *s_pResolvedInputMap;
+static const char *s_pResolvedInputName;
+static const typedescription_t *s_pResolvedInputDesc;
+
+const typedescription_t *CBaseEntity::FindInputDesc( datamap_t *pMap, const char *szInputName )
+{
+	return s_InputDispatchTables.Find( pMap, szInputName );
+}
+
+void CBaseEntity::SetResolvedInput( datamap_t *pMap, const char *szInputName, const typedescription_t *pInputDesc )
+{
+	s_pResolvedInputMap = pMap;
+	s_pResolvedInputName = szInputName;
+	s_pResolvedInputDesc = pInputDesc;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: calls the appropriate message mapped function in the entity according
 //			to the fired action.
@@ -4355,115 +4491,121 @@ bool CBaseEntity::AcceptInput( const char *szInputName, CBaseEntity *pActivator,
 		NDebugOverlay::Box( GetAbsOrigin(), Vector(-4, -4, -4), Vector(4, 4, 4), 0, 255, 0, 0, 3 );
 	}
 
-	// loop through the data description list, restoring each data desc block
-	for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
+	datamap_t *pMap = GetDataDescMap();
+
+	// the event queue may already know the handler
+	const typedescription_t *pInputDesc;
+	if ( s_pResolvedInputName == szInputName && s_pResolvedInputMap == pMap )
 	{
-		// search through all the actions in the data description, looking for a match
-		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		pInputDesc = s_pResolvedInputDesc;
+	}
+	else
+	{
+		pInputDesc = FindInputDesc( pMap, szInputName );
+	}
+	s_pResolvedInputName = NULL;
+
+	if ( pInputDesc )
+	{
+		// mapper debug message, only built when something will show it
+#if defined( DISABLE_DEBUG_HISTORY )
+		if ( developer.GetInt() >= 2 )
+#endif
 		{
-			if ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT )
+			char szBuffer[256];
+			if (pCaller != NULL)
 			{
-				if ( !Q_stricmp(dmap->dataDesc[i].externalName, szInputName) )
-				{
-					// found a match
-
-					char szBuffer[256];
-					// mapper debug message
-					if (pCaller != NULL)
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
-					}
-					else
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
-					}
-					DevMsg( 2, "%s", szBuffer );
-					ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
-
-					if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
-					{
-						DrawInputOverlay(szInputName,pCaller,Value);
-					}
-
-					// convert the value if necessary
-					if ( Value.FieldType() != dmap->dataDesc[i].fieldType )
-					{
-						if ( !(Value.FieldType() == FIELD_VOID && dmap->dataDesc[i].fieldType == FIELD_STRING) ) // allow empty strings
-						{
-							if ( !Value.Convert( (fieldtype_t)dmap->dataDesc[i].fieldType ) )
-							{
-								// bad conversion
-								Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
-									STRING(m_iClassname), GetDebugName(), szInputName, 
-									( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
-									( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
-								return false;
-							}
-						}
-					}
+				Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
+			}
+			else
+			{
+				Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
+			}
+			DevMsg( 2, "%s", szBuffer );
+			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
+		}
 
-					// call the input handler, or if there is none just set the value
-					inputfunc_t pfnInput = dmap->dataDesc[i].inputFunc;
+		if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
+		{
+			DrawInputOverlay(szInputName,pCaller,Value);
+		}
 
-					if ( pfnInput )
-					{ 
-						// Package the data into a struct for passing to the input handler.
-						inputdata_t data;
-						data.pActivator = pActivator;
-						data.pCaller = pCaller;
-						data.value = Value;
-						data.nOutputID = outputID;
+		// convert the value if necessary
+		if ( Value.FieldType() != pInputDesc->fieldType )
+		{
+			if ( !(Value.FieldType() == FIELD_VOID && pInputDesc->fieldType == FIELD_STRING) ) // allow empty strings
+			{
+				if ( !Value.Convert( (fieldtype_t)pInputDesc->fieldType ) )
+				{
+					// bad conversion
+					Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
+						STRING(m_iClassname), GetDebugName(), szInputName, 
+						( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
+						( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
+					return false;
+				}
+			}
+		}
 
-						// Now, see if there's a function named Input<Name of Input> in this entity's script file. 
-						// If so, execute it and let it decide whether to allow the default behavior to also execute.
-						bool bCallInputFunc = true; // Always assume default behavior (do call the input function)
-						ScriptVariant_t functionReturn;
+		// call the input handler, or if there is none just set the value
+		inputfunc_t pfnInput = pInputDesc->inputFunc;
 
-						if ( m_ScriptScope.IsInitialized() )
-						{
-							char szScriptFunctionName[255];
-							Q_strcpy( szScriptFunctionName, "Input" );
-							Q_strcat( szScriptFunctionName, szInputName, 255 );
+		if ( pfnInput )
+		{ 
+			// Package the data into a struct for passing to the input handler.
+			inputdata_t data;
+			data.pActivator = pActivator;
+			data.pCaller = pCaller;
+			data.value = Value;
+			data.nOutputID = outputID;
 
-							g_pScriptVM->SetValue( "activator", ( pActivator ) ? ScriptVariant_t( pActivator->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
-							g_pScriptVM->SetValue( "caller", ( pCaller ) ? ScriptVariant_t( pCaller->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
+			// Now, see if there's a function named Input<Name of Input> in this entity's script file. 
+			// If so, execute it and let it decide whether to allow the default behavior to also execute.
+			bool bCallInputFunc = true; // Always assume default behavior (do call the input function)
+			ScriptVariant_t functionReturn;
 
-							if( CallScriptFunction( szScriptFunctionName, &functionReturn ) )
-							{
-								bCallInputFunc = functionReturn;
-							}
-						}
+			if ( m_ScriptScope.IsInitialized() )
+			{
+				char szScriptFunctionName[255];
+				Q_strcpy( szScriptFunctionName, "Input" );
+				Q_strcat( szScriptFunctionName, szInputName, 255 );
 
-						if( bCallInputFunc )
-						{
-							(this->*pfnInput)( data );
-						}
-					
-						if ( m_ScriptScope.IsInitialized() )
-						{
-							g_pScriptVM->ClearValue( "activator" );
-							g_pScriptVM->ClearValue( "caller" );
-						}
-					}
-					else if ( dmap->dataDesc[i].flags & FTYPEDESC_KEY )
-					{
-						// set the value directly
-						Value.SetOther( ((char*)this) + dmap->dataDesc[i].fieldOffset[ TD_OFFSET_NORMAL ]);
-					
-						// TODO: if this becomes evil and causes too many full entity updates, then we should make
-						// a macro like this:
-						//
-						// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
-						//
-						// Then the datadesc points at that function and we call it here. The only pain is to add
-						// that function for all the DEFINE_INPUT calls.
-						NetworkStateChanged();
-					}
+				g_pScriptVM->SetValue( "activator", ( pActivator ) ? ScriptVariant_t( pActivator->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
+				g_pScriptVM->SetValue( "caller", ( pCaller ) ? ScriptVariant_t( pCaller->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
 
-					return true;
+				if( CallScriptFunction( szScriptFunctionName, &functionReturn ) )
+				{
+					bCallInputFunc = functionReturn;
 				}
 			}
+
+			if( bCallInputFunc )
+			{
+				(this->*pfnInput)( data );
+			}
+		
+			if ( m_ScriptScope.IsInitialized() )
+			{
+				g_pScriptVM->ClearValue( "activator" );
+				g_pScriptVM->ClearValue( "caller" );
+			}
+		}
+		else if ( pInputDesc->flags & FTYPEDESC_KEY )
+		{
+			// set the value directly
+			Value.SetOther( ((char*)this) + pInputDesc->fieldOffset[ TD_OFFSET_NORMAL ]);
+		
+			// TODO: if this becomes evil and causes too many full entity updates, then we should make
+			// a macro like this:
+			//
+			// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
+			//
+			// Then the datadesc points at that function and we call it here. The only pain is to add
+			// that function for all the DEFINE_INPUT calls.
+			NetworkStateChanged();
 		}
+
+		return true;
 	}
 
 	DevMsg( 2, "unhandled input: (%s) -> (%s,%s)\n", szInputName, STRING(m_iClassname), GetDebugName()/*,", from (%s,%s)" STRING(pCaller->m_iClassname), STRING(pCaller->m_iName)*/ );
@@ -673,6 +673,12 @@ public:
 	// returns true if the the value in the pass in should be set, false if the input is to be ignored
 	virtual bool AcceptInput( const char *szInputName, CBaseEntity *pActivator, CBaseEntity *pCaller, variant_t Value, int outputID );
 
+	// finds the input handler for a class through its precompiled dispatch table, NULL if it has none by that name
+	static const typedescription_t *FindInputDesc( datamap_t *pMap, const char *szInputName );
+
+	// lets the next AcceptInput call for exactly this map and name string skip the lookup, used by the event queue
+	static void SetResolvedInput( datamap_t *pMap, const char *szInputName, const typedescription_t *pInputDesc );
+
 	//
 	// Input handlers.
 	//
@@ -2196,12 +2202,6 @@ inline const char *CBaseEntity::GetPreTemplateName()
 	return szStrippedName;
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
-
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
 	if ( IDENT_STRINGS(m_iName, pszNameOrWildcard) )
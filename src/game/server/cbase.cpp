@@ -732,10 +732,48 @@ DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CUtlMemoryPool::G
 
 CEventQueue g_EventQueue;
 
+// keeps tick arithmetic on the wheel well away from overflow
+static const int EVENTQUEUE_MAX_TICK = ( 1 << 28 );
+
+static inline float EventQueueTime()
+{
+#ifdef USE_SERVER_TIME
+	return engine->GetServerTime();
+#else
+	return gpGlobals->curtime;
+#endif
+}
+
+// Returns true if a fires before b, events with equal fire times go in the order they were added
+static inline bool IsEventBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b )
+{
+	if ( a->m_flFireTime != b->m_flFireTime )
+		return ( a->m_flFireTime < b->m_flFireTime );
+
+	return ( (int)( a->m_nSerial - b->m_nSerial ) < 0 );
+}
+
+static int __cdecl EventOrderCompare( EventQueuePrioritizedEvent_t * const *ppLeft, EventQueuePrioritizedEvent_t * const *ppRight )
+{
+	if ( IsEventBefore( *ppLeft, *ppRight ) )
+		return -1;
+	if ( IsEventBefore( *ppRight, *ppLeft ) )
+		return 1;
+	return 0;
+}
+
 CEventQueue::CEventQueue()
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	memset( m_Buckets, 0, sizeof( m_Buckets ) );
+	for ( int i = 0; i < NUM_INDICES; i++ )
+	{
+		SetDefLessFunc( m_Index[i] );
+	}
+
+	m_nWheelTick = 0;
+	m_flTickInterval = 0.0f;
+	m_nNextSerial = 0;
+	m_nEventCount = 0;
 
 	Init();
 }
@@ -849,21 +887,50 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	for ( int i = 0; i < NUM_BUCKETS; i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-		delete pe;
-		pe = next;
+		EventQueuePrioritizedEvent_t *pe = m_Buckets[i].m_pHead;
+
+		while ( pe != NULL )
+		{
+			EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+			delete pe;
+			pe = next;
+		}
+
+		m_Buckets[i].m_pHead = m_Buckets[i].m_pTail = NULL;
+	}
+
+	for ( int i = 0; i < NUM_INDICES; i++ )
+	{
+		m_Index[i].RemoveAll();
+	}
+
+	m_nEventCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects every pending event, in the order they'll fire
+//-----------------------------------------------------------------------------
+void CEventQueue::GetEventsInOrder( CUtlVector<EventQueuePrioritizedEvent_t *> &events )
+{
+	events.EnsureCapacity( m_nEventCount );
+
+	for ( int i = 0; i < NUM_BUCKETS; i++ )
+	{
+		for ( EventQueuePrioritizedEvent_t *pe = m_Buckets[i].m_pHead; pe != NULL; pe = pe->m_pNext )
+		{
+			events.AddToTail( pe );
+		}
 	}
 
-	m_Events.m_pNext = NULL;
+	events.Sort( EventOrderCompare );
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector<EventQueuePrioritizedEvent_t *> events;
+	GetEventsInOrder( events );
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef USE_SERVER_TIME
@@ -873,9 +940,9 @@ void CEventQueue::Dump( void )
 #endif
 		);
 
-	while ( pe != NULL )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = events[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -884,8 +951,6 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
@@ -911,6 +976,8 @@ void CEventQueue::AddEvent( const char *target, const char *targetInput, variant
 	newEvent->m_pCaller = pCaller;
 	newEvent->m_VariantValue = Value;
 	newEvent->m_iOutputID = outputID;
+	newEvent->m_pInputMap = NULL;
+	newEvent->m_pInputDesc = NULL;
 
 	AddEvent( newEvent );
 }
@@ -934,6 +1001,8 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *targetInput, varian
 	newEvent->m_pCaller = pCaller;
 	newEvent->m_VariantValue = Value;
 	newEvent->m_iOutputID = outputID;
+	newEvent->m_pInputMap = NULL;
+	newEvent->m_pInputDesc = NULL;
 
 	AddEvent( newEvent );
 }
@@ -952,36 +1021,278 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	// an empty queue can start the wheel turning from the present tick
+	if ( m_nEventCount == 0 )
+	{
+		m_flTickInterval = gpGlobals->interval_per_tick;
+		m_nWheelTick = TimeToTick( EventQueueTime() ) + 1;
+	}
+
+	newEvent->m_nSerial = m_nNextSerial++;
+	newEvent->m_nTick = TimeToTick( newEvent->m_flFireTime );
+	ScheduleEvent( newEvent );
+
+	for ( int i = 0; i < NUM_INDICES; i++ )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
+		LinkToIndex( newEvent, i );
+	}
+
+	m_nEventCount++;
+}
+
+void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	UnlinkFromBucket( pe );
+
+	for ( int i = 0; i < NUM_INDICES; i++ )
+	{
+		UnlinkFromIndex( pe, i );
+	}
+
+	m_nEventCount--;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the tick a fire time falls in; the event is due once the
+//			wheel has passed that tick and the time has been reached.
+//-----------------------------------------------------------------------------
+int CEventQueue::TimeToTick( float flTime ) const
+{
+	if ( m_flTickInterval <= 0.0f )
+		return 0;
+
+	double flTicks = floor( (double)flTime / m_flTickInterval );
+	return (int)clamp( flTicks, -(double)EVENTQUEUE_MAX_TICK, (double)EVENTQUEUE_MAX_TICK );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files an event in the wheel slot for its tick. Events for ticks the
+//			wheel has already passed go on the due list, sorted by fire time.
+//-----------------------------------------------------------------------------
+void CEventQueue::ScheduleEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	int nDelta = pe->m_nTick - m_nWheelTick;
+
+	EventQueuePrioritizedEvent_t *pAfter;
+	if ( nDelta < 0 )
+	{
+		pe->m_iBucket = BUCKET_DUE;
+
+		// new arrivals usually belong at the end
+		pAfter = m_Buckets[BUCKET_DUE].m_pTail;
+		while ( pAfter && IsEventBefore( pe, pAfter ) )
 		{
-			break;
+			pAfter = pAfter->m_pPrev;
 		}
 	}
+	else
+	{
+		if ( nDelta < EVENTQUEUE_WHEEL_SLOTS )
+		{
+			pe->m_iBucket = pe->m_nTick & ( EVENTQUEUE_WHEEL_SLOTS - 1 );
+		}
+		else if ( nDelta < EVENTQUEUE_WHEEL_SLOTS * EVENTQUEUE_OUTER_SLOTS )
+		{
+			pe->m_iBucket = BUCKET_OUTER + ( ( pe->m_nTick >> EVENTQUEUE_WHEEL_BITS ) & ( EVENTQUEUE_OUTER_SLOTS - 1 ) );
+		}
+		else
+		{
+			pe->m_iBucket = BUCKET_OVERFLOW;
+		}
 
-	Assert( pe );
+		// slots are sorted when they're emptied into the due list
+		pAfter = m_Buckets[pe->m_iBucket].m_pTail;
+	}
+
+	Bucket_t &bucket = m_Buckets[pe->m_iBucket];
+	pe->m_pPrev = pAfter;
+	if ( pAfter )
+	{
+		pe->m_pNext = pAfter->m_pNext;
+		pAfter->m_pNext = pe;
+	}
+	else
+	{
+		pe->m_pNext = bucket.m_pHead;
+		bucket.m_pHead = pe;
+	}
 
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+	if ( pe->m_pNext )
+	{
+		pe->m_pNext->m_pPrev = pe;
+	}
+	else
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		bucket.m_pTail = pe;
 	}
 }
 
-void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+void CEventQueue::UnlinkFromBucket( EventQueuePrioritizedEvent_t *pe )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
+	Bucket_t &bucket = m_Buckets[pe->m_iBucket];
+
+	if ( pe->m_pPrev )
+	{
+		pe->m_pPrev->m_pNext = pe->m_pNext;
+	}
+	else
+	{
+		Assert( bucket.m_pHead == pe );
+		bucket.m_pHead = pe->m_pNext;
+	}
+
 	if ( pe->m_pNext )
 	{
 		pe->m_pNext->m_pPrev = pe->m_pPrev;
 	}
+	else
+	{
+		Assert( bucket.m_pTail == pe );
+		bucket.m_pTail = pe->m_pPrev;
+	}
+
+	pe->m_pNext = pe->m_pPrev = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Empties a bucket and files its events again against the current
+//			wheel position
+//-----------------------------------------------------------------------------
+void CEventQueue::RefileBucket( int iBucket )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Buckets[iBucket].m_pHead;
+	m_Buckets[iBucket].m_pHead = m_Buckets[iBucket].m_pTail = NULL;
+
+	while ( pe != NULL )
+	{
+		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		ScheduleEvent( pe );
+		pe = next;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Turns the wheel up to and including the given tick, moving the
+//			events in the slots it passes onto the due list
+//-----------------------------------------------------------------------------
+void CEventQueue::AdvanceWheel( int nTick )
+{
+	if ( nTick < m_nWheelTick - 1 || nTick - m_nWheelTick >= EVENTQUEUE_WHEEL_SLOTS )
+	{
+		// time jumped (a restore or a new map), cheaper to file everything again than to turn the wheel
+		RebuildWheel( nTick );
+		return;
+	}
+
+	while ( m_nWheelTick <= nTick )
+	{
+		if ( ( m_nWheelTick & ( EVENTQUEUE_WHEEL_SLOTS - 1 ) ) == 0 )
+		{
+			// the inner wheel has come round, pull in the next turn's worth from the outer wheel
+			if ( ( m_nWheelTick & ( EVENTQUEUE_WHEEL_SLOTS * EVENTQUEUE_OUTER_SLOTS - 1 ) ) == 0 )
+			{
+				RefileBucket( BUCKET_OVERFLOW );
+			}
+
+			RefileBucket( BUCKET_OUTER + ( ( m_nWheelTick >> EVENTQUEUE_WHEEL_BITS ) & ( EVENTQUEUE_OUTER_SLOTS - 1 ) ) );
+		}
+
+		m_nWheelTick++;
+		RefileBucket( ( m_nWheelTick - 1 ) & ( EVENTQUEUE_WHEEL_SLOTS - 1 ) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Recomputes every event's tick and files it again with the wheel
+//			positioned just past the given tick
+//-----------------------------------------------------------------------------
+void CEventQueue::RebuildWheel( int nTick )
+{
+	for ( int i = 0; i < NUM_BUCKETS; i++ )
+	{
+		for ( EventQueuePrioritizedEvent_t *pe = m_Buckets[i].m_pHead; pe != NULL; pe = pe->m_pNext )
+		{
+			pe->m_nTick = TimeToTick( pe->m_flFireTime );
+		}
+	}
+
+	m_nWheelTick = nTick + 1;
+
+	for ( int i = 0; i < NUM_BUCKETS; i++ )
+	{
+		RefileBucket( i );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Events are also listed by target and by caller so cancelling or
+//			looking up the events for an entity doesn't scan the whole queue
+//-----------------------------------------------------------------------------
+const CBaseHandle &CEventQueue::GetIndexHandle( EventQueuePrioritizedEvent_t *pe, int iIndex )
+{
+	return ( iIndex == INDEX_TARGET ) ? pe->m_pEntTarget : pe->m_pCaller;
+}
+
+void CEventQueue::LinkToIndex( EventQueuePrioritizedEvent_t *pe, int iIndex )
+{
+	pe->m_pIndexNext[iIndex] = pe->m_pIndexPrev[iIndex] = NULL;
+
+	const CBaseHandle &hEntity = GetIndexHandle( pe, iIndex );
+	if ( !hEntity.IsValid() )
+		return;
+
+	EventIndex_t &index = m_Index[iIndex];
+	EventIndex_t::IndexType_t iEntry = index.Find( hEntity.ToInt() );
+	if ( iEntry == index.InvalidIndex() )
+	{
+		index.Insert( hEntity.ToInt(), pe );
+		return;
+	}
+
+	// order within an entity's list doesn't matter
+	EventQueuePrioritizedEvent_t *pHead = index[iEntry];
+	pe->m_pIndexNext[iIndex] = pHead;
+	pHead->m_pIndexPrev[iIndex] = pe;
+	index[iEntry] = pe;
+}
+
+void CEventQueue::UnlinkFromIndex( EventQueuePrioritizedEvent_t *pe, int iIndex )
+{
+	const CBaseHandle &hEntity = GetIndexHandle( pe, iIndex );
+	if ( !hEntity.IsValid() )
+		return;
+
+	EventQueuePrioritizedEvent_t *pNext = pe->m_pIndexNext[iIndex];
+	EventQueuePrioritizedEvent_t *pPrev = pe->m_pIndexPrev[iIndex];
+
+	if ( pNext )
+	{
+		pNext->m_pIndexPrev[iIndex] = pPrev;
+	}
+
+	if ( pPrev )
+	{
+		pPrev->m_pIndexNext[iIndex] = pNext;
+	}
+	else
+	{
+		EventIndex_t &index = m_Index[iIndex];
+		EventIndex_t::IndexType_t iEntry = index.Find( hEntity.ToInt() );
+		Assert( iEntry != index.InvalidIndex() && index[iEntry] == pe );
+		if ( iEntry != index.InvalidIndex() )
+		{
+			if ( pNext )
+			{
+				index[iEntry] = pNext;
+			}
+			else
+			{
+				index.RemoveAt( iEntry );
+			}
+		}
+	}
+
+	pe->m_pIndexNext[iIndex] = pe->m_pIndexPrev[iIndex] = NULL;
 }
 
 
@@ -995,13 +1306,22 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	float flNow = EventQueueTime();
 
-#ifdef USE_SERVER_TIME
-	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
-#else
-	while ( pe != NULL && pe->m_flFireTime <= gpGlobals->curtime )
-#endif
+	// move everything up to the present tick onto the due list
+	if ( m_flTickInterval != gpGlobals->interval_per_tick )
+	{
+		m_flTickInterval = gpGlobals->interval_per_tick;
+		RebuildWheel( TimeToTick( flNow ) );
+	}
+	else
+	{
+		AdvanceWheel( TimeToTick( flNow ) );
+	}
+
+	EventQueuePrioritizedEvent_t *pe = m_Buckets[BUCKET_DUE].m_pHead;
+
+	while ( pe != NULL && pe->m_flFireTime <= flNow )
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
@@ -1020,7 +1340,7 @@ void CEventQueue::ServiceEvents( void )
 					break;
 
 				// pump the action into the target
-				target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+				FireEvent( pe, target );
 				targetFound = true;
 			}
 		}
@@ -1028,7 +1348,7 @@ void CEventQueue::ServiceEvents( void )
 		// direct pointer
 		if ( pe->m_pEntTarget != NULL )
 		{
-			pe->m_pEntTarget->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+			FireEvent( pe, pe->m_pEntTarget );
 			targetFound = true;
 		}
 
@@ -1045,7 +1365,7 @@ void CEventQueue::ServiceEvents( void )
 						break;
 
 					// pump the action into the target
-					target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+					FireEvent( pe, target );
 					targetFound = true;
 				}
 			}
@@ -1084,8 +1404,26 @@ void CEventQueue::ServiceEvents( void )
 		}
 
 		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
+		pe = m_Buckets[BUCKET_DUE].m_pHead;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends the event's input to one target. Targets of the same class reuse
+//			the handler resolved for the first one.
+//-----------------------------------------------------------------------------
+void CEventQueue::FireEvent( EventQueuePrioritizedEvent_t *pe, CBaseEntity *pTarget )
+{
+	datamap_t *pMap = pTarget->GetDataDescMap();
+	if ( pe->m_pInputMap != pMap )
+	{
+		pe->m_pInputMap = pMap;
+		pe->m_pInputDesc = CBaseEntity::FindInputDesc( pMap, STRING(pe->m_iTargetInput) );
 	}
+
+	CBaseEntity::SetResolvedInput( pMap, STRING(pe->m_iTargetInput), pe->m_pInputDesc );
+	pTarget->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+	CBaseEntity::SetResolvedInput( NULL, NULL, NULL );
 }
 
 void CEventQueue::RestoreEvents( void )
@@ -1099,17 +1437,16 @@ void CEventQueue::RestoreEvents( void )
 	float flAddedTime = gpGlobals->curtime - g_flTimeWhenPaused;
 #endif
 	
-	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = g_EventQueue.m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	// push all the events in the queue back by the time spent paused
+	for ( int i = 0; i < NUM_BUCKETS; i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-
-		pe->m_flFireTime += flAddedTime;
-
-		pe = next;
+		for ( EventQueuePrioritizedEvent_t *pe = m_Buckets[i].m_pHead; pe != NULL; pe = pe->m_pNext )
+		{
+			pe->m_flFireTime += flAddedTime;
+		}
 	}
+
+	RebuildWheel( TimeToTick( EventQueueTime() ) );
 #endif
 }
 
@@ -1137,7 +1474,11 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventIndex_t::IndexType_t iEntry = m_Index[INDEX_CALLER].Find( pCaller->GetRefEHandle().ToInt() );
+	if ( iEntry == m_Index[INDEX_CALLER].InvalidIndex() )
+		return;
+
+	EventQueuePrioritizedEvent_t *pCur = m_Index[INDEX_CALLER][iEntry];
 
 	while (pCur != NULL)
 	{
@@ -1154,7 +1495,7 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pIndexNext[INDEX_CALLER];
 
 		if (bDelete)
 		{
@@ -1175,7 +1516,11 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventIndex_t::IndexType_t iEntry = m_Index[INDEX_TARGET].Find( pTarget->GetRefEHandle().ToInt() );
+	if ( iEntry == m_Index[INDEX_TARGET].InvalidIndex() )
+		return;
+
+	EventQueuePrioritizedEvent_t *pCur = m_Index[INDEX_TARGET][iEntry];
 
 	while (pCur != NULL)
 	{
@@ -1190,7 +1535,7 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pIndexNext[INDEX_TARGET];
 
 		if (bDelete)
 		{
@@ -1210,7 +1555,11 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	EventIndex_t::IndexType_t iEntry = m_Index[INDEX_TARGET].Find( pTarget->GetRefEHandle().ToInt() );
+	if ( iEntry == m_Index[INDEX_TARGET].InvalidIndex() )
+		return false;
+
+	EventQueuePrioritizedEvent_t *pCur = m_Index[INDEX_TARGET][iEntry];
 
 	while (pCur != NULL)
 	{
@@ -1223,7 +1572,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pIndexNext[INDEX_TARGET];
 	}
 
 	return false;
@@ -1268,22 +1617,20 @@ END_DATADESC()
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// count the number of items in the queue, saved in the order they'll fire
+	CUtlVector<EventQueuePrioritizedEvent_t *> events;
+	GetEventsInOrder( events );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	m_iListCount = events.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = events[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
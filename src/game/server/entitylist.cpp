@@ -17,6 +17,7 @@
 #include "ai_initutils.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
+#include "tier1/generichash.h"
 
 #ifdef HL2_DLL
 #include "npc_playercompanion.h"
@@ -30,6 +31,9 @@ void SceneManager_ClientActive( CBasePlayer *player );
 
 static CUtlVector<IServerNetworkable*> g_DeleteList;
 
+ConVar ent_find_index( "ent_find_index", "1", 0, "Look up entities by name and classname through a hash index instead of walking the entity list" );
+ConVar ent_find_stats( "ent_find_stats", "0", 0, "Print entity name and classname lookup counts for each frame that had any" );
+
 CGlobalEntityList gEntList;
 CBaseEntityList *g_pEntityList = &gEntList;
 
@@ -294,6 +298,12 @@ CGlobalEntityList::CGlobalEntityList()
 {
 	m_iHighestEnt = m_iNumEnts = m_iNumEdicts = 0;
 	m_bClearingEntities = false;
+
+	memset( m_IndexedEntities, 0, sizeof( m_IndexedEntities ) );
+	m_nNextListOrder = 0;
+	SetDefLessFunc( m_NameIndex );
+	SetDefLessFunc( m_ClassnameIndex );
+	ResetLookupStats();
 }
 
 
@@ -382,6 +392,17 @@ void CGlobalEntityList::Clear( void )
 	m_iHighestEnt = 0;
 	m_iNumEnts = 0;
 
+	// drop the buckets left empty, and refile anything that survived
+	m_NameIndex.Purge();
+	m_ClassnameIndex.Purge();
+	m_IndexBuckets.Purge();
+	for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		m_IndexedEntities[i].iszName = NULL_STRING;
+		m_IndexedEntities[i].iszClassname = NULL_STRING;
+	}
+	RebuildEntityNameIndex();
+
 	m_bClearingEntities = false;
 }
 
@@ -481,6 +502,17 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter )
 {
+	m_LookupStats.nClassnameLookups++;
+
+	// wildcards can match any bucket
+	if ( ent_find_index.GetBool() && !V_strchr( szName, '*' ) )
+	{
+		m_LookupStats.nIndexed++;
+		return FindInIndex( m_ClassnameIndex, pStartEntity, szName, true, pFilter );
+	}
+
+	m_LookupStats.nScanned++;
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -595,6 +627,16 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	m_LookupStats.nNameLookups++;
+
+	if ( ent_find_index.GetBool() && !V_strchr( szName, '*' ) )
+	{
+		m_LookupStats.nIndexed++;
+		return FindInIndex( m_NameIndex, pStartEntity, szName, false, pFilter );
+	}
+
+	m_LookupStats.nScanned++;
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1121,10 +1163,18 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	if ( i > m_iHighestEnt )
 		m_iHighestEnt = i;
 
+	// the slot was just put at the tail of the active list
+	IndexedEntity_t &indexed = m_IndexedEntities[i];
+	indexed.iszName = NULL_STRING;
+	indexed.iszClassname = NULL_STRING;
+	indexed.nListOrder = ++m_nNextListOrder;
+
 	// If it's a CBaseEntity, notify the listeners.
 	CBaseEntity *pBaseEnt = static_cast<IServerUnknown*>(pEnt)->GetBaseEntity();
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts++;
+
+	UpdateEntityNameIndex( pBaseEnt );
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
@@ -1159,6 +1209,187 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 		m_iNumEdicts--;
 
 	m_iNumEnts--;
+
+	// the entity's own data is already gone, unfile the slot by what we recorded
+	int iSlot = handle.GetEntryIndex();
+	IndexedEntity_t &indexed = m_IndexedEntities[iSlot];
+	if ( indexed.iszName != NULL_STRING )
+	{
+		RemoveFromIndex( m_NameIndex, indexed.nNameHash, iSlot );
+		indexed.iszName = NULL_STRING;
+	}
+	if ( indexed.iszClassname != NULL_STRING )
+	{
+		RemoveFromIndex( m_ClassnameIndex, indexed.nClassnameHash, iSlot );
+		indexed.iszClassname = NULL_STRING;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: File the entity under its current name and classname.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::UpdateEntityNameIndex( CBaseEntity *pEntity )
+{
+	if ( !pEntity )
+		return;
+
+	// not in the list yet, or anymore
+	const CBaseHandle &handle = pEntity->GetRefEHandle();
+	if ( !handle.IsValid() || LookupEntity( handle ) != pEntity )
+		return;
+
+	int iSlot = handle.GetEntryIndex();
+	IndexedEntity_t &indexed = m_IndexedEntities[iSlot];
+
+	if ( !IDENT_STRINGS( indexed.iszName, pEntity->m_iName ) )
+	{
+		if ( indexed.iszName != NULL_STRING )
+		{
+			RemoveFromIndex( m_NameIndex, indexed.nNameHash, iSlot );
+		}
+
+		indexed.iszName = pEntity->m_iName;
+		if ( indexed.iszName != NULL_STRING )
+		{
+			indexed.nNameHash = HashStringCaseless( STRING( indexed.iszName ) );
+			AddToIndex( m_NameIndex, indexed.nNameHash, iSlot );
+		}
+	}
+
+	if ( !IDENT_STRINGS( indexed.iszClassname, pEntity->m_iClassname ) )
+	{
+		if ( indexed.iszClassname != NULL_STRING )
+		{
+			RemoveFromIndex( m_ClassnameIndex, indexed.nClassnameHash, iSlot );
+		}
+
+		indexed.iszClassname = pEntity->m_iClassname;
+		if ( indexed.iszClassname != NULL_STRING )
+		{
+			indexed.nClassnameHash = HashStringCaseless( STRING( indexed.iszClassname ) );
+			AddToIndex( m_ClassnameIndex, indexed.nClassnameHash, iSlot );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Refile every entity. Used after a restore wrote names without telling us.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::RebuildEntityNameIndex( void )
+{
+	for ( const CEntInfo *pInfo = FirstEntInfo(); pInfo; pInfo = pInfo->m_pNext )
+	{
+		UpdateEntityNameIndex( (CBaseEntity *)pInfo->m_pEntity );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::AddToIndex( EntityIndex_t &index, unsigned int nHash, int iSlot )
+{
+	unsigned short iBucket = index.Find( nHash );
+	if ( iBucket == index.InvalidIndex() )
+	{
+		iBucket = index.Insert( nHash, m_IndexBuckets.AddToTail() );
+	}
+
+	// keep the bucket in list order
+	CUtlVector<int> &bucket = m_IndexBuckets[ index[iBucket] ];
+	unsigned int nListOrder = m_IndexedEntities[iSlot].nListOrder;
+
+	int lo = 0, hi = bucket.Count();
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi ) / 2;
+		if ( m_IndexedEntities[ bucket[mid] ].nListOrder < nListOrder )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	bucket.InsertBefore( lo, iSlot );
+}
+
+
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::RemoveFromIndex( EntityIndex_t &index, unsigned int nHash, int iSlot )
+{
+	unsigned short iBucket = index.Find( nHash );
+	if ( iBucket == index.InvalidIndex() )
+	{
+		Assert( 0 );
+		return;
+	}
+
+	m_IndexBuckets[ index[iBucket] ].FindAndRemove( iSlot );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the first entity after pStartEntity in list order from the
+//			bucket for szName that really matches it.
+//-----------------------------------------------------------------------------
+CBaseEntity *CGlobalEntityList::FindInIndex( const EntityIndex_t &index, CBaseEntity *pStartEntity, const char *szName, bool bClassname, IEntityFindFilter *pFilter )
+{
+	unsigned short iMapIndex = index.Find( HashStringCaseless( szName ) );
+	if ( iMapIndex == index.InvalidIndex() )
+		return NULL;
+
+	int iBucket = index[iMapIndex];
+
+	int i = 0;
+	if ( pStartEntity )
+	{
+		unsigned int nStartOrder = m_IndexedEntities[ pStartEntity->GetRefEHandle().GetEntryIndex() ].nListOrder;
+
+		int hi = m_IndexBuckets[iBucket].Count();
+		while ( i < hi )
+		{
+			int mid = ( i + hi ) / 2;
+			if ( m_IndexedEntities[ m_IndexBuckets[iBucket][mid] ].nListOrder <= nStartOrder )
+			{
+				i = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+	}
+
+	// the filter may add entities, so don't hold on to the bucket
+	for ( ; i < m_IndexBuckets[iBucket].Count(); i++ )
+	{
+		m_LookupStats.nCandidates++;
+
+		CBaseEntity *pEntity = (CBaseEntity *)GetEntInfoPtrByIndex( m_IndexBuckets[iBucket][i] )->m_pEntity;
+		if ( !pEntity )
+			continue;
+
+		// different strings can share a hash
+		if ( bClassname ? !pEntity->ClassMatches( szName ) : !pEntity->NameMatches( szName ) )
+			continue;
+
+		if ( pFilter && !pFilter->ShouldFindEntity( pEntity ) )
+			continue;
+
+		return pEntity;
+	}
+
+	return NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::ResetLookupStats( void )
+{
+	memset( &m_LookupStats, 0, sizeof( m_LookupStats ) );
 }
 
 void CGlobalEntityList::NotifyCreateEntity( CBaseEntity *pEnt )
@@ -1178,6 +1409,9 @@ void CGlobalEntityList::NotifySpawn( CBaseEntity *pEnt )
 	if ( !pEnt )
 		return;
 
+	// keyvalues may have written the names directly
+	UpdateEntityNameIndex( pEnt );
+
 	//DevMsg(2,"Deleted %s\n", pBaseEnt->GetClassname() );
 	for ( int i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1458,8 +1692,24 @@ public:
 		}
 	}
 
+	void OnRestore()
+	{
+		gEntList.RebuildEntityNameIndex();
+	}
+
 	void FrameUpdatePostEntityThink()
 	{
+		if ( ent_find_stats.GetBool() )
+		{
+			const EntityListLookupStats_t &stats = gEntList.GetLookupStats();
+			if ( stats.nNameLookups || stats.nClassnameLookups )
+			{
+				Msg( "%d: entity lookups: %d by name, %d by classname (%d indexed, %d scanned, %d index candidates)\n",
+					gpGlobals->tickcount, stats.nNameLookups, stats.nClassnameLookups, stats.nIndexed, stats.nScanned, stats.nCandidates );
+			}
+		}
+		gEntList.ResetLookupStats();
+
 		g_TouchManager.FrameUpdatePostEntityThink();
 
 		if ( m_bRespawnAllEntities )
@@ -14,6 +14,7 @@
 #endif
 
 #include "baseentity.h"
+#include "utlmap.h"
 
 class IEntityListener;
 
@@ -66,6 +67,15 @@ public:
 	virtual CBaseEntity *GetFilterResult( void ) = 0;
 };
 
+struct EntityListLookupStats_t
+{
+	int		nNameLookups;
+	int		nClassnameLookups;
+	int		nIndexed;			// answered from the name/classname index
+	int		nScanned;			// wildcards, or the index is turned off
+	int		nCandidates;		// index entries examined
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: a global list of all the entities in the game.  All iteration through
 //			entities is done through this object.
@@ -81,6 +91,31 @@ private:
 	bool m_bClearingEntities;
 	CUtlVector<IEntityListener *>	m_entityListeners;
 
+	// Name and classname lookups go through hash buckets of entity slots. Each bucket is
+	// kept in the order of the active list so iteration with a start entity finds the same
+	// entities, in the same order, as walking the whole list.
+	struct IndexedEntity_t
+	{
+		string_t		iszName;			// the strings the slot is filed under
+		string_t		iszClassname;
+		unsigned int	nNameHash;
+		unsigned int	nClassnameHash;
+		unsigned int	nListOrder;			// grows with each entity added, like its position in the active list
+	};
+
+	typedef CUtlMap< unsigned int, int > EntityIndex_t;		// caseless string hash -> bucket
+
+	void			AddToIndex( EntityIndex_t &index, unsigned int nHash, int iSlot );
+	void			RemoveFromIndex( EntityIndex_t &index, unsigned int nHash, int iSlot );
+	CBaseEntity		*FindInIndex( const EntityIndex_t &index, CBaseEntity *pStartEntity, const char *szName, bool bClassname, IEntityFindFilter *pFilter );
+
+	IndexedEntity_t				m_IndexedEntities[NUM_ENT_ENTRIES];
+	unsigned int				m_nNextListOrder;
+	EntityIndex_t				m_NameIndex;
+	EntityIndex_t				m_ClassnameIndex;
+	CUtlVector< CUtlVector<int> >	m_IndexBuckets;		// entity slots, sorted by list order
+	EntityListLookupStats_t		m_LookupStats;
+
 public:
 	IServerNetworkable* GetServerNetworkable( CBaseHandle hEnt ) const;
 	CBaseNetworkable* GetBaseNetworkable( CBaseHandle hEnt ) const;
@@ -102,6 +137,14 @@ public:
 	// Returns true while in the Clear() call.
 	bool	IsClearingEntities()	{return m_bClearingEntities;}
 	
+	// keep the name and classname index current, call when either may have changed
+	void UpdateEntityNameIndex( CBaseEntity *pEntity );
+	void RebuildEntityNameIndex( void );
+
+	// lookup counts since the last call to ResetLookupStats
+	const EntityListLookupStats_t &GetLookupStats() const { return m_LookupStats; }
+	void ResetLookupStats( void );
+
 	// add a class that gets notified of entity events
 	void AddListenerEntity( IEntityListener *pListener );
 	void RemoveListenerEntity( IEntityListener *pListener );
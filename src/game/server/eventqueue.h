@@ -6,6 +6,11 @@
 //
 //			The queue is serviced once per server frame.
 //
+//			Pending events are kept on a two level timer wheel keyed by the tick
+//			they fall due on, so adding an event doesn't walk the whole queue.
+//			Events with the same fire time are dispatched in the order they were
+//			added.
+//
 //=============================================================================//
 
 #ifndef EVENTQUEUE_H
@@ -15,6 +20,12 @@
 #endif
 
 #include "mempool.h"
+#include "utlmap.h"
+
+#define EVENTQUEUE_WHEEL_BITS		8
+#define EVENTQUEUE_WHEEL_SLOTS		( 1 << EVENTQUEUE_WHEEL_BITS )		// ticks covered by the inner wheel
+#define EVENTQUEUE_OUTER_BITS		6
+#define EVENTQUEUE_OUTER_SLOTS		( 1 << EVENTQUEUE_OUTER_BITS )		// turns of the inner wheel covered by the outer wheel
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -28,8 +39,20 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
+	// input handler resolved for the last target class, not saved
+	datamap_t *m_pInputMap;
+	const typedescription_t *m_pInputDesc;
+
+	// links within the wheel slot the event is filed in, not saved
 	EventQueuePrioritizedEvent_t *m_pNext;
 	EventQueuePrioritizedEvent_t *m_pPrev;
+	int m_iBucket;
+	int m_nTick;
+	unsigned int m_nSerial;		// breaks ties between equal fire times
+
+	// links within the per target and per caller lists, not saved
+	EventQueuePrioritizedEvent_t *m_pIndexNext[2];
+	EventQueuePrioritizedEvent_t *m_pIndexPrev[2];
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -71,11 +94,53 @@ public:
 
 private:
 
+	enum
+	{
+		BUCKET_OUTER = EVENTQUEUE_WHEEL_SLOTS,
+		BUCKET_OVERFLOW = BUCKET_OUTER + EVENTQUEUE_OUTER_SLOTS,	// beyond the outer wheel, refiled each time it turns
+		BUCKET_DUE,													// slot time has passed, sorted by fire time
+		NUM_BUCKETS
+	};
+
+	enum
+	{
+		INDEX_TARGET,
+		INDEX_CALLER,
+		NUM_INDICES
+	};
+
+	struct Bucket_t
+	{
+		EventQueuePrioritizedEvent_t *m_pHead;
+		EventQueuePrioritizedEvent_t *m_pTail;
+	};
+
+	typedef CUtlMap<int, EventQueuePrioritizedEvent_t *> EventIndex_t;
+
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
+	void FireEvent( EventQueuePrioritizedEvent_t *pe, CBaseEntity *pTarget );
+
+	int TimeToTick( float flTime ) const;
+	void ScheduleEvent( EventQueuePrioritizedEvent_t *pe );
+	void UnlinkFromBucket( EventQueuePrioritizedEvent_t *pe );
+	void RefileBucket( int iBucket );
+	void AdvanceWheel( int nTick );
+	void RebuildWheel( int nTick );
+
+	static const CBaseHandle &GetIndexHandle( EventQueuePrioritizedEvent_t *pe, int iIndex );
+	void LinkToIndex( EventQueuePrioritizedEvent_t *pe, int iIndex );
+	void UnlinkFromIndex( EventQueuePrioritizedEvent_t *pe, int iIndex );
+
+	void GetEventsInOrder( CUtlVector<EventQueuePrioritizedEvent_t *> &events );
 
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	Bucket_t m_Buckets[NUM_BUCKETS];
+	EventIndex_t m_Index[NUM_INDICES];	// head of the event list for each target/caller handle
+	int m_nWheelTick;					// first tick whose inner slot hasn't been emptied into the due list
+	float m_flTickInterval;
+	unsigned int m_nNextSerial;
+	int m_nEventCount;
 	int m_iListCount;
 };
 
@@ -244,6 +244,7 @@ CNavArea::CNavArea( void )
 
 	m_inheritVisibilityFrom.area = NULL;
 	m_isInheritedFrom = false;
+	m_visibilityRecord = -1;
 
 	m_funcNavCostVector.RemoveAll();
 
@@ -770,6 +771,7 @@ void CNavArea::OnDestroyNotify( CNavArea *dead )
 	m_inheritVisibilityFrom.area = NULL;
 	m_potentiallyVisibleAreas.RemoveAll();
 	m_isInheritedFrom = false;
+	m_visibilityRecord = -1;
 }
 
 
@@ -3552,6 +3554,247 @@ void CNavArea::ClearSearchLists( void )
 	m_openListTail = NULL;
 }
 
+
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+CTHREADLOCALPTR( CNavAreaSearch ) CNavAreaSearch::s_threadSearch;
+CInterlockedInt CNavAreaSearch::s_areaDataSearchCount;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaSearch::CNavAreaSearch( void )
+{
+	m_marker = 0;
+	m_usesAreaData = !ThreadInMainThread();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaSearch *CNavAreaSearch::GetThreadSearch( void )
+{
+	CNavAreaSearch *search = s_threadSearch;
+	if ( !search )
+	{
+		search = new CNavAreaSearch;
+		s_threadSearch = search;
+
+		if ( search->UsesAreaData() )
+		{
+			++s_areaDataSearchCount;
+		}
+	}
+
+	return search;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Free this thread's search state. Parent pointers and costs from its last search
+ * are gone afterwards. The next search on this thread starts over with empty arrays.
+ */
+void CNavAreaSearch::ReleaseThreadSearch( void )
+{
+	CNavAreaSearch *search = s_threadSearch;
+	if ( !search )
+		return;
+
+	s_threadSearch = NULL;
+
+	if ( search->UsesAreaData() )
+	{
+		--s_areaDataSearchCount;
+	}
+
+	delete search;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::Begin( void )
+{
+	++m_marker;
+	if ( m_marker == 0 )
+	{
+		// wrapped, old markers are ambiguous now
+		for( int i=0; i<m_areaState.Count(); ++i )
+		{
+			m_areaState[i].m_marker = 0;
+		}
+		m_marker = 1;
+	}
+
+	m_openList.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaSearch::AreaState &CNavAreaSearch::GetAreaState( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_areaState.Count() )
+	{
+		int oldCount = m_areaState.Count();
+		m_areaState.SetCount( MAX( id + 1, CNavArea::m_nextID ) );
+		Q_memset( m_areaState.Base() + oldCount, 0, ( m_areaState.Count() - oldCount ) * sizeof( AreaState ) );
+	}
+	return m_areaState[ id ];
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavAreaSearch::IsOpen( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_areaState.Count() )
+		return false;
+
+	return m_areaState[ id ].m_marker == m_marker && m_areaState[ id ].m_heapIndex >= 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavAreaSearch::IsClosed( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_areaState.Count() )
+		return false;
+
+	return m_areaState[ id ].m_marker == m_marker && m_areaState[ id ].m_heapIndex < 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::AddToClosedList( CNavArea *area )
+{
+	AreaState &state = GetAreaState( area );
+	Assert( state.m_marker != m_marker || state.m_heapIndex < 0 );
+
+	state.m_marker = m_marker;
+	state.m_heapIndex = -1;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::SetHeapEntry( int index, const OpenEntry &entry )
+{
+	m_openList[ index ] = entry;
+	m_areaState[ entry.m_area->GetID() ].m_heapIndex = index;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::BubbleUp( int index )
+{
+	OpenEntry entry = m_openList[ index ];
+
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) / 2;
+		if ( m_openList[ parent ].m_totalCost <= entry.m_totalCost )
+			break;
+
+		SetHeapEntry( index, m_openList[ parent ] );
+		index = parent;
+	}
+
+	SetHeapEntry( index, entry );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::BubbleDown( int index )
+{
+	OpenEntry entry = m_openList[ index ];
+	int count = m_openList.Count();
+
+	while( true )
+	{
+		int child = 2 * index + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && m_openList[ child + 1 ].m_totalCost < m_openList[ child ].m_totalCost )
+		{
+			++child;
+		}
+
+		if ( entry.m_totalCost <= m_openList[ child ].m_totalCost )
+			break;
+
+		SetHeapEntry( index, m_openList[ child ] );
+		index = child;
+	}
+
+	SetHeapEntry( index, entry );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::AddToOpenList( CNavArea *area, float totalCost )
+{
+	AreaState &state = GetAreaState( area );
+	if ( state.m_marker == m_marker && state.m_heapIndex >= 0 )
+	{
+		// already on list
+		UpdateOnOpenList( area, totalCost );
+		return;
+	}
+
+	state.m_marker = m_marker;
+
+	OpenEntry entry;
+	entry.m_totalCost = totalCost;
+	entry.m_area = area;
+
+	int index = m_openList.AddToTail( entry );
+	state.m_heapIndex = index;
+	BubbleUp( index );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaSearch::UpdateOnOpenList( CNavArea *area, float totalCost )
+{
+	Assert( IsOpen( area ) );
+
+	int index = m_areaState[ area->GetID() ].m_heapIndex;
+	Assert( totalCost <= m_openList[ index ].m_totalCost );
+
+	// since value can only decrease, bubble this area up from current spot
+	m_openList[ index ].m_totalCost = totalCost;
+	BubbleUp( index );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavAreaSearch::PopOpenList( void )
+{
+	if ( m_openList.Count() == 0 )
+		return NULL;
+
+	CNavArea *area = m_openList[0].m_area;
+
+	// off both lists until it is closed
+	AreaState &state = m_areaState[ area->GetID() ];
+	state.m_marker = 0;
+	state.m_heapIndex = -1;
+
+	int last = m_openList.Count() - 1;
+	if ( last > 0 )
+	{
+		SetHeapEntry( 0, m_openList[ last ] );
+		m_openList.RemoveMultipleFromTail( 1 );
+		BubbleDown( 0 );
+	}
+	else
+	{
+		m_openList.RemoveAll();
+	}
+
+	return area;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 {
@@ -5446,6 +5689,9 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 	static CAreaBindInfoArray delta;
 
 	delta.RemoveAll();
+
+	EnsureVisibilityDecoded();
+	other->EnsureVisibilityDecoded();
 	
 	// do not delta from a delta - if 'other' is already inheriting, use its inherited source directly
 	if ( other->m_inheritVisibilityFrom.area != NULL )
@@ -5515,6 +5761,7 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 void CNavArea::ResetPotentiallyVisibleAreas()
 {
 	m_potentiallyVisibleAreas.RemoveAll();
+	m_visibilityRecord = -1;
 }
 
 
@@ -5526,7 +5773,10 @@ void CNavArea::ResetPotentiallyVisibleAreas()
  */
 
 CNavArea *g_pCurVisArea;
-CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
+CNavArea **g_pCurVisCandidates;
+CUtlVector< CNavArea::AreaBindInfo > g_ComputedVis;		// one slot per candidate, so the result doesn't depend on job order
+
+extern ConVar nav_generate_threaded;
 
 void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 {
@@ -5561,7 +5811,7 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 	{
 		info.area = area;
 		info.attributes = visThisToOther;
-		g_ComputedVis.PushItem( info );
+		g_ComputedVis[ &pOtherArea - g_pCurVisCandidates ] = info;
 	}
 
 	if ( visOtherToThis != NOT_VISIBLE )
@@ -5610,12 +5860,22 @@ void CNavArea::ComputeVisibilityToMesh( void )
 	SetupPVS();
 
 	g_pCurVisArea = this;
-	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea );
+	g_pCurVisCandidates = collector.m_area.Base();
+	g_ComputedVis.SetCount( collector.m_area.Count() );
+	FOR_EACH_VEC( g_ComputedVis, vit )
+	{
+		g_ComputedVis[ vit ].area = NULL;
+	}
+
+	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea, NULL, NULL, nav_generate_threaded.GetBool() ? INT_MAX : 0 );
 
-	m_potentiallyVisibleAreas.EnsureCapacity( g_ComputedVis.Count() );
-	while ( g_ComputedVis.Count() )
+	// keep the candidate order, which is the order a single threaded run would produce
+	FOR_EACH_VEC( g_ComputedVis, vit )
 	{
-		g_ComputedVis.PopItem( &m_potentiallyVisibleAreas[ m_potentiallyVisibleAreas.AddToTail() ] );
+		if ( g_ComputedVis[ vit ].area )
+		{
+			m_potentiallyVisibleAreas.AddToTail( g_ComputedVis[ vit ] );
+		}
 	}
 
 	FOR_EACH_VEC( collector.m_area, it )
@@ -5722,6 +5982,8 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	EnsureVisibilityDecoded();
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5736,6 +5998,7 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 	// viewedArea is not in our visibility list, check inherited set
 	if ( m_inheritVisibilityFrom.area )
 	{
+		m_inheritVisibilityFrom.area->EnsureVisibilityDecoded();
 		CAreaBindInfoArray &inherited = m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
 
 		for ( int i=0; i<inherited.Count(); ++i )
@@ -5767,6 +6030,8 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	EnsureVisibilityDecoded();
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5780,6 +6045,7 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 	// viewedArea is not in our visibility list, check inherited set
 	if ( m_inheritVisibilityFrom.area )
 	{
+		m_inheritVisibilityFrom.area->EnsureVisibilityDecoded();
 		CAreaBindInfoArray &inherited = m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
 
 		for ( int i=0; i<inherited.Count(); ++i )
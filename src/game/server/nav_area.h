@@ -14,6 +14,7 @@
 
 #include "nav_ladder.h"
 #include "tier1/memstack.h"
+#include "tier0/threadtools.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
 enum { MAX_NAV_TEAMS = 2 };
@@ -200,6 +201,98 @@ struct SpotEncounter
 typedef CUtlVectorUltraConservative< SpotEncounter * > SpotEncounterVector;
 
 
+//-------------------------------------------------------------------------------------------------------------------
+/**
+ * Per-thread state for NavAreaBuildPath(). The open list is a binary heap on total
+ * cost, and open/closed membership lives in arrays indexed by area ID instead of
+ * on the areas, so searches on different threads don't interfere.
+ *
+ * Off the main thread the cost, parent, and path length of each area are kept here
+ * as well. NavAreaBuildPath() looks up this thread's search once and goes through
+ * it directly; the CNavArea accessors (used by cost functors and when walking the
+ * result) only check the thread-local slot while some other thread owns a search,
+ * so the single-threaded path never touches it. The main thread keeps using the
+ * fields on the areas, so the other searches in nav_pathfind.h (which still use the
+ * shared intrusive open list) are unchanged.
+ *
+ * A thread other than the main thread must call ReleaseThreadSearch() once it is
+ * done with its paths, before it exits or is handed back to the thread pool.
+ */
+class CNavAreaSearch
+{
+public:
+	CNavAreaSearch( void );
+
+	static CNavAreaSearch *GetThreadSearch( void );			// this thread's search state, created on first use
+	static void ReleaseThreadSearch( void );				// free this thread's search state, and with it the results of its last search
+	static CNavAreaSearch *GetThreadAreaData( void );		// this thread's state if it keeps its own area data, else NULL
+
+	bool UsesAreaData( void ) const							{ return m_usesAreaData; }
+
+	void Begin( void );										// clear the open and closed lists for a new search
+
+	bool IsOpenListEmpty( void ) const						{ return m_openList.Count() == 0; }
+	void AddToOpenList( CNavArea *area, float totalCost );
+	void UpdateOnOpenList( CNavArea *area, float totalCost );	// a smaller total cost has been found
+	CNavArea *PopOpenList( void );							// remove and return the area with the smallest total cost
+
+	bool IsOpen( const CNavArea *area ) const;
+	bool IsClosed( const CNavArea *area ) const;
+	void AddToClosedList( CNavArea *area );
+	void RemoveFromClosedList( CNavArea *area )				{ }	// "closed" is visited and not open, as for CNavArea
+
+	struct AreaData
+	{
+		float m_totalCost;
+		float m_costSoFar;
+		float m_pathLengthSoFar;
+		CNavArea *m_parent;
+		NavTraverseType m_parentHow;
+	};
+
+	AreaData &GetAreaData( const CNavArea *area );			// grows the arrays as needed
+	const AreaData *FindAreaData( const CNavArea *area ) const;
+
+	// per-search view of the CNavArea cost and parent accessors, without a thread-local lookup
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+	void SetTotalCost( CNavArea *area, float value );
+	float GetTotalCost( const CNavArea *area ) const;
+	void SetCostSoFar( CNavArea *area, float value );
+	float GetCostSoFar( const CNavArea *area ) const;
+	void SetPathLengthSoFar( CNavArea *area, float value );
+	float GetPathLengthSoFar( const CNavArea *area ) const;
+
+private:
+	struct AreaState
+	{
+		unsigned int m_marker;								// equals m_marker if touched by the current search
+		int m_heapIndex;									// position in m_openList, or -1 if closed
+	};
+
+	struct OpenEntry
+	{
+		float m_totalCost;
+		CNavArea *m_area;
+	};
+
+	AreaState &GetAreaState( const CNavArea *area );
+	void SetHeapEntry( int index, const OpenEntry &entry );
+	void BubbleUp( int index );
+	void BubbleDown( int index );
+
+	unsigned int m_marker;
+	bool m_usesAreaData;									// true off the main thread, where costs and parents are kept in m_areaData
+	CUtlVector< AreaState > m_areaState;
+	CUtlVector< AreaData > m_areaData;
+	CUtlVector< OpenEntry > m_openList;
+
+	static CTHREADLOCALPTR( CNavAreaSearch ) s_threadSearch;
+	static CInterlockedInt s_areaDataSearchCount;			// number of live searches with m_usesAreaData set
+};
+
+
 //-------------------------------------------------------------------------------------------------------------------
 /**
  * A CNavArea is a rectangular region defining a walkable area in the environment
@@ -428,9 +521,9 @@ public:
 	void Mark( void )					{ m_marker = m_masterMarker; }
 	BOOL IsMarked( void ) const			{ return (m_marker == m_masterMarker) ? true : false; }
 	
-	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ m_parent = parent; m_parentHow = how; }
-	CNavArea *GetParent( void ) const	{ return m_parent; }
-	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
+	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( void ) const;
+	NavTraverseType GetParentHow( void ) const;
 
 	bool IsOpen( void ) const;									// true if on "open list"
 	void AddToOpenList( void );									// add to open list in decreasing value order
@@ -446,14 +539,15 @@ public:
 
 	static void ClearSearchLists( void );						// clears the open and closed lists for a new search
 
-	void SetTotalCost( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_totalCost = value; }
-	float GetTotalCost( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_totalCost ); return m_totalCost; }
+	// these use this thread's CNavAreaSearch when not on the main thread
+	void SetTotalCost( float value );
+	float GetTotalCost( void ) const;
 
-	void SetCostSoFar( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_costSoFar = value; }
-	float GetCostSoFar( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_costSoFar ); return m_costSoFar; }
+	void SetCostSoFar( float value );
+	float GetCostSoFar( void ) const;
 
-	void SetPathLengthSoFar( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_pathLengthSoFar = value; }
-	float GetPathLengthSoFar( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_pathLengthSoFar ); return m_pathLengthSoFar; }
+	void SetPathLengthSoFar( float value );
+	float GetPathLengthSoFar( void ) const;
 
 	//- editing -----------------------------------------------------------------------------------------
 	virtual void Draw( void ) const;							// draw area for debugging & editing
@@ -537,6 +631,8 @@ public:
 
 		++s_nCurrVisTestCounter;
 
+		EnsureVisibilityDecoded();
+
 		for ( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 		{
 			CNavArea *area = m_potentiallyVisibleAreas[i].area;
@@ -558,6 +654,7 @@ public:
 		if ( !m_inheritVisibilityFrom.area )
 			return true;
 
+		m_inheritVisibilityFrom.area->EnsureVisibilityDecoded();
 		CAreaBindInfoArray &inherited = m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
 
 		for ( i=0; i<inherited.Count(); ++i )
@@ -594,6 +691,8 @@ public:
 
 		++s_nCurrVisTestCounter;
 
+		EnsureVisibilityDecoded();
+
 		for ( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 		{
 			CNavArea *area = m_potentiallyVisibleAreas[i].area;
@@ -615,6 +714,7 @@ public:
 			return true;
 
 		// for each inherited area
+		m_inheritVisibilityFrom.area->EnsureVisibilityDecoded();
 		CAreaBindInfoArray &inherited = m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
 
 		for ( i=0; i<inherited.Count(); ++i )
@@ -643,6 +743,7 @@ public:
 private:
 	friend class CNavMesh;
 	friend class CNavLadder;
+	friend class CNavAreaSearch;
 	friend class CCSNavArea;									// allow CS load code to complete replace our default load behavior
 
 	static bool m_isReset;										// if true, don't bother cleaning up in destructor since everything is going away
@@ -748,9 +849,19 @@ private:
 #endif
 
 	AreaBindInfo m_inheritVisibilityFrom;						// if non-NULL, m_potentiallyVisibleAreas becomes a list of additions and deletions (NOT_VISIBLE) to the list of this area
-	CAreaBindInfoArray m_potentiallyVisibleAreas;				// list of areas potentially visible from inside this area (after PostLoad(), use area portion of union)
+	mutable CAreaBindInfoArray m_potentiallyVisibleAreas;		// list of areas potentially visible from inside this area (after PostLoad(), use area portion of union)
 	bool m_isInheritedFrom;										// latch used during visibility inheritance computation
 
+	mutable volatile int m_visibilityRecord;					// our record in the mesh's visibility section until m_potentiallyVisibleAreas is decoded from it, -1 after
+	void DecodeVisibility( void ) const;						// fill m_potentiallyVisibleAreas from our visibility record
+	void EnsureVisibilityDecoded( void ) const
+	{
+		if ( m_visibilityRecord >= 0 )
+		{
+			DecodeVisibility();
+		}
+	}
+
 	const CAreaBindInfoArray &ComputeVisibilityDelta( const CNavArea *other ) const;	// return a list of the delta between our visibility list and the given adjacent area
 
 	uint32 m_nVisTestCounter;
@@ -878,6 +989,278 @@ inline void CNavArea::RemoveFromClosedList( void )
 	// since "closed" is defined as visited (marked) and not on open list, do nothing
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline CNavAreaSearch *CNavAreaSearch::GetThreadAreaData( void )
+{
+	// only look at the thread-local slot while some thread keeps its own area data
+	return s_areaDataSearchCount ? (CNavAreaSearch *)s_threadSearch : NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavAreaSearch::AreaData &CNavAreaSearch::GetAreaData( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_areaData.Count() )
+	{
+		int oldCount = m_areaData.Count();
+		m_areaData.SetCount( MAX( id + 1, CNavArea::m_nextID ) );
+		Q_memset( m_areaData.Base() + oldCount, 0, ( m_areaData.Count() - oldCount ) * sizeof( AreaData ) );
+	}
+	return m_areaData[ id ];
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline const CNavAreaSearch::AreaData *CNavAreaSearch::FindAreaData( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	return ( id < (unsigned int)m_areaData.Count() ) ? &m_areaData[ id ] : NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavAreaSearch::SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	if ( m_usesAreaData )
+	{
+		AreaData &data = GetAreaData( area );
+		data.m_parent = parent;
+		data.m_parentHow = how;
+		return;
+	}
+
+	area->m_parent = parent;
+	area->m_parentHow = how;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavAreaSearch::GetParent( const CNavArea *area ) const
+{
+	if ( m_usesAreaData )
+	{
+		const AreaData *data = FindAreaData( area );
+		return data ? data->m_parent : NULL;
+	}
+
+	return area->m_parent;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavAreaSearch::GetParentHow( const CNavArea *area ) const
+{
+	if ( m_usesAreaData )
+	{
+		const AreaData *data = FindAreaData( area );
+		return data ? data->m_parentHow : NUM_TRAVERSE_TYPES;
+	}
+
+	return area->m_parentHow;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavAreaSearch::SetTotalCost( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+
+	if ( m_usesAreaData )
+	{
+		GetAreaData( area ).m_totalCost = value;
+		return;
+	}
+
+	area->m_totalCost = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavAreaSearch::GetTotalCost( const CNavArea *area ) const
+{
+	if ( m_usesAreaData )
+	{
+		const AreaData *data = FindAreaData( area );
+		return data ? data->m_totalCost : 0.0f;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( area->m_totalCost );
+	return area->m_totalCost;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavAreaSearch::SetCostSoFar( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+
+	if ( m_usesAreaData )
+	{
+		GetAreaData( area ).m_costSoFar = value;
+		return;
+	}
+
+	area->m_costSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavAreaSearch::GetCostSoFar( const CNavArea *area ) const
+{
+	if ( m_usesAreaData )
+	{
+		const AreaData *data = FindAreaData( area );
+		return data ? data->m_costSoFar : 0.0f;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( area->m_costSoFar );
+	return area->m_costSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavAreaSearch::SetPathLengthSoFar( CNavArea *area, float value )
+{
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+
+	if ( m_usesAreaData )
+	{
+		GetAreaData( area ).m_pathLengthSoFar = value;
+		return;
+	}
+
+	area->m_pathLengthSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavAreaSearch::GetPathLengthSoFar( const CNavArea *area ) const
+{
+	if ( m_usesAreaData )
+	{
+		const AreaData *data = FindAreaData( area );
+		return data ? data->m_pathLengthSoFar : 0.0f;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( area->m_pathLengthSoFar );
+	return area->m_pathLengthSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetParent( CNavArea *parent, NavTraverseType how )
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		search->SetParent( this, parent, how );
+		return;
+	}
+
+	m_parent = parent;
+	m_parentHow = how;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::GetParent( void ) const
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		return search->GetParent( this );
+	}
+
+	return m_parent;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavArea::GetParentHow( void ) const
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		return search->GetParentHow( this );
+	}
+
+	return m_parentHow;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetTotalCost( float value )
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		search->SetTotalCost( this, value );
+		return;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	m_totalCost = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetTotalCost( void ) const
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		return search->GetTotalCost( this );
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( m_totalCost );
+	return m_totalCost;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetCostSoFar( float value )
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		search->SetCostSoFar( this, value );
+		return;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	m_costSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetCostSoFar( void ) const
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		return search->GetCostSoFar( this );
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( m_costSoFar );
+	return m_costSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetPathLengthSoFar( float value )
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		search->SetPathLengthSoFar( this, value );
+		return;
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( value );
+	Assert( value >= 0.0 && !IS_NAN(value) );
+	m_pathLengthSoFar = value;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetPathLengthSoFar( void ) const
+{
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadAreaData();
+	if ( search )
+	{
+		return search->GetPathLengthSoFar( this );
+	}
+
+	DebuggerBreakOnNaN_StagingOnly( m_pathLengthSoFar );
+	return m_pathLengthSoFar;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline void CNavArea::SetClearedTimestamp( int teamID )
 {
@@ -44,7 +44,7 @@
 /// IMPORTANT: If this version changes, the swap function in makegamedata 
 /// must be updated to match. If not, this will break the Xbox 360.
 // TODO: Was changed from 15, update when latest 360 code is integrated (MSB 5/5/09)
-const int NavCurrentVersion = 16;
+const int NavCurrentVersion = 17;
 
 //--------------------------------------------------------------------------------------------------------------
 //
@@ -371,23 +371,7 @@ void CNavArea::Save( CUtlBuffer &fileBuffer, unsigned int version ) const
 		fileBuffer.PutFloat( m_lightIntensity[i] );
 	}
 
-	// save visible area set
-	unsigned int visibleAreaCount = m_potentiallyVisibleAreas.Count();
-	fileBuffer.PutUnsignedInt( visibleAreaCount );
-
-	for ( int vit=0; vit<m_potentiallyVisibleAreas.Count(); ++vit )
-	{
-		CNavArea *area = m_potentiallyVisibleAreas[ vit ].area;
-
-		unsigned int id = area ? area->GetID() : 0;
-
-		fileBuffer.PutUnsignedInt( id );
-		fileBuffer.PutUnsignedChar( m_potentiallyVisibleAreas[ vit ].attributes );
-	}
-
-	// store area we inherit visibility from
-	unsigned int id = ( m_inheritVisibilityFrom.area ) ? m_inheritVisibilityFrom.area->GetID() : 0;
-	fileBuffer.PutUnsignedInt( id );
+	// visible area sets are stored by the mesh in their own section, see CNavMesh::SaveVisibility()
 }
 
 
@@ -646,7 +630,8 @@ NavErrorType CNavArea::Load( CUtlBuffer &fileBuffer, unsigned int version, unsig
 		m_lightIntensity[i] = fileBuffer.GetFloat();
 	}
 
-	if ( version < 16 )
+	// version 17 moved visibility out of the area records and into the mesh's visibility section
+	if ( version < 16 || version >= 17 )
 		return NAV_OK;
 
 	// load visibility information
@@ -802,6 +787,52 @@ NavErrorType CNavArea::PostLoad( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Fill our visibility list from our record in the mesh's visibility section.
+ * Visibility queries can come from the job threads, so the first caller decodes and the rest wait for it.
+ */
+void CNavArea::DecodeVisibility( void ) const
+{
+	static CThreadFastMutex s_decodeMutex;
+	AUTO_LOCK( s_decodeMutex );
+
+	if ( m_visibilityRecord < 0 )
+	{
+		// decoded by another thread while we waited
+		return;
+	}
+
+	const unsigned int *entries;
+	int count = TheNavMesh->GetVisibilityEntries( m_visibilityRecord, &entries );
+
+	m_potentiallyVisibleAreas.EnsureCapacity( count );
+
+	for( int i=0; i<count; ++i )
+	{
+		unsigned int entry = LittleDWord( entries[i] );
+		unsigned int index = entry >> 8;
+
+		// records are in load order, and no area has been removed since or we would have been reset
+		if ( index >= (unsigned int)TheNavAreas.Count() )
+		{
+			Warning( "Invalid area in visible set for area #%d\n", GetID() );
+			continue;
+		}
+
+		AreaBindInfo info;
+		info.area = TheNavAreas[ index ];
+		info.attributes = (unsigned char)( entry & 0xFF );
+
+		m_potentiallyVisibleAreas.AddToTail( info );
+	}
+
+	// publish the list before the flag that says it's there
+	ThreadMemoryBarrier();
+	m_visibilityRecord = -1;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute travel distance along shortest path from startPos to goalPos. 
@@ -1074,6 +1105,168 @@ static void WarnIfMeshNeedsAnalysis( int version )
 #endif
 }
 
+/**
+ * Store the visibility section. Each area gets a fixed-size record in area order, followed by
+ * one table of packed entries that refer to areas by record index, so a loaded file can be
+ * used in place without any ID lookups.
+ */
+void CNavMesh::SaveVisibility( CUtlBuffer &fileBuffer ) const
+{
+	// entries refer to areas by their position in the file
+	unsigned int maxID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxID = MAX( maxID, TheNavAreas[ it ]->GetID() );
+	}
+
+	CUtlVector< int > recordIndex;
+	recordIndex.SetCount( maxID + 1 );
+
+	unsigned int entryCount = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		area->EnsureVisibilityDecoded();
+
+		recordIndex[ area->GetID() ] = it;
+
+		for ( int vit=0; vit<area->m_potentiallyVisibleAreas.Count(); ++vit )
+		{
+			if ( area->m_potentiallyVisibleAreas[ vit ].area )
+			{
+				++entryCount;
+			}
+		}
+	}
+
+	Assert( TheNavAreas.Count() < ( 1 << 24 ) );
+
+	// align the tables so they can be read in place once loaded
+	while ( fileBuffer.TellPut() & 3 )
+	{
+		fileBuffer.PutUnsignedChar( 0 );
+	}
+
+	fileBuffer.PutUnsignedInt( TheNavAreas.Count() );
+	fileBuffer.PutUnsignedInt( entryCount );
+
+	// store the records
+	unsigned int firstEntry = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		unsigned int count = 0;
+		for ( int vit=0; vit<area->m_potentiallyVisibleAreas.Count(); ++vit )
+		{
+			if ( area->m_potentiallyVisibleAreas[ vit ].area )
+			{
+				++count;
+			}
+		}
+
+		CNavArea *inherit = area->m_inheritVisibilityFrom.area;
+
+		fileBuffer.PutUnsignedInt( firstEntry );
+		fileBuffer.PutUnsignedInt( count );
+		fileBuffer.PutUnsignedInt( inherit ? recordIndex[ inherit->GetID() ] + 1 : 0 );
+
+		firstEntry += count;
+	}
+
+	// store the entries
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		for ( int vit=0; vit<area->m_potentiallyVisibleAreas.Count(); ++vit )
+		{
+			const CNavArea::AreaBindInfo &info = area->m_potentiallyVisibleAreas[ vit ];
+			if ( info.area )
+			{
+				fileBuffer.PutUnsignedInt( ( recordIndex[ info.area->GetID() ] << 8 ) | info.attributes );
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Validate the visibility section and point each area at its record.
+ * Nothing is decoded here - the section is kept and areas decode their own list on first use.
+ */
+NavErrorType CNavMesh::LoadVisibility( CUtlBuffer &fileBuffer )
+{
+	m_visibilityRecordCount = 0;
+	m_visibilityEntryCount = 0;
+
+	while ( fileBuffer.TellGet() & 3 )
+	{
+		fileBuffer.GetUnsignedChar();
+	}
+
+	unsigned int recordCount = fileBuffer.GetUnsignedInt();
+	unsigned int entryCount = fileBuffer.GetUnsignedInt();
+
+	int recordBytes = recordCount * sizeof( VisibilityRecord );
+	int entryBytes = entryCount * sizeof( unsigned int );
+
+	if ( !fileBuffer.IsValid() || recordCount != (unsigned int)TheNavAreas.Count() || fileBuffer.GetBytesRemaining() < recordBytes + entryBytes )
+	{
+		Msg( "CNavMesh::LoadVisibility: Corrupt navigation visibility data.\n" );
+		return NAV_CORRUPT_DATA;
+	}
+
+	const VisibilityRecord *records = (const VisibilityRecord *)fileBuffer.PeekGet();
+
+	for( unsigned int i=0; i<recordCount; ++i )
+	{
+		unsigned int first = LittleDWord( records[i].firstEntry );
+		unsigned int count = LittleDWord( records[i].entryCount );
+		unsigned int inheritFrom = LittleDWord( records[i].inheritFrom );
+
+		if ( first > entryCount || count > entryCount - first || inheritFrom > recordCount || inheritFrom == i + 1 )
+		{
+			Msg( "CNavMesh::LoadVisibility: Corrupt navigation visibility data.\n" );
+			return NAV_CORRUPT_DATA;
+		}
+
+		CNavArea *area = TheNavAreas[i];
+
+		// resolved into a pointer by CNavArea::PostLoad() along with the other area references
+		area->m_inheritVisibilityFrom.id = inheritFrom ? TheNavAreas[ inheritFrom - 1 ]->GetID() : 0;
+		area->m_visibilityRecord = count ? (int)i : -1;
+	}
+
+	m_visibilityRecordOffset = fileBuffer.TellGet();
+	m_visibilityEntryOffset = m_visibilityRecordOffset + recordBytes;
+	m_visibilityRecordCount = recordCount;
+	m_visibilityEntryCount = entryCount;
+
+	fileBuffer.SeekGet( CUtlBuffer::SEEK_CURRENT, recordBytes + entryBytes );
+
+	return NAV_OK;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavMesh::GetVisibilityEntries( int record, const unsigned int **entries ) const
+{
+	*entries = NULL;
+
+	if ( record < 0 || (unsigned int)record >= m_visibilityRecordCount || !m_visibilityImage.Base() )
+		return 0;
+
+	const byte *image = (const byte *)m_visibilityImage.Base();
+	const VisibilityRecord &info = ( (const VisibilityRecord *)( image + m_visibilityRecordOffset ) )[ record ];
+
+	*entries = (const unsigned int *)( image + m_visibilityEntryOffset ) + LittleDWord( info.firstEntry );
+	return LittleDWord( info.entryCount );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
 /**
  * Store Navigation Mesh to a file
  */
@@ -1123,6 +1316,7 @@ bool CNavMesh::Save( void ) const
 	// 14 - Added a bool for if the nav needs analysis
 	// 15 - removed approach areas
 	// 16 - Added visibility data to the base mesh
+	// 17 - Moved visibility data into fixed-size records after the ladders, decoded on demand
 	fileBuffer.PutUnsignedInt( NavCurrentVersion );
 
 	// The sub-version number is maintained and owned by classes derived from CNavMesh and CNavArea
@@ -1189,6 +1383,11 @@ bool CNavMesh::Save( void ) const
 		}
 	}
 
+	//
+	// Store visibility
+	//
+	SaveVisibility( fileBuffer );
+
 	//
 	// Store derived class mesh info
 	//
@@ -1321,6 +1520,32 @@ void CommandNavCheckFileConsistency( void )
 static ConCommand nav_check_file_consistency( "nav_check_file_consistency", CommandNavCheckFileConsistency, "Scans the maps directory and reports any missing/out-of-date navigation files.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavConvert( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	// any version we can read is rewritten in the current one
+	if ( TheNavMesh->Load() != NAV_OK )
+	{
+		Msg( "ERROR: Navigation Mesh load failed.\n" );
+		return;
+	}
+
+	if ( TheNavMesh->Save() )
+	{
+		Msg( "Navigation map '%s' converted to version %d.\n", TheNavMesh->GetFilename(), NavCurrentVersion );
+	}
+	else
+	{
+		const char *filename = TheNavMesh->GetFilename();
+		Msg( "ERROR: Cannot save navigation map '%s'.\n", (filename) ? filename : "(null)" );
+	}
+}
+static ConCommand nav_convert( "nav_convert", CommandNavConvert, "Reloads the Navigation Mesh for the current map and saves it in the current file format.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Reads the used place names from the nav file (can be used to selectively precache before the nav is loaded)
@@ -1593,6 +1818,31 @@ NavErrorType CNavMesh::Load( void )
 	// mark stairways (TODO: this can be removed once all maps are re-saved with this attribute in them)
 	MarkStairAreas();
 
+	//
+	// Bind areas to their visibility records
+	//
+	if ( version >= 17 )
+	{
+		NavErrorType visResult = LoadVisibility( fileBuffer );
+		if ( visResult != NAV_OK )
+		{
+			return visResult;
+		}
+
+		// keep a copy of just the visibility section, the areas decode their lists straight out of it
+		if ( m_visibilityRecordCount )
+		{
+			int sectionBytes = m_visibilityEntryOffset - m_visibilityRecordOffset + m_visibilityEntryCount * sizeof( unsigned int );
+
+			CUtlBuffer section( 0, sectionBytes );
+			section.Put( (const byte *)fileBuffer.Base() + m_visibilityRecordOffset, sectionBytes );
+			m_visibilityImage.Swap( section );
+
+			m_visibilityEntryOffset -= m_visibilityRecordOffset;
+			m_visibilityRecordOffset = 0;
+		}
+	}
+
 	//
 	// Load derived class mesh info
 	//
@@ -1603,6 +1853,9 @@ NavErrorType CNavMesh::Load( void )
 	//
 	NavErrorType loadResult = PostLoad( version );
 
+	// the areas are built, the file image is no longer needed
+	fileBuffer.Purge();
+
 	WarnIfMeshNeedsAnalysis( version );
 
 	return loadResult;
@@ -17,6 +17,9 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/vprof.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -43,6 +46,7 @@ ConVar nav_generate_jump_connections( "nav_generate_jump_connections", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_threaded( "nav_generate_threaded", "1", FCVAR_CHEAT, "Run the walkable space sampling traces and the mesh visibility computations on the job threads. The generated mesh is identical either way." );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3468,6 +3472,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	// the system will see this NULL and select the next walkable seed
 	m_currentNode = NULL;
+	m_sampleProbes.Purge();
 
 	// if there are no seed points, we can't generate
 	if (m_walkableSeeds.Count() == 0)
@@ -3660,6 +3665,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			// sampling is complete, now build nav areas
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
+			m_sampleProbes.Purge();
 
 			return true;
 		}
@@ -4119,6 +4125,7 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 		}
 		node->ConnectTo( source, OppositeDirection( dir ), obstacleHeight, GenerationStepSize - obstacleEndDist, GenerationStepSize - obstacleStartDist );
 		node->MarkAsVisited( OppositeDirection( dir ) );
+		DropSampleProbe( node, OppositeDirection( dir ) );
 	}
 
 	if (useNew)
@@ -4407,233 +4414,367 @@ bool CNavMesh::SampleStep( void )
 			if (!m_currentNode->HasVisited( (NavDirType)dir ))
 			{
 				// have not searched in this direction yet
+				m_generationDir = (NavDirType)dir;
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
+				// test if we can move to the adjacent node, the traces may have been done ahead of time on the job threads
+				SampleProbe probe;
+				if ( !FindSampleProbe( m_currentNode, m_generationDir, &probe ) )
+				{
+					ComputeSampleProbe( m_currentNode, m_generationDir, &probe );
+				}
 
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
+				// mark direction as visited
+				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// attempt to move to adjacent node
-				switch( dir )
+				if ( !probe.m_isValid )
 				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
+					return true;
 				}
 
-				pos.x = cx;
-				pos.y = cy;
+				// we can move here
+				// create a new navigation node, and update current node pointer
+				AddNode( probe.m_to, probe.m_toNormal, m_generationDir, m_currentNode, probe.m_isOnDisplacement, probe.m_obstacleHeight, probe.m_obstacleStartDist, probe.m_obstacleEndDist );
 
-				m_generationDir = (NavDirType)dir;
+				return true;
+			}
+		}
 
-				// mark direction as visited
-				m_currentNode->MarkAsVisited( m_generationDir );
+		// all directions have been searched from this node - pop back to its parent and continue
+		m_currentNode = m_currentNode->GetParent();
+	}
+}
 
-				// sanity check to not generate across the world for incremental generation
-				const float incrementalRange = nav_generate_incremental_range.GetFloat();
-				if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
-				{
-					bool inRange = false;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
-						{
-							inRange = true;
-							break;
-						}
-					}
 
-					if ( !inRange )
-					{
-						return true;
-					}
-				}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Do the traces for one step of SampleStep(), from 'node' in direction 'dir'.
+ * Returns false if no node can be added there. Only reads the mesh, so it can run on the
+ * job threads while sampling. (SampleStep() is still the only thing that adds nodes.)
+ */
+bool CNavMesh::ComputeSampleProbe( const CNavNode *node, NavDirType dir, SampleProbe *probe )
+{
+	probe->m_isValid = false;
+
+	// start at node position
+	Vector pos = *node->GetPosition();
+
+	// snap to grid
+	int cx = SnapToGrid( pos.x );
+	int cy = SnapToGrid( pos.y );
+
+	// attempt to move to adjacent node
+	switch( dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	pos.x = cx;
+	pos.y = cy;
+
+	// sanity check to not generate across the world for incremental generation
+	const float incrementalRange = nav_generate_incremental_range.GetFloat();
+	if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+	{
+		bool inRange = false;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
+			{
+				inRange = true;
+				break;
+			}
+		}
+
+		if ( !inRange )
+		{
+			return false;
+		}
+	}
+
+	if ( m_generationMode == GENERATE_SIMPLIFY )
+	{
+		if ( !m_simplifyGenerationExtent.Contains( pos ) )
+		{
+			return false;
+		}
+	}
 
-				if ( m_generationMode == GENERATE_SIMPLIFY )
+	// test if we can move to new position
+	trace_t result;
+	Vector from( *node->GetPosition() );
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to = vec3_origin, toNormal = vec3_origin;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
 				{
-					if ( !m_simplifyGenerationExtent.Contains( pos ) )
-					{
-						return true;
-					}
+					break;
 				}
 
-				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to = vec3_origin, toNormal = vec3_origin;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
+
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
 				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
+					break;
 				}
-				else
+
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
 				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
+					{
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
 						{
-							if ( !StayOnFloor( &tr ) )
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
 							{
-								break;
+								obstacleEndDist = GenerationStepSize;
 							}
+						}								
+					}
+				}
+			}
+		}
 
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
+		if ( !success )
+		{
+			return false;
+		}
+	}
 
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return false;
+	}
 
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+	{
+		return false;
+	}
 
-					if ( !success )
-					{
-						return true;
-					}
-				}
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
 
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
-				{
-					return true;
-				}
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
 
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+		if ( !bValid )
+			return false;
+	}
+
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
 				{
-					return true;
+					return false;
 				}
+			}
+		}
+	}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
+	float deltaZ = to.z - node->GetPosition()->z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
 
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
+	probe->m_to = to;
+	probe->m_toNormal = toNormal;
+	probe->m_isOnDisplacement = isOnDisplacement;
+	probe->m_obstacleHeight = obstacleHeight;
+	probe->m_obstacleStartDist = obstacleStartDist;
+	probe->m_obstacleEndDist = obstacleEndDist;
+	probe->m_isValid = true;
 
-					if ( !bValid )
-						return true;
-				}
+	return true;
+}
 
 
-				bool isOnDisplacement = result.IsDispSurface();
+//--------------------------------------------------------------------------------------------------------------
+static void PreSampleProbes( void )
+{
+	mdlcache->BeginLock();
+}
 
-				if ( nav_displacement_test.GetInt() > 0 )
-				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
-					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
-						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
-							{
-								return true;
-							}
-						}
-					}
-				}
+static void PostSampleProbes( void )
+{
+	mdlcache->EndLock();
+}
 
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
-				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
-				}
 
-				// we can move here
-				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::ComputeSampleProbeJob( SampleProbeJob &job )
+{
+	TheNavMesh->ComputeSampleProbe( job.m_node, job.m_dir, &job.m_probe );
+}
 
-				return true;
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the result of an earlier ComputeSampleProbe() for this step if there is one.
+ * When threaded, a miss runs a batch of probes on the job threads first: all the
+ * unvisited directions of the given node and of the most recently added nodes, which
+ * is where the depth-first sampling will go next. The probes are pure functions of
+ * node position and direction, so the generated mesh is the same as a serial run no
+ * matter which probes were computed ahead of time. At most maxCached probes are kept
+ * waiting, so a large map can't grow the cache without bound.
+ */
+bool CNavMesh::FindSampleProbe( const CNavNode *node, NavDirType dir, SampleProbe *probe )
+{
+	if ( !nav_generate_threaded.GetBool() )
+		return false;
+
+	unsigned int key = node->GetID() * NUM_DIRECTIONS + dir;
+
+	int it = m_sampleProbes.Find( key );
+	if ( it == m_sampleProbes.InvalidIndex() )
+	{
+		VPROF( "CNavMesh::FindSampleProbe( batch )" );
+
+		const int maxBatch = 64;
+		const int maxNodesScanned = 1024;
+		const int maxCached = 4096;
+
+		CUtlVector< SampleProbeJob > batch;
+		batch.EnsureCapacity( maxBatch );
+
+		SampleProbeJob job;
+		job.m_node = const_cast< CNavNode * >( node );
+		job.m_dir = dir;
+		batch.AddToTail( job );
+
+		int batchLimit = clamp( maxCached - m_sampleProbes.Count(), 1, maxBatch );
+
+		int scanned = 0;
+		for( CNavNode *other = CNavNode::GetFirst(); other && batch.Count() < batchLimit && scanned < maxNodesScanned; other = other->GetNext(), ++scanned )
+		{
+			for( int d = 0; d < NUM_DIRECTIONS && batch.Count() < batchLimit; ++d )
+			{
+				if ( other->HasVisited( (NavDirType)d ) || ( other == node && d == dir ) )
+					continue;
+
+				if ( m_sampleProbes.Find( other->GetID() * NUM_DIRECTIONS + d ) != m_sampleProbes.InvalidIndex() )
+					continue;
+
+				job.m_node = other;
+				job.m_dir = (NavDirType)d;
+				batch.AddToTail( job );
 			}
 		}
 
-		// all directions have been searched from this node - pop back to its parent and continue
-		m_currentNode = m_currentNode->GetParent();
+		ParallelProcess( "CNavMesh::FindSampleProbe", batch.Base(), batch.Count(), &ComputeSampleProbeJob, &PreSampleProbes, &PostSampleProbes );
+
+		FOR_EACH_VEC( batch, bit )
+		{
+			m_sampleProbes.Insert( batch[ bit ].m_node->GetID() * NUM_DIRECTIONS + batch[ bit ].m_dir, batch[ bit ].m_probe );
+		}
+
+		it = m_sampleProbes.Find( key );
+		Assert( it != m_sampleProbes.InvalidIndex() );
 	}
+
+	*probe = m_sampleProbes[ it ];
+	m_sampleProbes.RemoveAt( it );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Called when a direction is marked visited without being sampled (AddNode() connecting
+ * both ways), so a probe computed ahead of time for it would otherwise never be used.
+ */
+void CNavMesh::DropSampleProbe( const CNavNode *node, NavDirType dir )
+{
+	m_sampleProbes.Remove( node->GetID() * NUM_DIRECTIONS + dir );
 }
 
 
@@ -72,6 +72,13 @@ CNavMesh::CNavMesh( void )
 	m_placeCount = 0;
 	m_placeName = NULL;
 
+	SetDefLessFunc( m_sampleProbes );
+
+	m_visibilityRecordOffset = 0;
+	m_visibilityEntryOffset = 0;
+	m_visibilityRecordCount = 0;
+	m_visibilityEntryCount = 0;
+
 	LoadPlaceDatabase();
 
 	ListenForGameEvent( "round_start" );
@@ -188,6 +195,11 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 
 		CNavArea::m_isReset = false;
 
+		// no area is left to decode its visibility from the file image
+		m_visibilityImage.Purge();
+		m_visibilityRecordCount = 0;
+		m_visibilityEntryCount = 0;
+
 
 		// destroy ladder representations
 		DestroyLadders();
@@ -230,6 +242,9 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 		// Reset the next area and ladder IDs to 1
 		CNavArea::CompressIDs();
 		CNavLadder::CompressIDs();
+
+		// the search arrays are indexed by the old area IDs
+		CNavAreaSearch::ReleaseThreadSearch();
 	}
 
 	SetEditMode( NORMAL );
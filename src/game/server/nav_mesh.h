@@ -20,6 +20,7 @@
 #define _NAV_MESH_H_
 
 #include "utlbuffer.h"
+#include "utlmap.h"
 #include "filesystem.h"
 #include "GameEventListener.h"
 
@@ -1116,6 +1117,27 @@ private:
 	void DestroyNavigationMesh( bool incremental = false );		// free all resources of the mesh and reset it to empty state
 	void DestroyHidingSpots( void );
 
+	//----------------------------------------------------------------------------------
+	// Visibility section (version 17+). The file image is kept after loading and each
+	// area decodes its visibility list from it the first time the list is needed.
+	//
+	struct VisibilityRecord										// one per area, in the same order as the area records
+	{
+		unsigned int firstEntry;								// index of the first entry of this area in the entry table
+		unsigned int entryCount;
+		unsigned int inheritFrom;								// 1 + record index of the area we inherit visibility from, 0 if none
+	};
+
+	void SaveVisibility( CUtlBuffer &fileBuffer ) const;		// store every area's visibility list as fixed-size records and packed entries
+	NavErrorType LoadVisibility( CUtlBuffer &fileBuffer );		// validate the section and point each area at its record
+	int GetVisibilityEntries( int record, const unsigned int **entries ) const;	// return the entries of the given record, each is ( record index << 8 ) | VisibilityType
+
+	CUtlBuffer m_visibilityImage;								// copy of the visibility section of the loaded nav file, the records are decoded from it
+	int m_visibilityRecordOffset;								// byte offset of the record table within the image
+	int m_visibilityEntryOffset;								// byte offset of the entry table within the image
+	unsigned int m_visibilityRecordCount;
+	unsigned int m_visibilityEntryCount;
+
 	void ComputeBattlefrontAreas( void );						// determine areas where rushing teams will first meet
 
 	//----------------------------------------------------------------------------------
@@ -1189,6 +1211,30 @@ private:
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+
+	struct SampleProbe											// result of the traces for one sampling step
+	{
+		bool m_isValid;											// false if no node can be added
+		Vector m_to;
+		Vector m_toNormal;
+		bool m_isOnDisplacement;
+		float m_obstacleHeight;
+		float m_obstacleStartDist;
+		float m_obstacleEndDist;
+	};
+
+	struct SampleProbeJob
+	{
+		CNavNode *m_node;
+		NavDirType m_dir;
+		SampleProbe m_probe;
+	};
+
+	bool ComputeSampleProbe( const CNavNode *node, NavDirType dir, SampleProbe *probe );	// do the traces for one sampling step, thread safe
+	bool FindSampleProbe( const CNavNode *node, NavDirType dir, SampleProbe *probe );	// get a probe computed ahead of time on the job threads
+	void DropSampleProbe( const CNavNode *node, NavDirType dir );	// forget a probe for a direction that won't be sampled after all
+	static void ComputeSampleProbeJob( SampleProbeJob &job );
+	CUtlMap< unsigned int, SampleProbe, int > m_sampleProbes;	// probes computed ahead of time, keyed by node ID and direction
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
 	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
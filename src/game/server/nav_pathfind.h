@@ -95,6 +95,9 @@ public:
  * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
  * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
  * Returns true if a path exists.
+ * May be called from any thread. The parent pointers and costs are per thread (see CNavAreaSearch),
+ * so the path must be read back on the thread that built it, and a thread other than the main thread
+ * must call CNavAreaSearch::ReleaseThreadSearch() when it is done with its paths.
  */
 #define IGNORE_NAV_BLOCKERS true
 template< typename CostFunctor >
@@ -111,7 +114,10 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	// this thread's open and closed lists, costs, and parents, so searches can run on any thread
+	CNavAreaSearch *search = CNavAreaSearch::GetThreadSearch();
+
+	search->SetParent( startArea, NULL );
 
 	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
 		goalArea = NULL;
@@ -129,28 +135,28 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
 	// start search
-	CNavArea::ClearSearchLists();
+	search->Begin();
 
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	search->SetTotalCost( startArea, (startArea->GetCenter() - actualGoalPos).Length() );
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
+	search->SetCostSoFar( startArea, initCost );
+	search->SetPathLengthSoFar( startArea, 0.0 );
 
-	startArea->AddToOpenList();
+	search->AddToOpenList( startArea, search->GetTotalCost( startArea ) );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = search->GetTotalCost( startArea );
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search->IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = search->PopOpenList();
 
 
 		// don't consider blocked areas
@@ -323,7 +329,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == search->GetParent( area ) )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
@@ -346,13 +352,13 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			Assert( newCostSoFar >= search->GetCostSoFar( area ) );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001f + 0.00001f;
+			float minNewCostSoFar = search->GetCostSoFar( area ) * 1.00001f + 0.00001f;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
 				
 			// stop if path length limit reached
@@ -360,14 +366,17 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				float newLengthSoFar = search->GetPathLengthSoFar( area ) + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
 				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
+				search->SetPathLengthSoFar( newArea, newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			bool isOpen = search->IsOpen( newArea );
+			bool isClosed = !isOpen && search->IsClosed( newArea );
+
+			if ( ( isOpen || isClosed ) && search->GetCostSoFar( newArea ) <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -385,30 +394,30 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+				search->SetCostSoFar( newArea, newCostSoFar );
+				search->SetTotalCost( newArea, newCostSoFar + newCostRemaining );
 
-				if ( newArea->IsClosed() )
+				if ( isClosed )
 				{
-					newArea->RemoveFromClosedList();
+					search->RemoveFromClosedList( newArea );
 				}
 
-				if ( newArea->IsOpen() )
+				if ( isOpen )
 				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					// area already on open list, update the heap to keep costs sorted
+					search->UpdateOnOpenList( newArea, search->GetTotalCost( newArea ) );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					search->AddToOpenList( newArea, search->GetTotalCost( newArea ) );
 				}
 
-				newArea->SetParent( area, how );
+				search->SetParent( newArea, area, how );
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		search->AddToClosedList( area );
 	}
 
 	return false;
@@ -10,9 +10,12 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
+#ifdef PORTAL
+#include "prop_portal.h"
+#include "prop_portal_shared.h"
+#endif
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -37,6 +40,57 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+#ifdef PORTAL
+ConVar sv_unlag_portals( "sv_unlag_portals", "1", FCVAR_DEVELOPMENTONLY, "Rewind portal placement along with players so shots through portals are resolved against what the shooter saw" );
+#endif
+
+// sv_maxunlag is capped at 1 second, so this covers a full second of history at up to 128 ticks per second
+#define MAX_LAG_RECORDS			128
+
+// portals only get a new record when they're placed, moved or relinked
+#define MAX_PORTAL_LAG_RECORDS	16
+
+//-----------------------------------------------------------------------------
+// Purpose: Fixed size history, newest record at age 0. Once full, adding a
+//			record reuses the oldest slot.
+//-----------------------------------------------------------------------------
+template< class T, int MAX_RECORDS >
+class CLagRecordRing
+{
+public:
+	CLagRecordRing() : m_iHead( MAX_RECORDS - 1 ), m_iCount( 0 )
+	{
+		COMPILE_TIME_ASSERT( (MAX_RECORDS & (MAX_RECORDS - 1)) == 0 );
+	}
+
+	int Count() const { return m_iCount; }
+	bool IsFull() const { return m_iCount == MAX_RECORDS; }
+
+	T &Element( int iAge )
+	{
+		Assert( (iAge >= 0) && (iAge < m_iCount) );
+		return m_Records[(m_iHead - iAge) & (MAX_RECORDS - 1)];
+	}
+	T &Head() { return Element( 0 ); }
+	T &Tail() { return Element( m_iCount - 1 ); }
+
+	T &AddToHead()
+	{
+		m_iHead = (m_iHead + 1) & (MAX_RECORDS - 1);
+		if ( m_iCount < MAX_RECORDS )
+			++m_iCount;
+		return m_Records[m_iHead];
+	}
+
+	void RemoveTail() { Assert( m_iCount > 0 ); --m_iCount; }
+	void RemoveAll() { m_iCount = 0; }
+
+private:
+	T	m_Records[MAX_RECORDS];
+	int	m_iHead;
+	int	m_iCount;
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -126,6 +180,28 @@ public:
 	float					m_flPoseParameters[MAXSTUDIOPOSEPARAM];
 };
 
+typedef CLagRecordRing< LagRecord, MAX_LAG_RECORDS > LagRecordTrack;
+
+#ifdef PORTAL
+struct PortalLagRecord
+{
+	float									m_flTime;
+	CProp_Portal::LagCompensationState_t	m_State;
+};
+
+struct PortalLagTrack
+{
+	CHandle<CProp_Portal>	m_hPortal;
+	CLagRecordRing< PortalLagRecord, MAX_PORTAL_LAG_RECORDS > m_Records;
+	bool					m_bLostHistory;	// we've dropped records, so what the portal looked like before the oldest one is unknown
+
+	// Scratchpad for restoring after lag compensation
+	bool					m_bRestore;
+	CProp_Portal::LagCompensationState_t	m_RestoreState;	// portal before we moved it back
+	CProp_Portal::LagCompensationState_t	m_ChangeState;	// portal where we moved it back
+};
+#endif
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -185,6 +261,9 @@ public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
 	{
 		m_isCurrentlyDoingCompensation = false;
+#ifdef PORTAL
+		m_bNeedToRestorePortals = false;
+#endif
 	}
 
 	// IServerSystem stuff
@@ -212,14 +291,30 @@ public:
 private:
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
 
+#ifdef PORTAL
+	void			RecordPortalHistory( float flDeadtime );
+	void			BacktrackPortals( float flTargetTime );
+	void			RestorePortals();
+#endif
+
 	void ClearHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+			m_PlayerTrack[i].RemoveAll();
+
+#ifdef PORTAL
+		m_PortalTracks.PurgeAndDeleteElements();
+#endif
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	LagRecordTrack			m_PlayerTrack[ MAX_PLAYERS ];
+
+#ifdef PORTAL
+	// and for each portal
+	CUtlVector< PortalLagTrack * >	m_PortalTracks;
+	bool					m_bNeedToRestorePortals;
+#endif
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -257,52 +352,46 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	// remove all records before that time:
 	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
+#ifdef PORTAL
+	RecordPortalHistory( flDeadtime );
+#endif
+
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		LagRecordTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
-			if ( track->Count() > 0 )
-			{
-				track->RemoveAll();
-			}
-
+			track->RemoveAll();
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->Tail().m_flSimulationTime >= flDeadtime )
 				break;
 			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
+			LagRecord &head = track->Head();
 
 			// check if player changed simulation time since last time updated
 			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
-		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		// add new record to player track, once the ring is full this overwrites the oldest record
+		LagRecord &record = track->AddToHead();
+		record = LagRecord();
 
 		record.m_fFlags = 0;
 		if ( pPlayer->IsAlive() )
@@ -435,6 +524,11 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		// Move other player back in time
 		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
 	}
+
+#ifdef PORTAL
+	// Move portals back too, otherwise shots through them are resolved against a placement the shooter hasn't seen yet
+	BacktrackPortals( TICKS_TO_TIME( targettick ) );
+#endif
 }
 
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
@@ -448,27 +542,25 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	LagRecordTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-	intp curr = track->Head();
-
 	LagRecord *prevRecord = NULL;
 	LagRecord *record = NULL;
 
 	Vector prevOrg = pPlayer->GetLocalOrigin();
 	
 	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	for ( int iAge = 0; iAge < track->Count(); ++iAge )
 	{
 		// remember last record
 		prevRecord = record;
 
 		// get next record
-		record = &track->Element( curr );
+		record = &track->Element( iAge );
 
 		if ( !(record->m_fFlags & LC_ALIVE) )
 		{
@@ -488,9 +580,6 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			break; // hurra, stop
 
 		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
 	}
 
 	Assert( record );
@@ -771,6 +860,13 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 
 	m_pCurrentPlayer = NULL;
 
+#ifdef PORTAL
+	if ( m_bNeedToRestorePortals )
+	{
+		RestorePortals();
+	}
+#endif
+
 	if ( !m_bNeedToRestore )
 	{
 		m_isCurrentlyDoingCompensation = false;
@@ -873,3 +969,156 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 }
 
 
+#ifdef PORTAL
+//-----------------------------------------------------------------------------
+// Purpose: Portal placement only changes when a portal is shot, moved or relinked, so
+//			rather than a record per tick each portal gets one whenever it differs from
+//			its newest record.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RecordPortalHistory( float flDeadtime )
+{
+	VPROF_BUDGET( "RecordPortalHistory", "CLagCompensationManager" );
+
+	// forget portals that have been removed
+	for ( int i = m_PortalTracks.Count(); --i >= 0; )
+	{
+		if ( m_PortalTracks[i]->m_hPortal.Get() == NULL )
+		{
+			delete m_PortalTracks[i];
+			m_PortalTracks.FastRemove( i );
+		}
+	}
+
+	if ( !sv_unlag_portals.GetBool() )
+	{
+		m_PortalTracks.PurgeAndDeleteElements();
+		return;
+	}
+
+	for ( int i = 0; i < CProp_Portal_Shared::AllPortals.Count(); ++i )
+	{
+		CProp_Portal *pPortal = CProp_Portal_Shared::AllPortals[i];
+
+		PortalLagTrack *pTrack = NULL;
+		for ( int j = 0; j < m_PortalTracks.Count(); ++j )
+		{
+			if ( m_PortalTracks[j]->m_hPortal.Get() == pPortal )
+			{
+				pTrack = m_PortalTracks[j];
+				break;
+			}
+		}
+
+		if ( !pTrack )
+		{
+			pTrack = new PortalLagTrack;
+			pTrack->m_hPortal = pPortal;
+			pTrack->m_bLostHistory = false;
+			pTrack->m_bRestore = false;
+			m_PortalTracks.AddToTail( pTrack );
+		}
+
+		CProp_Portal::LagCompensationState_t state;
+		pPortal->GetLagCompensationState( state );
+
+		if ( (pTrack->m_Records.Count() == 0) || (pTrack->m_Records.Head().m_State != state) )
+		{
+			if ( pTrack->m_Records.IsFull() )
+				pTrack->m_bLostHistory = true;
+
+			PortalLagRecord &record = pTrack->m_Records.AddToHead();
+			record.m_flTime = gpGlobals->curtime;
+			record.m_State = state;
+		}
+
+		// the oldest record is only needed while nothing newer covers the dead time
+		while ( (pTrack->m_Records.Count() > 1) && (pTrack->m_Records.Element( pTrack->m_Records.Count() - 2 ).m_flTime <= flDeadtime) )
+		{
+			pTrack->m_Records.RemoveTail();
+			pTrack->m_bLostHistory = true;
+		}
+	}
+}
+
+void CLagCompensationManager::BacktrackPortals( float flTargetTime )
+{
+	VPROF_BUDGET( "BacktrackPortals", "CLagCompensationManager" );
+
+	for ( int i = 0; i < m_PortalTracks.Count(); ++i )
+	{
+		PortalLagTrack *pTrack = m_PortalTracks[i];
+		CProp_Portal *pPortal = pTrack->m_hPortal.Get();
+		if ( !pPortal || (pTrack->m_Records.Count() == 0) )
+			continue;
+
+		// newest record that was already in place at the target time
+		int iAge;
+		for ( iAge = 0; iAge < pTrack->m_Records.Count(); ++iAge )
+		{
+			if ( pTrack->m_Records.Element( iAge ).m_flTime <= flTargetTime )
+				break;
+		}
+
+		CProp_Portal::LagCompensationState_t wantedState;
+		if ( iAge < pTrack->m_Records.Count() )
+		{
+			wantedState = pTrack->m_Records.Element( iAge ).m_State;
+		}
+		else
+		{
+			// target time is older than anything we have. If we've never dropped a record the track
+			// just started (new portal, sv_unlag_portals turned on, history cleared) and we know nothing
+			// about back then, so leave the portal where it is. Otherwise the oldest record is the best guess
+			if ( !pTrack->m_bLostHistory )
+				continue;
+
+			wantedState = pTrack->m_Records.Tail().m_State;
+		}
+
+		CProp_Portal::LagCompensationState_t currentState;
+		pPortal->GetLagCompensationState( currentState );
+
+		if ( currentState == wantedState )
+			continue;
+
+		if ( sv_unlag_debug.GetBool() )
+		{
+			DevMsg( "BacktrackPortals: moved portal %d back to ( %.1f %.1f %.1f )\n", pPortal->entindex(), 
+				wantedState.ptOrigin.x, wantedState.ptOrigin.y, wantedState.ptOrigin.z );
+		}
+
+		pTrack->m_RestoreState = currentState;
+		pTrack->m_ChangeState = wantedState;
+		pTrack->m_bRestore = true;
+		m_bNeedToRestorePortals = true;
+
+		pPortal->SetLagCompensationState( wantedState );
+	}
+}
+
+void CLagCompensationManager::RestorePortals()
+{
+	for ( int i = 0; i < m_PortalTracks.Count(); ++i )
+	{
+		PortalLagTrack *pTrack = m_PortalTracks[i];
+		if ( !pTrack->m_bRestore )
+			continue;
+
+		pTrack->m_bRestore = false;
+
+		CProp_Portal *pPortal = pTrack->m_hPortal.Get();
+		if ( !pPortal )
+			continue;
+
+		// if the command re-placed the portal, leave the new placement alone
+		CProp_Portal::LagCompensationState_t currentState;
+		pPortal->GetLagCompensationState( currentState );
+		if ( currentState != pTrack->m_ChangeState )
+			continue;
+
+		pPortal->SetLagCompensationState( pTrack->m_RestoreState );
+	}
+
+	m_bNeedToRestorePortals = false;
+}
+#endif // PORTAL
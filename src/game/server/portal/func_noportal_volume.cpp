@@ -13,6 +13,7 @@
 #include "portal_shareddefs.h"
 #include "portal_util_shared.h"
 #include "collisionutils.h"
+#include "portal_placement.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -60,11 +61,13 @@ CFuncNoPortalVolume::CFuncNoPortalVolume()
 
 	// Add me to the global list
 	g_FuncNoPortalVolumeList.Insert( this );
+	InvalidateNoPortalVolumeTree();
 }
 
 CFuncNoPortalVolume::~CFuncNoPortalVolume()
 {
 	g_FuncNoPortalVolumeList.Remove( this );
+	InvalidateNoPortalVolumeTree();
 }
 
 
@@ -87,6 +90,9 @@ void CFuncNoPortalVolume::Spawn()
 	SetSolid( SOLID_VPHYSICS );	// we may want slanted walls, so we'll use OBB
 	AddSolidFlags( FSOLID_NOT_SOLID );
 	AddSolidFlags( FSOLID_TRIGGER ); // This is needed to fix the client sided bumping entities check
+
+	// Our bounds are known now
+	InvalidateNoPortalVolumeTree();
 }
 
 void CFuncNoPortalVolume::OnActivate( void )
@@ -41,6 +41,7 @@
 #include "physicsshadowclone.h"
 #include "weapon_portalgun_shared.h"
 #include "modelentities.h"
+#include "ilagcompensationmanager.h"
 
 extern CBaseEntity* g_pLastSpawn;
 
@@ -1730,9 +1731,15 @@ void CPortal_Player::UpdateWooshSounds(void)
 
 void CPortal_Player::FireBullets(const FireBulletsInfo_t& info)
 {
+	// Move other players and the portals back to history positions based on local player's lag
+	lagcompensation->StartLagCompensation( this, this->GetCurrentCommand() );
+
 	NoteWeaponFired();
 
 	BaseClass::FireBullets(info);
+
+	// Move other players and the portals back to their current positions
+	lagcompensation->FinishLagCompensation( this );
 }
 
 void CPortal_Player::NoteWeaponFired(void)
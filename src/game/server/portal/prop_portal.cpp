@@ -183,11 +183,13 @@ CProp_Portal::CProp_Portal( void )
 	m_pCollisionShape = physcollision->ConvertConvexToCollide( &pConvex, 1 );
 
 	CProp_Portal_Shared::AllPortals.AddToTail( this );
+	UTIL_Portal_InvalidateQueryTable();
 }
 
 CProp_Portal::~CProp_Portal( void )
 {
 	CProp_Portal_Shared::AllPortals.FindAndRemove( this );
+	UTIL_Portal_InvalidateQueryTable();
 	s_PortalLinkageGroups[m_iLinkageGroupID].FindAndRemove( this );
 }
 
@@ -395,6 +397,7 @@ void CProp_Portal::OnRestore()
 	m_qAbsAngle = GetAbsAngles();
 
 	UpdateCorners();
+	UTIL_Portal_InvalidateQueryTable();
 
 	Assert( m_hAttachedCloningArea == NULL );
 	m_hAttachedCloningArea = CPhysicsCloneArea::CreatePhysicsCloneArea( this );
@@ -896,6 +899,7 @@ void CProp_Portal::Activate( void )
 {
 	m_ptOrigin = GetAbsOrigin();
 	m_qAbsAngle = GetAbsAngles();
+	UTIL_Portal_InvalidateQueryTable();
 
 	UpdateCollisionShape();
 
@@ -1479,6 +1483,7 @@ void CProp_Portal::UpdatePortalTeleportMatrix( void )
 	//setup our origin plane
 	GetVectors( &m_plane_Origin.AsVector3D(), NULL, NULL );
 	m_plane_Origin.w = m_plane_Origin.AsVector3D().Dot( m_ptOrigin );
+	UTIL_Portal_InvalidateQueryTable();
 	
 	if ( m_hLinkedPortal != NULL )
 	{
@@ -1494,6 +1499,44 @@ void CProp_Portal::UpdatePortalTeleportMatrix( void )
 	}
 }
 
+void CProp_Portal::GetLagCompensationState( LagCompensationState_t &state ) const
+{
+	state.ptOrigin = m_ptOrigin;
+	state.qAngles = m_qAbsAngle;
+	state.matThisToLinked = m_matrixThisToLinked;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Puts the portal somewhere it was in the recent past for the span of a lag compensated
+//			user command. Only the data used by portal ray tests is touched. The entity itself
+//			isn't moved, so it stays linked where it is and in sync with m_PortalSimulator,
+//			whose collision lag compensated traces never look at.
+//-----------------------------------------------------------------------------
+void CProp_Portal::SetLagCompensationState( const LagCompensationState_t &state )
+{
+	m_ptOrigin = state.ptOrigin;
+	m_qAbsAngle = state.qAngles;
+
+	AngleVectors( state.qAngles, &m_vForward, &m_vRight, &m_vUp );
+	m_plane_Origin.AsVector3D() = m_vForward;
+	m_plane_Origin.w = m_vForward.Dot( state.ptOrigin );
+
+	//UpdateCorners() would read the entity's angles, build them from the swapped basis instead
+	for ( int i = 0; i < 4; ++i )
+	{
+		Vector vAddPoint = state.ptOrigin;
+
+		vAddPoint += m_vRight * ((i & (1<<0))?(PORTAL_HALF_WIDTH):(-PORTAL_HALF_WIDTH));
+		vAddPoint += m_vUp * ((i & (1<<1))?(PORTAL_HALF_HEIGHT):(-PORTAL_HALF_HEIGHT));
+
+		m_vPortalCorners[i] = vAddPoint;
+	}
+
+	m_matrixThisToLinked = state.matThisToLinked;
+
+	UTIL_Portal_InvalidateQueryTable();
+}
+
 void CProp_Portal::CreatePortalMicAndSpeakers( void )
 {
 	// Don't use microphones in Rexaura! Many of the button sounds, timers, etc... are louder so both players can hear them, but they're way too loud for Rexaura
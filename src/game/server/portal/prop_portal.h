@@ -153,6 +153,22 @@ public:
 	void					UpdatePortalLinkage( void );
 	void					UpdatePortalTeleportMatrix( void ); //computes the transformation from this portal to the linked portal, and will update the remote matrix as well
 
+	//Everything bullet traces look at when going through a portal. Lag compensation rewinds portals by swapping these around without re-running placement
+	struct LagCompensationState_t
+	{
+		Vector	ptOrigin;
+		QAngle	qAngles;
+		VMatrix	matThisToLinked;
+
+		bool operator==( const LagCompensationState_t &src ) const
+		{
+			return (ptOrigin == src.ptOrigin) && (qAngles == src.qAngles) && (matThisToLinked == src.matThisToLinked);
+		}
+		bool operator!=( const LagCompensationState_t &src ) const { return !(*this == src); }
+	};
+	void					GetLagCompensationState( LagCompensationState_t &state ) const;
+	void					SetLagCompensationState( const LagCompensationState_t &state );
+
 	//void					SendInteractionMessage( CBaseEntity *pEntity, bool bEntering ); //informs clients that the entity is interacting with a portal (mostly used for clip planes)
 
 	bool					SharedEnvironmentCheck( CBaseEntity *pEntity ); //does all testing to verify that the object is better handled with this portal instead of the other
@@ -37,6 +37,8 @@
 #include "util.h"
 #include "cdll_int.h"
 #include "vscript_server.h"
+#include "vstdlib/jobthread.h"
+#include "kvimage.h"
 
 #ifdef PORTAL
 #include "PortalSimulation.h"
@@ -124,6 +126,299 @@ CON_COMMAND( dump_entity_sizes, "Print sizeof(entclass)" )
 }
 
 
+//-----------------------------------------------------------------------------
+// Symbol table microbenchmark, tree lookups against hashed ones
+//-----------------------------------------------------------------------------
+struct SymbolBenchJob_t
+{
+	int		iFirst;
+	int		nLookups;
+	int		nFound;
+};
+
+static CUtlVector< CUtlString > s_SymbolBenchStrings;
+static CUtlSymbolTableMT *s_pSymbolBenchTree;
+static CUtlSymbolTableHashed *s_pSymbolBenchHashed;
+
+template < class TABLE >
+static int SymbolBenchLookups( const TABLE *pTable, int iFirst, int nLookups )
+{
+	int nFound = 0;
+	int nStrings = s_SymbolBenchStrings.Count();
+	for ( int i = 0; i < nLookups; i++ )
+	{
+		// stride through the strings so consecutive lookups don't share cache lines
+		const char *pszString = s_SymbolBenchStrings[ ( iFirst + i * 7919 ) % nStrings ].Get();
+		if ( pTable->Find( pszString ).IsValid() )
+		{
+			nFound++;
+		}
+	}
+	return nFound;
+}
+
+static void SymbolBenchTreeJob( SymbolBenchJob_t &job )
+{
+	job.nFound = SymbolBenchLookups( s_pSymbolBenchTree, job.iFirst, job.nLookups );
+}
+
+static void SymbolBenchHashedJob( SymbolBenchJob_t &job )
+{
+	job.nFound = SymbolBenchLookups( s_pSymbolBenchHashed, job.iFirst, job.nLookups );
+}
+
+CON_COMMAND( utlsymbol_bench, "Times symbol lookups in the tree and hashed symbol tables, on this thread and on the job threads.\n\tArguments:	[strings] [lookups]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nStrings = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 60000 ) : 10000;
+	int nLookups = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 1000000;
+
+	// Start from real names, then pad out with made up paths
+	CEntityFactoryDictionary *pDict = (CEntityFactoryDictionary *)EntityFactoryDictionary();
+	for ( int i = pDict->m_Factories.First(); i != pDict->m_Factories.InvalidIndex() && s_SymbolBenchStrings.Count() < nStrings; i = pDict->m_Factories.Next( i ) )
+	{
+		s_SymbolBenchStrings.AddToTail( pDict->m_Factories.GetElementName( i ) );
+	}
+	while ( s_SymbolBenchStrings.Count() < nStrings )
+	{
+		s_SymbolBenchStrings.AddToTail( CFmtStr( "models/props_bench/prop_%d.mdl", s_SymbolBenchStrings.Count() ).Access() );
+	}
+
+	CUtlSymbolTableMT tree( 0, 32, true );
+	CUtlSymbolTableHashed hashed( 0, 32, true );
+	s_pSymbolBenchTree = &tree;
+	s_pSymbolBenchHashed = &hashed;
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nStrings; i++ )
+	{
+		tree.AddString( s_SymbolBenchStrings[i].Get() );
+	}
+	double flTreeAdd = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nStrings; i++ )
+	{
+		hashed.AddString( s_SymbolBenchStrings[i].Get() );
+	}
+	double flHashedAdd = Plat_FloatTime() - flStart;
+
+	// Both tables hand out symbols in the same order
+	int nMismatched = 0;
+	for ( int i = 0; i < nStrings; i++ )
+	{
+		if ( (UtlSymId_t)tree.Find( s_SymbolBenchStrings[i].Get() ) != (UtlSymId_t)hashed.Find( s_SymbolBenchStrings[i].Get() ) )
+		{
+			nMismatched++;
+		}
+	}
+
+	flStart = Plat_FloatTime();
+	SymbolBenchLookups( &tree, 0, nLookups );
+	double flTreeFind = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	SymbolBenchLookups( &hashed, 0, nLookups );
+	double flHashedFind = Plat_FloatTime() - flStart;
+
+	// Same number of lookups again, split across the job threads
+	CUtlVector< SymbolBenchJob_t > jobs;
+	int nJobs = 64;
+	for ( int i = 0; i < nJobs; i++ )
+	{
+		SymbolBenchJob_t &job = jobs[ jobs.AddToTail() ];
+		job.iFirst = i;
+		job.nLookups = nLookups / nJobs;
+		job.nFound = 0;
+	}
+
+	flStart = Plat_FloatTime();
+	ParallelProcess( "utlsymbol_bench tree", jobs.Base(), jobs.Count(), &SymbolBenchTreeJob );
+	double flTreeParallel = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	ParallelProcess( "utlsymbol_bench hashed", jobs.Base(), jobs.Count(), &SymbolBenchHashedJob );
+	double flHashedParallel = Plat_FloatTime() - flStart;
+
+	s_pSymbolBenchTree = NULL;
+	s_pSymbolBenchHashed = NULL;
+	s_SymbolBenchStrings.Purge();
+
+	int nParallel = ( nLookups / nJobs ) * nJobs;
+	Msg( "utlsymbol_bench: %d strings, %d lookups\n", nStrings, nLookups );
+	Msg( "    add:              tree %.3f ms, hashed %.3f ms\n", flTreeAdd * 1000.0, flHashedAdd * 1000.0 );
+	Msg( "    find:             tree %.1f ns, hashed %.1f ns per lookup\n", flTreeFind * 1e9 / nLookups, flHashedFind * 1e9 / nLookups );
+	Msg( "    find (threaded):  tree %.1f ns, hashed %.1f ns per lookup\n", flTreeParallel * 1e9 / nParallel, flHashedParallel * 1e9 / nParallel );
+
+	if ( nMismatched )
+	{
+		Warning( "utlsymbol_bench: %d strings got different symbols from the two tables!\n", nMismatched );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Compiled KeyValues images, filling the cache ahead of time and timing it
+//-----------------------------------------------------------------------------
+struct KVPrecompileCounts_t
+{
+	int		nCompiled;
+	int		nCurrent;
+	int		nSkipped;
+};
+
+static void KVPrecompileDirectory( const char *pszDir, const char *pszWildcard, const char *pszPathID, KVPrecompileCounts_t &counts )
+{
+	char szSearch[MAX_PATH];
+	char szFile[MAX_PATH];
+	FileFindHandle_t hFind;
+
+	Q_snprintf( szSearch, sizeof( szSearch ), "%s/%s", pszDir, pszWildcard );
+	for ( const char *pszFile = filesystem->FindFirstEx( szSearch, pszPathID, &hFind ); pszFile; pszFile = filesystem->FindNext( hFind ) )
+	{
+		if ( filesystem->FindIsDirectory( hFind ) )
+			continue;
+
+		Q_snprintf( szFile, sizeof( szFile ), "%s/%s", pszDir, pszFile );
+
+		bool bCompiled;
+		if ( !CKeyValuesImage::UpdateCache( filesystem, szFile, pszPathID, &bCompiled ) )
+		{
+			DevMsg( "kv_precompile: skipped %s\n", szFile );
+			counts.nSkipped++;
+		}
+		else if ( bCompiled )
+		{
+			counts.nCompiled++;
+		}
+		else
+		{
+			counts.nCurrent++;
+		}
+	}
+	filesystem->FindClose( hFind );
+
+	CUtlVector< CUtlString > subDirs;
+	Q_snprintf( szSearch, sizeof( szSearch ), "%s/*", pszDir );
+	for ( const char *pszFile = filesystem->FindFirstEx( szSearch, pszPathID, &hFind ); pszFile; pszFile = filesystem->FindNext( hFind ) )
+	{
+		if ( filesystem->FindIsDirectory( hFind ) && pszFile[0] != '.' )
+		{
+			subDirs.AddToTail( CFmtStr( "%s/%s", pszDir, pszFile ).Access() );
+		}
+	}
+	filesystem->FindClose( hFind );
+
+	for ( int i = 0; i < subDirs.Count(); i++ )
+	{
+		KVPrecompileDirectory( subDirs[i].Get(), pszWildcard, pszPathID, counts );
+	}
+}
+
+CON_COMMAND( kv_precompile, "Compiles the KeyValues files in a directory and its subdirectories into the KeyValues image cache.\n\tArguments:	<directory> [wildcard] [path ID]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: kv_precompile <directory> [wildcard] [path ID]\n" );
+		return;
+	}
+
+	const char *pszWildcard = ( args.ArgC() > 2 ) ? args[2] : "*.txt";
+	const char *pszPathID = ( args.ArgC() > 3 ) ? args[3] : "GAME";
+
+	KVPrecompileCounts_t counts = { 0, 0, 0 };
+	double flStart = Plat_FloatTime();
+	KVPrecompileDirectory( args[1], pszWildcard, pszPathID, counts );
+
+	Msg( "kv_precompile: %d compiled, %d already cached, %d skipped in %.1f ms\n", counts.nCompiled, counts.nCurrent, counts.nSkipped, ( Plat_FloatTime() - flStart ) * 1000.0 );
+}
+
+// Counts the keys where the image doesn't read back like the tree
+static int KVImageBenchCompare( KeyValues *pKey, CKeyValuesView view )
+{
+	int nMismatched = 0;
+	for ( ; pKey; pKey = pKey->GetNextKey(), view = view.GetNextKey() )
+	{
+		if ( !view.IsValid() )
+			return nMismatched + 1;
+
+		if ( Q_strcmp( pKey->GetName(), view.GetName() ) || pKey->GetDataType() != view.GetDataType() ||
+			 pKey->GetInt() != view.GetInt() || pKey->GetFloat() != view.GetFloat() )
+		{
+			nMismatched++;
+		}
+
+		nMismatched += KVImageBenchCompare( pKey->GetFirstSubKey(), view.GetFirstSubKey() );
+
+		// GetString() converts the key, so it goes last
+		if ( pKey->GetDataType() != KeyValues::TYPE_NONE && Q_strcmp( pKey->GetString(), view.GetString() ) )
+		{
+			nMismatched++;
+		}
+	}
+
+	return nMismatched + ( view.IsValid() ? 1 : 0 );
+}
+
+CON_COMMAND( kv_image_bench, "Times loading a KeyValues file as text against loading it as a cached image.\n\tArguments:	<file> [passes] [path ID]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: kv_image_bench <file> [passes] [path ID]\n" );
+		return;
+	}
+
+	const char *pszFile = args[1];
+	int nPasses = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 100;
+	const char *pszPathID = ( args.ArgC() > 3 ) ? args[3] : "GAME";
+
+	// Makes sure the cache is filled, so the timed passes measure cache hits
+	CKeyValuesImage image;
+	if ( !image.LoadFromFile( filesystem, pszFile, pszPathID ) )
+	{
+		Warning( "kv_image_bench: couldn't load %s\n", pszFile );
+		return;
+	}
+
+	KeyValues *pKeyValues = new KeyValues( pszFile );
+	pKeyValues->LoadFromFile( filesystem, pszFile, pszPathID );
+	int nMismatched = KVImageBenchCompare( pKeyValues, image.GetRoot() );
+	pKeyValues->deleteThis();
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nPasses; i++ )
+	{
+		KeyValues *pPass = new KeyValues( pszFile );
+		pPass->LoadFromFile( filesystem, pszFile, pszPathID );
+		pPass->deleteThis();
+	}
+	double flText = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nPasses; i++ )
+	{
+		CKeyValuesImage pass;
+		pass.LoadFromFile( filesystem, pszFile, pszPathID );
+	}
+	double flImage = Plat_FloatTime() - flStart;
+
+	Msg( "kv_image_bench: %s, %d keys, %s\n", pszFile, image.GetNodeCount(), image.IsMapped() ? "mapped" : "not mapped" );
+	Msg( "    load:  text %.3f ms, image %.3f ms per pass\n", flText * 1000.0 / nPasses, flImage * 1000.0 / nPasses );
+
+	if ( nMismatched )
+	{
+		Warning( "kv_image_bench: %d keys read back differently from the image!\n", nMismatched );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Constructor
 //-----------------------------------------------------------------------------
@@ -0,0 +1,413 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//=====================================================================================//
+
+#include "cbase.h"
+#include "PortalCollisionCache.h"
+#include "StaticCollisionPolyhedronCache.h"
+#include "vphysics_interface.h"
+#include "physics.h"
+
+#include "tier0/memdbgon.h"
+
+
+ConVar portal_collision_cache( "portal_collision_cache", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Reuse carved polyhedrons and collideables when portals are re-placed on a surface that was carved before." );
+ConVar portal_collision_cache_max_surfaces( "portal_collision_cache_max_surfaces", "32", FCVAR_REPLICATED | FCVAR_CHEAT, "Maximum number of portal surfaces to keep carved collision for." );
+
+CPortalCollisionCache g_PortalCollisionCache;
+
+#define PORTALCOLLISIONCACHE_NORMAL_TOLERANCE	0.9999f
+#define PORTALCOLLISIONCACHE_DIST_TOLERANCE		0.01f
+#define PORTALCOLLISIONCACHE_MAX_BRUSH_SETS		8 //distinct world brush sets per surface before unused collideables get thrown out
+
+typedef const IHandleEntity *ConstHandleEntityPtr;
+typedef const CPolyhedron *ConstPolyhedronPtr;
+typedef CPhysCollide *PhysCollidePtr;
+
+static bool LessFunc_BrushIndex( const int &a, const int &b ) { return a < b; }
+static bool LessFunc_ConstPolyhedronPtr( const ConstPolyhedronPtr &a, const ConstPolyhedronPtr &b ) { return a < b; }
+static bool LessFunc_ConstHandleEntityPtr( const ConstHandleEntityPtr &a, const ConstHandleEntityPtr &b ) { return a < b; }
+static bool LessFunc_PhysCollidePtr( const PhysCollidePtr &a, const PhysCollidePtr &b ) { return a < b; }
+
+struct PortalCollisionCacheCollide_t
+{
+	CUtlVector<int> Brushes;
+	CPhysCollide *pCollide;
+	int iRefCount;
+};
+
+struct PortalCollisionCacheSurface_t
+{
+	VPlane Plane;
+
+	CUtlMap<int, CPolyhedron *> ClippedBrushes[PCCC_COUNT]; //NULL entries mean the brush was entirely clipped away
+	CUtlMap<ConstPolyhedronPtr, CPolyhedron *> ClippedStaticPropPieces;
+
+	CUtlVector<PortalCollisionCacheCollide_t *> WorldBrushCollides;
+	CUtlMap<ConstHandleEntityPtr, PortalCollisionCacheCollide_t *> StaticPropCollides;
+
+	int iOutstandingCollides; //surfaces with collideables in use can't be evicted
+
+	PortalCollisionCacheSurface_t( void )
+		: ClippedStaticPropPieces( LessFunc_ConstPolyhedronPtr ),
+		  StaticPropCollides( LessFunc_ConstHandleEntityPtr ),
+		  iOutstandingCollides( 0 )
+	{
+		for( int i = 0; i != PCCC_COUNT; ++i )
+			ClippedBrushes[i].SetLessFunc( LessFunc_BrushIndex );
+	}
+};
+
+static CPolyhedron *CopyPolyhedron( const CPolyhedron *pSource )
+{
+	if( pSource == NULL )
+		return NULL;
+
+	CPolyhedron *pCopy = CPolyhedron_AllocByNew::Allocate( pSource->iVertexCount, pSource->iLineCount, pSource->iIndexCount, pSource->iPolygonCount );
+	memcpy( pCopy->pVertices, pSource->pVertices, pSource->iVertexCount * sizeof( Vector ) );
+	memcpy( pCopy->pLines, pSource->pLines, pSource->iLineCount * sizeof( Polyhedron_IndexedLine_t ) );
+	memcpy( pCopy->pIndices, pSource->pIndices, pSource->iIndexCount * sizeof( Polyhedron_IndexedLineReference_t ) );
+	memcpy( pCopy->pPolygons, pSource->pPolygons, pSource->iPolygonCount * sizeof( Polyhedron_IndexedPolygon_t ) );
+
+	return pCopy;
+}
+
+
+
+CPortalCollisionCache::CPortalCollisionCache( void )
+: m_CollideOwners( LessFunc_PhysCollidePtr )
+{
+	ResetStats();
+}
+
+CPortalCollisionCache::~CPortalCollisionCache( void )
+{
+	Clear();
+}
+
+void CPortalCollisionCache::LevelShutdownPostEntity( void )
+{
+	//brush indices and static props are only valid for the current map
+	Clear();
+}
+
+void CPortalCollisionCache::Shutdown( void )
+{
+	Clear();
+}
+
+bool CPortalCollisionCache::IsEnabled( void ) const
+{
+	return portal_collision_cache.GetBool();
+}
+
+void CPortalCollisionCache::ResetStats( void )
+{
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+PortalCollisionCacheSurface_t *CPortalCollisionCache::FindOrCreateSurface( const VPlane &PortalPlane )
+{
+	if( !IsEnabled() )
+		return NULL;
+
+	for( int i = m_Surfaces.Count(); --i >= 0; )
+	{
+		PortalCollisionCacheSurface_t *pSurface = m_Surfaces[i];
+		if( (pSurface->Plane.m_Normal.Dot( PortalPlane.m_Normal ) >= PORTALCOLLISIONCACHE_NORMAL_TOLERANCE) &&
+			(fabs( pSurface->Plane.m_Dist - PortalPlane.m_Dist ) <= PORTALCOLLISIONCACHE_DIST_TOLERANCE) )
+		{
+			//move to the most recently used end
+			if( i != m_Surfaces.Count() - 1 )
+			{
+				m_Surfaces.Remove( i );
+				m_Surfaces.AddToTail( pSurface );
+			}
+			return pSurface;
+		}
+	}
+
+	PortalCollisionCacheSurface_t *pSurface = new PortalCollisionCacheSurface_t;
+	pSurface->Plane = PortalPlane;
+	m_Surfaces.AddToTail( pSurface );
+
+	EvictSurfaces();
+
+	return pSurface;
+}
+
+void CPortalCollisionCache::ClipBrushes( PortalCollisionCacheSurface_t *pSurface, PortalCollisionCacheCut_t eCut, const int *pBrushes, int iBrushCount, const float *pClipPlane, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList )
+{
+	Assert( (eCut >= 0) && (eCut < PCCC_COUNT) );
+
+	for( int i = 0; i != iBrushCount; ++i )
+	{
+		CPolyhedron *pClipped;
+
+		if( pSurface )
+		{
+			CUtlMap<int, CPolyhedron *> &ClippedBrushes = pSurface->ClippedBrushes[eCut];
+			unsigned short iIndex = ClippedBrushes.Find( pBrushes[i] );
+			if( ClippedBrushes.IsValidIndex( iIndex ) )
+			{
+				++m_Stats.iPolyhedronHits;
+				pClipped = ClippedBrushes.Element( iIndex );
+			}
+			else
+			{
+				++m_Stats.iPolyhedronMisses;
+				pClipped = ClipPolyhedron( g_StaticCollisionPolyhedronCache.GetBrushPolyhedron( pBrushes[i] ), pClipPlane, 1, fClipEpsilon );
+				ClippedBrushes.Insert( pBrushes[i], pClipped );
+			}
+
+			pClipped = CopyPolyhedron( pClipped );
+		}
+		else
+		{
+			pClipped = ClipPolyhedron( g_StaticCollisionPolyhedronCache.GetBrushPolyhedron( pBrushes[i] ), pClipPlane, 1, fClipEpsilon );
+		}
+
+		if( pClipped )
+			pPolyhedronList->AddToTail( pClipped );
+	}
+}
+
+CPolyhedron *CPortalCollisionCache::ClipStaticPropPiece( PortalCollisionCacheSurface_t *pSurface, const CPolyhedron *pPiece, const float *pClipPlane, float fClipEpsilon )
+{
+	if( pSurface == NULL )
+		return ClipPolyhedron( pPiece, pClipPlane, 1, fClipEpsilon, false );
+
+	CPolyhedron *pClipped;
+	unsigned short iIndex = pSurface->ClippedStaticPropPieces.Find( pPiece );
+	if( pSurface->ClippedStaticPropPieces.IsValidIndex( iIndex ) )
+	{
+		++m_Stats.iPolyhedronHits;
+		pClipped = pSurface->ClippedStaticPropPieces.Element( iIndex );
+	}
+	else
+	{
+		++m_Stats.iPolyhedronMisses;
+		pClipped = ClipPolyhedron( pPiece, pClipPlane, 1, fClipEpsilon, false );
+		pSurface->ClippedStaticPropPieces.Insert( pPiece, pClipped );
+	}
+
+	return CopyPolyhedron( pClipped );
+}
+
+CPhysCollide *CPortalCollisionCache::FindWorldBrushCollide( PortalCollisionCacheSurface_t *pSurface, const int *pBrushes, int iBrushCount )
+{
+	if( pSurface == NULL )
+		return NULL;
+
+	for( int i = pSurface->WorldBrushCollides.Count(); --i >= 0; )
+	{
+		PortalCollisionCacheCollide_t *pEntry = pSurface->WorldBrushCollides[i];
+		if( (pEntry->Brushes.Count() == iBrushCount) && (memcmp( pEntry->Brushes.Base(), pBrushes, sizeof( int ) * iBrushCount ) == 0) )
+		{
+			++m_Stats.iCollideHits;
+			++pEntry->iRefCount;
+			++pSurface->iOutstandingCollides;
+			return pEntry->pCollide;
+		}
+	}
+
+	++m_Stats.iCollideMisses;
+	return NULL;
+}
+
+void CPortalCollisionCache::AddWorldBrushCollide( PortalCollisionCacheSurface_t *pSurface, const int *pBrushes, int iBrushCount, CPhysCollide *pCollide )
+{
+	Assert( pSurface && pCollide );
+
+	for( int i = 0; (i < pSurface->WorldBrushCollides.Count()) && (pSurface->WorldBrushCollides.Count() >= PORTALCOLLISIONCACHE_MAX_BRUSH_SETS); )
+	{
+		PortalCollisionCacheCollide_t *pOldEntry = pSurface->WorldBrushCollides[i];
+		if( pOldEntry->iRefCount != 0 )
+		{
+			++i;
+			continue;
+		}
+
+		m_CollideOwners.Remove( pOldEntry->pCollide );
+		physcollision->DestroyCollide( pOldEntry->pCollide );
+		delete pOldEntry;
+		pSurface->WorldBrushCollides.Remove( i );
+	}
+
+	PortalCollisionCacheCollide_t *pEntry = new PortalCollisionCacheCollide_t;
+	pEntry->Brushes.CopyArray( pBrushes, iBrushCount );
+	pEntry->pCollide = pCollide;
+	pEntry->iRefCount = 1;
+	pSurface->WorldBrushCollides.AddToTail( pEntry );
+	++pSurface->iOutstandingCollides;
+
+	m_CollideOwners.Insert( pCollide, pSurface );
+}
+
+CPhysCollide *CPortalCollisionCache::FindStaticPropCollide( PortalCollisionCacheSurface_t *pSurface, const IHandleEntity *pSourceProp )
+{
+	if( pSurface == NULL )
+		return NULL;
+
+	unsigned short iIndex = pSurface->StaticPropCollides.Find( pSourceProp );
+	if( !pSurface->StaticPropCollides.IsValidIndex( iIndex ) )
+	{
+		++m_Stats.iCollideMisses;
+		return NULL;
+	}
+
+	++m_Stats.iCollideHits;
+	PortalCollisionCacheCollide_t *pEntry = pSurface->StaticPropCollides.Element( iIndex );
+	++pEntry->iRefCount;
+	++pSurface->iOutstandingCollides;
+	return pEntry->pCollide;
+}
+
+void CPortalCollisionCache::AddStaticPropCollide( PortalCollisionCacheSurface_t *pSurface, const IHandleEntity *pSourceProp, CPhysCollide *pCollide )
+{
+	Assert( pSurface && pCollide );
+
+	PortalCollisionCacheCollide_t *pEntry = new PortalCollisionCacheCollide_t;
+	pEntry->pCollide = pCollide;
+	pEntry->iRefCount = 1;
+	pSurface->StaticPropCollides.Insert( pSourceProp, pEntry );
+	++pSurface->iOutstandingCollides;
+
+	m_CollideOwners.Insert( pCollide, pSurface );
+}
+
+bool CPortalCollisionCache::ReleaseCollide( CPhysCollide *pCollide )
+{
+	unsigned short iOwnerIndex = m_CollideOwners.Find( pCollide );
+	if( !m_CollideOwners.IsValidIndex( iOwnerIndex ) )
+		return false;
+
+	PortalCollisionCacheSurface_t *pSurface = m_CollideOwners.Element( iOwnerIndex );
+	Assert( pSurface->iOutstandingCollides > 0 );
+	--pSurface->iOutstandingCollides;
+
+	for( int i = pSurface->WorldBrushCollides.Count(); --i >= 0; )
+	{
+		if( pSurface->WorldBrushCollides[i]->pCollide == pCollide )
+		{
+			--pSurface->WorldBrushCollides[i]->iRefCount;
+			Assert( pSurface->WorldBrushCollides[i]->iRefCount >= 0 );
+			return true;
+		}
+	}
+
+	for( unsigned short i = pSurface->StaticPropCollides.FirstInorder(); pSurface->StaticPropCollides.IsValidIndex( i ); i = pSurface->StaticPropCollides.NextInorder( i ) )
+	{
+		if( pSurface->StaticPropCollides[i]->pCollide == pCollide )
+		{
+			--pSurface->StaticPropCollides[i]->iRefCount;
+			Assert( pSurface->StaticPropCollides[i]->iRefCount >= 0 );
+			return true;
+		}
+	}
+
+	Assert( false ); //owner map and surface disagree
+	return true;
+}
+
+void CPortalCollisionCache::EvictSurfaces( void )
+{
+	int iMaxSurfaces = MAX( portal_collision_cache_max_surfaces.GetInt(), 1 );
+
+	//oldest first, skip anything that still has live collideables. Never evict the most recently used surface, it's about to be handed out.
+	for( int i = 0; (i < m_Surfaces.Count() - 1) && (m_Surfaces.Count() > iMaxSurfaces); )
+	{
+		PortalCollisionCacheSurface_t *pSurface = m_Surfaces[i];
+		if( pSurface->iOutstandingCollides != 0 )
+		{
+			++i;
+			continue;
+		}
+
+		m_Surfaces.Remove( i );
+		DestroySurface( pSurface );
+		++m_Stats.iSurfaceEvictions;
+	}
+}
+
+void CPortalCollisionCache::DestroySurface( PortalCollisionCacheSurface_t *pSurface )
+{
+	AssertMsg( pSurface->iOutstandingCollides == 0, "Destroying a portal collision cache surface that still has collideables in use." );
+
+	for( int i = 0; i != PCCC_COUNT; ++i )
+	{
+		CUtlMap<int, CPolyhedron *> &ClippedBrushes = pSurface->ClippedBrushes[i];
+		for( unsigned short j = ClippedBrushes.FirstInorder(); ClippedBrushes.IsValidIndex( j ); j = ClippedBrushes.NextInorder( j ) )
+		{
+			if( ClippedBrushes[j] )
+				ClippedBrushes[j]->Release();
+		}
+	}
+
+	for( unsigned short i = pSurface->ClippedStaticPropPieces.FirstInorder(); pSurface->ClippedStaticPropPieces.IsValidIndex( i ); i = pSurface->ClippedStaticPropPieces.NextInorder( i ) )
+	{
+		if( pSurface->ClippedStaticPropPieces[i] )
+			pSurface->ClippedStaticPropPieces[i]->Release();
+	}
+
+	for( int i = pSurface->WorldBrushCollides.Count(); --i >= 0; )
+	{
+		PortalCollisionCacheCollide_t *pEntry = pSurface->WorldBrushCollides[i];
+		m_CollideOwners.Remove( pEntry->pCollide );
+		physcollision->DestroyCollide( pEntry->pCollide );
+		delete pEntry;
+	}
+
+	for( unsigned short i = pSurface->StaticPropCollides.FirstInorder(); pSurface->StaticPropCollides.IsValidIndex( i ); i = pSurface->StaticPropCollides.NextInorder( i ) )
+	{
+		PortalCollisionCacheCollide_t *pEntry = pSurface->StaticPropCollides[i];
+		m_CollideOwners.Remove( pEntry->pCollide );
+		physcollision->DestroyCollide( pEntry->pCollide );
+		delete pEntry;
+	}
+
+	delete pSurface;
+}
+
+void CPortalCollisionCache::Clear( void )
+{
+	for( int i = m_Surfaces.Count(); --i >= 0; )
+		DestroySurface( m_Surfaces[i] );
+
+	m_Surfaces.RemoveAll();
+	Assert( m_CollideOwners.Count() == 0 );
+	m_CollideOwners.RemoveAll();
+}
+
+
+
+static void PrintPortalCollisionCacheStats( const CCommand &args )
+{
+	const PortalCollisionCacheStats_t &stats = g_PortalCollisionCache.GetStats();
+
+	int iPolyhedronLookups = stats.iPolyhedronHits + stats.iPolyhedronMisses;
+	int iCollideLookups = stats.iCollideHits + stats.iCollideMisses;
+
+	Msg( "Portal collision cache: %d surfaces\n", g_PortalCollisionCache.GetSurfaceCount() );
+	Msg( "  Polyhedrons: %d hits, %d misses (%.1f%% hit rate)\n", stats.iPolyhedronHits, stats.iPolyhedronMisses, (iPolyhedronLookups != 0) ? ((100.0f * stats.iPolyhedronHits) / iPolyhedronLookups) : 0.0f );
+	Msg( "  Collideables: %d hits, %d misses (%.1f%% hit rate)\n", stats.iCollideHits, stats.iCollideMisses, (iCollideLookups != 0) ? ((100.0f * stats.iCollideHits) / iCollideLookups) : 0.0f );
+	Msg( "  Surfaces evicted: %d\n", stats.iSurfaceEvictions );
+
+	if( (args.ArgC() > 1) && (Q_stricmp( args[1], "reset" ) == 0) )
+		g_PortalCollisionCache.ResetStats();
+}
+
+#ifdef GAME_DLL
+CON_COMMAND( portal_collision_cache_stats_server, "Prints hit/miss counts for the server portal collision cache. Pass \"reset\" to clear them afterwards." )
+{
+	PrintPortalCollisionCacheStats( args );
+}
+#else
+CON_COMMAND( portal_collision_cache_stats_client, "Prints hit/miss counts for the client portal collision cache. Pass \"reset\" to clear them afterwards." )
+{
+	PrintPortalCollisionCacheStats( args );
+}
+#endif
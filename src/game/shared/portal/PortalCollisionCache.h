@@ -0,0 +1,85 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Caches the results of carving world geometry around portals so that
+//			re-placing a portal on a surface that has already been carved reuses
+//			the previous clip results and collideables instead of redoing them.
+//
+// $NoKeywords: $
+//=====================================================================================//
+
+#ifndef PORTALCOLLISIONCACHE_H
+#define PORTALCOLLISIONCACHE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "mathlib/polyhedron.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlmap.h"
+
+class CPhysCollide;
+class IHandleEntity;
+
+enum PortalCollisionCacheCut_t
+{
+	PCCC_WORLD_BRUSHES,	//brushes clipped to the space in front of the portal plane
+	PCCC_WALL_BRUSHES,	//brushes clipped to the space behind the portal plane, before the hole is cut
+
+	PCCC_COUNT,
+};
+
+struct PortalCollisionCacheStats_t
+{
+	int iPolyhedronHits;
+	int iPolyhedronMisses;
+	int iCollideHits;
+	int iCollideMisses;
+	int iSurfaceEvictions;
+};
+
+struct PortalCollisionCacheSurface_t;
+
+class CPortalCollisionCache : public CAutoGameSystem
+{
+public:
+	CPortalCollisionCache( void );
+	~CPortalCollisionCache( void );
+
+	virtual void LevelShutdownPostEntity( void );
+	virtual void Shutdown( void );
+
+	bool IsEnabled( void ) const;
+
+	//find the cached surface for a portal plane, creating it if it's the first time a portal was placed there. Returns NULL when disabled.
+	PortalCollisionCacheSurface_t *FindOrCreateSurface( const VPlane &PortalPlane );
+
+	//appends copies of the brush polyhedrons clipped by pClipPlane. The caller owns the copies and should Release() them as usual.
+	void ClipBrushes( PortalCollisionCacheSurface_t *pSurface, PortalCollisionCacheCut_t eCut, const int *pBrushes, int iBrushCount, const float *pClipPlane, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList );
+	CPolyhedron *ClipStaticPropPiece( PortalCollisionCacheSurface_t *pSurface, const CPolyhedron *pPiece, const float *pClipPlane, float fClipEpsilon );
+
+	//collideables handed out by these are shared, give them back with ReleaseCollide() instead of destroying them
+	CPhysCollide *FindWorldBrushCollide( PortalCollisionCacheSurface_t *pSurface, const int *pBrushes, int iBrushCount );
+	void AddWorldBrushCollide( PortalCollisionCacheSurface_t *pSurface, const int *pBrushes, int iBrushCount, CPhysCollide *pCollide );
+	CPhysCollide *FindStaticPropCollide( PortalCollisionCacheSurface_t *pSurface, const IHandleEntity *pSourceProp );
+	void AddStaticPropCollide( PortalCollisionCacheSurface_t *pSurface, const IHandleEntity *pSourceProp, CPhysCollide *pCollide );
+	bool ReleaseCollide( CPhysCollide *pCollide ); //returns false if the collideable isn't owned by the cache, in which case the caller should destroy it
+
+	const PortalCollisionCacheStats_t &GetStats( void ) const { return m_Stats; }
+	void ResetStats( void );
+	int GetSurfaceCount( void ) const { return m_Surfaces.Count(); }
+
+private:
+	CUtlVector<PortalCollisionCacheSurface_t *> m_Surfaces; //most recently used at the tail
+	CUtlMap<CPhysCollide *, PortalCollisionCacheSurface_t *> m_CollideOwners;
+	PortalCollisionCacheStats_t m_Stats;
+
+	void EvictSurfaces( void );
+	void DestroySurface( PortalCollisionCacheSurface_t *pSurface );
+	void Clear( void );
+};
+
+extern CPortalCollisionCache g_PortalCollisionCache;
+
+#endif //#ifndef PORTALCOLLISIONCACHE_H
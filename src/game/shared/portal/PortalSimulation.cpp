@@ -12,10 +12,12 @@
 #include "physics.h"
 #include "portal_shareddefs.h"
 #include "StaticCollisionPolyhedronCache.h"
+#include "PortalCollisionCache.h"
 #include "model_types.h"
 #include "filesystem.h"
 #include "collisionutils.h"
 #include "tier1/callqueue.h"
+#include "vstdlib/jobthread.h"
 #include "portal/weapon_physcannon.h"
 #include "physicsshadowclone.h"
 
@@ -44,6 +46,7 @@ CCallQueue *GetPortalCallQueue();
 extern IPhysicsConstraintEvent *g_pConstraintEvents;
 
 ConVar portal_clone_displacements ( "portal_clone_displacements", "0", FCVAR_REPLICATED | FCVAR_CHEAT );
+ConVar portal_async_collision_build( "portal_async_collision_build", "0", FCVAR_REPLICATED | FCVAR_CHEAT, "Carve the collision for re-placed portals on a job thread. The portal keeps its old placement until the result is swapped in at the start of the next physics frame." );
 static ConVar sv_portal_collision_sim_bounds_x( "sv_portal_collision_sim_bounds_x", "200", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
 static ConVar sv_portal_collision_sim_bounds_y( "sv_portal_collision_sim_bounds_y", "200", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
 static ConVar sv_portal_collision_sim_bounds_z( "sv_portal_collision_sim_bounds_z", "252", FCVAR_REPLICATED, "Size of box used to grab collision geometry around placed portals. These should be at the default size or larger only!" );
@@ -99,11 +102,32 @@ static int s_iPortalSimulatorGUID = 0; //used in standalone function that have n
 #define PORTAL_HOLE_HALF_WIDTH (PORTAL_HALF_WIDTH + 0.1f)
 
 
-static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList );
 static void ClipPolyhedrons( CPolyhedron * const *pExistingPolyhedrons, int iPolyhedronCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList );
 static inline CPolyhedron *TransformAndClipSinglePolyhedron( CPolyhedron *pExistingPolyhedron, const VMatrix &Transform, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fCutEpsilon, bool bUseTempMemory );
 static int GetEntityPhysicsObjects( IPhysicsEnvironment *pEnvironment, CBaseEntity *pEntity, IPhysicsObject **pRetList, int iRetListArraySize );
 static CPhysCollide *ConvertPolyhedronsToCollideable( CPolyhedron **pPolyhedrons, int iPolyhedronCount );
+static void UpdatePlacementBasis( PS_PlacementData_t &Placement, const Vector &ptCenter, const QAngle &angles );
+
+//everything the engine has to be asked for before the world around a portal can be carved up. Gathered on the main thread so the carving itself can run anywhere
+struct PS_CollisionSources_t
+{
+	CUtlVector<int> WorldBrushes;
+	CUtlVector<int> WallBrushes; //left empty when not simulating vphysics
+	CUtlVector<CPolyhedron *> StaticPropPieces; //unclipped pieces, owned by g_StaticCollisionPolyhedronCache
+	CUtlVector<PS_SD_Static_World_StaticProps_ClippedProp_t> StaticProps; //PolyhedronGroup indexes into StaticPropPieces
+};
+
+struct PS_AsyncCollisionBuild_t //a placement whose collision is being carved on a job thread
+{
+	Vector ptCenter;
+	QAngle qAngles;
+	PS_PlacementData_t Placement; //only the geometric basis is filled in
+	bool bSimulatingVPhysics;
+	PS_CollisionSources_t Sources;
+	PS_SD_Static_t Static; //results, anything still in here when the build is destroyed wasn't adopted and gets freed
+	CJob *pJob;
+};
+
 
 #if defined( CLIENT_DLL )
 //copy/paste from game/server/hierarchy.cpp
@@ -189,7 +213,8 @@ CPortalSimulator::CPortalSimulator( void )
 	m_bSharedCollisionConfiguration(false),
 	m_pLinkedPortal(NULL),
 	m_bInCrossLinkedFunction(false),
-	m_pCallbacks(&s_DummyPortalSimulatorCallback)
+	m_pCallbacks(&s_DummyPortalSimulatorCallback),
+	m_pAsyncBuild(NULL)
 //	GetInternalData()(m_InternalData)
 {
 	s_PortalSimulators.AddToTail( this );
@@ -271,8 +296,31 @@ CPortalSimulator::~CPortalSimulator( void )
 
 void CPortalSimulator::MoveTo( const Vector &ptCenter, const QAngle &angles )
 {
+	if( m_pAsyncBuild )
+	{
+		if( (m_pAsyncBuild->ptCenter == ptCenter) && (m_pAsyncBuild->qAngles == angles) ) //already on the way there
+			return;
+
+		CancelAsyncMove();
+	}
+
 	if( (m_InternalData.Placement.ptCenter == ptCenter) && (m_InternalData.Placement.qAngles == angles) ) //not actually moving at all
 		return;
+
+	//the first placement is always done in place so there's never a window where the portal has no collision at all
+	if( portal_async_collision_build.GetBool() && m_bLocalDataIsReady && IsCollisionGenerationEnabled() )
+	{
+		StartAsyncMove( ptCenter, angles );
+		return;
+	}
+
+	ApplyMove( ptCenter, angles, NULL );
+}
+
+
+
+void CPortalSimulator::ApplyMove( const Vector &ptCenter, const QAngle &angles, PS_AsyncCollisionBuild_t *pPrebuilt )
+{
 #ifdef DEBUG
 #ifdef GAME_DLL
 	//Msg("Server: CPortalSimulator::MoveTo:\nptCenter %f %f %f\nangles %f %f %f\n\n", ptCenter[0], ptCenter[1], ptCenter[2], angles[0], angles[1], angles[2]);
@@ -307,13 +355,7 @@ void CPortalSimulator::MoveTo( const Vector &ptCenter, const QAngle &angles )
 	VPlane OldPlane = m_InternalData.Placement.PortalPlane; //used in fixing code
 
 	//update geometric data
-	{
-		m_InternalData.Placement.ptCenter = ptCenter;
-		m_InternalData.Placement.qAngles = angles;
-		AngleVectors( angles, &m_InternalData.Placement.vForward, &m_InternalData.Placement.vRight, &m_InternalData.Placement.vUp );
-		
-		m_InternalData.Placement.PortalPlane.Init( m_InternalData.Placement.vForward, m_InternalData.Placement.vForward.Dot( m_InternalData.Placement.ptCenter ) );
-	}
+	UpdatePlacementBasis( m_InternalData.Placement, ptCenter, angles );
 
 	//Clear();
 	ClearLinkedPhysics();
@@ -399,6 +441,9 @@ void CPortalSimulator::MoveTo( const Vector &ptCenter, const QAngle &angles )
 		}
 	}
 
+	if( pPrebuilt )
+		AdoptPrebuiltCollision( pPrebuilt ); //polyhedrons and local collideables were carved on a job thread, CreateLocalCollision() only fills in what's missing
+
 	CreatePolyhedrons();	
 	CreateAllCollision();
 	CreateAllPhysics();
@@ -704,6 +749,7 @@ void CPortalSimulator::ClearEverything( void )
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::Clear() START\n", GetPortalSimulatorGUID(), TABSPACING ); );
 	INCREMENTTABSPACING();	
 
+	CancelAsyncMove();
 	ClearAllPhysics();
 	ClearAllCollision();
 	ClearPolyhedrons();
@@ -1785,11 +1831,22 @@ void CPortalSimulator::CreateLocalCollision( void )
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::CreateLocalCollision() START\n", GetPortalSimulatorGUID(), TABSPACING ); );
 	INCREMENTTABSPACING();
 	
+	//world collideables only depend on the portal plane and which brushes/props were grabbed, so they can be shared through the collision cache
+	PortalCollisionCacheSurface_t *pCacheSurface = g_PortalCollisionCache.FindOrCreateSurface( m_InternalData.Placement.PortalPlane );
+
 	CREATEDEBUGTIMER( worldBrushTimer );
 	STARTDEBUGTIMER( worldBrushTimer );
-	Assert( m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
-	if( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() != 0 )
-		m_InternalData.Simulation.Static.World.Brushes.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() );
+	if( (m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL) && (m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() != 0) ) //may have been prebuilt on a job thread
+	{
+		const CUtlVector<int> &SourceBrushes = m_InternalData.Simulation.Static.World.Brushes.SourceBrushes;
+		m_InternalData.Simulation.Static.World.Brushes.pCollideable = g_PortalCollisionCache.FindWorldBrushCollide( pCacheSurface, SourceBrushes.Base(), SourceBrushes.Count() );
+		if( m_InternalData.Simulation.Static.World.Brushes.pCollideable == NULL )
+		{
+			m_InternalData.Simulation.Static.World.Brushes.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() );
+			if( pCacheSurface && m_InternalData.Simulation.Static.World.Brushes.pCollideable )
+				g_PortalCollisionCache.AddWorldBrushCollide( pCacheSurface, SourceBrushes.Base(), SourceBrushes.Count(), m_InternalData.Simulation.Static.World.Brushes.pCollideable );
+		}
+	}
 	STOPDEBUGTIMER( worldBrushTimer );
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWorld Brushes=%fms\n", GetPortalSimulatorGUID(), TABSPACING, worldBrushTimer.GetDuration().GetMillisecondsF() ); );
 
@@ -2064,12 +2121,6 @@ void CPortalSimulator::CreateLocalCollision( void )
 
 	CREATEDEBUGTIMER( worldPropTimer );
 	STARTDEBUGTIMER( worldPropTimer );
-#ifdef _DEBUG
-	for( int i = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.Count(); --i >= 0; )
-	{
-		Assert( m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i].pCollide == NULL );
-	}
-#endif
 	Assert( m_InternalData.Simulation.Static.World.StaticProps.bCollisionExists == false ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
 	if( m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.Count() != 0 )
 	{
@@ -2079,8 +2130,16 @@ void CPortalSimulator::CreateLocalCollision( void )
 		{
 			PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
 			
-			Assert( Representation.pCollide == NULL );
-			Representation.pCollide = ConvertPolyhedronsToCollideable( &pPolyhedronsBase[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
+			if( Representation.pCollide != NULL ) //prebuilt on a job thread
+				continue;
+
+			Representation.pCollide = g_PortalCollisionCache.FindStaticPropCollide( pCacheSurface, Representation.pSourceProp );
+			if( Representation.pCollide == NULL )
+			{
+				Representation.pCollide = ConvertPolyhedronsToCollideable( &pPolyhedronsBase[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
+				if( pCacheSurface && Representation.pCollide )
+					g_PortalCollisionCache.AddStaticPropCollide( pCacheSurface, Representation.pSourceProp, Representation.pCollide );
+			}
 			Assert( Representation.pCollide != NULL );
 		}
 	}
@@ -2095,8 +2154,7 @@ void CPortalSimulator::CreateLocalCollision( void )
 		//TODO: replace the complete wall with the wall shell
 		CREATEDEBUGTIMER( wallBrushTimer );
 		STARTDEBUGTIMER( wallBrushTimer );
-		Assert( m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
-		if( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() != 0 )
+		if( (m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable == NULL) && (m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() != 0) )
 			m_InternalData.Simulation.Static.Wall.Local.Brushes.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() );
 		STOPDEBUGTIMER( wallBrushTimer );
 		DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWall Brushes=%fms\n", GetPortalSimulatorGUID(), TABSPACING, wallBrushTimer.GetDuration().GetMillisecondsF() ); );
@@ -2104,8 +2162,7 @@ void CPortalSimulator::CreateLocalCollision( void )
 
 	CREATEDEBUGTIMER( wallTubeTimer );
 	STARTDEBUGTIMER( wallTubeTimer );
-	Assert( m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable == NULL ); //Be sure to find graceful fixes for asserts, performance is a big concern with portal simulation
-	if( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() != 0 )
+	if( (m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable == NULL) && (m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() != 0) )
 		m_InternalData.Simulation.Static.Wall.Local.Tube.pCollideable = ConvertPolyhedronsToCollideable( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Base(), m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() );
 	STOPDEBUGTIMER( wallTubeTimer );
 	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sWall Tube=%fms\n", GetPortalSimulatorGUID(), TABSPACING, wallTubeTimer.GetDuration().GetMillisecondsF() ); );
@@ -2224,7 +2281,9 @@ void CPortalSimulator::ClearLocalCollision( void )
 
 	if( m_InternalData.Simulation.Static.World.Brushes.pCollideable )
 	{
-		physcollision->DestroyCollide( m_InternalData.Simulation.Static.World.Brushes.pCollideable );
+		if( !g_PortalCollisionCache.ReleaseCollide( m_InternalData.Simulation.Static.World.Brushes.pCollideable ) )
+			physcollision->DestroyCollide( m_InternalData.Simulation.Static.World.Brushes.pCollideable );
+
 		m_InternalData.Simulation.Static.World.Brushes.pCollideable = NULL;
 	}
 
@@ -2236,7 +2295,9 @@ void CPortalSimulator::ClearLocalCollision( void )
 			PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[i];
 			if( Representation.pCollide )
 			{
-				physcollision->DestroyCollide( Representation.pCollide );
+				if( !g_PortalCollisionCache.ReleaseCollide( Representation.pCollide ) )
+					physcollision->DestroyCollide( Representation.pCollide );
+
 				Representation.pCollide = NULL;
 			}
 		}
@@ -2252,49 +2313,13 @@ void CPortalSimulator::ClearLocalCollision( void )
 
 
 
-void CPortalSimulator::CreatePolyhedrons( void )
+static void GatherPortalCollisionSources( const PS_PlacementData_t &Placement, bool bSimulatingVPhysics, const PS_SD_Static_SurfaceProperties_t &SurfaceProperties, PS_CollisionSources_t &Sources )
 {
-	if( m_CreationChecklist.bPolyhedronsGenerated )
-		return;
-
-	if( IsCollisionGenerationEnabled() == false )
-		return;
-
-	CREATEDEBUGTIMER( functionTimer );
-
-	STARTDEBUGTIMER( functionTimer );
-	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::CreatePolyhedrons() START\n", GetPortalSimulatorGUID(), TABSPACING ); );
-	INCREMENTTABSPACING();
-
-	//forward reverse conventions signify whether the normal is the same direction as m_InternalData.Placement.PortalPlane.m_Normal
-	//World and wall conventions signify whether it's been shifted in front of the portal plane or behind it
-
-	float fWorldClipPlane_Forward[4] = {	m_InternalData.Placement.PortalPlane.m_Normal.x,
-											m_InternalData.Placement.PortalPlane.m_Normal.y,
-											m_InternalData.Placement.PortalPlane.m_Normal.z,
-											m_InternalData.Placement.PortalPlane.m_Dist + PORTAL_WORLD_WALL_HALF_SEPARATION_AMOUNT };
-
-	float fWorldClipPlane_Reverse[4] = {	-fWorldClipPlane_Forward[0],
-											-fWorldClipPlane_Forward[1],
-											-fWorldClipPlane_Forward[2],
-											-fWorldClipPlane_Forward[3] };
-
-	float fWallClipPlane_Forward[4] = {		m_InternalData.Placement.PortalPlane.m_Normal.x,
-											m_InternalData.Placement.PortalPlane.m_Normal.y,
-											m_InternalData.Placement.PortalPlane.m_Normal.z,
-											m_InternalData.Placement.PortalPlane.m_Dist }; // - PORTAL_WORLD_WALL_HALF_SEPARATION_AMOUNT
-
-	//float fWallClipPlane_Reverse[4] = {		-fWallClipPlane_Forward[0],
-	//										-fWallClipPlane_Forward[1],
-	//										-fWallClipPlane_Forward[2],
-	//										-fWallClipPlane_Forward[3] };
-
-
 	//World
 	{
-		Vector vOBBForward = m_InternalData.Placement.vForward;
-		Vector vOBBRight = m_InternalData.Placement.vRight;
-		Vector vOBBUp = m_InternalData.Placement.vUp;
+		Vector vOBBForward = Placement.vForward;
+		Vector vOBBRight = Placement.vRight;
+		Vector vOBBUp = Placement.vUp;
 
 
 		//scale the extents to usable sizes
@@ -2313,7 +2338,7 @@ void CPortalSimulator::CreatePolyhedrons( void )
 		vOBBUp		*= flScaleZ;	// default size for scale z (252) is player (height + portal half height) * 2. Any smaller than this will allow for players to 
 									// reach unsimulated geometry before an end touch with teh portal.
 
-		Vector ptOBBOrigin = m_InternalData.Placement.ptCenter;
+		Vector ptOBBOrigin = Placement.ptCenter;
 		ptOBBOrigin -= vOBBRight / 2.0f;
 		ptOBBOrigin -= vOBBUp / 2.0f;
 
@@ -2335,105 +2360,66 @@ void CPortalSimulator::CreatePolyhedrons( void )
 			if( ptTest.z > vAABBMaxs.z ) vAABBMaxs.z = ptTest.z;
 		}
 
-		//Brushes
-		{
-			Assert( m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.Count() == 0 );
-
-			CUtlVector<int> WorldBrushes;
-			enginetrace->GetBrushesInAABB( vAABBMins, vAABBMaxs, &WorldBrushes, MASK_SOLID_BRUSHONLY|CONTENTS_PLAYERCLIP|CONTENTS_MONSTERCLIP );
+		enginetrace->GetBrushesInAABB( vAABBMins, vAABBMaxs, &Sources.WorldBrushes, MASK_SOLID_BRUSHONLY|CONTENTS_PLAYERCLIP|CONTENTS_MONSTERCLIP );
 
-			//create locally clipped polyhedrons for the world
-			{
-				int *pBrushList = WorldBrushes.Base();
-				int iBrushCount = WorldBrushes.Count();
-				ConvertBrushListToClippedPolyhedronList( pBrushList, iBrushCount, fWorldClipPlane_Reverse, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.World.Brushes.Polyhedrons );
-			}
-		}
+		CUtlVector<ICollideable *> StaticProps;
+		staticpropmgr->GetAllStaticPropsInAABB( vAABBMins, vAABBMaxs, &StaticProps );
 
-		//static props
+		for( int i = StaticProps.Count(); --i >= 0; )
 		{
-			Assert( m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count() == 0 );
+			ICollideable *pProp = StaticProps[i];
 
-			CUtlVector<ICollideable *> StaticProps;
-			staticpropmgr->GetAllStaticPropsInAABB( vAABBMins, vAABBMaxs, &StaticProps );
-
-			for( int i = StaticProps.Count(); --i >= 0; )
-			{
-				ICollideable *pProp = StaticProps[i];
+			// Don't recreate non-solid static prop geometry
+			if ( pProp->GetSolid() == SOLID_NONE )
+				continue;
 
-				// Don't recreate non-solid static prop geometry
-				if ( pProp->GetSolid() == SOLID_NONE )
-					continue;
+			CPolyhedron *PolyhedronArray[1024];
+			int iPolyhedronCount = g_StaticCollisionPolyhedronCache.GetStaticPropPolyhedrons( pProp, PolyhedronArray, 1024 );
+			if( iPolyhedronCount == 0 )
+				continue;
 
-				CPolyhedron *PolyhedronArray[1024];
-				int iPolyhedronCount = g_StaticCollisionPolyhedronCache.GetStaticPropPolyhedrons( pProp, PolyhedronArray, 1024 );
+			int index = Sources.StaticProps.AddToTail();
+			PS_SD_Static_World_StaticProps_ClippedProp_t &NewEntry = Sources.StaticProps[index];
 
-				StaticPropPolyhedronGroups_t indices;
-				indices.iStartIndex = m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count();
+			NewEntry.PolyhedronGroup.iStartIndex = Sources.StaticPropPieces.Count();
+			NewEntry.PolyhedronGroup.iNumPolyhedrons = iPolyhedronCount;
+			Sources.StaticPropPieces.AddMultipleToTail( iPolyhedronCount, PolyhedronArray );
 
-				for( int j = 0; j != iPolyhedronCount; ++j )
-				{
-					CPolyhedron *pPropPolyhedronPiece = PolyhedronArray[j];
-					if( pPropPolyhedronPiece )
-					{
-						CPolyhedron *pClippedPropPolyhedron = ClipPolyhedron( pPropPolyhedronPiece, fWorldClipPlane_Reverse, 1, 0.01f, false );
-						if( pClippedPropPolyhedron )
-							m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.AddToTail( pClippedPropPolyhedron );
-					}
-				}
+			NewEntry.pCollide = NULL;
+			NewEntry.pPhysicsObject = NULL;
+			NewEntry.pSourceProp = pProp->GetEntityHandle();
 
-				indices.iNumPolyhedrons = m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count() - indices.iStartIndex;
-				if( indices.iNumPolyhedrons != 0 )
-				{
-					int index = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations.AddToTail();
-					PS_SD_Static_World_StaticProps_ClippedProp_t &NewEntry = m_InternalData.Simulation.Static.World.StaticProps.ClippedRepresentations[index];
-
-					NewEntry.PolyhedronGroup = indices;
-					NewEntry.pCollide = NULL;
-					NewEntry.pPhysicsObject = NULL;
-					NewEntry.pSourceProp = pProp->GetEntityHandle();
-
-					const model_t *pModel = pProp->GetCollisionModel();
-					bool bIsStudioModel = pModel && (modelinfo->GetModelType( pModel ) == mod_studio);
-					AssertOnce( bIsStudioModel );
-					if( bIsStudioModel )
-					{
-						studiohdr_t *pStudioHdr = modelinfo->GetStudiomodel( pModel );
-						Assert( pStudioHdr != NULL );
-						NewEntry.iTraceContents = pStudioHdr->contents;						
-						NewEntry.iTraceSurfaceProps = physprops->GetSurfaceIndex( pStudioHdr->pszSurfaceProp() );
-					}
-					else
-					{
-						NewEntry.iTraceContents = m_InternalData.Simulation.Static.SurfaceProperties.contents;
-						NewEntry.iTraceSurfaceProps = m_InternalData.Simulation.Static.SurfaceProperties.surface.surfaceProps;
-					}
-				}
+			const model_t *pModel = pProp->GetCollisionModel();
+			bool bIsStudioModel = pModel && (modelinfo->GetModelType( pModel ) == mod_studio);
+			AssertOnce( bIsStudioModel );
+			if( bIsStudioModel )
+			{
+				studiohdr_t *pStudioHdr = modelinfo->GetStudiomodel( pModel );
+				Assert( pStudioHdr != NULL );
+				NewEntry.iTraceContents = pStudioHdr->contents;						
+				NewEntry.iTraceSurfaceProps = physprops->GetSurfaceIndex( pStudioHdr->pszSurfaceProp() );
+			}
+			else
+			{
+				NewEntry.iTraceContents = SurfaceProperties.contents;
+				NewEntry.iTraceSurfaceProps = SurfaceProperties.surface.surfaceProps;
 			}
 		}
 	}
 
-
-
 	//(Holy) Wall
+	if( bSimulatingVPhysics ) //if not simulating vphysics, we skip making the entire wall, and just create the minimal tube instead
 	{
-		Assert( m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.Count() == 0 );
-		Assert( m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.Count() == 0 );
-
-		Vector vBackward = -m_InternalData.Placement.vForward;
-		Vector vLeft = -m_InternalData.Placement.vRight;
-		Vector vDown = -m_InternalData.Placement.vUp;
-
-		Vector vOBBForward = -m_InternalData.Placement.vForward;
-		Vector vOBBRight = -m_InternalData.Placement.vRight;
-		Vector vOBBUp = m_InternalData.Placement.vUp;
+		Vector vOBBForward = -Placement.vForward;
+		Vector vOBBRight = -Placement.vRight;
+		Vector vOBBUp = Placement.vUp;
 
 		//scale the extents to usable sizes
 		vOBBForward *= PORTAL_WALL_FARDIST / 2.0f;
 		vOBBRight *= PORTAL_WALL_FARDIST * 2.0f;
 		vOBBUp *= PORTAL_WALL_FARDIST * 2.0f;
 
-		Vector ptOBBOrigin = m_InternalData.Placement.ptCenter;
+		Vector ptOBBOrigin = Placement.ptCenter;
 		ptOBBOrigin -= vOBBRight / 2.0f;
 		ptOBBOrigin -= vOBBUp / 2.0f;
 
@@ -2455,6 +2441,91 @@ void CPortalSimulator::CreatePolyhedrons( void )
 			if( ptTest.z > vAABBMaxs.z ) vAABBMaxs.z = ptTest.z;
 		}
 
+		enginetrace->GetBrushesInAABB( vAABBMins, vAABBMaxs, &Sources.WallBrushes, MASK_SOLID_BRUSHONLY );
+	}
+}
+
+
+
+//pure clipping, no engine queries. bUseTempMemory must be false off the main thread since the temporary polyhedron buffer is a single shared block
+static void CarvePortalPolyhedrons( const PS_PlacementData_t &Placement, const PS_CollisionSources_t &Sources, PortalCollisionCacheSurface_t *pCacheSurface, bool bUseTempMemory, PS_SD_Static_t &Static )
+{
+	//forward reverse conventions signify whether the normal is the same direction as Placement.PortalPlane.m_Normal
+	//World and wall conventions signify whether it's been shifted in front of the portal plane or behind it
+
+	float fWorldClipPlane_Forward[4] = {	Placement.PortalPlane.m_Normal.x,
+											Placement.PortalPlane.m_Normal.y,
+											Placement.PortalPlane.m_Normal.z,
+											Placement.PortalPlane.m_Dist + PORTAL_WORLD_WALL_HALF_SEPARATION_AMOUNT };
+
+	float fWorldClipPlane_Reverse[4] = {	-fWorldClipPlane_Forward[0],
+											-fWorldClipPlane_Forward[1],
+											-fWorldClipPlane_Forward[2],
+											-fWorldClipPlane_Forward[3] };
+
+	float fWallClipPlane_Forward[4] = {		Placement.PortalPlane.m_Normal.x,
+											Placement.PortalPlane.m_Normal.y,
+											Placement.PortalPlane.m_Normal.z,
+											Placement.PortalPlane.m_Dist }; // - PORTAL_WORLD_WALL_HALF_SEPARATION_AMOUNT
+
+	//float fWallClipPlane_Reverse[4] = {		-fWallClipPlane_Forward[0],
+	//										-fWallClipPlane_Forward[1],
+	//										-fWallClipPlane_Forward[2],
+	//										-fWallClipPlane_Forward[3] };
+
+	//World
+	{
+		//Brushes
+		{
+			Assert( Static.World.Brushes.Polyhedrons.Count() == 0 );
+
+			//create locally clipped polyhedrons for the world
+			g_PortalCollisionCache.ClipBrushes( pCacheSurface, PCCC_WORLD_BRUSHES, Sources.WorldBrushes.Base(), Sources.WorldBrushes.Count(), fWorldClipPlane_Reverse, PORTAL_POLYHEDRON_CUT_EPSILON, &Static.World.Brushes.Polyhedrons );
+			Static.World.Brushes.SourceBrushes.CopyArray( Sources.WorldBrushes.Base(), Sources.WorldBrushes.Count() );
+		}
+
+		//static props
+		{
+			Assert( Static.World.StaticProps.Polyhedrons.Count() == 0 );
+
+			for( int i = 0; i != Sources.StaticProps.Count(); ++i )
+			{
+				const PS_SD_Static_World_StaticProps_ClippedProp_t &SourceProp = Sources.StaticProps[i];
+
+				StaticPropPolyhedronGroups_t indices;
+				indices.iStartIndex = Static.World.StaticProps.Polyhedrons.Count();
+
+				for( int j = 0; j != SourceProp.PolyhedronGroup.iNumPolyhedrons; ++j )
+				{
+					CPolyhedron *pPropPolyhedronPiece = Sources.StaticPropPieces[SourceProp.PolyhedronGroup.iStartIndex + j];
+					if( pPropPolyhedronPiece )
+					{
+						CPolyhedron *pClippedPropPolyhedron = g_PortalCollisionCache.ClipStaticPropPiece( pCacheSurface, pPropPolyhedronPiece, fWorldClipPlane_Reverse, 0.01f );
+						if( pClippedPropPolyhedron )
+							Static.World.StaticProps.Polyhedrons.AddToTail( pClippedPropPolyhedron );
+					}
+				}
+
+				indices.iNumPolyhedrons = Static.World.StaticProps.Polyhedrons.Count() - indices.iStartIndex;
+				if( indices.iNumPolyhedrons != 0 )
+				{
+					int index = Static.World.StaticProps.ClippedRepresentations.AddToTail( SourceProp );
+					Static.World.StaticProps.ClippedRepresentations[index].PolyhedronGroup = indices;
+				}
+			}
+		}
+	}
+
+
+
+	//(Holy) Wall
+	{
+		Assert( Static.Wall.Local.Tube.Polyhedrons.Count() == 0 );
+		Assert( Static.Wall.Local.Brushes.Polyhedrons.Count() == 0 );
+
+		Vector vBackward = -Placement.vForward;
+		Vector vLeft = -Placement.vRight;
+		Vector vDown = -Placement.vUp;
 
 		float fPlanes[6 * 4];
 
@@ -2467,56 +2538,52 @@ void CPortalSimulator::CreatePolyhedrons( void )
 		fPlanes[(1*4) + 0] = vBackward.x;
 		fPlanes[(1*4) + 1] = vBackward.y;
 		fPlanes[(1*4) + 2] = vBackward.z;
-		float fTubeDepthDist = vBackward.Dot( m_InternalData.Placement.ptCenter + (vBackward * (PORTAL_WALL_TUBE_DEPTH + PORTAL_WALL_TUBE_OFFSET)) );
+		float fTubeDepthDist = vBackward.Dot( Placement.ptCenter + (vBackward * (PORTAL_WALL_TUBE_DEPTH + PORTAL_WALL_TUBE_OFFSET)) );
 		fPlanes[(1*4) + 3] = fTubeDepthDist;
 
 
 		//the remaining planes will always have the same ordering of normals, with different distances plugged in for each convex we're creating
 		//normal order is up, down, left, right
 
-		fPlanes[(2*4) + 0] = m_InternalData.Placement.vUp.x;
-		fPlanes[(2*4) + 1] = m_InternalData.Placement.vUp.y;
-		fPlanes[(2*4) + 2] = m_InternalData.Placement.vUp.z;
-		fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vUp * PORTAL_HOLE_HALF_HEIGHT) );
+		fPlanes[(2*4) + 0] = Placement.vUp.x;
+		fPlanes[(2*4) + 1] = Placement.vUp.y;
+		fPlanes[(2*4) + 2] = Placement.vUp.z;
+		fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (Placement.vUp * PORTAL_HOLE_HALF_HEIGHT) );
 
 		fPlanes[(3*4) + 0] = vDown.x;
 		fPlanes[(3*4) + 1] = vDown.y;
 		fPlanes[(3*4) + 2] = vDown.z;
-		fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
+		fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
 
 		fPlanes[(4*4) + 0] = vLeft.x;
 		fPlanes[(4*4) + 1] = vLeft.y;
 		fPlanes[(4*4) + 2] = vLeft.z;
-		fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + (vLeft * PORTAL_HOLE_HALF_WIDTH) );
+		fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + (vLeft * PORTAL_HOLE_HALF_WIDTH) );
 
-		fPlanes[(5*4) + 0] = m_InternalData.Placement.vRight.x;
-		fPlanes[(5*4) + 1] = m_InternalData.Placement.vRight.y;
-		fPlanes[(5*4) + 2] = m_InternalData.Placement.vRight.z;
-		fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vRight * PORTAL_HOLE_HALF_WIDTH) );
+		fPlanes[(5*4) + 0] = Placement.vRight.x;
+		fPlanes[(5*4) + 1] = Placement.vRight.y;
+		fPlanes[(5*4) + 2] = Placement.vRight.z;
+		fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + (Placement.vRight * PORTAL_HOLE_HALF_WIDTH) );
 
 		float *fSidePlanesOnly = &fPlanes[(2*4)];
 
 		//these 2 get re-used a bit
-		float fFarRightPlaneDistance = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * (PORTAL_WALL_FARDIST * 10.0f) );
-		float fFarLeftPlaneDistance = vLeft.Dot( m_InternalData.Placement.ptCenter + vLeft * (PORTAL_WALL_FARDIST * 10.0f) );
+		float fFarRightPlaneDistance = Placement.vRight.Dot( Placement.ptCenter + Placement.vRight * (PORTAL_WALL_FARDIST * 10.0f) );
+		float fFarLeftPlaneDistance = vLeft.Dot( Placement.ptCenter + vLeft * (PORTAL_WALL_FARDIST * 10.0f) );
 
 
-		CUtlVector<int> WallBrushes;
 		CUtlVector<CPolyhedron *> WallBrushPolyhedrons_ClippedToWall;
 		CPolyhedron **pWallClippedPolyhedrons = NULL;
 		int iWallClippedPolyhedronCount = 0;
-		if( IsSimulatingVPhysics() ) //if not simulating vphysics, we skip making the entire wall, and just create the minimal tube instead
+		if( Sources.WallBrushes.Count() != 0 ) //if not simulating vphysics, we skip making the entire wall, and just create the minimal tube instead
 		{
-			enginetrace->GetBrushesInAABB( vAABBMins, vAABBMaxs, &WallBrushes, MASK_SOLID_BRUSHONLY );
-
-			if( WallBrushes.Count() != 0 )
-				ConvertBrushListToClippedPolyhedronList( WallBrushes.Base(), WallBrushes.Count(), fPlanes, 1, PORTAL_POLYHEDRON_CUT_EPSILON, &WallBrushPolyhedrons_ClippedToWall );
+			g_PortalCollisionCache.ClipBrushes( pCacheSurface, PCCC_WALL_BRUSHES, Sources.WallBrushes.Base(), Sources.WallBrushes.Count(), fPlanes, PORTAL_POLYHEDRON_CUT_EPSILON, &WallBrushPolyhedrons_ClippedToWall );
 			
 			if( WallBrushPolyhedrons_ClippedToWall.Count() != 0 )
 			{
 				for( int i = WallBrushPolyhedrons_ClippedToWall.Count(); --i >= 0; )
 				{
-					CPolyhedron *pPolyhedron = ClipPolyhedron( WallBrushPolyhedrons_ClippedToWall[i], fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, true );
+					CPolyhedron *pPolyhedron = ClipPolyhedron( WallBrushPolyhedrons_ClippedToWall[i], fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, bUseTempMemory );
 					if( pPolyhedron )
 					{
 						//a chunk of this brush passes through the hole, not eligible to be removed from cutting
@@ -2525,7 +2592,7 @@ void CPortalSimulator::CreatePolyhedrons( void )
 					else
 					{
 						//no part of this brush interacts with the hole, no point in cutting the brush any later
-						m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons.AddToTail( WallBrushPolyhedrons_ClippedToWall[i] );
+						Static.Wall.Local.Brushes.Polyhedrons.AddToTail( WallBrushPolyhedrons_ClippedToWall[i] );
 						WallBrushPolyhedrons_ClippedToWall.FastRemove( i );
 					}
 				}
@@ -2543,94 +2610,94 @@ void CPortalSimulator::CreatePolyhedrons( void )
 		{
 			//minimal portion that extends into the hole space
 			//fPlanes[(1*4) + 3] = fTubeDepthDist;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vUp * PORTAL_HOLE_HALF_HEIGHT );
-			fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
-			fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + Placement.vUp * PORTAL_HOLE_HALF_HEIGHT );
+			fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
 
 			CPolyhedron *pTubePolyhedron = GeneratePolyhedronFromPlanes( fPlanes, 6, PORTAL_POLYHEDRON_CUT_EPSILON );
 			if( pTubePolyhedron )
-				m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
+				Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
 
 			//general hole cut
 			//fPlanes[(1*4) + 3] += 2000.0f;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vUp * (PORTAL_WALL_FARDIST * 10.0f) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + Placement.vUp * (PORTAL_WALL_FARDIST * 10.0f) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
 			fPlanes[(4*4) + 3] = fFarLeftPlaneDistance;
 			fPlanes[(5*4) + 3] = fFarRightPlaneDistance;
 
 			
 
-			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons );
+			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &Static.Wall.Local.Brushes.Polyhedrons );
 		}
 
 		//lower wall
 		{
 			//minimal portion that extends into the hole space
 			//fPlanes[(1*4) + 3] = fTubeDepthDist;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
-			fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
-			fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
 
 			CPolyhedron *pTubePolyhedron = GeneratePolyhedronFromPlanes( fPlanes, 6, PORTAL_POLYHEDRON_CUT_EPSILON );
 			if( pTubePolyhedron )
-				m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
+				Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
 
 			//general hole cut
 			//fPlanes[(1*4) + 3] += 2000.0f;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + (vDown * (PORTAL_WALL_FARDIST * 10.0f)) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + (vDown * (PORTAL_WALL_FARDIST * 10.0f)) );
 			fPlanes[(4*4) + 3] = fFarLeftPlaneDistance;
 			fPlanes[(5*4) + 3] = fFarRightPlaneDistance;
 
-			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons );
+			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &Static.Wall.Local.Brushes.Polyhedrons );
 		}
 
 		//left wall
 		{
 			//minimal portion that extends into the hole space
 			//fPlanes[(1*4) + 3] = fTubeDepthDist;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vUp * PORTAL_HOLE_HALF_HEIGHT) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
-			fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + (vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS)) );
-			fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + (vLeft * PORTAL_HOLE_HALF_WIDTH) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (Placement.vUp * PORTAL_HOLE_HALF_HEIGHT) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + (vDown * PORTAL_HOLE_HALF_HEIGHT) );
+			fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + (vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + (vLeft * PORTAL_HOLE_HALF_WIDTH) );
 
 			CPolyhedron *pTubePolyhedron = GeneratePolyhedronFromPlanes( fPlanes, 6, PORTAL_POLYHEDRON_CUT_EPSILON );
 			if( pTubePolyhedron )
-				m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
+				Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
 
 			//general hole cut
 			//fPlanes[(1*4) + 3] += 2000.0f;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter - (m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter - (Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
 			fPlanes[(4*4) + 3] = fFarLeftPlaneDistance;
-			fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + (vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + (vLeft * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS)) );
 
-			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons );
+			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &Static.Wall.Local.Brushes.Polyhedrons );
 		}
 
 		//right wall
 		{
 			//minimal portion that extends into the hole space
 			//fPlanes[(1*4) + 3] = fTubeDepthDist;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT)) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT)) );
-			fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * PORTAL_HOLE_HALF_WIDTH );
-			fPlanes[(5*4) + 3] = m_InternalData.Placement.vRight.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT)) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT)) );
+			fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + Placement.vRight * PORTAL_HOLE_HALF_WIDTH );
+			fPlanes[(5*4) + 3] = Placement.vRight.Dot( Placement.ptCenter + Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
 
 			CPolyhedron *pTubePolyhedron = GeneratePolyhedronFromPlanes( fPlanes, 6, PORTAL_POLYHEDRON_CUT_EPSILON );
 			if( pTubePolyhedron )
-				m_InternalData.Simulation.Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
+				Static.Wall.Local.Tube.Polyhedrons.AddToTail( pTubePolyhedron );
 
 			//general hole cut
 			//fPlanes[(1*4) + 3] += 2000.0f;
-			fPlanes[(2*4) + 3] = m_InternalData.Placement.vUp.Dot( m_InternalData.Placement.ptCenter + (m_InternalData.Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
-			fPlanes[(3*4) + 3] = vDown.Dot( m_InternalData.Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
-			fPlanes[(4*4) + 3] = vLeft.Dot( m_InternalData.Placement.ptCenter + m_InternalData.Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
+			fPlanes[(2*4) + 3] = Placement.vUp.Dot( Placement.ptCenter + (Placement.vUp * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(3*4) + 3] = vDown.Dot( Placement.ptCenter + (vDown * (PORTAL_HOLE_HALF_HEIGHT + PORTAL_WALL_MIN_THICKNESS)) );
+			fPlanes[(4*4) + 3] = vLeft.Dot( Placement.ptCenter + Placement.vRight * (PORTAL_HOLE_HALF_WIDTH + PORTAL_WALL_MIN_THICKNESS) );
 			fPlanes[(5*4) + 3] = fFarRightPlaneDistance;
 
-			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &m_InternalData.Simulation.Static.Wall.Local.Brushes.Polyhedrons );
+			ClipPolyhedrons( pWallClippedPolyhedrons, iWallClippedPolyhedronCount, fSidePlanesOnly, 4, PORTAL_POLYHEDRON_CUT_EPSILON, &Static.Wall.Local.Brushes.Polyhedrons );
 		}
 
 		for( int i = WallBrushPolyhedrons_ClippedToWall.Count(); --i >= 0; )
@@ -2638,6 +2705,31 @@ void CPortalSimulator::CreatePolyhedrons( void )
 
 		WallBrushPolyhedrons_ClippedToWall.RemoveAll();
 	}
+}
+
+
+
+void CPortalSimulator::CreatePolyhedrons( void )
+{
+	if( m_CreationChecklist.bPolyhedronsGenerated )
+		return;
+
+	if( IsCollisionGenerationEnabled() == false )
+		return;
+
+	CREATEDEBUGTIMER( functionTimer );
+
+	STARTDEBUGTIMER( functionTimer );
+	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::CreatePolyhedrons() START\n", GetPortalSimulatorGUID(), TABSPACING ); );
+	INCREMENTTABSPACING();
+
+	PS_CollisionSources_t Sources;
+	GatherPortalCollisionSources( m_InternalData.Placement, IsSimulatingVPhysics(), m_InternalData.Simulation.Static.SurfaceProperties, Sources );
+
+	//clip results that only depend on the portal plane are shared by every portal placed on this surface
+	PortalCollisionCacheSurface_t *pCacheSurface = g_PortalCollisionCache.FindOrCreateSurface( m_InternalData.Placement.PortalPlane );
+
+	CarvePortalPolyhedrons( m_InternalData.Placement, Sources, pCacheSurface, true, m_InternalData.Simulation.Static );
 
 	STOPDEBUGTIMER( functionTimer );
 	DECREMENTTABSPACING();
@@ -2648,6 +2740,161 @@ void CPortalSimulator::CreatePolyhedrons( void )
 
 
 
+static void BuildPortalCollisionJob( PS_AsyncCollisionBuild_t *pBuild )
+{
+	//no collision cache surface here, the cache isn't safe to touch off the main thread
+	CarvePortalPolyhedrons( pBuild->Placement, pBuild->Sources, NULL, false, pBuild->Static );
+}
+
+//physcollision isn't known to be thread safe, so the carved polyhedrons are turned into collideables on the main thread when the build is swapped in
+static void ConvertAsyncCollisionBuild( PS_AsyncCollisionBuild_t *pBuild )
+{
+	PS_SD_Static_t &Static = pBuild->Static;
+
+	if( Static.World.Brushes.Polyhedrons.Count() != 0 )
+		Static.World.Brushes.pCollideable = ConvertPolyhedronsToCollideable( Static.World.Brushes.Polyhedrons.Base(), Static.World.Brushes.Polyhedrons.Count() );
+
+	for( int i = Static.World.StaticProps.ClippedRepresentations.Count(); --i >= 0; )
+	{
+		PS_SD_Static_World_StaticProps_ClippedProp_t &Representation = Static.World.StaticProps.ClippedRepresentations[i];
+		Representation.pCollide = ConvertPolyhedronsToCollideable( &Static.World.StaticProps.Polyhedrons[Representation.PolyhedronGroup.iStartIndex], Representation.PolyhedronGroup.iNumPolyhedrons );
+	}
+
+	if( pBuild->bSimulatingVPhysics && (Static.Wall.Local.Brushes.Polyhedrons.Count() != 0) )
+		Static.Wall.Local.Brushes.pCollideable = ConvertPolyhedronsToCollideable( Static.Wall.Local.Brushes.Polyhedrons.Base(), Static.Wall.Local.Brushes.Polyhedrons.Count() );
+
+	if( Static.Wall.Local.Tube.Polyhedrons.Count() != 0 )
+		Static.Wall.Local.Tube.pCollideable = ConvertPolyhedronsToCollideable( Static.Wall.Local.Tube.Polyhedrons.Base(), Static.Wall.Local.Tube.Polyhedrons.Count() );
+}
+
+static void ReleasePolyhedronList( CUtlVector<CPolyhedron *> &Polyhedrons )
+{
+	for( int i = Polyhedrons.Count(); --i >= 0; )
+		Polyhedrons[i]->Release();
+
+	Polyhedrons.RemoveAll();
+}
+
+static void DestroyAsyncCollisionBuild( PS_AsyncCollisionBuild_t *pBuild )
+{
+	Assert( pBuild->pJob == NULL );
+
+	PS_SD_Static_t &Static = pBuild->Static;
+
+	if( Static.World.Brushes.pCollideable )
+		physcollision->DestroyCollide( Static.World.Brushes.pCollideable );
+
+	for( int i = Static.World.StaticProps.ClippedRepresentations.Count(); --i >= 0; )
+	{
+		if( Static.World.StaticProps.ClippedRepresentations[i].pCollide )
+			physcollision->DestroyCollide( Static.World.StaticProps.ClippedRepresentations[i].pCollide );
+	}
+
+	if( Static.Wall.Local.Brushes.pCollideable )
+		physcollision->DestroyCollide( Static.Wall.Local.Brushes.pCollideable );
+
+	if( Static.Wall.Local.Tube.pCollideable )
+		physcollision->DestroyCollide( Static.Wall.Local.Tube.pCollideable );
+
+	ReleasePolyhedronList( Static.World.Brushes.Polyhedrons );
+	ReleasePolyhedronList( Static.World.StaticProps.Polyhedrons );
+	ReleasePolyhedronList( Static.Wall.Local.Brushes.Polyhedrons );
+	ReleasePolyhedronList( Static.Wall.Local.Tube.Polyhedrons );
+
+	delete pBuild;
+}
+
+
+
+void CPortalSimulator::StartAsyncMove( const Vector &ptCenter, const QAngle &angles )
+{
+	Assert( m_pAsyncBuild == NULL );
+
+	DEBUGTIMERONLY( DevMsg( 2, "[PSDT:%d] %sCPortalSimulator::StartAsyncMove()\n", GetPortalSimulatorGUID(), TABSPACING ); );
+
+	PS_AsyncCollisionBuild_t *pBuild = new PS_AsyncCollisionBuild_t;
+	pBuild->ptCenter = ptCenter;
+	pBuild->qAngles = angles;
+	UpdatePlacementBasis( pBuild->Placement, ptCenter, angles );
+	pBuild->bSimulatingVPhysics = IsSimulatingVPhysics();
+
+	//engine spatial queries aren't thread safe, so everything the job needs is gathered up front
+	GatherPortalCollisionSources( pBuild->Placement, pBuild->bSimulatingVPhysics, m_InternalData.Simulation.Static.SurfaceProperties, pBuild->Sources );
+
+	pBuild->pJob = ThreadExecute( &BuildPortalCollisionJob, pBuild );
+	m_pAsyncBuild = pBuild;
+}
+
+
+
+void CPortalSimulator::FinishAsyncMove( void )
+{
+	if( m_pAsyncBuild == NULL )
+		return;
+
+	PS_AsyncCollisionBuild_t *pBuild = m_pAsyncBuild;
+	m_pAsyncBuild = NULL;
+
+	pBuild->pJob->WaitForFinishAndRelease();
+	pBuild->pJob = NULL;
+
+	if( (pBuild->bSimulatingVPhysics == IsSimulatingVPhysics()) && IsCollisionGenerationEnabled() )
+	{
+		ConvertAsyncCollisionBuild( pBuild );
+		ApplyMove( pBuild->ptCenter, pBuild->qAngles, pBuild );
+	}
+	else
+		ApplyMove( pBuild->ptCenter, pBuild->qAngles, NULL ); //settings changed out from under the build, it's carved for the wrong configuration
+
+	DestroyAsyncCollisionBuild( pBuild );
+}
+
+
+
+void CPortalSimulator::CancelAsyncMove( void )
+{
+	if( m_pAsyncBuild == NULL )
+		return;
+
+	PS_AsyncCollisionBuild_t *pBuild = m_pAsyncBuild;
+	m_pAsyncBuild = NULL;
+
+	pBuild->pJob->WaitForFinishAndRelease();
+	pBuild->pJob = NULL;
+
+	DestroyAsyncCollisionBuild( pBuild );
+}
+
+
+
+void CPortalSimulator::AdoptPrebuiltCollision( PS_AsyncCollisionBuild_t *pPrebuilt )
+{
+	Assert( !m_CreationChecklist.bPolyhedronsGenerated && !m_CreationChecklist.bLocalCollisionGenerated );
+
+	PS_SD_Static_t &Source = pPrebuilt->Static;
+	PS_SD_Static_t &Dest = m_InternalData.Simulation.Static;
+
+	Dest.World.Brushes.Polyhedrons.Swap( Source.World.Brushes.Polyhedrons );
+	Dest.World.Brushes.SourceBrushes.Swap( Source.World.Brushes.SourceBrushes );
+	Dest.World.Brushes.pCollideable = Source.World.Brushes.pCollideable;
+	Source.World.Brushes.pCollideable = NULL;
+
+	Dest.World.StaticProps.Polyhedrons.Swap( Source.World.StaticProps.Polyhedrons );
+	Dest.World.StaticProps.ClippedRepresentations.Swap( Source.World.StaticProps.ClippedRepresentations );
+
+	Dest.Wall.Local.Brushes.Polyhedrons.Swap( Source.Wall.Local.Brushes.Polyhedrons );
+	Dest.Wall.Local.Brushes.pCollideable = Source.Wall.Local.Brushes.pCollideable;
+	Source.Wall.Local.Brushes.pCollideable = NULL;
+
+	Dest.Wall.Local.Tube.Polyhedrons.Swap( Source.Wall.Local.Tube.Polyhedrons );
+	Dest.Wall.Local.Tube.pCollideable = Source.Wall.Local.Tube.pCollideable;
+	Source.Wall.Local.Tube.pCollideable = NULL;
+
+	m_CreationChecklist.bPolyhedronsGenerated = true;
+}
+
+
+
 void CPortalSimulator::ClearPolyhedrons( void )
 {
 	if( m_CreationChecklist.bPolyhedronsGenerated == false )
@@ -2666,6 +2913,7 @@ void CPortalSimulator::ClearPolyhedrons( void )
 		
 		m_InternalData.Simulation.Static.World.Brushes.Polyhedrons.RemoveAll();
 	}
+	m_InternalData.Simulation.Static.World.Brushes.SourceBrushes.RemoveAll();
 
 	if( m_InternalData.Simulation.Static.World.StaticProps.Polyhedrons.Count() != 0 )
 	{
@@ -2759,6 +3007,8 @@ void CPortalSimulator::SetVPhysicsSimulationEnabled( bool bEnabled )
 	if( bEnabled == m_bSimulateVPhysics )
 		return;
 
+	FinishAsyncMove(); //pending builds were carved for the old setting
+
 	CREATEDEBUGTIMER( functionTimer );
 
 	STARTDEBUGTIMER( functionTimer );
@@ -2829,6 +3079,11 @@ void CPortalSimulator::PrePhysFrame( void )
 	if( iPortalSimulators != 0 )
 	{
 		CPortalSimulator **pAllSimulators = s_PortalSimulators.Base();
+
+		//swap in collision carved on job threads since the last frame. Always at this point in the frame regardless of when the jobs actually finished so simulation stays deterministic
+		for( int i = 0; i != iPortalSimulators; ++i )
+			pAllSimulators[i]->FinishAsyncMove();
+
 		for( int i = 0; i != iPortalSimulators; ++i )
 		{
 			CPortalSimulator *pSimulator = pAllSimulators[i];
@@ -3005,22 +3260,6 @@ bool CPortalSimulator::CreatedPhysicsObject( const IPhysicsObject *pObject, PS_P
 }
 
 
-static void ConvertBrushListToClippedPolyhedronList( const int *pBrushes, int iBrushCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList )
-{
-	if( pPolyhedronList == NULL )
-		return;
-
-	if( (pBrushes == NULL) || (iBrushCount == 0) )
-		return;
-
-	for( int i = 0; i != iBrushCount; ++i )
-	{
-		CPolyhedron *pPolyhedron = ClipPolyhedron( g_StaticCollisionPolyhedronCache.GetBrushPolyhedron( pBrushes[i] ), pOutwardFacingClipPlanes, iClipPlaneCount, fClipEpsilon );
-		if( pPolyhedron )
-			pPolyhedronList->AddToTail( pPolyhedron );
-	}
-}
-
 static void ClipPolyhedrons( CPolyhedron * const *pExistingPolyhedrons, int iPolyhedronCount, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fClipEpsilon, CUtlVector<CPolyhedron *> *pPolyhedronList )
 {
 	if( pPolyhedronList == NULL )
@@ -3088,6 +3327,17 @@ static CPhysCollide *ConvertPolyhedronsToCollideable( CPolyhedron **pPolyhedrons
 }
 
 
+static void UpdatePlacementBasis( PS_PlacementData_t &Placement, const Vector &ptCenter, const QAngle &angles )
+{
+	Placement.ptCenter = ptCenter;
+	Placement.qAngles = angles;
+	AngleVectors( angles, &Placement.vForward, &Placement.vRight, &Placement.vUp );
+	
+	Placement.PortalPlane.Init( Placement.vForward, Placement.vForward.Dot( Placement.ptCenter ) );
+}
+
+
+
 static inline CPolyhedron *TransformAndClipSinglePolyhedron( CPolyhedron *pExistingPolyhedron, const VMatrix &Transform, const float *pOutwardFacingClipPlanes, int iClipPlaneCount, float fCutEpsilon, bool bUseTempMemory )
 {
 	Vector *pTempPointArray = (Vector *)stackalloc( sizeof( Vector ) * pExistingPolyhedron->iVertexCount );
@@ -117,6 +117,7 @@ struct PS_PlacementData_t //stuff useful for geometric operations
 struct PS_SD_Static_World_Brushes_t
 {
 	CUtlVector<CPolyhedron *> Polyhedrons; //the building blocks of more complex collision
+	CUtlVector<int> SourceBrushes; //brushes the polyhedrons were carved from, identifies the collideable in the portal collision cache
 	CPhysCollide *pCollideable;
 	IPhysicsObject *pPhysicsObject;
 	PS_SD_Static_World_Brushes_t() : pCollideable(NULL), pPhysicsObject(NULL) {};
@@ -365,6 +366,8 @@ EXTERN_SEND_TABLE(DT_PS_InternalData_t);
 EXTERN_RECV_TABLE(DT_PS_InternalData_t);
 #endif
 
+struct PS_AsyncCollisionBuild_t;
+
 class CPortalSimulator
 {
 public:
@@ -384,6 +387,7 @@ public:
 	void				SetPortalSimulatorCallbacks( CPortalSimulatorEventCallbacks *pCallbacks );
 	
 	bool				IsReadyToSimulate( void ) const; //is active and linked to another portal
+	bool				IsActivating( void ) const; //moved, but collision for the new placement is still being built on a job thread. The old placement stays in effect until the next PrePhysFrame()
 	
 	void				SetCollisionGenerationEnabled( bool bEnabled ); //enable/disable collision generation for the hole in the wall, needed for proper vphysics simulation
 	bool				IsCollisionGenerationEnabled( void ) const;
@@ -448,6 +452,7 @@ protected:
 	CPortalSimulator	*m_pLinkedPortal;
 	bool				m_bInCrossLinkedFunction; //A flag to mark that we're already in a linked function and that the linked portal shouldn't call our side
 	CPortalSimulatorEventCallbacks *m_pCallbacks; 
+	PS_AsyncCollisionBuild_t *m_pAsyncBuild; //non-NULL while activating
 #ifdef PORTAL_SIMULATORS_EMBED_GUID
 	int					m_iPortalSimulatorGUID;
 #endif
@@ -494,6 +499,12 @@ protected:
 
 	void				UpdateLinkMatrix( void );
 
+	void				ApplyMove( const Vector &ptCenter, const QAngle &angles, PS_AsyncCollisionBuild_t *pPrebuilt ); //the guts of MoveTo(), pPrebuilt is NULL when everything should be generated in place
+	void				StartAsyncMove( const Vector &ptCenter, const QAngle &angles );
+	void				FinishAsyncMove( void ); //blocks until the pending build is done, then swaps it in
+	void				CancelAsyncMove( void );
+	void				AdoptPrebuiltCollision( PS_AsyncCollisionBuild_t *pPrebuilt );
+
 	void				MarkAsOwned( CBaseEntity *pEntity );
 	void				MarkAsReleased( CBaseEntity *pEntity );
 
@@ -537,6 +548,11 @@ inline bool CPortalSimulator::IsReadyToSimulate( void ) const
 	return m_bLocalDataIsReady && m_pLinkedPortal && m_pLinkedPortal->m_bLocalDataIsReady;
 }
 
+inline bool CPortalSimulator::IsActivating( void ) const
+{
+	return (m_pAsyncBuild != NULL);
+}
+
 inline bool CPortalSimulator::IsSimulatingVPhysics( void ) const
 {
 	return m_bSimulateVPhysics && m_bGenerateCollision;
@@ -9,6 +9,8 @@
 #include "StaticCollisionPolyhedronCache.h"
 #include "engine/IEngineTrace.h"
 #include "edict.h"
+#include "bspfile.h"
+#include "filesystem.h"
 
 #include "tier0/memdbgon.h"
 
@@ -34,6 +36,33 @@ public:
 
 		return pAllocated;
 	}
+
+	//wraps polyhedron data that already lives elsewhere (the on-disk cache buffer)
+	static CPolyhedron_LumpedMemory *CreateAt( void *pMemory, int iVertices, int iLines, int iIndices, int iPolygons, uint8 *pData )
+	{
+#include "tier0/memdbgoff.h"
+		CPolyhedron_LumpedMemory *pAllocated = new ( pMemory ) CPolyhedron_LumpedMemory;
+#include "tier0/memdbgon.h"
+
+		pAllocated->iVertexCount = iVertices;
+		pAllocated->iLineCount = iLines;
+		pAllocated->iIndexCount = iIndices;
+		pAllocated->iPolygonCount = iPolygons;
+		pAllocated->pVertices = (Vector *)pData;
+		pAllocated->pLines = (Polyhedron_IndexedLine_t *)(pAllocated->pVertices + iVertices);
+		pAllocated->pIndices = (Polyhedron_IndexedLineReference_t *)(pAllocated->pLines + iLines);
+		pAllocated->pPolygons = (Polyhedron_IndexedPolygon_t *)(pAllocated->pIndices + iIndices);
+
+		return pAllocated;
+	}
+
+	static size_t DataSize( int iVertices, int iLines, int iIndices, int iPolygons )
+	{
+		return (sizeof( Vector ) * iVertices) +
+			(sizeof( Polyhedron_IndexedLine_t ) * iLines) +
+			(sizeof( Polyhedron_IndexedLineReference_t ) * iIndices) +
+			(sizeof( Polyhedron_IndexedPolygon_t ) * iPolygons);
+	}
 };
 
 static uint8 *s_BrushPolyhedronMemory = NULL;
@@ -41,6 +70,72 @@ static uint8 *s_StaticPropPolyhedronMemory = NULL;
 
 CStaticCollisionPolyhedronCache g_StaticCollisionPolyhedronCache;
 
+ConVar portal_polyhedron_cache_disk( "portal_polyhedron_cache_disk", "1", 0, "Save static collision polyhedrons to disk after generating them and load them back on later runs of the same map." );
+
+#define POLYHEDRONCACHE_FILE_IDENT		(('C'<<24)+('H'<<16)+('P'<<8)+'S')
+#define POLYHEDRONCACHE_FILE_VERSION	1
+#define POLYHEDRONCACHE_FILE_PATHID		"MOD"
+#define POLYHEDRONCACHE_NULL_OFFSET		0xFFFFFFFF
+
+//File layout: header, static prop info array, polyhedron entry array (brushes then static props), then the raw polyhedron data.
+//Everything is stored as offsets from the start of the data section so the file can be used in place after a single read.
+struct PolyhedronCacheFileHeader_t
+{
+	int			ident;
+	int			version;
+	CRC32_t		cacheKey;
+	int			iBrushPolyhedronCount;
+	int			iStaticPropPolyhedronCount;
+	int			iStaticPropInfoCount;
+	uint32		iDataSize;
+};
+
+struct PolyhedronCacheFileEntry_t
+{
+	unsigned short iVertexCount;
+	unsigned short iLineCount;
+	unsigned short iIndexCount;
+	unsigned short iPolygonCount;
+	uint32 iDataOffset; //POLYHEDRONCACHE_NULL_OFFSET for brushes that failed to generate a polyhedron
+};
+
+//every index in the polyhedron data has to land inside the arrays it refers to, the polyhedron code doesn't check them
+static bool ArePolyhedronCacheIndicesValid( const PolyhedronCacheFileEntry_t &entry, const uint8 *pData )
+{
+	const Polyhedron_IndexedLine_t *pLines = (const Polyhedron_IndexedLine_t *)(((const Vector *)pData) + entry.iVertexCount);
+	const Polyhedron_IndexedLineReference_t *pIndices = (const Polyhedron_IndexedLineReference_t *)(pLines + entry.iLineCount);
+	const Polyhedron_IndexedPolygon_t *pPolygons = (const Polyhedron_IndexedPolygon_t *)(pIndices + entry.iIndexCount);
+
+	for( int i = 0; i != entry.iLineCount; ++i )
+	{
+		if( (pLines[i].iPointIndices[0] >= entry.iVertexCount) || (pLines[i].iPointIndices[1] >= entry.iVertexCount) )
+			return false;
+	}
+
+	for( int i = 0; i != entry.iIndexCount; ++i )
+	{
+		if( (pIndices[i].iLineIndex >= entry.iLineCount) || (pIndices[i].iEndPointIndex > 1) )
+			return false;
+	}
+
+	for( int i = 0; i != entry.iPolygonCount; ++i )
+	{
+		if( ((int)pPolygons[i].iFirstIndex + (int)pPolygons[i].iIndexCount) > (int)entry.iIndexCount )
+			return false;
+	}
+
+	return true;
+}
+
+static void GetPolyhedronCacheFileName( char *pszOut, int iOutSize )
+{
+#ifdef CLIENT_DLL
+	Q_snprintf( pszOut, iOutSize, "cache/%s_client.phc", IGameSystem::MapName() );
+#else
+	Q_snprintf( pszOut, iOutSize, "cache/%s_server.phc", IGameSystem::MapName() );
+#endif
+}
+
 typedef ICollideable *ICollideablePtr; //needed for key comparison function syntax
 static bool CollideablePtr_KeyCompareFunc( const ICollideablePtr &a, const ICollideablePtr &b )
 { 
@@ -48,7 +143,8 @@ static bool CollideablePtr_KeyCompareFunc( const ICollideablePtr &a, const IColl
 };
 
 CStaticCollisionPolyhedronCache::CStaticCollisionPolyhedronCache( void )
-: m_CollideableIndicesMap( CollideablePtr_KeyCompareFunc )
+: m_CachedKey( 0 ),
+  m_CollideableIndicesMap( CollideablePtr_KeyCompareFunc )
 {
 
 }
@@ -60,37 +156,31 @@ CStaticCollisionPolyhedronCache::~CStaticCollisionPolyhedronCache( void )
 
 void CStaticCollisionPolyhedronCache::LevelInitPreEntity( void )
 {
+	CRC32_t cacheKey = ComputeCacheKey();
 
-	// FIXME: Fast updates would be nice but this method doesn't work with the recent changes to standard containers.
-	// For now we're going with the quick fix of always doing a full update. -Jeep
-
-//	if( Q_stricmp( m_CachedMap, MapName() ) != 0 )
-//	{
-//		// New map or the last load was a transition, fully update the cache
-//		m_CachedMap.Set( MapName() );
-
-		Update();
-//	}
-//	else
-//	{
-//		// No need for a full update, but we need to remap static prop ICollideable's in the old system to the new system
-//		for( int i = m_CollideableIndicesMap.Count(); --i >= 0; )
-//		{
-//#ifdef _DEBUG
-//			StaticPropPolyhedronCacheInfo_t cacheInfo = m_CollideableIndicesMap.Element(i);
-//#endif
-//			m_CollideableIndicesMap.Reinsert( staticpropmgr->GetStaticPropByIndex( m_CollideableIndicesMap.Element(i).iStaticPropIndex ), i );
-//
-//			Assert( (m_CollideableIndicesMap.Element(i).iStartIndex == cacheInfo.iStartIndex) &&
-//					(m_CollideableIndicesMap.Element(i).iNumPolyhedrons == cacheInfo.iNumPolyhedrons) &&
-//					(m_CollideableIndicesMap.Element(i).iStaticPropIndex == cacheInfo.iStaticPropIndex) ); //I'm assuming this doesn't cause a reindex of the unordered list, if it does then this needs to be rewritten
-//		}
-//	}
+	if( (Q_stricmp( m_CachedMap, MapName() ) == 0) && (m_CachedKey == cacheKey) )
+	{
+		// Map restarted without changing, the polyhedrons are still good. Just remap static prop ICollideable's in the old system to the new system
+		RemapStaticPropCollideables();
+		return;
+	}
+
+	m_CachedMap.Set( MapName() );
+	m_CachedKey = cacheKey;
+
+	if( portal_polyhedron_cache_disk.GetBool() && LoadFromDisk( cacheKey ) )
+		return;
+
+	Update();
+
+	if( portal_polyhedron_cache_disk.GetBool() )
+		SaveToDisk( cacheKey );
 }
 
 void CStaticCollisionPolyhedronCache::Shutdown( void )
 {
 	Clear();
+	m_CachedMap.Set( NULL );
 }
 
 
@@ -118,6 +208,8 @@ void CStaticCollisionPolyhedronCache::Clear( void )
 			s_StaticPropPolyhedronMemory = NULL;
 		}
 	}
+
+	m_DiskCache.Purge();
 }
 
 void CStaticCollisionPolyhedronCache::Update( void )
@@ -449,6 +541,285 @@ void CStaticCollisionPolyhedronCache::Update( void )
 
 
 
+CRC32_t CStaticCollisionPolyhedronCache::ComputeCacheKey( void )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	//The bsp header covers the lump layout and map revision, the brush lumps cover the actual geometry we convert
+	{
+		char szBSPName[MAX_PATH];
+		Q_snprintf( szBSPName, sizeof( szBSPName ), "maps/%s.bsp", MapName() );
+
+		FileHandle_t hBSP = filesystem->Open( szBSPName, "rb", "GAME" );
+		if( hBSP != FILESYSTEM_INVALID_HANDLE )
+		{
+			dheader_t header;
+			if( (filesystem->Read( &header, sizeof( dheader_t ), hBSP ) == sizeof( dheader_t )) && (header.ident == IDBSPHEADER) )
+			{
+				CRC32_ProcessBuffer( &crc, &header, sizeof( dheader_t ) );
+
+				static const int s_BrushLumps[] = { LUMP_PLANES, LUMP_BRUSHES, LUMP_BRUSHSIDES };
+				CUtlBuffer lumpData;
+				for( int i = 0; i != ARRAYSIZE( s_BrushLumps ); ++i )
+				{
+					const lump_t &lump = header.lumps[s_BrushLumps[i]];
+					if( lump.filelen <= 0 )
+						continue;
+
+					lumpData.EnsureCapacity( lump.filelen );
+					filesystem->Seek( hBSP, lump.fileofs, FILESYSTEM_SEEK_HEAD );
+					int iRead = filesystem->Read( lumpData.Base(), lump.filelen, hBSP );
+					if( iRead > 0 )
+						CRC32_ProcessBuffer( &crc, lumpData.Base(), iRead );
+				}
+			}
+
+			filesystem->Close( hBSP );
+		}
+	}
+
+	//Static prop layout
+	{
+		CUtlVector<ICollideable *> StaticPropCollideables;
+		staticpropmgr->GetAllStaticProps( &StaticPropCollideables );
+
+		int iPropCount = StaticPropCollideables.Count();
+		CRC32_ProcessBuffer( &crc, &iPropCount, sizeof( int ) );
+
+		for( int i = 0; i != iPropCount; ++i )
+		{
+			ICollideable *pProp = StaticPropCollideables[i];
+			const char *pszModelName = modelinfo->GetModelName( pProp->GetCollisionModel() );
+			if( pszModelName )
+				CRC32_ProcessBuffer( &crc, pszModelName, Q_strlen( pszModelName ) );
+
+			CRC32_ProcessBuffer( &crc, &pProp->GetCollisionOrigin(), sizeof( Vector ) );
+			CRC32_ProcessBuffer( &crc, &pProp->GetCollisionAngles(), sizeof( QAngle ) );
+		}
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+void CStaticCollisionPolyhedronCache::RemapStaticPropCollideables( void )
+{
+	CUtlVector<StaticPropPolyhedronCacheInfo_t> cacheInfos;
+	cacheInfos.EnsureCapacity( m_CollideableIndicesMap.Count() );
+
+	for( unsigned short i = m_CollideableIndicesMap.FirstInorder(); m_CollideableIndicesMap.IsValidIndex( i ); i = m_CollideableIndicesMap.NextInorder( i ) )
+	{
+		cacheInfos.AddToTail( m_CollideableIndicesMap.Element( i ) );
+	}
+
+	m_CollideableIndicesMap.RemoveAll();
+
+	for( int i = 0; i != cacheInfos.Count(); ++i )
+	{
+		ICollideable *pProp = staticpropmgr->GetStaticPropByIndex( cacheInfos[i].iStaticPropIndex );
+		Assert( pProp != NULL );
+		if( pProp )
+			m_CollideableIndicesMap.InsertOrReplace( pProp, cacheInfos[i] );
+	}
+}
+
+static void AddCacheFileEntries( const CUtlVector<CPolyhedron *> &Polyhedrons, CUtlVector<PolyhedronCacheFileEntry_t> &Entries, uint32 &iDataSize )
+{
+	for( int i = 0; i != Polyhedrons.Count(); ++i )
+	{
+		const CPolyhedron *pPolyhedron = Polyhedrons[i];
+		PolyhedronCacheFileEntry_t &entry = Entries[Entries.AddToTail()];
+
+		if( pPolyhedron == NULL )
+		{
+			memset( &entry, 0, sizeof( PolyhedronCacheFileEntry_t ) );
+			entry.iDataOffset = POLYHEDRONCACHE_NULL_OFFSET;
+			continue;
+		}
+
+		entry.iVertexCount = pPolyhedron->iVertexCount;
+		entry.iLineCount = pPolyhedron->iLineCount;
+		entry.iIndexCount = pPolyhedron->iIndexCount;
+		entry.iPolygonCount = pPolyhedron->iPolygonCount;
+		entry.iDataOffset = iDataSize;
+
+		iDataSize += CPolyhedron_LumpedMemory::DataSize( entry.iVertexCount, entry.iLineCount, entry.iIndexCount, entry.iPolygonCount );
+	}
+}
+
+static void PutCacheFileData( const CUtlVector<CPolyhedron *> &Polyhedrons, CUtlBuffer &buf )
+{
+	for( int i = 0; i != Polyhedrons.Count(); ++i )
+	{
+		const CPolyhedron *pPolyhedron = Polyhedrons[i];
+		if( pPolyhedron == NULL )
+			continue;
+
+		//lumped polyhedrons keep their arrays contiguous and in this order
+		buf.Put( pPolyhedron->pVertices, CPolyhedron_LumpedMemory::DataSize( pPolyhedron->iVertexCount, pPolyhedron->iLineCount, pPolyhedron->iIndexCount, pPolyhedron->iPolygonCount ) );
+	}
+}
+
+void CStaticCollisionPolyhedronCache::SaveToDisk( CRC32_t cacheKey )
+{
+	CUtlVector<PolyhedronCacheFileEntry_t> Entries;
+	Entries.EnsureCapacity( m_BrushPolyhedrons.Count() + m_StaticPropPolyhedrons.Count() );
+	uint32 iDataSize = 0;
+	AddCacheFileEntries( m_BrushPolyhedrons, Entries, iDataSize );
+	AddCacheFileEntries( m_StaticPropPolyhedrons, Entries, iDataSize );
+
+	PolyhedronCacheFileHeader_t header;
+	header.ident = POLYHEDRONCACHE_FILE_IDENT;
+	header.version = POLYHEDRONCACHE_FILE_VERSION;
+	header.cacheKey = cacheKey;
+	header.iBrushPolyhedronCount = m_BrushPolyhedrons.Count();
+	header.iStaticPropPolyhedronCount = m_StaticPropPolyhedrons.Count();
+	header.iStaticPropInfoCount = m_CollideableIndicesMap.Count();
+	header.iDataSize = iDataSize;
+
+	CUtlBuffer buf;
+	buf.EnsureCapacity( sizeof( PolyhedronCacheFileHeader_t ) + 
+						(sizeof( StaticPropPolyhedronCacheInfo_t ) * header.iStaticPropInfoCount) + 
+						(sizeof( PolyhedronCacheFileEntry_t ) * Entries.Count()) +
+						iDataSize );
+
+	buf.Put( &header, sizeof( PolyhedronCacheFileHeader_t ) );
+
+	for( unsigned short i = m_CollideableIndicesMap.FirstInorder(); m_CollideableIndicesMap.IsValidIndex( i ); i = m_CollideableIndicesMap.NextInorder( i ) )
+	{
+		buf.Put( &m_CollideableIndicesMap.Element( i ), sizeof( StaticPropPolyhedronCacheInfo_t ) );
+	}
+
+	buf.Put( Entries.Base(), sizeof( PolyhedronCacheFileEntry_t ) * Entries.Count() );
+
+	PutCacheFileData( m_BrushPolyhedrons, buf );
+	PutCacheFileData( m_StaticPropPolyhedrons, buf );
+
+	char szCacheFile[MAX_PATH];
+	GetPolyhedronCacheFileName( szCacheFile, sizeof( szCacheFile ) );
+
+	filesystem->CreateDirHierarchy( "cache", POLYHEDRONCACHE_FILE_PATHID );
+	if( !filesystem->WriteFile( szCacheFile, POLYHEDRONCACHE_FILE_PATHID, buf ) )
+	{
+		DevWarning( "CStaticCollisionPolyhedronCache: Unable to write %s\n", szCacheFile );
+	}
+}
+
+bool CStaticCollisionPolyhedronCache::LoadFromDisk( CRC32_t cacheKey )
+{
+	Clear();
+
+	char szCacheFile[MAX_PATH];
+	GetPolyhedronCacheFileName( szCacheFile, sizeof( szCacheFile ) );
+
+	if( !filesystem->FileExists( szCacheFile, POLYHEDRONCACHE_FILE_PATHID ) ||
+		!filesystem->ReadFile( szCacheFile, POLYHEDRONCACHE_FILE_PATHID, m_DiskCache ) )
+	{
+		m_DiskCache.Purge();
+		return false;
+	}
+
+	//validate everything before we hand out pointers into the buffer
+	int iFileSize = m_DiskCache.TellPut();
+	const PolyhedronCacheFileHeader_t *pHeader = (const PolyhedronCacheFileHeader_t *)m_DiskCache.Base();
+	if( (iFileSize < (int)sizeof( PolyhedronCacheFileHeader_t )) ||
+		(pHeader->ident != POLYHEDRONCACHE_FILE_IDENT) ||
+		(pHeader->version != POLYHEDRONCACHE_FILE_VERSION) ||
+		(pHeader->cacheKey != cacheKey) ||
+		(pHeader->iBrushPolyhedronCount < 0) ||
+		(pHeader->iStaticPropPolyhedronCount < 0) ||
+		(pHeader->iStaticPropInfoCount < 0) )
+	{
+		m_DiskCache.Purge();
+		return false;
+	}
+
+	int iEntryCount = pHeader->iBrushPolyhedronCount + pHeader->iStaticPropPolyhedronCount;
+	size_t iExpectedSize = sizeof( PolyhedronCacheFileHeader_t ) + 
+							(sizeof( StaticPropPolyhedronCacheInfo_t ) * pHeader->iStaticPropInfoCount) + 
+							(sizeof( PolyhedronCacheFileEntry_t ) * iEntryCount) +
+							pHeader->iDataSize;
+
+	if( iExpectedSize != (size_t)iFileSize )
+	{
+		m_DiskCache.Purge();
+		return false;
+	}
+
+	const StaticPropPolyhedronCacheInfo_t *pStaticPropInfos = (const StaticPropPolyhedronCacheInfo_t *)(pHeader + 1);
+	const PolyhedronCacheFileEntry_t *pEntries = (const PolyhedronCacheFileEntry_t *)(pStaticPropInfos + pHeader->iStaticPropInfoCount);
+	uint8 *pData = (uint8 *)(pEntries + iEntryCount);
+
+	for( int i = 0; i != iEntryCount; ++i )
+	{
+		const PolyhedronCacheFileEntry_t &entry = pEntries[i];
+		if( entry.iDataOffset == POLYHEDRONCACHE_NULL_OFFSET )
+			continue;
+
+		size_t iDataSize = CPolyhedron_LumpedMemory::DataSize( entry.iVertexCount, entry.iLineCount, entry.iIndexCount, entry.iPolygonCount );
+		if( ((size_t)entry.iDataOffset + iDataSize) > pHeader->iDataSize ||
+			((entry.iDataOffset % sizeof( float )) != 0) ||
+			!ArePolyhedronCacheIndicesValid( entry, pData + entry.iDataOffset ) )
+		{
+			m_DiskCache.Purge();
+			return false;
+		}
+	}
+
+	for( int i = 0; i != pHeader->iStaticPropInfoCount; ++i )
+	{
+		const StaticPropPolyhedronCacheInfo_t &cacheInfo = pStaticPropInfos[i];
+		if( (cacheInfo.iStartIndex < 0) || (cacheInfo.iNumPolyhedrons < 0) || ((cacheInfo.iStartIndex + cacheInfo.iNumPolyhedrons) > pHeader->iStaticPropPolyhedronCount) )
+		{
+			m_DiskCache.Purge();
+			return false;
+		}
+	}
+
+	//Only the polyhedron headers need new memory, the vertex/line/index/polygon arrays are used straight out of the file buffer
+	if( pHeader->iBrushPolyhedronCount != 0 )
+		s_BrushPolyhedronMemory = new uint8 [sizeof( CPolyhedron_LumpedMemory ) * pHeader->iBrushPolyhedronCount];
+
+	if( pHeader->iStaticPropPolyhedronCount != 0 )
+		s_StaticPropPolyhedronMemory = new uint8 [sizeof( CPolyhedron_LumpedMemory ) * pHeader->iStaticPropPolyhedronCount];
+
+	m_BrushPolyhedrons.EnsureCapacity( pHeader->iBrushPolyhedronCount );
+	m_StaticPropPolyhedrons.EnsureCapacity( pHeader->iStaticPropPolyhedronCount );
+
+	for( int i = 0; i != iEntryCount; ++i )
+	{
+		const PolyhedronCacheFileEntry_t &entry = pEntries[i];
+		bool bBrush = (i < pHeader->iBrushPolyhedronCount);
+		CUtlVector<CPolyhedron *> &Polyhedrons = bBrush ? m_BrushPolyhedrons : m_StaticPropPolyhedrons;
+
+		if( entry.iDataOffset == POLYHEDRONCACHE_NULL_OFFSET )
+		{
+			Polyhedrons.AddToTail( NULL );
+			continue;
+		}
+
+		uint8 *pHeaderMemory = bBrush ? s_BrushPolyhedronMemory : s_StaticPropPolyhedronMemory;
+		pHeaderMemory += sizeof( CPolyhedron_LumpedMemory ) * Polyhedrons.Count();
+
+		Polyhedrons.AddToTail( CPolyhedron_LumpedMemory::CreateAt( pHeaderMemory, entry.iVertexCount, entry.iLineCount, entry.iIndexCount, entry.iPolygonCount, pData + entry.iDataOffset ) );
+	}
+
+	for( int i = 0; i != pHeader->iStaticPropInfoCount; ++i )
+	{
+		const StaticPropPolyhedronCacheInfo_t &cacheInfo = pStaticPropInfos[i];
+		ICollideable *pProp = staticpropmgr->GetStaticPropByIndex( cacheInfo.iStaticPropIndex );
+		if( pProp )
+			m_CollideableIndicesMap.InsertOrReplace( pProp, cacheInfo );
+	}
+
+	DevMsg( 2, "CStaticCollisionPolyhedronCache: Loaded %d brush and %d static prop polyhedrons from %s.\n", m_BrushPolyhedrons.Count(), m_StaticPropPolyhedrons.Count(), szCacheFile );
+
+	return true;
+}
+
+
+
 const CPolyhedron *CStaticCollisionPolyhedronCache::GetBrushPolyhedron( int iBrushNumber )
 {
 	Assert( iBrushNumber < m_BrushPolyhedrons.Count() );
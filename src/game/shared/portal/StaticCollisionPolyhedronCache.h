@@ -13,6 +13,8 @@
 #include "tier1/utlvector.h"
 #include "tier1/utlstring.h"
 #include "tier1/utlmap.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/checksum_crc.h"
 
 
 
@@ -29,8 +31,8 @@ public:
 	int GetStaticPropPolyhedrons( ICollideable *pStaticProp, CPolyhedron **pOutputPolyhedronArray, int iOutputArraySize );
 
 private:
-	// See comments in LevelInitPreEntity for why these members are commented out
-//	CUtlString	m_CachedMap;
+	CUtlString	m_CachedMap;
+	CRC32_t		m_CachedKey; //CRC of the bsp collision lumps and static prop layout that m_CachedMap was built from
 
 	CUtlVector<CPolyhedron *> m_BrushPolyhedrons;
 
@@ -45,8 +47,15 @@ private:
 	CUtlMap<ICollideable *, StaticPropPolyhedronCacheInfo_t> m_CollideableIndicesMap;
 
 
+	CUtlBuffer m_DiskCache; //backing store for polyhedron data when it was loaded from disk instead of generated
+
 	void Clear( void );
 	void Update( void );
+
+	CRC32_t ComputeCacheKey( void );
+	void RemapStaticPropCollideables( void ); //map restarted in place, static prop ICollideable pointers changed but the polyhedrons are still good
+	bool LoadFromDisk( CRC32_t cacheKey );
+	void SaveToDisk( CRC32_t cacheKey );
 };
 
 extern CStaticCollisionPolyhedronCache g_StaticCollisionPolyhedronCache;
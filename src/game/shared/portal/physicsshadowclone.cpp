@@ -22,12 +22,15 @@
 #endif
 
 #include "PortalSimulation.h"
+#include "tier0/vprof.h"
 
 #define MAX_SHADOW_CLONE_COUNT 200
 
-static int g_iShadowCloneCount = 0;
+static int g_iShadowCloneCount = 0; //includes pooled clones, they're still entities
 ConVar sv_debug_physicsshadowclones("sv_debug_physicsshadowclones", "0", FCVAR_REPLICATED );
 ConVar sv_use_shadow_clones( "sv_use_shadow_clones", "1", FCVAR_REPLICATED | FCVAR_CHEAT ); //should we create shadow clones?
+ConVar sv_shadow_clone_pool_size( "sv_shadow_clone_pool_size", "32", FCVAR_REPLICATED | FCVAR_CHEAT, "Number of freed shadow clones kept around for reuse by objects with the same collision model." );
+ConVar sv_shadow_clone_dirty_sync( "sv_shadow_clone_dirty_sync", "1", FCVAR_REPLICATED | FCVAR_CHEAT, "Skip the per frame full sync of shadow clones whose source object hasn't changed since the last one." );
 
 static void DrawDebugOverlayForShadowClone( CPhysicsShadowClone *pClone );
 
@@ -38,6 +41,7 @@ LINK_ENTITY_TO_CLASS( physicsshadowclone, CPhysicsShadowClone );
 #endif
 
 static CUtlVector<CPhysicsShadowClone *> s_ActiveShadowClones;
+static CUtlVector<CPhysicsShadowClone *> s_PooledShadowClones; //freed clones waiting for a source with the same collision model, most recently freed at the tail
 CUtlVector<CPhysicsShadowClone *> const &CPhysicsShadowClone::g_ShadowCloneList = s_ActiveShadowClones;
 #ifdef GAME_DLL
 static bool s_IsShadowClone[MAX_EDICTS] = { false };
@@ -80,6 +84,7 @@ CPhysicsShadowClone::CPhysicsShadowClone( void )
 	m_matrixShadowTransform.Identity();
 	m_matrixShadowTransform_Inverse.Identity();
 	m_bShadowTransformIsIdentity = true;
+	m_bSyncStateValid = false;
 	s_ActiveShadowClones.AddToTail( this );
 
 #ifdef CLIENT_DLL
@@ -104,7 +109,7 @@ CPhysicsShadowClone::~CPhysicsShadowClone( void )
 #endif
 }
 
-void CPhysicsShadowClone::UpdateOnRemove( void )
+void CPhysicsShadowClone::UnlinkFromClonedEntity( void )
 {
 	CBaseEntity *pSource = m_hClonedEntity;
 	if( pSource )
@@ -131,6 +136,15 @@ void CPhysicsShadowClone::UpdateOnRemove( void )
 		}
 		s_SCLLManager.Free( pFind );
 	}
+}
+
+void CPhysicsShadowClone::UpdateOnRemove( void )
+{
+	CBaseEntity *pSource = m_hClonedEntity;
+	if( pSource )
+	{
+		UnlinkFromClonedEntity();
+	}
 #ifdef _DEBUG
 	else
 	{
@@ -150,6 +164,13 @@ void CPhysicsShadowClone::UpdateOnRemove( void )
 	VPhysicsSetObject( NULL );
 	m_hClonedEntity = NULL;
 	s_ActiveShadowClones.FindAndRemove( this ); //also removed in Destructor
+
+	if( s_PooledShadowClones.FindAndRemove( this ) )
+	{
+		//removed while parked (level change), Free() won't be called for it again
+		--g_iShadowCloneCount;
+	}
+
 	BaseClass::UpdateOnRemove();
 }
 
@@ -369,6 +390,8 @@ void CPhysicsShadowClone::FullSync( bool bAllowAssumedSync )
 	if( bBigChanges )
 		CollisionRulesChanged();
 
+	CaptureSyncState();
+
 	if( sv_debug_physicsshadowclones.GetBool() )
 		DrawDebugOverlayForShadowClone( this );
 }
@@ -777,6 +800,8 @@ void CPhysicsShadowClone::FullSyncClonedPhysicsObjects( bool bTeleport )
 
 void CPhysicsShadowClone::PartialSync( bool bPullChanges )
 {
+	m_bSyncStateValid = false;
+
 	VMatrix *pTransform;
 	
 	if( bPullChanges )
@@ -820,6 +845,9 @@ int CPhysicsShadowClone::VPhysicsGetObjectList( IPhysicsObject **pList, int list
 
 void CPhysicsShadowClone::VPhysicsDestroyObject( void )
 {
+	m_CloneSyncStates.RemoveAll();
+	m_bSyncStateValid = false;
+
 	VPhysicsSetObject( NULL );
 	
 	for( int i = m_CloneLinks.Count(); --i >= 0; )
@@ -1005,23 +1033,33 @@ CPhysicsShadowClone *CPhysicsShadowClone::CreateShadowClone( IPhysicsEnvironment
 		return NULL;
 	}*/
 
-	// Too many shadow clones breaks the game (too many entities)
-	if( g_iShadowCloneCount >= MAX_SHADOW_CLONE_COUNT )
+	CPhysicsShadowClone *pClone = TakeFromPool( pInPhysicsEnvironment, pClonedEntity );
+	bool bFromPool = (pClone != NULL);
+
+	if( !bFromPool )
 	{
-		AssertMsg( false, "Too many shadow clones, consider upping the limit or reducing the level's physics props" );
-		return NULL;
-	}
-	++g_iShadowCloneCount;
+		// Too many shadow clones breaks the game (too many entities). Parked clones are the first to go
+		while( (g_iShadowCloneCount >= MAX_SHADOW_CLONE_COUNT) && (s_PooledShadowClones.Count() != 0) )
+			EvictFromPool();
+
+		if( g_iShadowCloneCount >= MAX_SHADOW_CLONE_COUNT )
+		{
+			AssertMsg( false, "Too many shadow clones, consider upping the limit or reducing the level's physics props" );
+			return NULL;
+		}
+		++g_iShadowCloneCount;
 
 #ifdef GAME_DLL
-	CPhysicsShadowClone *pClone = (CPhysicsShadowClone*)CreateEntityByName("physicsshadowclone");
+		pClone = (CPhysicsShadowClone*)CreateEntityByName("physicsshadowclone");
 #else
-	CPhysicsShadowClone *pClone = new CPhysicsShadowClone();
+		pClone = new CPhysicsShadowClone();
 #endif
 #ifdef GAME_DLL
-	s_IsShadowClone[pClone->entindex()] = true;
+		s_IsShadowClone[pClone->entindex()] = true;
 #endif
-	pClone->m_pOwnerPhysEnvironment = pInPhysicsEnvironment;
+		pClone->m_pOwnerPhysEnvironment = pInPhysicsEnvironment;
+	}
+
 	pClone->m_hClonedEntity = hEntToClone;
 	DBG_CODE_NOSCOPE( pClone->m_szDebugMarker = szDebugMarker; );
 
@@ -1043,18 +1081,136 @@ CPhysicsShadowClone *CPhysicsShadowClone::CreateShadowClone( IPhysicsEnvironment
 			}
 		}
 	}
+	else if( bFromPool )
+	{
+		pClone->m_matrixShadowTransform.Identity();
+		pClone->m_matrixShadowTransform_Inverse.Identity();
+		pClone->m_bShadowTransformIsIdentity = true;
+	}
 
+	if( bFromPool )
+	{
+		//already spawned, the physics objects just need to be pulled over to the new source
+		VPROF_INCREMENT_COUNTER( "CPhysicsShadowClone pool hits", 1 );
+		pClone->m_bInAssumedSyncState = false;
+		pClone->FullSync( false );
+	}
+	else
+	{
 #ifdef GAME_DLL
-	DispatchSpawn( pClone );
+		DispatchSpawn( pClone );
 #else
-	pClone->Spawn();
+		pClone->Spawn();
 #endif
+	}
 
 	return pClone;
 }
 
+CPhysicsShadowClone *CPhysicsShadowClone::TakeFromPool( IPhysicsEnvironment *pInPhysicsEnvironment, CBaseEntity *pClonedEntity )
+{
+	if( s_PooledShadowClones.Count() == 0 )
+		return NULL;
+
+	IPhysicsObject *pSourceObjects[1024];
+	int iObjectCount = pClonedEntity->VPhysicsGetObjectList( pSourceObjects, 1024 );
+
+	for( int i = s_PooledShadowClones.Count(); --i >= 0; )
+	{
+		CPhysicsShadowClone *pClone = s_PooledShadowClones[i];
+
+		if( (pClone->m_pOwnerPhysEnvironment != pInPhysicsEnvironment) ||
+			(pClone->m_CloneLinks.Count() != iObjectCount) ||
+			pClone->IsMarkedForDeletion() )
+		{
+			continue;
+		}
+
+		//every object has to be built from the same collision model for the existing clones to stand in for it
+		int j;
+		for( j = 0; j != iObjectCount; ++j )
+		{
+			if( (pSourceObjects[j] == NULL) || (pSourceObjects[j]->GetCollide() != pClone->m_CloneLinks[j].pClone->GetCollide()) )
+				break;
+		}
+
+		if( j != iObjectCount )
+			continue;
+
+		for( j = 0; j != iObjectCount; ++j )
+		{
+			pClone->m_CloneLinks[j].pSource = pSourceObjects[j];
+		}
+
+		s_PooledShadowClones.Remove( i );
+		s_ActiveShadowClones.AddToTail( pClone );
+		return pClone;
+	}
+
+	return NULL;
+}
+
+bool CPhysicsShadowClone::ReturnToPool( void )
+{
+	if( s_PooledShadowClones.Count() >= sv_shadow_clone_pool_size.GetInt() )
+		return false;
+
+	if( IsMarkedForDeletion() || (m_CloneLinks.Count() == 0) )
+		return false;
+
+	UnlinkFromClonedEntity();
+	m_hClonedEntity = NULL;
+
+	//keep the objects, but make sure they can't affect anything while parked
+	for( int i = m_CloneLinks.Count(); --i >= 0; )
+	{
+		IPhysicsObject *pClonePhysics = m_CloneLinks[i].pClone;
+
+		if( pClonePhysics->GetShadowController() != NULL )
+			pClonePhysics->RemoveShadowController();
+
+		pClonePhysics->EnableCollisions( false );
+		pClonePhysics->EnableMotion( false );
+		pClonePhysics->Sleep();
+
+		m_CloneLinks[i].pSource = NULL;
+	}
+
+	m_CloneSyncStates.RemoveAll();
+	m_bSyncStateValid = false;
+	m_bInAssumedSyncState = false;
+
+	SetMoveType( MOVETYPE_NONE );
+	SetSolid( SOLID_NONE );
+	SetSolidFlags( 0 );
+	SetCollisionGroup( COLLISION_GROUP_NONE );
+
+	s_ActiveShadowClones.FindAndRemove( this );
+	s_PooledShadowClones.AddToTail( this );
+	return true;
+}
+
+void CPhysicsShadowClone::EvictFromPool( void )
+{
+	CPhysicsShadowClone *pClone = s_PooledShadowClones[0];
+	s_PooledShadowClones.Remove( 0 );
+
+	pClone->VPhysicsDestroyObject();
+
+#ifdef GAME_DLL
+	UTIL_Remove( pClone );
+#else
+	pClone->Remove();
+#endif
+
+	--g_iShadowCloneCount;
+}
+
 void CPhysicsShadowClone::Free( void )
 {
+	if( ReturnToPool() )
+		return;
+
 	VPhysicsDestroyObject();
 
 #ifdef GAME_DLL
@@ -1070,10 +1226,148 @@ void CPhysicsShadowClone::Free( void )
 
 void CPhysicsShadowClone::FullSyncAllClones( void )
 {
+	VPROF_BUDGET( "CPhysicsShadowClone::FullSyncAllClones", VPROF_BUDGETGROUP_PHYSICS );
+	VPROF_INCREMENT_COUNTER( "CPhysicsShadowClone active", s_ActiveShadowClones.Count() );
+	VPROF_INCREMENT_COUNTER( "CPhysicsShadowClone pooled", s_PooledShadowClones.Count() );
+
+	bool bDirtySync = sv_shadow_clone_dirty_sync.GetBool();
+
 	for( int i = s_ActiveShadowClones.Count(); --i >= 0; )
 	{
-		s_ActiveShadowClones[i]->FullSync( true );
+		CPhysicsShadowClone *pClone = s_ActiveShadowClones[i];
+
+		if( bDirtySync && !pClone->IsSyncStateDirty() )
+		{
+			VPROF_INCREMENT_COUNTER( "CPhysicsShadowClone syncs skipped", 1 );
+			if( sv_debug_physicsshadowclones.GetBool() )
+				DrawDebugOverlayForShadowClone( pClone );
+
+			continue;
+		}
+
+		VPROF_INCREMENT_COUNTER( "CPhysicsShadowClone syncs", 1 );
+		pClone->FullSync( true );
+	}
+}
+
+
+#define SHADOWCLONE_SYNC_SOURCE_COLLISIONS	(1<<0)
+#define SHADOWCLONE_SYNC_SOURCE_GRAVITY		(1<<1)
+#define SHADOWCLONE_SYNC_SOURCE_DRAG		(1<<2)
+#define SHADOWCLONE_SYNC_SOURCE_MOTION		(1<<3)
+#define SHADOWCLONE_SYNC_SOURCE_ASLEEP		(1<<4)
+#define SHADOWCLONE_SYNC_CLONE_COLLISIONS	(1<<5)
+#define SHADOWCLONE_SYNC_CLONE_GRAVITY		(1<<6)
+#define SHADOWCLONE_SYNC_CLONE_MOTION		(1<<7)
+#define SHADOWCLONE_SYNC_CLONE_ASLEEP		(1<<8)
+
+static void CapturePhysicsObjectSyncState( IPhysicsObject *pSource, IPhysicsObject *pClone, PhysicsObjectCloneSyncState_t &state )
+{
+	memset( &state, 0, sizeof( PhysicsObjectCloneSyncState_t ) ); //compared with memcmp()
+
+	pSource->GetPosition( &state.ptSourcePosition, &state.qSourceAngles );
+	pSource->GetVelocity( &state.vSourceVelocity, &state.vSourceAngularVelocity );
+	pClone->GetPosition( &state.ptClonePosition, &state.qCloneAngles );
+	pClone->GetVelocity( &state.vCloneVelocity, &state.vCloneAngularVelocity );
+
+	state.fSourceMass = pSource->GetMass();
+	pSource->GetDamping( &state.fSourceSpeedDamping, &state.fSourceRotationalDamping );
+	state.iSourceGameFlags = pSource->GetGameFlags();
+	state.iSourceContents = pSource->GetContents();
+	state.iSourceMaterialIndex = pSource->GetMaterialIndex();
+	state.iSourceCallbackFlags = pSource->GetCallbackFlags();
+
+	state.iEnableBits = (pSource->IsCollisionEnabled() ? SHADOWCLONE_SYNC_SOURCE_COLLISIONS : 0) |
+						(pSource->IsGravityEnabled() ? SHADOWCLONE_SYNC_SOURCE_GRAVITY : 0) |
+						(pSource->IsDragEnabled() ? SHADOWCLONE_SYNC_SOURCE_DRAG : 0) |
+						(pSource->IsMotionEnabled() ? SHADOWCLONE_SYNC_SOURCE_MOTION : 0) |
+						(pSource->IsAsleep() ? SHADOWCLONE_SYNC_SOURCE_ASLEEP : 0) |
+						(pClone->IsCollisionEnabled() ? SHADOWCLONE_SYNC_CLONE_COLLISIONS : 0) |
+						(pClone->IsGravityEnabled() ? SHADOWCLONE_SYNC_CLONE_GRAVITY : 0) |
+						(pClone->IsMotionEnabled() ? SHADOWCLONE_SYNC_CLONE_MOTION : 0) |
+						(pClone->IsAsleep() ? SHADOWCLONE_SYNC_CLONE_ASLEEP : 0);
+}
+
+static void CaptureEntitySyncState( CBaseEntity *pSource, CBaseEntity *pClone, int iSourceObjectCount, ShadowCloneEntitySyncState_t &state )
+{
+	memset( &state, 0, sizeof( ShadowCloneEntitySyncState_t ) ); //compared with memcmp()
+
+	state.ptSourceOrigin = pSource->GetAbsOrigin();
+	state.qSourceAngles = pSource->GetAbsAngles();
+	state.vSourceVelocity = pSource->GetAbsVelocity();
+	state.ptCloneOrigin = pClone->GetAbsOrigin();
+	state.qCloneAngles = pClone->GetAbsAngles();
+	state.vCloneVelocity = pClone->GetAbsVelocity();
+
+	CCollisionProperty *pSourceCollisionProp = pSource->CollisionProp();
+	state.vSourceMins = pSourceCollisionProp->OBBMins();
+	state.vSourceMaxs = pSourceCollisionProp->OBBMaxs();
+
+	state.iSourceMoveType = pSource->GetMoveType();
+	state.iSourceMoveCollide = pSource->GetMoveCollide();
+	state.iSourceSolid = pSource->GetSolid();
+	state.iSourceSolidFlags = pSource->GetSolidFlags();
+	state.iSourceCollisionGroup = pSource->GetCollisionGroup();
+	state.iSourceEffects = pSource->GetEffects();
+	state.iSourceModelIndex = pSource->GetModelIndex();
+	state.iSourceObjectCount = iSourceObjectCount;
+}
+
+void CPhysicsShadowClone::CaptureSyncState( void )
+{
+	m_bSyncStateValid = false;
+
+	CBaseEntity *pClonedEntity = m_hClonedEntity.Get();
+	if( pClonedEntity == NULL )
+		return;
+
+	CaptureEntitySyncState( pClonedEntity, this, m_CloneLinks.Count(), m_EntitySyncState );
+
+	m_CloneSyncStates.SetCount( m_CloneLinks.Count() );
+	for( int i = m_CloneLinks.Count(); --i >= 0; )
+	{
+		CapturePhysicsObjectSyncState( m_CloneLinks[i].pSource, m_CloneLinks[i].pClone, m_CloneSyncStates[i] );
 	}
+
+	m_bSyncStateValid = true;
+}
+
+bool CPhysicsShadowClone::IsSyncStateDirty( void )
+{
+	if( !m_bSyncStateValid )
+		return true;
+
+	CBaseEntity *pClonedEntity = m_hClonedEntity.Get();
+	if( pClonedEntity == NULL )
+		return true;
+
+	IPhysicsObject *pSourceObjects[1024];
+	int iObjectCount = pClonedEntity->VPhysicsGetObjectList( pSourceObjects, 1024 );
+
+	ShadowCloneEntitySyncState_t entityState;
+	CaptureEntitySyncState( pClonedEntity, this, iObjectCount, entityState );
+	if( memcmp( &entityState, &m_EntitySyncState, sizeof( ShadowCloneEntitySyncState_t ) ) != 0 )
+		return true;
+
+	Assert( m_CloneSyncStates.Count() == m_CloneLinks.Count() );
+
+	for( int i = 0; i != iObjectCount; ++i )
+	{
+		IPhysicsObject *pSource = pSourceObjects[i];
+		if( pSource != m_CloneLinks[i].pSource )
+			return true;
+
+		//shadow controller targets and held object parameters move every frame without showing up in the snapshot
+		if( (pSource->GetShadowController() != NULL) || (pSource->GetGameFlags() & FVPHYSICS_PLAYER_HELD) )
+			return true;
+
+		PhysicsObjectCloneSyncState_t state;
+		CapturePhysicsObjectSyncState( pSource, m_CloneLinks[i].pClone, state );
+		if( memcmp( &state, &m_CloneSyncStates[i], sizeof( PhysicsObjectCloneSyncState_t ) ) != 0 )
+			return true;
+	}
+
+	return false;
 }
 
 
@@ -31,6 +31,47 @@ struct PhysicsObjectCloneLink_t
 	IPhysicsObject *pClone;
 };
 
+//snapshot of a linked pair taken after a full sync, if nothing in it changes the next full sync would be a no-op
+struct PhysicsObjectCloneSyncState_t
+{
+	Vector ptSourcePosition;
+	QAngle qSourceAngles;
+	Vector vSourceVelocity;
+	Vector vSourceAngularVelocity;
+	Vector ptClonePosition;
+	QAngle qCloneAngles;
+	Vector vCloneVelocity;
+	Vector vCloneAngularVelocity;
+	float fSourceMass;
+	float fSourceSpeedDamping;
+	float fSourceRotationalDamping;
+	unsigned int iSourceGameFlags;
+	unsigned int iSourceContents;
+	int iSourceMaterialIndex;
+	unsigned short iSourceCallbackFlags;
+	unsigned short iEnableBits; //collision/gravity/drag/motion/sleep state of both objects
+};
+
+struct ShadowCloneEntitySyncState_t
+{
+	Vector ptSourceOrigin;
+	QAngle qSourceAngles;
+	Vector vSourceVelocity;
+	Vector ptCloneOrigin;
+	QAngle qCloneAngles;
+	Vector vCloneVelocity;
+	Vector vSourceMins;
+	Vector vSourceMaxs;
+	int iSourceMoveType;
+	int iSourceMoveCollide;
+	int iSourceSolid;
+	int iSourceSolidFlags;
+	int iSourceCollisionGroup;
+	int iSourceEffects;
+	int iSourceModelIndex;
+	int iSourceObjectCount;
+};
+
 struct CPhysicsShadowCloneLL
 {
 	CPhysicsShadowClone *pClone;
@@ -53,9 +94,23 @@ private:
 	bool			m_bImmovable; //cloning a track train or door, something that doesn't really work on a force-based level
 	bool			m_bInAssumedSyncState;
 
+	CUtlVector<PhysicsObjectCloneSyncState_t> m_CloneSyncStates; //parallel to m_CloneLinks, what the last full sync left behind
+	ShadowCloneEntitySyncState_t m_EntitySyncState;
+	bool			m_bSyncStateValid;
+
 	void			FullSyncClonedPhysicsObjects( bool bTeleport );
 	void			SyncEntity( bool bPullChanges );
 
+	//dirty tracking, lets FullSyncAllClones() skip clones whose source hasn't changed since the last full sync
+	void			CaptureSyncState( void );
+	bool			IsSyncStateDirty( void );
+
+	//unused clones are parked with their physics objects intact so the next clone of the same collision model can skip creating them
+	void			UnlinkFromClonedEntity( void );
+	bool			ReturnToPool( void );
+	static CPhysicsShadowClone *TakeFromPool( IPhysicsEnvironment *pInPhysicsEnvironment, CBaseEntity *pClonedEntity );
+	static void		EvictFromPool( void ); //destroys the least recently pooled clone to make room for a new one
+
 	IPhysicsEnvironment *m_pOwnerPhysEnvironment; //clones exist because of multi-environment situations
 
 
@@ -10,6 +10,9 @@
 #include "collisionutils.h"
 #include "decals.h"
 #include "debugoverlay_shared.h"
+#include "igamesystem.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlhashtable.h"
 
 #ifdef GAME_DLL
 #include "func_noportal_volume.h"
@@ -56,6 +59,109 @@ ConVar sv_portal_placement_never_bump ("sv_portal_placement_never_bump", "0", FC
 
 bool g_bTest = true;
 
+
+//-----------------------------------------------------------------------------
+// Per shot counters so the cost of placement can be looked at without a profiler
+//-----------------------------------------------------------------------------
+struct PortalPlacementStats_t
+{
+	int iShots;
+	int iTraces;
+	int iEntityClips;
+	int iBumperQueries;
+	int iMaterialHits;
+	int iMaterialMisses;
+	int iNoPortalVolumeTests;
+	double fTotalTime;
+	double fMaxTime;
+};
+
+static PortalPlacementStats_t s_PortalPlacementStats;
+
+static inline void PortalPlacementTraceLine( const Vector &vStart, const Vector &vEnd, unsigned int iMask, ITraceFilter *pFilter, trace_t *pTrace )
+{
+	++s_PortalPlacementStats.iTraces;
+	UTIL_TraceLine( vStart, vEnd, iMask, pFilter, pTrace );
+}
+
+static inline void PortalPlacementTraceRay( const Ray_t &ray, unsigned int iMask, ITraceFilter *pFilter, trace_t *pTrace )
+{
+	++s_PortalPlacementStats.iTraces;
+	enginetrace->TraceRay( ray, iMask, pFilter, pTrace );
+}
+
+static inline void PortalPlacementClipRayToEntity( const Ray_t &ray, unsigned int iMask, CBaseEntity *pEntity, trace_t *pTrace )
+{
+	++s_PortalPlacementStats.iEntityClips;
+	enginetrace->ClipRayToEntity( ray, iMask, pEntity, pTrace );
+}
+
+
+//-----------------------------------------------------------------------------
+// Whether a surface can take a portal depends only on its material, flags and
+// surface properties, none of which change for the life of a map. Surface names
+// handed back in traces point at the map's material names, so the portal surface
+// map remembers the answer per name pointer and a shot at an unportalable wall
+// costs one hash lookup rather than a surface data lookup and a lowercase
+// substring search per pass through material.
+//
+// It also keeps a bounding volume tree of the func_noportal_volumes so placement
+// only runs the box/portal tests against the volumes near the portal.
+//-----------------------------------------------------------------------------
+enum PortalSurfaceClass_t
+{
+	PSC_NOPORTAL =		(1<<0),
+	PSC_PASSTHROUGH =	(1<<1),
+};
+
+struct PortalSurfaceClassEntry_t
+{
+	unsigned short iFlags;		//surface flags and props the class was worked out from, a mismatch means reclassify
+	short iSurfaceProps;
+	unsigned char iClass;
+};
+
+struct NoPortalVolumeTreeNode_t
+{
+	Vector vMins;
+	Vector vMaxs;
+	int iFirstChild;	//children are at iFirstChild and iFirstChild + 1, -1 for leaves
+	int iVolume;		//index into m_TreeVolumes for leaves
+};
+
+class CPortalSurfaceMap : public CAutoGameSystem
+{
+public:
+	CPortalSurfaceMap( void ) : CAutoGameSystem( "CPortalSurfaceMap" ), m_bTreeDirty( true ) { }
+
+	virtual void LevelInitPostEntity( void );
+	virtual void LevelShutdownPostEntity( void );
+
+	int GetSurfaceClass( const csurface_t &surface );
+	int GetSurfaceClassCount( void ) const { return m_SurfaceClasses.Count(); }
+
+	void InvalidateNoPortalVolumes( void ) { m_bTreeDirty = true; }
+	void GetNoPortalVolumesNear( const Vector &vMins, const Vector &vMaxs, CUtlVector<CFuncNoPortalVolume *> &volumes );
+	int GetNoPortalVolumeCount( void ) const { return m_TreeVolumes.Count() + m_LooseVolumes.Count(); }
+
+private:
+	CUtlHashtable<const void *, PortalSurfaceClassEntry_t> m_SurfaceClasses;
+
+	CUtlVector<NoPortalVolumeTreeNode_t> m_TreeNodes;
+	CUtlVector< CHandle<CFuncNoPortalVolume> > m_TreeVolumes;
+	CUtlVector<Vector> m_TreeVolumeOrigins; //where each tree volume was when its bounds were baked
+	CUtlVector<QAngle> m_TreeVolumeAngles;
+	CUtlVector< CHandle<CFuncNoPortalVolume> > m_LooseVolumes; //parented or moving volumes, their bounds can't be baked
+	bool m_bTreeDirty;
+
+	bool AreNoPortalVolumesStale( void ) const;
+	void BuildNoPortalVolumeTree( void );
+	int BuildNoPortalVolumeTreeNode( int *pVolumes, int iVolumeCount, const CUtlVector<Vector> &Mins, const CUtlVector<Vector> &Maxs );
+};
+
+static CPortalSurfaceMap s_PortalSurfaceMap;
+
+
 bool IsMaterialInList( const csurface_t &surface, char *g_ppszMaterials[] )
 {
 	char szLowerName[ 256 ];
@@ -75,7 +181,7 @@ bool IsMaterialInList( const csurface_t &surface, char *g_ppszMaterials[] )
 	return false;
 }
 
-bool IsNoPortalMaterial( const csurface_t &surface )
+static bool ClassifyNoPortalMaterial( const csurface_t &surface )
 {
 	if ( surface.flags & SURF_NOPORTAL )
 		return true;
@@ -91,7 +197,7 @@ bool IsNoPortalMaterial( const csurface_t &surface )
 	return false;
 }
 
-bool IsPassThroughMaterial( const csurface_t &surface )
+static bool ClassifyPassThroughMaterial( const csurface_t &surface )
 {
 	if ( surface.flags & SURF_SKY )
 		return true;
@@ -102,6 +208,238 @@ bool IsPassThroughMaterial( const csurface_t &surface )
 	return false;
 }
 
+bool IsNoPortalMaterial( const csurface_t &surface )
+{
+	return ( s_PortalSurfaceMap.GetSurfaceClass( surface ) & PSC_NOPORTAL ) != 0;
+}
+
+bool IsPassThroughMaterial( const csurface_t &surface )
+{
+	return ( s_PortalSurfaceMap.GetSurfaceClass( surface ) & PSC_PASSTHROUGH ) != 0;
+}
+
+void InvalidateNoPortalVolumeTree( void )
+{
+	s_PortalSurfaceMap.InvalidateNoPortalVolumes();
+}
+
+
+void CPortalSurfaceMap::LevelInitPostEntity( void )
+{
+	// Every map spawned volume has its model bound by now, bake them before the first shot
+	BuildNoPortalVolumeTree();
+}
+
+void CPortalSurfaceMap::LevelShutdownPostEntity( void )
+{
+	m_SurfaceClasses.RemoveAll();
+	m_TreeNodes.RemoveAll();
+	m_TreeVolumes.RemoveAll();
+	m_TreeVolumeOrigins.RemoveAll();
+	m_TreeVolumeAngles.RemoveAll();
+	m_LooseVolumes.RemoveAll();
+	m_bTreeDirty = true;
+}
+
+int CPortalSurfaceMap::GetSurfaceClass( const csurface_t &surface )
+{
+	if ( surface.name == NULL )
+	{
+		return ( ClassifyNoPortalMaterial( surface ) ? PSC_NOPORTAL : 0 ) | ( ClassifyPassThroughMaterial( surface ) ? PSC_PASSTHROUGH : 0 );
+	}
+
+	UtlHashHandle_t hClass = m_SurfaceClasses.Find( surface.name );
+	if ( hClass != m_SurfaceClasses.InvalidHandle() )
+	{
+		const PortalSurfaceClassEntry_t &entry = m_SurfaceClasses.Element( hClass );
+		if ( (entry.iFlags == surface.flags) && (entry.iSurfaceProps == surface.surfaceProps) )
+		{
+			++s_PortalPlacementStats.iMaterialHits;
+			return entry.iClass;
+		}
+	}
+
+	++s_PortalPlacementStats.iMaterialMisses;
+
+	PortalSurfaceClassEntry_t entry;
+	entry.iFlags = surface.flags;
+	entry.iSurfaceProps = surface.surfaceProps;
+	entry.iClass = ( ClassifyNoPortalMaterial( surface ) ? PSC_NOPORTAL : 0 ) | ( ClassifyPassThroughMaterial( surface ) ? PSC_PASSTHROUGH : 0 );
+
+	if ( hClass != m_SurfaceClasses.InvalidHandle() )
+		m_SurfaceClasses.Element( hClass ) = entry;
+	else
+		m_SurfaceClasses.Insert( surface.name, entry );
+
+	return entry.iClass;
+}
+
+void CPortalSurfaceMap::BuildNoPortalVolumeTree( void )
+{
+	m_TreeNodes.RemoveAll();
+	m_TreeVolumes.RemoveAll();
+	m_TreeVolumeOrigins.RemoveAll();
+	m_TreeVolumeAngles.RemoveAll();
+	m_LooseVolumes.RemoveAll();
+	m_bTreeDirty = false;
+
+	CUtlVector<Vector> Mins, Maxs;
+
+	for ( CFuncNoPortalVolume *pNoPortalEnt = GetNoPortalVolumeList(); pNoPortalEnt != NULL; pNoPortalEnt = pNoPortalEnt->m_pNext )
+	{
+		if ( (pNoPortalEnt->GetMoveParent() != NULL) || (pNoPortalEnt->GetMoveType() != MOVETYPE_NONE) || (pNoPortalEnt->GetCollideable() == NULL) )
+		{
+			m_LooseVolumes.AddToTail( pNoPortalEnt );
+			continue;
+		}
+
+		int iVolume = m_TreeVolumes.AddToTail( pNoPortalEnt );
+		m_TreeVolumeOrigins.AddToTail( pNoPortalEnt->GetAbsOrigin() );
+		m_TreeVolumeAngles.AddToTail( pNoPortalEnt->GetAbsAngles() );
+		Mins.AddToTail();
+		Maxs.AddToTail();
+		pNoPortalEnt->GetCollideable()->WorldSpaceSurroundingBounds( &Mins[iVolume], &Maxs[iVolume] );
+	}
+
+	if ( m_TreeVolumes.Count() == 0 )
+		return;
+
+	int *pVolumes = (int *)stackalloc( sizeof( int ) * m_TreeVolumes.Count() );
+	for ( int i = 0; i != m_TreeVolumes.Count(); ++i )
+	{
+		pVolumes[i] = i;
+	}
+
+	m_TreeNodes.EnsureCapacity( m_TreeVolumes.Count() * 2 - 1 );
+	m_TreeNodes.AddToTail(); //root
+	int iRoot = BuildNoPortalVolumeTreeNode( pVolumes, m_TreeVolumes.Count(), Mins, Maxs );
+	m_TreeNodes[0] = m_TreeNodes[iRoot];
+	m_TreeNodes.FastRemove( iRoot );
+}
+
+int CPortalSurfaceMap::BuildNoPortalVolumeTreeNode( int *pVolumes, int iVolumeCount, const CUtlVector<Vector> &Mins, const CUtlVector<Vector> &Maxs )
+{
+	NoPortalVolumeTreeNode_t node;
+	node.vMins = Mins[pVolumes[0]];
+	node.vMaxs = Maxs[pVolumes[0]];
+	node.iFirstChild = -1;
+	node.iVolume = pVolumes[0];
+
+	for ( int i = 1; i < iVolumeCount; ++i )
+	{
+		VectorMin( node.vMins, Mins[pVolumes[i]], node.vMins );
+		VectorMax( node.vMaxs, Maxs[pVolumes[i]], node.vMaxs );
+	}
+
+	if ( iVolumeCount > 1 )
+	{
+		// Split around the mean center on the longest axis
+		Vector vSize = node.vMaxs - node.vMins;
+		int iAxis = ( vSize.x > vSize.y ) ? ( ( vSize.x > vSize.z ) ? 0 : 2 ) : ( ( vSize.y > vSize.z ) ? 1 : 2 );
+
+		float fSplit = 0.0f;
+		for ( int i = 0; i < iVolumeCount; ++i )
+		{
+			fSplit += Mins[pVolumes[i]][iAxis] + Maxs[pVolumes[i]][iAxis];
+		}
+		fSplit /= (float)iVolumeCount;
+
+		int iFront = 0;
+		for ( int i = 0; i < iVolumeCount; ++i )
+		{
+			if ( (Mins[pVolumes[i]][iAxis] + Maxs[pVolumes[i]][iAxis]) < fSplit )
+			{
+				V_swap( pVolumes[i], pVolumes[iFront] );
+				++iFront;
+			}
+		}
+
+		// All the centers landed on one side, just halve the list
+		if ( (iFront == 0) || (iFront == iVolumeCount) )
+			iFront = iVolumeCount / 2;
+
+		node.iFirstChild = m_TreeNodes.AddMultipleToTail( 2 );
+		node.iVolume = -1;
+
+		int iFirstChild = node.iFirstChild;
+		int iChild = BuildNoPortalVolumeTreeNode( pVolumes, iFront, Mins, Maxs );
+		m_TreeNodes[iFirstChild] = m_TreeNodes[iChild];
+		m_TreeNodes.FastRemove( iChild );
+
+		iChild = BuildNoPortalVolumeTreeNode( pVolumes + iFront, iVolumeCount - iFront, Mins, Maxs );
+		m_TreeNodes[iFirstChild + 1] = m_TreeNodes[iChild];
+		m_TreeNodes.FastRemove( iChild );
+	}
+
+	return m_TreeNodes.AddToTail( node );
+}
+
+//-----------------------------------------------------------------------------
+// A volume that was static when the tree was built can be parented, given a
+// movetype or teleported later, and none of those tell us. Check every baked
+// volume against what it looked like at build time instead. A volume that
+// fails goes in the loose list when the tree is rebuilt, so this doesn't
+// rebuild again for it.
+//-----------------------------------------------------------------------------
+bool CPortalSurfaceMap::AreNoPortalVolumesStale( void ) const
+{
+	for ( int i = 0; i != m_TreeVolumes.Count(); ++i )
+	{
+		CFuncNoPortalVolume *pVolume = m_TreeVolumes[i];
+		if ( pVolume == NULL )
+			continue;
+
+		if ( (pVolume->GetMoveParent() != NULL) || (pVolume->GetMoveType() != MOVETYPE_NONE) ||
+			(pVolume->GetAbsOrigin() != m_TreeVolumeOrigins[i]) || (pVolume->GetAbsAngles() != m_TreeVolumeAngles[i]) )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CPortalSurfaceMap::GetNoPortalVolumesNear( const Vector &vMins, const Vector &vMaxs, CUtlVector<CFuncNoPortalVolume *> &volumes )
+{
+	if ( m_bTreeDirty || AreNoPortalVolumesStale() )
+		BuildNoPortalVolumeTree();
+
+	volumes.RemoveAll();
+
+	for ( int i = 0; i != m_LooseVolumes.Count(); ++i )
+	{
+		if ( m_LooseVolumes[i] != NULL )
+			volumes.AddToTail( m_LooseVolumes[i] );
+	}
+
+	if ( m_TreeNodes.Count() == 0 )
+		return;
+
+	CUtlVectorFixedGrowable<int, 64> stack;
+	stack.AddToTail( 0 );
+
+	while ( stack.Count() != 0 )
+	{
+		const NoPortalVolumeTreeNode_t &node = m_TreeNodes[stack.Tail()];
+		stack.RemoveMultipleFromTail( 1 );
+
+		if ( !IsBoxIntersectingBox( vMins, vMaxs, node.vMins, node.vMaxs ) )
+			continue;
+
+		if ( node.iFirstChild == -1 )
+		{
+			CFuncNoPortalVolume *pVolume = m_TreeVolumes[node.iVolume];
+			if ( pVolume != NULL )
+				volumes.AddToTail( pVolume );
+		}
+		else
+		{
+			stack.AddToTail( node.iFirstChild );
+			stack.AddToTail( node.iFirstChild + 1 );
+		}
+	}
+}
+
 
 void TracePortals( const CProp_Portal *pIgnorePortal, const Vector &vForward, const Vector &vStart, const Vector &vEnd, trace_t &tr )
 {
@@ -153,6 +491,87 @@ int AllEdictsAlongRay( CBaseEntity **pList, int listMax, const Ray_t &ray, int f
 	return rayEnum.GetCount();
 }
 
+int AllEdictsInBox( CBaseEntity **pList, int listMax, const Vector &vMins, const Vector &vMaxs, int flagMask )
+{
+	CFlaggedEntitiesEnum boxEnum( pList, listMax, flagMask );
+#if defined( GAME_DLL )
+	partition->EnumerateElementsInBox( PARTITION_ENGINE_NON_STATIC_EDICTS, vMins, vMaxs, false, &boxEnum );
+#else
+	partition->EnumerateElementsInBox( PARTITION_ALL_CLIENT_EDICTS, vMins, vMaxs, false, &boxEnum );
+#endif
+	return boxEnum.GetCount();
+}
+
+static bool IsPortalBumpingEntity( CBaseEntity *pEntity )
+{
+	return ( dynamic_cast<CFuncPortalBumper*>( pEntity ) != NULL ) ||
+		   ( dynamic_cast<CTriggerPortalCleanser*>( pEntity ) != NULL ) ||
+		   ( dynamic_cast<CFuncNoPortalVolume*>( pEntity ) != NULL );
+}
+
+
+//-----------------------------------------------------------------------------
+// The corner traces for one fit all fan out from the same origin, so rather than
+// asking the partition for the entities along each ray and type checking every
+// one of them, gather the bumping entities around all of the rays once and only
+// test those. TraceBumpingEntities() uses the innermost batch that's in scope.
+//-----------------------------------------------------------------------------
+class CPortalBumpingEntityBatch
+{
+public:
+	CPortalBumpingEntityBatch( const Vector *pPoints, int iPointCount );
+	~CPortalBumpingEntityBatch( void ) { s_pActive = m_pPrevious; }
+
+	static CPortalBumpingEntityBatch *GetActive( void ) { return s_pActive; }
+
+	bool Contains( const Ray_t &ray ) const;
+
+	CUtlVectorFixedGrowable<CBaseEntity *, 16> m_Entities;
+
+private:
+	Vector m_vMins;
+	Vector m_vMaxs;
+	CPortalBumpingEntityBatch *m_pPrevious;
+
+	static CPortalBumpingEntityBatch *s_pActive;
+};
+
+CPortalBumpingEntityBatch *CPortalBumpingEntityBatch::s_pActive = NULL;
+
+CPortalBumpingEntityBatch::CPortalBumpingEntityBatch( const Vector *pPoints, int iPointCount )
+{
+	m_vMins = m_vMaxs = pPoints[0];
+	for ( int i = 1; i < iPointCount; ++i )
+	{
+		VectorMin( m_vMins, pPoints[i], m_vMins );
+		VectorMax( m_vMaxs, pPoints[i], m_vMaxs );
+	}
+
+	++s_PortalPlacementStats.iBumperQueries;
+
+	CBaseEntity *list[1024];
+	int nCount = AllEdictsInBox( list, 1024, m_vMins, m_vMaxs, 0 );
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		if ( IsPortalBumpingEntity( list[i] ) )
+			m_Entities.AddToTail( list[i] );
+	}
+
+	m_pPrevious = s_pActive;
+	s_pActive = this;
+}
+
+bool CPortalBumpingEntityBatch::Contains( const Ray_t &ray ) const
+{
+	Vector vEnd = ray.m_Start + ray.m_Delta;
+
+	return ( ray.m_Start.x >= m_vMins.x && ray.m_Start.y >= m_vMins.y && ray.m_Start.z >= m_vMins.z &&
+			 ray.m_Start.x <= m_vMaxs.x && ray.m_Start.y <= m_vMaxs.y && ray.m_Start.z <= m_vMaxs.z &&
+			 vEnd.x >= m_vMins.x && vEnd.y >= m_vMins.y && vEnd.z >= m_vMins.z &&
+			 vEnd.x <= m_vMaxs.x && vEnd.y <= m_vMaxs.y && vEnd.z <= m_vMaxs.z );
+}
+
 bool TraceBumpingEntities( const Vector &vStart, const Vector &vEnd, trace_t &tr )
 {
 	UTIL_ClearTrace( tr );
@@ -166,7 +585,25 @@ bool TraceBumpingEntities( const Vector &vStart, const Vector &vEnd, trace_t &tr
 	Ray_t ray;
 	ray.Init( vStart, vEnd );
 
-	int nCount = AllEdictsAlongRay(list, 1024, ray, 0);
+	int nCount = 0;
+
+	CPortalBumpingEntityBatch *pBatch = CPortalBumpingEntityBatch::GetActive();
+	if ( pBatch && pBatch->Contains( ray ) )
+	{
+		// Only the gathered entities whose bounds the ray actually passes through
+		for ( int i = 0; i < pBatch->m_Entities.Count(); ++i )
+		{
+			Vector vEntityMins, vEntityMaxs;
+			pBatch->m_Entities[i]->CollisionProp()->WorldSpaceSurroundingBounds( &vEntityMins, &vEntityMaxs );
+			if ( IsBoxIntersectingRay( vEntityMins, vEntityMaxs, ray, 1.0f ) )
+				list[nCount++] = pBatch->m_Entities[i];
+		}
+	}
+	else
+	{
+		++s_PortalPlacementStats.iBumperQueries;
+		nCount = AllEdictsAlongRay(list, 1024, ray, 0);
+	}
 
 	for ( int i = 0; i < nCount; i++ )
 	{
@@ -187,7 +624,7 @@ bool TraceBumpingEntities( const Vector &vStart, const Vector &vEnd, trace_t &tr
 			if( ((CFuncPortalBumper *)list[i])->IsActive() )
 			{
 				bSoftBumper = true;
-				enginetrace->ClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
+				PortalPlacementClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
 				if ( trTemp.startsolid )
 				{
 					trTemp.fraction = 1.0f;
@@ -198,7 +635,7 @@ bool TraceBumpingEntities( const Vector &vStart, const Vector &vEnd, trace_t &tr
 		{
 			if( !((CTriggerPortalCleanser *)list[i])->m_bDisabled )
 			{
-				enginetrace->ClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
+				PortalPlacementClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
 				if ( trTemp.startsolid )
 				{
 					trTemp.fraction = 1.0f;
@@ -210,7 +647,7 @@ bool TraceBumpingEntities( const Vector &vStart, const Vector &vEnd, trace_t &tr
 			trTemp.fraction = 1.0f;
 			if ( static_cast<CFuncNoPortalVolume*>( list[i] )->IsActive() )
 			{
-				enginetrace->ClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
+				PortalPlacementClipRayToEntity( ray, MASK_ALL, list[i], &trTemp );
 
 				// Bump by an extra 2 units so that the portal isn't touching the no portal volume
 				Vector vDelta = trTemp.endpos - trTemp.startpos;
@@ -239,7 +676,7 @@ bool TracePortalCorner( const CProp_Portal *pIgnorePortal, const Vector &vOrigin
 
 	// Check for surface edge
 	trace_t trSurfaceEdge;
-	UTIL_TraceLine( vOrigin - vForward, vCorner - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
+	PortalPlacementTraceLine( vOrigin - vForward, vCorner - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
 
 	if ( trSurfaceEdge.startsolid )
 	{
@@ -247,7 +684,7 @@ bool TracePortalCorner( const CProp_Portal *pIgnorePortal, const Vector &vOrigin
 
 		while ( trSurfaceEdge.startsolid && trSurfaceEdge.fractionleftsolid > 0.0f && fTotalFraction < 1.0f )
 		{
-			UTIL_TraceLine( vOrigin + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, vCorner + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
+			PortalPlacementTraceLine( vOrigin + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, vCorner + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
 
 			if ( trSurfaceEdge.startsolid )
 			{
@@ -257,7 +694,7 @@ bool TracePortalCorner( const CProp_Portal *pIgnorePortal, const Vector &vOrigin
 
 		if ( fTotalFraction < 1.0f )
 		{
-			UTIL_TraceLine( vOrigin + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, vOrigin - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
+			PortalPlacementTraceLine( vOrigin + vOriginToCorner * ( fTotalFraction + 0.05f ) - vForward, vOrigin - vForward, MASK_SHOT_PORTAL, pTraceFilterPortalShot, &trSurfaceEdge );
 
 			if ( trSurfaceEdge.startsolid )
 			{
@@ -281,7 +718,7 @@ bool TracePortalCorner( const CProp_Portal *pIgnorePortal, const Vector &vOrigin
 
 	// Check for enclosing wall
 	trace_t trEnclosingWall;
-	UTIL_TraceLine( vOrigin + vForward, vCorner + vForward, MASK_SOLID_BRUSHONLY|CONTENTS_MONSTER, pTraceFilterPortalShot, &trEnclosingWall );
+	PortalPlacementTraceLine( vOrigin + vForward, vCorner + vForward, MASK_SOLID_BRUSHONLY|CONTENTS_MONSTER, pTraceFilterPortalShot, &trEnclosingWall );
 
 	if ( trSurfaceEdge.fraction < trEnclosingWall.fraction )
 	{
@@ -491,6 +928,16 @@ bool FitPortalOnSurface( const CProp_Portal *pIgnorePortal, Vector &vOrigin, con
 
 	int iOldIntersectionCount = iIntersectionCount;
 
+	// Gather the bumping entities for all four corner traces in one go
+	Vector pptBumpTraceBounds[ 5 ];
+	pptBumpTraceBounds[ 0 ] = vOrigin + vForward;
+	for ( int iCorner = 0; iCorner < 4; ++iCorner )
+	{
+		pptBumpTraceBounds[ iCorner + 1 ] = pptCorner[ iCorner ] + vForward;
+	}
+
+	CPortalBumpingEntityBatch bumpingEntities( pptBumpTraceBounds, 5 );
+
 	// Find intersections from center to each corner
 	for ( int iIntersection = 0; iIntersection < 4; ++iIntersection )
 	{
@@ -1005,15 +1452,32 @@ void FitPortalAroundOtherPortals( const CProp_Portal *pIgnorePortal, Vector &vOr
 }
 bool IsPortalIntersectingNoPortalVolume( const Vector &vOrigin, const QAngle &qAngles, const Vector &vForward )
 {
-	// Walk the no portal volume list, check each with box-box intersection
-	for ( CFuncNoPortalVolume *pNoPortalEnt = GetNoPortalVolumeList(); pNoPortalEnt != NULL; pNoPortalEnt = pNoPortalEnt->m_pNext )
+	// Bounds of the portal quad, padded a little so the tree never culls a volume the exact test would hit
+	Vector vRight, vUp;
+	AngleVectors( qAngles, NULL, &vRight, &vUp );
+
+	Vector vPortalExtents;
+	for ( int i = 0; i < 3; ++i )
 	{
+		vPortalExtents[i] = fabsf( vRight[i] ) * PORTAL_HALF_WIDTH + fabsf( vUp[i] ) * PORTAL_HALF_HEIGHT + 1.0f;
+	}
+
+	CUtlVector<CFuncNoPortalVolume *> nearbyVolumes;
+	s_PortalSurfaceMap.GetNoPortalVolumesNear( vOrigin - vPortalExtents, vOrigin + vPortalExtents, nearbyVolumes );
+
+	// Check each nearby no portal volume with box-box intersection
+	for ( int iVolume = 0; iVolume != nearbyVolumes.Count(); ++iVolume )
+	{
+		CFuncNoPortalVolume *pNoPortalEnt = nearbyVolumes[iVolume];
+
 		// Skip inactive no portal zones
 		if ( !pNoPortalEnt->IsActive() )
 		{
 			continue;
 		}
 
+		++s_PortalPlacementStats.iNoPortalVolumeTests;
+
 		Vector vMin;
 		Vector vMax;
 		pNoPortalEnt->GetCollideable()->WorldSpaceSurroundingBounds( &vMin, &vMax );
@@ -1040,7 +1504,7 @@ bool IsPortalIntersectingNoPortalVolume( const Vector &vOrigin, const QAngle &qA
 		}
 	}
 
-	// Passed the list, so we didn't hit any func_noportal_volumes
+	// Passed the nearby volumes, so we didn't hit any func_noportal_volumes
 	return false;
 }
 bool IsPortalOverlappingOtherPortals( const CProp_Portal *pIgnorePortal, const Vector &vOrigin, const QAngle &qAngles, bool bFizzle /*= false*/, bool bFizzlePartnerPortals /*= false*/ )
@@ -1242,7 +1706,7 @@ bool IsPortalOnValidSurface( const Vector &vOrigin, const Vector &vForward, cons
 
 		Ray_t ray;
 		ray.Init( ptCorner + vForward, ptCorner - vForward );
-		enginetrace->TraceRay( ray, MASK_SOLID_BRUSHONLY, traceFilterPortalShot, &tr );
+		PortalPlacementTraceRay( ray, MASK_SOLID_BRUSHONLY, traceFilterPortalShot, &tr );
 
 		if ( tr.startsolid )
 		{
@@ -1306,7 +1770,7 @@ bool IsPortalOnValidSurface( const Vector &vOrigin, const Vector &vForward, cons
 	return true;
 }
 
-float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin, QAngle &qAngles, int iPlacedBy, bool bTest /*= false*/ )
+static float VerifyPortalPlacementInternal( const CProp_Portal *pIgnorePortal, Vector &vOrigin, QAngle &qAngles, int iPlacedBy, bool bTest )
 {
 	g_bTest = bTest;
 
@@ -1333,7 +1797,7 @@ float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin,
 	// Check if center is on a surface
 	Ray_t ray;
 	ray.Init( vOrigin + vForward, vOrigin - vForward );
-	enginetrace->TraceRay( ray, MASK_SHOT_PORTAL, &traceFilterPortalShot, &tr );
+	PortalPlacementTraceRay( ray, MASK_SHOT_PORTAL, &traceFilterPortalShot, &tr );
 
 	if ( tr.fraction == 1.0f )
 	{
@@ -1456,12 +1920,12 @@ float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin,
 		{
 			Vector vSmallForward = vForward * 0.05f;
 			trace_t FloorTrace;
-			UTIL_TraceLine( vOrigin + vSmallForward, vOrigin + vSmallForward - (vUp * (PORTAL_HALF_HEIGHT + 1.5f)), MASK_SOLID_BRUSHONLY, &traceFilterPortalShot, &FloorTrace );
+			PortalPlacementTraceLine( vOrigin + vSmallForward, vOrigin + vSmallForward - (vUp * (PORTAL_HALF_HEIGHT + 1.5f)), MASK_SOLID_BRUSHONLY, &traceFilterPortalShot, &FloorTrace );
 			if( FloorTrace.fraction < 1.0f )
 			{
 				//we hit floor in that 1 extra unit, now doublecheck to make sure we didn't hit something else
 				trace_t FloorTrace_Verify;
-				UTIL_TraceLine( vOrigin + vSmallForward, vOrigin + vSmallForward - (vUp * (PORTAL_HALF_HEIGHT - 0.1f)), MASK_SOLID_BRUSHONLY, &traceFilterPortalShot, &FloorTrace_Verify );
+				PortalPlacementTraceLine( vOrigin + vSmallForward, vOrigin + vSmallForward - (vUp * (PORTAL_HALF_HEIGHT - 0.1f)), MASK_SOLID_BRUSHONLY, &traceFilterPortalShot, &FloorTrace_Verify );
 				if( FloorTrace_Verify.fraction == 1.0f )
 				{
 					//if we're in here, we're definitely in a floor matching configuration, bump down to match the floor better
@@ -1507,6 +1971,25 @@ float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin,
 }
 
 
+float VerifyPortalPlacement( const CProp_Portal *pIgnorePortal, Vector &vOrigin, QAngle &qAngles, int iPlacedBy, bool bTest /*= false*/ )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	float fResult = VerifyPortalPlacementInternal( pIgnorePortal, vOrigin, qAngles, iPlacedBy, bTest );
+
+	timer.End();
+
+	double fTime = timer.GetDuration().GetMillisecondsF();
+	++s_PortalPlacementStats.iShots;
+	s_PortalPlacementStats.fTotalTime += fTime;
+	if ( fTime > s_PortalPlacementStats.fMaxTime )
+		s_PortalPlacementStats.fMaxTime = fTime;
+
+	return fResult;
+}
+
+
 float VerifyPortalPlacementAndFizzleBlockingPortals(const CProp_Portal *pIgnorePortal, Vector &vOrigin, QAngle &qAngles, int iPlacedBy, bool bTest /*= false*/)
 {
 	float placementResult = VerifyPortalPlacement( pIgnorePortal, vOrigin, qAngles, iPlacedBy, bTest );
@@ -1526,4 +2009,37 @@ float VerifyPortalPlacementAndFizzleBlockingPortals(const CProp_Portal *pIgnoreP
 	}
 
 	return placementResult;
-}
\ No newline at end of file
+}
+
+
+static void PrintPortalPlacementStats( const CCommand &args )
+{
+	const PortalPlacementStats_t &stats = s_PortalPlacementStats;
+
+	int iShots = MAX( stats.iShots, 1 );
+	int iMaterialLookups = stats.iMaterialHits + stats.iMaterialMisses;
+
+	Msg( "Portal placement: %d placements verified\n", stats.iShots );
+	Msg( "  Traces: %d (%.1f per placement)\n", stats.iTraces, (float)stats.iTraces / iShots );
+	Msg( "  Entity clips: %d (%.1f per placement)\n", stats.iEntityClips, (float)stats.iEntityClips / iShots );
+	Msg( "  Bumper queries: %d (%.1f per placement)\n", stats.iBumperQueries, (float)stats.iBumperQueries / iShots );
+	Msg( "  Time: %.3fms average, %.3fms max\n", stats.fTotalTime / iShots, stats.fMaxTime );
+	Msg( "  Material classes: %d cached, %d hits, %d misses (%.1f%% hit rate)\n", s_PortalSurfaceMap.GetSurfaceClassCount(), stats.iMaterialHits, stats.iMaterialMisses, (iMaterialLookups != 0) ? ((100.0f * stats.iMaterialHits) / iMaterialLookups) : 0.0f );
+
+	Msg( "  No portal volumes: %d in map, %d box tests\n", s_PortalSurfaceMap.GetNoPortalVolumeCount(), stats.iNoPortalVolumeTests );
+
+	if( (args.ArgC() > 1) && (Q_stricmp( args[1], "reset" ) == 0) )
+		memset( &s_PortalPlacementStats, 0, sizeof( s_PortalPlacementStats ) );
+}
+
+#ifdef GAME_DLL
+CON_COMMAND( portal_placement_stats_server, "Prints trace counts and timings for server portal placement. Pass \"reset\" to clear them afterwards." )
+{
+	PrintPortalPlacementStats( args );
+}
+#else
+CON_COMMAND( portal_placement_stats_client, "Prints trace counts and timings for client portal placement. Pass \"reset\" to clear them afterwards." )
+{
+	PrintPortalPlacementStats( args );
+}
+#endif
@@ -13,6 +13,7 @@
 #include "beam_shared.h"
 #include "collisionutils.h"
 #include "util_shared.h"
+#include "mathlib/ssemath.h"
 #ifndef CLIENT_DLL
 	#include "util.h"
 	#include "ndebugoverlay.h"
@@ -253,6 +254,225 @@ void UTIL_Portal_Trace_Filter( CTraceFilterSimpleClassnameList *traceFilterPorta
 	traceFilterPortalShot->AddClassnameToIgnore( "prop_radio" ); 
 }
 
+//-----------------------------------------------------------------------------
+// Packed copy of every portal quad, four portals per group, so the "which portal does this
+// hit" helpers can reject most portals four at a time before running the exact tests.
+// Only geometry lives here, active/linked state is always read from the portal itself.
+//-----------------------------------------------------------------------------
+#define PORTAL_QUERY_TABLE_SLACK 1.0f //the kernels only cull, keep them generous so rounding never rejects something the exact test would accept
+
+struct PortalQueryGroup_t
+{
+	FourVectors vForward;
+	FourVectors vRight;
+	FourVectors vUp;
+	FourVectors vAbsForward; //component-wise absolute values, used for projecting box extents
+	FourVectors vAbsRight;
+	FourVectors vAbsUp;
+	FourVectors ptCenter;
+	fltx4 fPlaneDist;
+};
+
+class CPortalQueryTable
+{
+public:
+	CPortalQueryTable( void ) : m_bDirty( true ), m_iPortalCount( 0 ) {}
+
+	void Invalidate( void ) { m_bDirty = true; }
+
+	//each of these fills pCandidates (sized for AllPortals.Count()) with the portals that might pass, in AllPortals order
+	int CullRay( const Ray_t &ray, float fMustBeCloserThan, CProp_Portal **pCandidates );
+	int CullBox( const Vector &ptCenter, const Vector &vExtents, float fTolerance, CProp_Portal **pCandidates );
+	int CullPoint( const Vector &vPoint, float fOnPlaneEpsilon, CProp_Portal **pCandidates );
+
+private:
+	void Rebuild( void );
+	int EmitCandidates( int iGroup, const fltx4 &fPassMask, CProp_Portal **pCandidates, int iCandidateCount ) const;
+
+	CUtlVector< PortalQueryGroup_t, CUtlMemoryAligned< PortalQueryGroup_t, 16 > > m_Groups;
+	bool m_bDirty;
+	int m_iPortalCount;
+};
+
+static CPortalQueryTable s_PortalQueryTable;
+
+void UTIL_Portal_InvalidateQueryTable( void )
+{
+	s_PortalQueryTable.Invalidate();
+}
+
+void CPortalQueryTable::Rebuild( void )
+{
+	m_bDirty = false;
+	m_iPortalCount = CProp_Portal_Shared::AllPortals.Count();
+
+	int iGroupCount = (m_iPortalCount + 3) / 4;
+	m_Groups.SetCount( iGroupCount );
+	if( iGroupCount == 0 )
+		return;
+
+	memset( m_Groups.Base(), 0, sizeof( PortalQueryGroup_t ) * iGroupCount ); //zero out the unused lanes of the last group
+
+	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	for( int i = 0; i != m_iPortalCount; ++i )
+	{
+		PortalQueryGroup_t &Group = m_Groups[i >> 2];
+		int iLane = i & 3;
+
+		//same basis UTIL_Portal_Triangles() builds the quad from
+		Vector vForward, vRight, vUp;
+		AngleVectors( pPortals[i]->m_qAbsAngle, &vForward, &vRight, &vUp );
+		const Vector &ptCenter = pPortals[i]->m_ptOrigin;
+
+		for( int j = 0; j != 3; ++j )
+		{
+			SubFloat( Group.vForward[j], iLane ) = vForward[j];
+			SubFloat( Group.vRight[j], iLane ) = vRight[j];
+			SubFloat( Group.vUp[j], iLane ) = vUp[j];
+			SubFloat( Group.vAbsForward[j], iLane ) = fabs( vForward[j] );
+			SubFloat( Group.vAbsRight[j], iLane ) = fabs( vRight[j] );
+			SubFloat( Group.vAbsUp[j], iLane ) = fabs( vUp[j] );
+			SubFloat( Group.ptCenter[j], iLane ) = ptCenter[j];
+		}
+
+		SubFloat( Group.fPlaneDist, iLane ) = vForward.Dot( ptCenter );
+	}
+}
+
+int CPortalQueryTable::EmitCandidates( int iGroup, const fltx4 &fPassMask, CProp_Portal **pCandidates, int iCandidateCount ) const
+{
+	int iMask = TestSignSIMD( fPassMask );
+	if( iMask == 0 )
+		return iCandidateCount;
+
+	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	for( int iLane = 0; iLane != 4; ++iLane )
+	{
+		int iPortal = (iGroup << 2) + iLane;
+		if( (iMask & (1 << iLane)) && (iPortal < m_iPortalCount) )
+		{
+			pCandidates[iCandidateCount] = pPortals[iPortal];
+			++iCandidateCount;
+		}
+	}
+
+	return iCandidateCount;
+}
+
+int CPortalQueryTable::CullRay( const Ray_t &ray, float fMustBeCloserThan, CProp_Portal **pCandidates )
+{
+	if( m_bDirty || (m_iPortalCount != CProp_Portal_Shared::AllPortals.Count()) )
+		Rebuild();
+
+	//how far IntersectRayWithTriangle() lets a swept box overshoot the ends of the ray
+	float fBoxOffset = PORTAL_QUERY_TABLE_SLACK;
+	if( !ray.m_IsRay )
+	{
+		fBoxOffset += (fabs( ray.m_Extents.x * ray.m_Delta.x ) + fabs( ray.m_Extents.y * ray.m_Delta.y ) + fabs( ray.m_Extents.z * ray.m_Delta.z )) / MAX( ray.m_Delta.LengthSqr(), 1e-6f );
+	}
+
+	FourVectors vStart, vDelta;
+	vStart.DuplicateVector( ray.m_Start );
+	vDelta.DuplicateVector( ray.m_Delta );
+
+	fltx4 fMinT = ReplicateX4( -fBoxOffset );
+	fltx4 fMaxT = ReplicateX4( MIN( 1.0f, fMustBeCloserThan ) + fBoxOffset );
+	fltx4 fHalfWidth = ReplicateX4( PORTAL_HALF_WIDTH + PORTAL_QUERY_TABLE_SLACK );
+	fltx4 fHalfHeight = ReplicateX4( PORTAL_HALF_HEIGHT + PORTAL_QUERY_TABLE_SLACK );
+
+	int iCandidateCount = 0;
+	for( int i = 0; i != m_Groups.Count(); ++i )
+	{
+		const PortalQueryGroup_t &Group = m_Groups[i];
+
+		//has to come at the front of the portal
+		fltx4 fDenom = Group.vForward * vDelta;
+		fltx4 fPass = CmpLtSIMD( fDenom, Four_Zeros );
+		if( TestSignSIMD( fPass ) == 0 )
+			continue;
+
+		//where it crosses the portal plane
+		fltx4 fT = DivSIMD( SubSIMD( Group.fPlaneDist, Group.vForward * vStart ), fDenom );
+		fPass = AndSIMD( fPass, CmpGeSIMD( fT, fMinT ) );
+		fPass = AndSIMD( fPass, CmpLeSIMD( fT, fMaxT ) );
+
+		//and that crossing has to be on the quad
+		FourVectors vOffset = vDelta;
+		vOffset *= fT;
+		vOffset += vStart;
+		vOffset -= Group.ptCenter;
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vRight, fHalfWidth ) );
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vUp, fHalfHeight ) );
+
+		iCandidateCount = EmitCandidates( i, fPass, pCandidates, iCandidateCount );
+	}
+
+	return iCandidateCount;
+}
+
+int CPortalQueryTable::CullBox( const Vector &ptCenter, const Vector &vExtents, float fTolerance, CProp_Portal **pCandidates )
+{
+	if( m_bDirty || (m_iPortalCount != CProp_Portal_Shared::AllPortals.Count()) )
+		Rebuild();
+
+	FourVectors vBoxCenter;
+	vBoxCenter.DuplicateVector( ptCenter );
+
+	fltx4 fSlack = ReplicateX4( fTolerance + PORTAL_QUERY_TABLE_SLACK );
+	fltx4 fHalfWidth = ReplicateX4( PORTAL_HALF_WIDTH );
+	fltx4 fHalfHeight = ReplicateX4( PORTAL_HALF_HEIGHT );
+
+	int iCandidateCount = 0;
+	for( int i = 0; i != m_Groups.Count(); ++i )
+	{
+		const PortalQueryGroup_t &Group = m_Groups[i];
+
+		//separating axis test against the quad's normal and its two edge directions. Necessary but not sufficient, the exact test sorts out the rest
+		FourVectors vOffset = vBoxCenter;
+		vOffset -= Group.ptCenter;
+
+		fltx4 fPass = CmpInBoundsSIMD( vOffset * Group.vForward, AddSIMD( Group.vAbsForward * vExtents, fSlack ) );
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vRight, AddSIMD( AddSIMD( Group.vAbsRight * vExtents, fSlack ), fHalfWidth ) ) );
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vUp, AddSIMD( AddSIMD( Group.vAbsUp * vExtents, fSlack ), fHalfHeight ) ) );
+
+		iCandidateCount = EmitCandidates( i, fPass, pCandidates, iCandidateCount );
+	}
+
+	return iCandidateCount;
+}
+
+int CPortalQueryTable::CullPoint( const Vector &vPoint, float fOnPlaneEpsilon, CProp_Portal **pCandidates )
+{
+	if( m_bDirty || (m_iPortalCount != CProp_Portal_Shared::AllPortals.Count()) )
+		Rebuild();
+
+	FourVectors vTestPoint;
+	vTestPoint.DuplicateVector( vPoint );
+
+	fltx4 fPlaneEpsilon = ReplicateX4( fOnPlaneEpsilon + PORTAL_QUERY_TABLE_SLACK );
+	fltx4 fHalfWidth = ReplicateX4( PORTAL_HALF_WIDTH + PORTAL_QUERY_TABLE_SLACK );
+	fltx4 fHalfHeight = ReplicateX4( PORTAL_HALF_HEIGHT + PORTAL_QUERY_TABLE_SLACK );
+
+	int iCandidateCount = 0;
+	for( int i = 0; i != m_Groups.Count(); ++i )
+	{
+		const PortalQueryGroup_t &Group = m_Groups[i];
+
+		FourVectors vOffset = vTestPoint;
+		vOffset -= Group.ptCenter;
+
+		fltx4 fPass = CmpInBoundsSIMD( vOffset * Group.vForward, fPlaneEpsilon );
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vRight, fHalfWidth ) );
+		fPass = AndSIMD( fPass, CmpInBoundsSIMD( vOffset * Group.vUp, fHalfHeight ) );
+
+		iCandidateCount = EmitCandidates( i, fPass, pCandidates, iCandidateCount );
+	}
+
+	return iCandidateCount;
+}
+
+
+
 CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserThan )
 {
 	CProp_Portal *pIntersectedPortal = NULL;
@@ -260,7 +480,8 @@ CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserT
 	int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
 	if( iPortalCount != 0 )
 	{
-		CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+		CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+		iPortalCount = s_PortalQueryTable.CullRay( ray, fMustBeCloserThan, pPortals );
 
 		for( int i = 0; i != iPortalCount; ++i )
 		{
@@ -293,7 +514,8 @@ CProp_Portal* UTIL_Portal_FirstAlongRayAll(const Ray_t &ray, float &fMustBeClose
     int iPortalCount = CProp_Portal_Shared::AllPortals.Count();
     if (iPortalCount != 0)
     {
-        CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+        CProp_Portal **pPortals = (CProp_Portal **)stackalloc(sizeof(CProp_Portal *) * iPortalCount);
+        iPortalCount = s_PortalQueryTable.CullRay(ray, fMustBeCloserThan, pPortals);
 
         for (int i = 0; i != iPortalCount; ++i)
         {
@@ -899,6 +1121,21 @@ void UTIL_Portal_TraceRay( const CProp_Portal *pPortal, const Ray_t &ray, unsign
 	UTIL_Portal_TraceRay( pPortal, ray, fMask, &traceFilter, pTrace, bTraceHolyWall );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The transform to use for traces against the simulators' collision. While
+//			either portal is activating, the collision is still the old placement's
+//			but the entity's matrix already belongs to the new one.
+//-----------------------------------------------------------------------------
+static const VMatrix &GetSimulatedMatrixThisToLinked( const CProp_Portal *pPortal )
+{
+	const CPortalSimulator &portalSimulator = pPortal->m_PortalSimulator;
+	const CPortalSimulator *pLinkedPortalSimulator = portalSimulator.GetLinkedPortalSimulator();
+	if( portalSimulator.IsActivating() || (pLinkedPortalSimulator && pLinkedPortalSimulator->IsActivating()) )
+		return portalSimulator.GetInternalData().Placement.matThisToLinked;
+
+	return pPortal->MatrixThisToLinked();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Trace a ray 'past' a portal's surface, hitting objects in the linked portal's collision environment
 // Input  : *pPortal - The portal being traced 'through'
@@ -914,7 +1151,7 @@ void UTIL_PortalLinked_TraceRay( const CProp_Portal *pPortal, const Ray_t &ray,
 #endif
 	// Transform the specified ray to the remote portal's space
 	Ray_t rayTransformed;
-	UTIL_Portal_RayTransform( pPortal->MatrixThisToLinked(), ray, rayTransformed );
+	UTIL_Portal_RayTransform( GetSimulatedMatrixThisToLinked( pPortal ), ray, rayTransformed );
 
 	AssertMsg ( ray.m_IsRay, "Ray with extents across portal tracing not implemented!" );
 
@@ -935,7 +1172,7 @@ void UTIL_PortalLinked_TraceRay( const CProp_Portal *pPortal, const Ray_t &ray,
 
 	// Transform the ray's start, end and plane back into this portal's space, 
 	// because we react to the collision as it is displayed, and the image is displayed with this local portal's orientation.
-	VMatrix matLinkedToThis = pLinkedPortal->MatrixThisToLinked();
+	VMatrix matLinkedToThis = GetSimulatedMatrixThisToLinked( pLinkedPortal );
 	UTIL_Portal_PointTransform( matLinkedToThis, pTrace->startpos, pTrace->startpos );
 	UTIL_Portal_PointTransform( matLinkedToThis, pTrace->endpos, pTrace->endpos );
 	UTIL_Portal_PlaneTransform( matLinkedToThis, pTrace->plane, pTrace->plane );
@@ -1602,7 +1839,8 @@ CProp_Portal *UTIL_IntersectEntityExtentsWithPortal( const CBaseEntity *pEntity
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+	iPortalCount = s_PortalQueryTable.CullBox( ptCenter, vExtents, 0.0f, pPortals );
 	for( int i = 0; i != iPortalCount; ++i )
 	{
 		CProp_Portal *pTempPortal = pPortals[i];
@@ -1626,7 +1864,8 @@ CProp_Portal *UTIL_IntersectBoxExtentsWithPortal( Vector vMin, Vector vMax )
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+	iPortalCount = s_PortalQueryTable.CullBox( ptCenter, vExtents, 0.0f, pPortals );
 	for( int i = 0; i != iPortalCount; ++i )
 	{
 		CProp_Portal *pTempPortal = pPortals[i];
@@ -1652,7 +1891,8 @@ bool UTIL_EntityIsIntersectingFloorPortal(const CBaseEntity *pEntity)
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+	iPortalCount = s_PortalQueryTable.CullBox( ptCenter, vExtents, 0.0f, pPortals );
 	for( int i = 0; i != iPortalCount; ++i )
 	{
 		CProp_Portal *pTempPortal = pPortals[i];
@@ -1679,7 +1919,8 @@ bool UTIL_EntityIsIntersectingCeilingPortal(const CBaseEntity *pEntity)
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+	iPortalCount = s_PortalQueryTable.CullBox( ptCenter, vExtents, 0.0f, pPortals );
 	for( int i = 0; i != iPortalCount; ++i )
 	{
 		CProp_Portal *pTempPortal = pPortals[i];
@@ -1706,7 +1947,8 @@ bool UTIL_EntityIsIntersectingPortalWithLinkedAlsoBeingFloorOrCeiling(const CBas
 	Vector ptCenter = ( vMin + vMax ) * 0.5f;
 	Vector vExtents = ( vMax - vMin ) * 0.5f;
 
-	CProp_Portal **pPortals = CProp_Portal_Shared::AllPortals.Base();
+	CProp_Portal **pPortals = (CProp_Portal **)stackalloc( sizeof( CProp_Portal * ) * iPortalCount );
+	iPortalCount = s_PortalQueryTable.CullBox( ptCenter, vExtents, 0.0f, pPortals );
 	for( int i = 0; i != iPortalCount; ++i )
 	{
 		CProp_Portal *pTempPortal = pPortals[i];
@@ -2059,6 +2301,17 @@ CProp_Portal *UTIL_PointIsOnPortalQuad(const Vector vPoint, float fOnPlaneEpsilo
 	if( iArraySize == 0 )
 		return NULL;
 
+	if( (pPortalsToCheck == CProp_Portal_Shared::AllPortals.Base()) && (iArraySize == CProp_Portal_Shared::AllPortals.Count()) )
+	{
+		//checking every portal, let the packed table throw out the ones that are nowhere close
+		CProp_Portal **pCandidates = (CProp_Portal **)stackalloc(sizeof(CProp_Portal *) * iArraySize);
+		iArraySize = s_PortalQueryTable.CullPoint( vPoint, fOnPlaneEpsilon, pCandidates );
+		if( iArraySize == 0 )
+			return NULL;
+
+		pPortalsToCheck = pCandidates;
+	}
+
 	CProp_Portal **pPlanarCandidates = (CProp_Portal **)stackalloc(sizeof(CProp_Portal *) * iArraySize);
 	int iPlanarCandidateCount = 0;
 	for( int i = 0; i != iArraySize; ++i )
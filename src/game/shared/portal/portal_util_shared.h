@@ -47,6 +47,8 @@ void UTIL_Portal_ColorSet_GlowColor( PortalColorSet_t iPortalColorSet, Vector &v
 
 void UTIL_Portal_Trace_Filter( class CTraceFilterSimpleClassnameList *traceFilterPortalShot );
 
+void UTIL_Portal_InvalidateQueryTable( void ); //call when a portal is created, destroyed or moved so the packed table behind the ray/box/point helpers gets rebuilt
+
 CProp_Portal* UTIL_Portal_FirstAlongRay( const Ray_t &ray, float &fMustBeCloserThan );
 CProp_Portal* UTIL_Portal_FirstAlongRayAll( const Ray_t &ray, float &fMustBeCloserThan );
 
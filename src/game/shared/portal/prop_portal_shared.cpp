@@ -908,6 +908,15 @@ bool CProp_Portal::ShouldTeleportTouchingEntity( CBaseEntity *pOther )
 		return false;
 	}
 
+	//collision for a new placement of either portal is still being built on a job thread. The simulators still have the old placement, so wait for the swap at the next PrePhysFrame()
+	if( m_PortalSimulator.IsActivating() || m_hLinkedPortal->m_PortalSimulator.IsActivating() )
+	{
+		if ( sv_portal_debug_touch.GetBool() )
+			Msg( "Portal %i not teleporting %s because the new placement isn't in effect yet. : %f \n", ((m_bIsPortal2)?(2):(1)), pOther->GetDebugName(), gpGlobals->curtime );
+
+		return false;
+	}
+
 	if ( !CProp_Portal_Shared::IsEntityTeleportable(pOther) )
 	{		
 		if ( sv_portal_debug_touch.GetBool() )
@@ -39,6 +39,7 @@ class CUtlBuffer;
 class Color;
 typedef void * FileHandle_t;
 class CKeyValuesGrowableStringTable;
+class CKeyValuesArena;
 
 //-----------------------------------------------------------------------------
 // Purpose: Simple recursive data access class
@@ -120,6 +121,13 @@ public:
 	// File access. Set UsesEscapeSequences true, if resource file/buffer uses Escape Sequences (eg \n, \t)
 	void UsesEscapeSequences(bool state); // default false
 	void UsesConditionals(bool state); // default true
+
+	// Set UsesArena true to have LoadFromBuffer allocate the keys and strings it reads in a single
+	// arena owned by this key, released in one go when this key is deleted. Keys with many children
+	// in such a tree also get a child index so lookups don't walk the sibling list. Arena trees are
+	// meant to be read: keys taken out of the tree don't outlive this key, don't relink children
+	// with SetNextKey() or rename them, and MakeCopy() anything that's handed to another module.
+	void UsesArena(bool state); // default false
 	bool LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL, bool refreshCache = false );
 	bool SaveToFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL, bool sortKeys = false, bool bAllowEmptyString = false, bool bCacheResult = false );
 
@@ -291,7 +299,15 @@ private:
 	void SaveKeyToFile( KeyValues *dat, IBaseFileSystem *filesystem, FileHandle_t f, CUtlBuffer *pBuf, int indentLevel, bool sortKeys, bool bAllowEmptyString );
 	void WriteConvertedString( IBaseFileSystem *filesystem, FileHandle_t f, CUtlBuffer *pBuf, const char *pszString );
 	
-	void RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &buf );
+	void RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &buf, CKeyValuesArena *pArena );
+
+	// Arena allocation and child index, see UsesArena()
+	static KeyValues *AllocKeyValues( const char *setName, CKeyValuesArena *pArena );
+	CKeyValuesArena *GetOrCreateArena();
+	KeyValues *FindChildKey( int keySymbol, KeyValues **ppLastChild ) const;
+	void IndexChildKey( KeyValues *pChild );
+	void DropChildIndex();
+	void FreeStringValues();
 
 	// For handling #include "filename"
 	void AppendIncludedKeys( CUtlVector< KeyValues * >& includedKeys );
@@ -330,7 +346,7 @@ private:
 	char	   m_iDataType;
 	char	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
 	char	   m_bEvaluateConditionals; // true, if while parsing this KeyValue, conditionals blocks are evaluated (default true)
-	char	   unused[1];
+	unsigned char m_nArenaFlags; // KEYVALUES_ARENA_* bits, see UsesArena()
 
 	KeyValues *m_pPeer;	// pointer to next key in list
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
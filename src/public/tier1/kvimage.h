@@ -0,0 +1,183 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled, read-only KeyValues images. A tree is flattened into a
+//			node array linked by node indices plus a string table, so files
+//			that are loaded over and over can be used straight from a memory
+//			mapped cache file instead of being tokenized into a heap tree.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef KVIMAGE_H
+#define KVIMAGE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "KeyValues.h"
+#include "checksum_crc.h"
+#include "utlbuffer.h"
+
+class IFileSystem;
+class CKeyValuesImage;
+
+#define KVIMAGE_ID				MAKEID( 'K', 'V', 'I', 'M' )
+#define KVIMAGE_VERSION			1
+#define KVIMAGE_CACHE_DIR		"kvcache"
+#define KVIMAGE_CACHE_EXT		".kvi"
+#define KVIMAGE_NO_NODE			-1
+
+//-----------------------------------------------------------------------------
+// Image layout. Everything is relative to the start of the image, which is
+// written in host byte order: the header, then the nodes, then the strings.
+// The top level keys come first, and the children of a key are consecutive.
+//-----------------------------------------------------------------------------
+struct KVImageHeader_t
+{
+	int32	m_nId;
+	int32	m_nVersion;
+	CRC32_t	m_nSourceCRC;		// of the text the image was compiled from
+	int32	m_nSourceSize;
+	int32	m_nNodes;
+	int32	m_nNodeOffset;
+	int32	m_nStringBytes;
+	int32	m_nStringOffset;
+};
+
+struct KVImageNode_t
+{
+	int32	m_nName;			// string table offset
+	uint32	m_nNameHash;		// case insensitive, names compare like key symbols do
+	int32	m_nFirstChild;		// node index or KVIMAGE_NO_NODE
+	int32	m_nNextPeer;		// node index or KVIMAGE_NO_NODE
+	int32	m_nType;			// KeyValues::types_t
+	int32	m_nString;			// string table offset of the value as GetString() returns it, -1 if it has none
+	union
+	{
+		int32	m_nInt;
+		float32	m_flFloat;
+		uint64	m_nUint64;
+		uint8	m_Color[4];
+	};
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: A key in an image. Mirrors the read side of KeyValues; an invalid
+//			view stands in for a NULL KeyValues pointer.
+//-----------------------------------------------------------------------------
+class CKeyValuesView
+{
+public:
+	CKeyValuesView() : m_pImage( NULL ), m_iNode( KVIMAGE_NO_NODE ) {}
+	CKeyValuesView( const CKeyValuesImage *pImage, int iNode ) : m_pImage( pImage ), m_iNode( iNode ) {}
+
+	bool IsValid() const { return m_iNode != KVIMAGE_NO_NODE; }
+
+	const char *GetName() const;
+
+	// Accepts "sub/key" paths like KeyValues::FindKey
+	CKeyValuesView FindKey( const char *keyName ) const;
+
+	// Key iteration, see the KeyValues versions
+	CKeyValuesView GetFirstSubKey() const;
+	CKeyValuesView GetNextKey() const;
+	CKeyValuesView GetFirstTrueSubKey() const;
+	CKeyValuesView GetNextTrueSubKey() const;
+	CKeyValuesView GetFirstValue() const;
+	CKeyValuesView GetNextValue() const;
+
+	// Data access, converting between types the same way KeyValues does
+	int GetInt( const char *keyName = NULL, int defaultValue = 0 ) const;
+	uint64 GetUint64( const char *keyName = NULL, uint64 defaultValue = 0 ) const;
+	float GetFloat( const char *keyName = NULL, float defaultValue = 0.0f ) const;
+	const char *GetString( const char *keyName = NULL, const char *defaultValue = "" ) const;
+	bool GetBool( const char *keyName = NULL, bool defaultValue = false, bool* optGotDefault = NULL ) const;
+	Color GetColor( const char *keyName = NULL ) const;
+	bool IsEmpty( const char *keyName = NULL ) const;
+	KeyValues::types_t GetDataType( const char *keyName = NULL ) const;
+
+	// Heap KeyValues copy of this key and everything below it, for code that needs a real tree
+	KeyValues *MakeKeyValues() const;
+
+private:
+	const KVImageNode_t &Node() const;
+
+	const CKeyValuesImage *m_pImage;
+	int m_iNode;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Owns an image, either memory mapped from the cache, read into
+//			memory, or compiled on the spot.
+//-----------------------------------------------------------------------------
+class CKeyValuesImage
+{
+public:
+	CKeyValuesImage();
+	~CKeyValuesImage();
+
+	// Flattens pKeyValues and its peers into an image
+	static bool Compile( KeyValues *pKeyValues, CRC32_t nSourceCRC, int nSourceSize, CUtlBuffer &image );
+
+	// Uses an image in place, after checking it's well formed. The memory must outlive this object.
+	bool Init( const void *pImage, int nSize );
+
+	// Loads a text KeyValues file as an image, through the cache in KVIMAGE_CACHE_DIR. Cached images
+	// are named after the CRC of the text they were compiled from, so the text is always read, but
+	// only tokenized when there's no image for it yet.
+	bool LoadFromFile( IFileSystem *filesystem, const char *resourceName, const char *pathID = NULL );
+
+	// Makes sure the cache has an image of a text file. Returns false if the file can't be read or
+	// compiled, or can't be cached because it uses #include or #base. pbCompiled is set if the
+	// image had to be compiled.
+	static bool UpdateCache( IFileSystem *filesystem, const char *resourceName, const char *pathID = NULL, bool *pbCompiled = NULL );
+
+	static void GetCacheFileName( const char *resourceName, CRC32_t nSourceCRC, char *pDest, int nMaxLen );
+
+	void Clear();
+
+	bool IsValid() const { return m_pHeader != NULL; }
+	bool IsMapped() const { return m_pMapping != NULL; }
+	CRC32_t GetSourceCRC() const { return m_pHeader ? m_pHeader->m_nSourceCRC : 0; }
+	int GetNodeCount() const { return m_pHeader ? m_pHeader->m_nNodes : 0; }
+
+	// The first top level key, walk the rest with GetNextKey()
+	CKeyValuesView GetRoot() const { return CKeyValuesView( this, GetNodeCount() ? 0 : KVIMAGE_NO_NODE ); }
+
+private:
+	friend class CKeyValuesView;
+
+	const KVImageNode_t &GetNode( int iNode ) const { return m_pNodes[iNode]; }
+	const char *GetString( int nOffset ) const { return m_pStrings + nOffset; }
+
+	// The text of a file, with what identifies its image
+	struct Source_t
+	{
+		Source_t();
+
+		CUtlBuffer	m_Text;			// null terminated
+		int			m_nSize;
+		CRC32_t		m_nCRC;
+		bool		m_bCacheable;
+		char		m_szCacheFile[MAX_PATH];
+	};
+
+	static bool ReadSource( IFileSystem *filesystem, const char *resourceName, const char *pathID, Source_t &source );
+	static bool CompileSource( IFileSystem *filesystem, const char *resourceName, const char *pathID, Source_t &source, CUtlBuffer &image );
+	static void WriteCache( IFileSystem *filesystem, const Source_t &source, CUtlBuffer &image );
+
+	bool MapFile( const char *pFullPath );
+	bool UseImage( const void *pImage, int nSize, const Source_t &source );
+	void TakeImage( CUtlBuffer &image );
+
+	const KVImageHeader_t *m_pHeader;
+	const KVImageNode_t *m_pNodes;
+	const char *m_pStrings;
+
+	void *m_pMapping;		// mapped cache file
+	int m_nMappingSize;
+	void *m_pMemory;		// or an image we allocated
+};
+
+#endif // KVIMAGE_H
@@ -23,6 +23,7 @@
 //-----------------------------------------------------------------------------
 class CUtlSymbolTable;
 class CUtlSymbolTableMT;
+class CUtlSymbolTableHashed;
 
 
 //-----------------------------------------------------------------------------
@@ -67,10 +68,10 @@ protected:
 	static void Initialize();
 	
 	// returns the current symbol table
-	static CUtlSymbolTableMT* CurrTable();
+	static CUtlSymbolTableHashed* CurrTable();
 		
 	// The standard global symbol table
-	static CUtlSymbolTableMT* s_pSymbolTable; 
+	static CUtlSymbolTableHashed* s_pSymbolTable; 
 
 	static bool s_bAllowStaticSymbolTable;
 
@@ -217,6 +218,98 @@ private:
 };
 
 
+//-----------------------------------------------------------------------------
+// CUtlSymbolTableHashed:
+// description:
+//    Same interface and symbols as CUtlSymbolTableMT, but strings are found
+//    through an open addressed hash table instead of a tree of string compares.
+//    Find and String never take a lock, so any number of threads can look up
+//    symbols while another thread adds them; adding takes a lock.
+//
+//    Symbols are handed out in order from zero, and neither the string data nor
+//    a symbol's entry ever moves once added. The table grows by publishing a new
+//    copy, older copies are kept until RemoveAll so a lookup still reading one
+//    stays safe. RemoveAll itself must not race with lookups.
+//-----------------------------------------------------------------------------
+
+class CUtlSymbolTableHashed
+{
+public:
+	// constructor, destructor
+	CUtlSymbolTableHashed( int growSize = 0, int initSize = 32, bool caseInsensitive = false );
+	~CUtlSymbolTableHashed();
+
+	// Finds and/or creates a symbol based on the string
+	CUtlSymbol AddString( const char* pString );
+
+	// Finds the symbol for pString
+	CUtlSymbol Find( const char* pString ) const;
+
+	// Look up the string associated with a particular symbol
+	const char* String( CUtlSymbol id ) const;
+
+	inline bool HasElement( const char* pStr ) const
+	{
+		return Find( pStr ) != UTL_INVAL_SYMBOL;
+	}
+
+	// Remove all symbols in the table.
+	void  RemoveAll();
+
+	int GetNumStrings( void ) const
+	{
+		return m_nSymbols;
+	}
+
+private:
+	enum
+	{
+		ENTRY_BLOCK_BITS = 8,
+		ENTRY_BLOCK_SIZE = ( 1 << ENTRY_BLOCK_BITS ),
+		MAX_ENTRY_BLOCKS = ( UTL_INVAL_SYMBOL + 1 ) / ENTRY_BLOCK_SIZE,
+	};
+
+	// The hash precedes the string data in the string pools
+	struct Entry_t
+	{
+		uint32	m_nHash;
+		char	m_String[1];
+	};
+
+	// Each slot holds the top 16 bits of the hash and the symbol + 1, or zero if empty
+	struct SlotTable_t
+	{
+		uint32	m_nMask;
+		uint32	m_nSlots[1];
+	};
+
+	struct StringPool_t
+	{
+		int m_TotalLen;
+		int m_SpaceUsed;
+		char m_Data[1];
+	};
+
+	uint32			HashSymbolString( const char *pString ) const;
+	const Entry_t	*GetEntry( UtlSymId_t id ) const	{ return m_pEntryBlocks[ id >> ENTRY_BLOCK_BITS ][ id & ( ENTRY_BLOCK_SIZE - 1 ) ]; }
+	CUtlSymbol		FindInTable( const SlotTable_t *pTable, const char *pString, uint32 nHash ) const;
+	static void		InsertIntoTable( SlotTable_t *pTable, UtlSymId_t id, uint32 nHash );
+	static SlotTable_t *AllocTable( int nSlots );
+	Entry_t			*AllocEntry( const char *pString, uint32 nHash );
+
+	SlotTable_t * volatile	m_pTable;
+	Entry_t **		m_pEntryBlocks[ MAX_ENTRY_BLOCKS ];
+	volatile int	m_nSymbols;
+	int				m_nInitialSlots;
+	bool			m_bInsensitive;
+
+	// only touched while adding
+	CThreadFastMutex			m_AddMutex;
+	CUtlVector<SlotTable_t *>	m_RetiredTables;
+	CUtlVector<StringPool_t *>	m_StringPools;
+};
+
+
 
 //-----------------------------------------------------------------------------
 // CUtlFilenameSymbolTable:
@@ -26,6 +26,7 @@
 #include "tier0/mem.h"
 #include "utlbuffer.h"
 #include "utlhash.h"
+#include "utlhashtable.h"
 #include "utlvector.h"
 #include "utlqueue.h"
 #include "UtlSortVector.h"
@@ -368,6 +369,327 @@ const char *KeyValues::GetStringForSymbolGrowable( int symbol )
 	return s_pGrowableStringTable->GetStringForSymbol( symbol );
 }
 
+//-----------------------------------------------------------------------------
+// Arena and child index bits kept in m_nArenaFlags
+//-----------------------------------------------------------------------------
+enum
+{
+	KEYVALUES_ARENA_ALLOC	= 0x01,	// UsesArena( true ), LoadFromBuffer reads into the arena
+	KEYVALUES_ARENA_OWNER	= 0x02,	// owns an arena, released along with this key
+	KEYVALUES_ARENA_KEY		= 0x04,	// lives in an arena, deleteThis only runs the destructor
+	KEYVALUES_ARENA_STRING	= 0x08,	// m_sValue points into an arena
+	KEYVALUES_CHILD_INDEX	= 0x10,	// has an entry in s_KVChildIndices
+};
+
+// Keys get a child index once a lookup has walked this many children
+#define KEYVALUES_CHILD_INDEX_MIN_CHILDREN	16
+
+//-----------------------------------------------------------------------------
+// Purpose: Bump allocator behind a tree loaded with UsesArena( true ). Keys and
+//	value strings are carved out of large blocks that are only freed together.
+//-----------------------------------------------------------------------------
+class CKeyValuesArena
+{
+public:
+	CKeyValuesArena() : m_pBlocks( NULL ), m_pNextAlloc( NULL ), m_pAllocLimit( NULL )
+	{
+	}
+
+	~CKeyValuesArena()
+	{
+		while ( m_pBlocks )
+		{
+			Block_t *pNext = m_pBlocks->m_pNext;
+			free( m_pBlocks );
+			m_pBlocks = pNext;
+		}
+	}
+
+	void *Alloc( int nBytes )
+	{
+		nBytes = AlignValue( nBytes, ALIGNMENT );
+		if ( nBytes > m_pAllocLimit - m_pNextAlloc )
+		{
+			// big allocations get a block of their own rather than wasting the rest of the current one
+			if ( nBytes > BLOCK_SIZE / 4 )
+				return AllocBlock( nBytes );
+
+			m_pNextAlloc = (byte *)AllocBlock( BLOCK_SIZE );
+			m_pAllocLimit = m_pNextAlloc + BLOCK_SIZE;
+		}
+
+		void *pResult = m_pNextAlloc;
+		m_pNextAlloc += nBytes;
+		return pResult;
+	}
+
+private:
+	enum
+	{
+		BLOCK_SIZE = 32 * 1024,
+		ALIGNMENT = 8,
+	};
+
+	// Block header, the allocations follow it at ALIGNMENT
+	struct Block_t
+	{
+		Block_t *m_pNext;
+	};
+
+	void *AllocBlock( int nBytes )
+	{
+		Block_t *pBlock = (Block_t *)malloc( ALIGNMENT + nBytes );
+		pBlock->m_pNext = m_pBlocks;
+		m_pBlocks = pBlock;
+		return (byte *)pBlock + ALIGNMENT;
+	}
+
+	Block_t *m_pBlocks;
+	byte *m_pNextAlloc;
+	byte *m_pAllocLimit;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Open addressed key symbol -> child table for keys with many children.
+//	Like the sibling list walk it replaces, it finds the first child with a name.
+//-----------------------------------------------------------------------------
+class CKeyValuesChildIndex
+{
+public:
+	CKeyValuesChildIndex( int nChildren )
+	{
+		int nSlots = 32;
+		while ( nSlots < nChildren * 2 )
+		{
+			nSlots <<= 1;
+		}
+
+		m_Slots.SetCount( nSlots );
+		memset( m_Slots.Base(), 0, nSlots * sizeof( Slot_t ) );
+		m_nMask = nSlots - 1;
+		m_nCount = 0;
+		m_pLastChild = NULL;
+	}
+
+	KeyValues *Find( int iSymbol ) const
+	{
+		for ( int i = Hash( iSymbol ); ; i = ( i + 1 ) & m_nMask )
+		{
+			const Slot_t &slot = m_Slots[i];
+			if ( !slot.m_pKey )
+				return NULL;
+			if ( slot.m_iSymbol == iSymbol )
+				return slot.m_pKey;
+		}
+	}
+
+	// Called for each child appended to the key. Returns false if the table is
+	// too full to take it, in which case the index has to be dropped.
+	bool Add( KeyValues *pChild, int iSymbol )
+	{
+		m_pLastChild = pChild;
+
+		for ( int i = Hash( iSymbol ); ; i = ( i + 1 ) & m_nMask )
+		{
+			Slot_t &slot = m_Slots[i];
+			if ( !slot.m_pKey )
+			{
+				if ( ( m_nCount + 1 ) * 2 > m_Slots.Count() )
+					return false;
+
+				slot.m_iSymbol = iSymbol;
+				slot.m_pKey = pChild;
+				m_nCount++;
+				return true;
+			}
+
+			// an earlier child with the same name keeps winning lookups
+			if ( slot.m_iSymbol == iSymbol )
+				return true;
+		}
+	}
+
+	KeyValues *GetLastChild() const { return m_pLastChild; }
+
+private:
+	struct Slot_t
+	{
+		int m_iSymbol;
+		KeyValues *m_pKey;
+	};
+
+	int Hash( int iSymbol ) const
+	{
+		unsigned int h = (unsigned int)iSymbol * 0x9E3779B1u;
+		return (int)( h ^ ( h >> 15 ) ) & m_nMask;
+	}
+
+	CUtlVector< Slot_t > m_Slots;
+	int m_nMask;
+	int m_nCount;
+	KeyValues *m_pLastChild;
+};
+
+// Arenas by the key that owns them and child indices by the key they belong to. Only
+// keys with the matching bit set in m_nArenaFlags ever look in here.
+static CThreadSpinRWLock s_KVArenaLock;
+static CUtlHashtable< const void *, CKeyValuesArena * > s_KVArenas;
+static CUtlHashtable< const void *, CKeyValuesChildIndex * > s_KVChildIndices;
+
+//-----------------------------------------------------------------------------
+// Purpose: Allocates a key, in the arena if there is one
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::AllocKeyValues( const char *setName, CKeyValuesArena *pArena )
+{
+	if ( !pArena )
+		return new KeyValues( setName );
+
+	KeyValues *pKey = Construct( (KeyValues *)pArena->Alloc( sizeof( KeyValues ) ), setName );
+	pKey->m_nArenaFlags |= KEYVALUES_ARENA_KEY;
+	return pKey;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the arena owned by this key, creating it on first use
+//-----------------------------------------------------------------------------
+CKeyValuesArena *KeyValues::GetOrCreateArena()
+{
+	s_KVArenaLock.LockForWrite();
+
+	CKeyValuesArena *pArena = s_KVArenas.Get( this, NULL );
+	if ( !pArena )
+	{
+		pArena = new CKeyValuesArena;
+		s_KVArenas.Insert( this, pArena );
+		m_nArenaFlags |= KEYVALUES_ARENA_OWNER;
+	}
+
+	s_KVArenaLock.UnlockWrite();
+
+	return pArena;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks up the first child with the given name, through the child index
+//	if there is one. Keys in arena trees get an index once lookups on them start
+//	walking a lot of children. ppLastChild, if given, is set to the last child
+//	when nothing is found.
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::FindChildKey( int keySymbol, KeyValues **ppLastChild ) const
+{
+	if ( m_nArenaFlags & KEYVALUES_CHILD_INDEX )
+	{
+		s_KVArenaLock.LockForRead();
+		const CKeyValuesChildIndex *pIndex = s_KVChildIndices.Get( this, NULL );
+		KeyValues *dat = pIndex->Find( keySymbol );
+		if ( ppLastChild )
+		{
+			*ppLastChild = pIndex->GetLastChild();
+		}
+		s_KVArenaLock.UnlockRead();
+
+		return dat;
+	}
+
+	KeyValues *lastItem = NULL;
+	KeyValues *dat;
+	int nVisited = 0;
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		lastItem = dat;
+		nVisited++;
+
+		if ( dat->m_iKeyName == keySymbol )
+			break;
+	}
+
+	if ( ppLastChild )
+	{
+		*ppLastChild = lastItem;
+	}
+
+	if ( nVisited >= KEYVALUES_CHILD_INDEX_MIN_CHILDREN && ( m_nArenaFlags & ( KEYVALUES_ARENA_OWNER | KEYVALUES_ARENA_KEY ) ) )
+	{
+		int nChildren = 0;
+		for ( KeyValues *pChild = m_pSub; pChild != NULL; pChild = pChild->m_pPeer )
+		{
+			nChildren++;
+		}
+
+		CKeyValuesChildIndex *pIndex = new CKeyValuesChildIndex( nChildren );
+		for ( KeyValues *pChild = m_pSub; pChild != NULL; pChild = pChild->m_pPeer )
+		{
+			pIndex->Add( pChild, pChild->m_iKeyName );
+		}
+
+		// lookups are const, another thread may have beaten us to it
+		s_KVArenaLock.LockForWrite();
+		if ( !( m_nArenaFlags & KEYVALUES_CHILD_INDEX ) )
+		{
+			s_KVChildIndices.Insert( this, pIndex );
+			const_cast< KeyValues * >( this )->m_nArenaFlags |= KEYVALUES_CHILD_INDEX;
+			pIndex = NULL;
+		}
+		s_KVArenaLock.UnlockWrite();
+
+		delete pIndex;
+	}
+
+	return dat;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps the child index up to date when a child is appended
+//-----------------------------------------------------------------------------
+void KeyValues::IndexChildKey( KeyValues *pChild )
+{
+	if ( !( m_nArenaFlags & KEYVALUES_CHILD_INDEX ) )
+		return;
+
+	s_KVArenaLock.LockForWrite();
+	bool bAdded = s_KVChildIndices.Get( this, NULL )->Add( pChild, pChild->m_iKeyName );
+	s_KVArenaLock.UnlockWrite();
+
+	if ( !bAdded )
+	{
+		// it'll be rebuilt at the right size by the next lookup that walks the children
+		DropChildIndex();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Throws away the child index, after children were removed or reordered
+//-----------------------------------------------------------------------------
+void KeyValues::DropChildIndex()
+{
+	if ( !( m_nArenaFlags & KEYVALUES_CHILD_INDEX ) )
+		return;
+
+	s_KVArenaLock.LockForWrite();
+	CKeyValuesChildIndex *pIndex = s_KVChildIndices.Get( this, NULL );
+	s_KVChildIndices.Remove( this );
+	m_nArenaFlags &= ~KEYVALUES_CHILD_INDEX;
+	s_KVArenaLock.UnlockWrite();
+
+	delete pIndex;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees the string values, unless they live in an arena
+//-----------------------------------------------------------------------------
+void KeyValues::FreeStringValues()
+{
+	if ( !( m_nArenaFlags & KEYVALUES_ARENA_STRING ) )
+	{
+		delete [] m_sValue;
+	}
+	m_sValue = NULL;
+	m_nArenaFlags &= ~KEYVALUES_ARENA_STRING;
+
+	delete [] m_wsValue;
+	m_wsValue = NULL;
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -462,8 +784,7 @@ void KeyValues::Init()
 	m_bHasEscapeSequences = false;
 	m_bEvaluateConditionals = true;
 
-	// for future proof
-	memset( unused, 0, sizeof(unused) );
+	m_nArenaFlags = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -487,20 +808,30 @@ void KeyValues::RemoveEverything()
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->deleteThis();
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->deleteThis();
 	}
 
-	delete [] m_sValue;
-	m_sValue = NULL;
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	FreeStringValues();
+	DropChildIndex();
+
+	// everything that was loaded into our arena is gone now
+	if ( m_nArenaFlags & KEYVALUES_ARENA_OWNER )
+	{
+		s_KVArenaLock.LockForWrite();
+		CKeyValuesArena *pArena = s_KVArenas.Get( this, NULL );
+		s_KVArenas.Remove( this );
+		s_KVArenaLock.UnlockWrite();
+
+		delete pArena;
+		m_nArenaFlags &= ~KEYVALUES_ARENA_OWNER;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -640,6 +971,22 @@ void KeyValues::UsesConditionals(bool state)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: if LoadFromBuffer should allocate the tree it reads in an arena, set to true
+//-----------------------------------------------------------------------------
+void KeyValues::UsesArena(bool state)
+{
+	if ( state )
+	{
+		m_nArenaFlags |= KEYVALUES_ARENA_ALLOC;
+	}
+	else
+	{
+		m_nArenaFlags &= ~KEYVALUES_ARENA_ALLOC;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Load keyValues from disk
 //-----------------------------------------------------------------------------
@@ -967,13 +1314,7 @@ void KeyValues::SaveKeyToFile( KeyValues *dat, IBaseFileSystem *filesystem, File
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::FindKey(int keySymbol) const
 {
-	for (KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
-	{
-		if (dat->m_iKeyName == keySymbol)
-			return dat;
-	}
-
-	return NULL;
+	return FindChildKey( keySymbol, NULL );
 }
 
 //-----------------------------------------------------------------------------
@@ -1009,19 +1350,9 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 		return NULL;
 	}
 
+	// find the searchStr in the current peer list, recording the last item (for if we need to append to the end of the list)
 	KeyValues *lastItem = NULL;
-	KeyValues *dat;
-	// find the searchStr in the current peer list
-	for (dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
-	{
-		lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
-
-		// symbol compare
-		if (dat->m_iKeyName == iSearchStr)
-		{
-			break;
-		}
-	}
+	KeyValues *dat = FindChildKey( iSearchStr, &lastItem );
 
 	if ( !dat && m_pChain )
 	{
@@ -1050,6 +1381,7 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 				m_pSub = dat;
 			}
 			dat->m_pPeer = NULL;
+			IndexChildKey( dat );
 
 			// a key graduates to be a submsg as soon as it's m_pSub is set
 			// this should be the only place m_pSub is set
@@ -1155,6 +1487,8 @@ void KeyValues::AddSubkeyUsingKnownLastChild( KeyValues *pSubkey, KeyValues *pLa
 
 		pLastChild->SetNextKey( pSubkey );
 	}
+
+	IndexChildKey( pSubkey );
 }
 
 
@@ -1182,6 +1516,8 @@ void KeyValues::AddSubKey( KeyValues *pSubkey )
 
 		pTempDat->SetNextKey( pSubkey );
 	}
+
+	IndexChildKey( pSubkey );
 }
 
 
@@ -1194,6 +1530,8 @@ void KeyValues::RemoveSubKey(KeyValues *subKey)
 	if (!subKey)
 		return;
 
+	DropChildIndex();
+
 	// check the list pointer
 	if (m_pSub == subKey)
 	{
@@ -1595,11 +1933,8 @@ void KeyValues::SetColor( const char *keyName, Color value)
 
 void KeyValues::SetStringValue( char const *strValue )
 {
-	// delete the old value
-	delete [] m_sValue;
-	// make sure we're not storing the WSTRING  - as we're converting over to STRING
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+	FreeStringValues();
 
 	if (!strValue)
 	{
@@ -1629,11 +1964,8 @@ void KeyValues::SetString( const char *keyName, const char *value )
 			return;
 		}
 
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+		dat->FreeStringValues();
 
 		if (!value)
 		{
@@ -1658,11 +1990,8 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 	KeyValues *dat = FindKey( keyName, true );
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_wsValue;
-		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		// delete the old value, make sure we're not storing the STRING  - as we're converting over to WSTRING
+		dat->FreeStringValues();
 
 		if (!value)
 		{
@@ -1702,11 +2031,8 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+		dat->FreeStringValues();
 
 		dat->m_sValue = new char[sizeof(uint64)];
 		*((uint64 *)dat->m_sValue) = value;
@@ -1876,8 +2202,12 @@ void KeyValues::CopyKeyValue( const KeyValues& src, size_t tmpBufferSizeB, char*
 
 KeyValues& KeyValues::operator=( const KeyValues& src )
 {
+	// where this key lives doesn't change
+	unsigned char nArenaFlags = m_nArenaFlags & ( KEYVALUES_ARENA_ALLOC | KEYVALUES_ARENA_KEY );
+
 	RemoveEverything();
 	Init();	// reset all values
+	m_nArenaFlags = nArenaFlags;
 	CopyKeyValuesFromRecursive( src );
 	return *this;
 }
@@ -1888,6 +2218,9 @@ KeyValues& KeyValues::operator=( const KeyValues& src )
 //-----------------------------------------------------------------------------
 void KeyValues::CopySubkeys( KeyValues *pParent ) const
 {
+	// the copies replace pParent's child list, so any index it has is stale
+	pParent->DropChildIndex();
+
 	// recursively copy subkeys
 	// Also maintain ordering....
 	KeyValues *pPrev = NULL;
@@ -2017,7 +2350,11 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	DropChildIndex();
+	if ( m_pSub )
+	{
+		m_pSub->deleteThis();
+	}
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
 }
@@ -2039,6 +2376,13 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
+	if ( m_nArenaFlags & KEYVALUES_ARENA_KEY )
+	{
+		// the memory goes back when the arena's owner is deleted
+		this->~KeyValues();
+		return;
+	}
+
 	delete this;
 }
 
@@ -2259,6 +2603,7 @@ static CThreadFastMutex g_KVMutex;
 bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBaseFileSystem* pFileSystem, const char *pPathID )
 {
 	AUTO_LOCK( g_KVMutex );
+	CKeyValuesArena *pArena = ( m_nArenaFlags & KEYVALUES_ARENA_ALLOC ) ? GetOrCreateArena() : NULL;
 	KeyValues *pPreviousKey = NULL;
 	KeyValues *pCurrentKey = this;
 	CUtlVector< KeyValues * > includedKeys;
@@ -2310,7 +2655,7 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 
 		if ( !pCurrentKey )
 		{
-			pCurrentKey = new KeyValues( s );
+			pCurrentKey = AllocKeyValues( s, pArena );
 			Assert( pCurrentKey );
 
 			pCurrentKey->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // same format has parent use
@@ -2340,7 +2685,7 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 		if ( s && *s == '{' && !wasQuoted )
 		{
 			// header is valid so load the file
-			pCurrentKey->RecursiveLoadFromBuffer( resourceName, buf );
+			pCurrentKey->RecursiveLoadFromBuffer( resourceName, buf, pArena );
 		}
 		else
 		{
@@ -2422,7 +2767,7 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, const char *pBuffer, I
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &buf )
+void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &buf, CKeyValuesArena *pArena )
 {
 	CKeyErrorContext errorReport(this);
 	bool wasQuoted;
@@ -2466,7 +2811,10 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 
 		// Always create the key; note that this could potentially
 		// cause some duplication, but that's what we want sometimes
-		KeyValues *dat = CreateKeyUsingKnownLastChild( name, pLastChild );
+		KeyValues *dat = AllocKeyValues( name, pArena );
+		dat->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // use same format as parent does
+		dat->UsesConditionals( m_bEvaluateConditionals != 0 );
+		AddSubkeyUsingKnownLastChild( dat, pLastChild );
 
 		errorKey.Reset( dat->GetNameSymbol() );
 
@@ -2498,7 +2846,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			// this isn't a key, it's a section
 			errorKey.Reset( INVALID_KEY_SYMBOL );
 			// sub value list
-			dat->RecursiveLoadFromBuffer( resourceName, buf );
+			dat->RecursiveLoadFromBuffer( resourceName, buf, pArena );
 		}
 		else 
 		{
@@ -2508,11 +2856,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeStringValues();
 
 			int len = Q_strlen( value );
 
@@ -2552,7 +2896,15 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 							digit -= 'A' - ( '9' + 1 );
 					retVal = ( retVal * 16 ) + ( digit - '0' );
 				}
-				dat->m_sValue = new char[sizeof(uint64)];
+				if ( pArena )
+				{
+					dat->m_sValue = (char *)pArena->Alloc( sizeof(uint64) );
+					dat->m_nArenaFlags |= KEYVALUES_ARENA_STRING;
+				}
+				else
+				{
+					dat->m_sValue = new char[sizeof(uint64)];
+				}
 				*((uint64 *)dat->m_sValue) = retVal;
 				dat->m_iDataType = TYPE_UINT64;
 			}
@@ -2574,7 +2926,15 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			if (dat->m_iDataType == TYPE_STRING)
 			{
 				// copy in the string information
-				dat->m_sValue = new char[len+1];
+				if ( pArena )
+				{
+					dat->m_sValue = (char *)pArena->Alloc( len+1 );
+					dat->m_nArenaFlags |= KEYVALUES_ARENA_STRING;
+				}
+				else
+				{
+					dat->m_sValue = new char[len+1];
+				}
 				Q_memcpy( dat->m_sValue, value, len+1 );
 			}
 
@@ -2600,6 +2960,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 		else
 		{
 			//this->RemoveSubKey( dat );
+			DropChildIndex();
 			if ( pLastChild == NULL )
 			{
 				Assert( m_pSub == dat );
@@ -2726,8 +3087,10 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 	if ( !buffer.IsValid() ) // must be valid, no overflows etc
 		return false;
 
+	unsigned char nArenaFlags = m_nArenaFlags & ( KEYVALUES_ARENA_ALLOC | KEYVALUES_ARENA_KEY );
 	RemoveEverything(); // remove current content
 	Init();	// reset
+	m_nArenaFlags = nArenaFlags;
 	
 	if ( nStackDepth > 100 )
 	{
@@ -0,0 +1,827 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled, read-only KeyValues images
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#if defined( _WIN32 ) && !defined( _X360 )
+#include <windows.h>		// for the file mapping functions
+#elif defined( POSIX )
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <KeyValues.h>
+#include "kvimage.h"
+
+#include "filesystem.h"
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "generichash.h"
+#include "strtools.h"
+#include "utlbuffer.h"
+#include "UtlStringMap.h"
+#include "utlvector.h"
+#include <Color.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+#define KVIMAGE_HASH_SEED		0x6B564931
+#define KVIMAGE_CACHE_PATH_ID	"DEFAULT_WRITE_PATH"
+
+static uint32 KVImageNameHash( const char *pName )
+{
+	return MurmurHash2LowerCase( pName, KVIMAGE_HASH_SEED );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the string table of an image, storing each distinct string once
+//-----------------------------------------------------------------------------
+class CKVImageStringTable
+{
+public:
+	CKVImageStringTable() : m_Offsets( false )
+	{
+		AddString( "" );
+	}
+
+	int AddString( const char *pString )
+	{
+		UtlSymId_t id = m_Offsets.Find( pString );
+		if ( id != m_Offsets.InvalidIndex() )
+			return m_Offsets[id];
+
+		int nOffset = m_Strings.TellPut();
+		m_Strings.PutString( pString );
+		m_Strings.PutChar( 0 );
+		m_Offsets[pString] = nOffset;
+		return nOffset;
+	}
+
+	CUtlBuffer &GetBuffer() { return m_Strings; }
+
+private:
+	CUtlBuffer m_Strings;
+	CUtlStringMap< int > m_Offsets;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Flattens a tree and its peers into an image
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::Compile( KeyValues *pKeyValues, CRC32_t nSourceCRC, int nSourceSize, CUtlBuffer &image )
+{
+	if ( !pKeyValues || image.IsText() )
+		return false;
+
+	// Lay the keys out breadth first, so the children of each key end up next to each other
+	CUtlVector< KeyValues * > keys;
+	CUtlVector< int > firstChild;
+	CUtlVector< int > nextPeer;
+
+	for ( KeyValues *pKey = pKeyValues; pKey != NULL; pKey = pKey->GetNextKey() )
+	{
+		nextPeer.AddToTail( pKey->GetNextKey() ? keys.Count() + 1 : KVIMAGE_NO_NODE );
+		keys.AddToTail( pKey );
+	}
+
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		KeyValues *pSub = keys[i]->GetFirstSubKey();
+		firstChild.AddToTail( pSub ? keys.Count() : KVIMAGE_NO_NODE );
+
+		for ( ; pSub != NULL; pSub = pSub->GetNextKey() )
+		{
+			nextPeer.AddToTail( pSub->GetNextKey() ? keys.Count() + 1 : KVIMAGE_NO_NODE );
+			keys.AddToTail( pSub );
+		}
+	}
+
+	CKVImageStringTable strings;
+	CUtlVector< KVImageNode_t > nodes;
+	nodes.SetCount( keys.Count() );
+	memset( nodes.Base(), 0, nodes.Count() * sizeof( KVImageNode_t ) );
+
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		KeyValues *pKey = keys[i];
+		KVImageNode_t &node = nodes[i];
+
+		node.m_nName = strings.AddString( pKey->GetName() );
+		node.m_nNameHash = KVImageNameHash( pKey->GetName() );
+		node.m_nFirstChild = firstChild[i];
+		node.m_nNextPeer = nextPeer[i];
+		node.m_nType = pKey->GetDataType();
+		node.m_nString = -1;
+
+		// Store the string form GetString() would return up front. The conversions are done
+		// here rather than through GetString(), which would turn the source key into a string.
+		char buf[64];
+		switch ( node.m_nType )
+		{
+		case KeyValues::TYPE_NONE:
+			break;
+		case KeyValues::TYPE_STRING:
+			node.m_nString = strings.AddString( pKey->GetString() );
+			break;
+		case KeyValues::TYPE_INT:
+			node.m_nInt = pKey->GetInt();
+			Q_snprintf( buf, sizeof( buf ), "%d", node.m_nInt );
+			node.m_nString = strings.AddString( buf );
+			break;
+		case KeyValues::TYPE_FLOAT:
+			node.m_flFloat = pKey->GetFloat();
+			Q_snprintf( buf, sizeof( buf ), "%f", node.m_flFloat );
+			node.m_nString = strings.AddString( buf );
+			break;
+		case KeyValues::TYPE_UINT64:
+			node.m_nUint64 = pKey->GetUint64();
+			Q_snprintf( buf, sizeof( buf ), "%lld", node.m_nUint64 );
+			node.m_nString = strings.AddString( buf );
+			break;
+		case KeyValues::TYPE_COLOR:
+			{
+				Color color = pKey->GetColor();
+				for ( int j = 0; j < 4; j++ )
+				{
+					node.m_Color[j] = color[j];
+				}
+			}
+			break;
+		case KeyValues::TYPE_WSTRING:
+			{
+				// images only hold UTF-8, GetWString() callers need a real tree
+				char wideBuf[512];
+				if ( !Q_UnicodeToUTF8( pKey->GetWString(), wideBuf, sizeof( wideBuf ) ) )
+					return false;
+
+				node.m_nType = KeyValues::TYPE_STRING;
+				node.m_nString = strings.AddString( wideBuf );
+			}
+			break;
+		default:
+			// pointers don't mean anything on disk
+			Warning( "CKeyValuesImage::Compile: key \"%s\" has a value that can't be stored\n", pKey->GetName() );
+			return false;
+		}
+	}
+
+	CUtlBuffer &stringBuf = strings.GetBuffer();
+
+	KVImageHeader_t header;
+	header.m_nId = KVIMAGE_ID;
+	header.m_nVersion = KVIMAGE_VERSION;
+	header.m_nSourceCRC = nSourceCRC;
+	header.m_nSourceSize = nSourceSize;
+	header.m_nNodes = nodes.Count();
+	header.m_nNodeOffset = sizeof( KVImageHeader_t );
+	header.m_nStringBytes = stringBuf.TellPut();
+	header.m_nStringOffset = header.m_nNodeOffset + nodes.Count() * sizeof( KVImageNode_t );
+
+	image.Put( &header, sizeof( header ) );
+	image.Put( nodes.Base(), nodes.Count() * sizeof( KVImageNode_t ) );
+	image.Put( stringBuf.Base(), stringBuf.TellPut() );
+
+	return image.IsValid();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructor, destructor
+//-----------------------------------------------------------------------------
+CKeyValuesImage::CKeyValuesImage()
+{
+	m_pHeader = NULL;
+	m_pNodes = NULL;
+	m_pStrings = NULL;
+	m_pMapping = NULL;
+	m_nMappingSize = 0;
+	m_pMemory = NULL;
+}
+
+CKeyValuesImage::~CKeyValuesImage()
+{
+	Clear();
+}
+
+void CKeyValuesImage::Clear()
+{
+	m_pHeader = NULL;
+	m_pNodes = NULL;
+	m_pStrings = NULL;
+
+	if ( m_pMapping )
+	{
+#if defined( _WIN32 ) && !defined( _X360 )
+		UnmapViewOfFile( m_pMapping );
+#elif defined( POSIX )
+		munmap( m_pMapping, m_nMappingSize );
+#endif
+		m_pMapping = NULL;
+		m_nMappingSize = 0;
+	}
+
+	if ( m_pMemory )
+	{
+		free( m_pMemory );
+		m_pMemory = NULL;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Uses an image in place. Everything a view follows is checked here
+//	once, so a truncated or damaged cache file is rejected instead of read past.
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::Init( const void *pImage, int nSize )
+{
+	m_pHeader = NULL;
+	m_pNodes = NULL;
+	m_pStrings = NULL;
+
+	if ( !pImage || ( (uintp)pImage % sizeof( uint64 ) ) != 0 || nSize < (int)sizeof( KVImageHeader_t ) )
+		return false;
+
+	const KVImageHeader_t *pHeader = (const KVImageHeader_t *)pImage;
+	if ( pHeader->m_nId != KVIMAGE_ID || pHeader->m_nVersion != KVIMAGE_VERSION )
+		return false;
+
+	int64 nNodeEnd = (int64)pHeader->m_nNodeOffset + (int64)pHeader->m_nNodes * (int64)sizeof( KVImageNode_t );
+	if ( pHeader->m_nNodes < 0 || pHeader->m_nNodeOffset < (int)sizeof( KVImageHeader_t ) || ( pHeader->m_nNodeOffset % sizeof( uint64 ) ) != 0 ||
+		 pHeader->m_nStringBytes <= 0 || pHeader->m_nStringOffset < nNodeEnd ||
+		 (int64)pHeader->m_nStringOffset + pHeader->m_nStringBytes > nSize )
+		return false;
+
+	const KVImageNode_t *pNodes = (const KVImageNode_t *)( (const byte *)pImage + pHeader->m_nNodeOffset );
+	const char *pStrings = (const char *)pImage + pHeader->m_nStringOffset;
+	if ( pStrings[pHeader->m_nStringBytes - 1] != 0 )
+		return false;
+
+	for ( int i = 0; i < pHeader->m_nNodes; i++ )
+	{
+		const KVImageNode_t &node = pNodes[i];
+
+		if ( node.m_nName < 0 || node.m_nName >= pHeader->m_nStringBytes ||
+			 node.m_nString < -1 || node.m_nString >= pHeader->m_nStringBytes ||
+			 node.m_nType < 0 || node.m_nType >= KeyValues::TYPE_NUMTYPES )
+			return false;
+
+		// links only ever point forward, so walking them always ends
+		if ( ( node.m_nFirstChild != KVIMAGE_NO_NODE && ( node.m_nFirstChild <= i || node.m_nFirstChild >= pHeader->m_nNodes ) ) ||
+			 ( node.m_nNextPeer != KVIMAGE_NO_NODE && ( node.m_nNextPeer <= i || node.m_nNextPeer >= pHeader->m_nNodes ) ) )
+			return false;
+	}
+
+	m_pHeader = pHeader;
+	m_pNodes = pNodes;
+	m_pStrings = pStrings;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Cache file for a text file, named after the CRC of the text so a
+//	stale image is never used
+//-----------------------------------------------------------------------------
+void CKeyValuesImage::GetCacheFileName( const char *resourceName, CRC32_t nSourceCRC, char *pDest, int nMaxLen )
+{
+	Q_snprintf( pDest, nMaxLen, "%s/%s.%08x%s", KVIMAGE_CACHE_DIR, resourceName, nSourceCRC, KVIMAGE_CACHE_EXT );
+	Q_FixSlashes( pDest );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The cache file name is built from the resource name, so it has to
+//	be a relative path that stays inside KVIMAGE_CACHE_DIR
+//-----------------------------------------------------------------------------
+static bool IsCacheableResourceName( const char *resourceName )
+{
+	if ( Q_IsAbsolutePath( resourceName ) || strchr( resourceName, ':' ) )
+		return false;
+
+	for ( const char *pComponent = resourceName; *pComponent; )
+	{
+		const char *pEnd = pComponent;
+		while ( *pEnd && *pEnd != '/' && *pEnd != '\\' )
+		{
+			++pEnd;
+		}
+
+		if ( pEnd - pComponent == 2 && pComponent[0] == '.' && pComponent[1] == '.' )
+			return false;
+
+		pComponent = *pEnd ? pEnd + 1 : pEnd;
+	}
+
+	return true;
+}
+
+CKeyValuesImage::Source_t::Source_t()
+{
+	m_nSize = 0;
+	m_nCRC = 0;
+	m_bCacheable = false;
+	m_szCacheFile[0] = 0;
+}
+
+bool CKeyValuesImage::ReadSource( IFileSystem *filesystem, const char *resourceName, const char *pathID, Source_t &source )
+{
+	if ( !filesystem->ReadFile( resourceName, pathID, source.m_Text ) )
+		return false;
+
+	source.m_nSize = source.m_Text.TellPut();
+	source.m_nCRC = CRC32_ProcessSingleBuffer( source.m_Text.Base(), source.m_nSize );
+
+	// double NULL terminating in case this is a unicode file, like KeyValues::LoadFromFile
+	source.m_Text.PutChar( 0 );
+	source.m_Text.PutChar( 0 );
+
+	// The image only depends on this file's text, unless it pulls in other files. Unicode
+	// files can't be checked for that here, they're converted in LoadFromBuffer.
+	const char *pText = (const char *)source.m_Text.Base();
+	bool bUnicode = source.m_nSize > 2 && (uint8)pText[0] == 0xFF && (uint8)pText[1] == 0xFE;
+	source.m_bCacheable = !bUnicode && IsCacheableResourceName( resourceName ) && !Q_stristr( pText, "#include" ) && !Q_stristr( pText, "#base" );
+	if ( source.m_bCacheable )
+	{
+		GetCacheFileName( resourceName, source.m_nCRC, source.m_szCacheFile, sizeof( source.m_szCacheFile ) );
+	}
+
+	return true;
+}
+
+bool CKeyValuesImage::CompileSource( IFileSystem *filesystem, const char *resourceName, const char *pathID, Source_t &source, CUtlBuffer &image )
+{
+	// the tree only lives long enough to be flattened
+	KeyValues *pKeyValues = new KeyValues( resourceName );
+	pKeyValues->UsesArena( true );
+
+	bool bOk = pKeyValues->LoadFromBuffer( resourceName, (const char *)source.m_Text.Base(), filesystem, pathID ) &&
+			   Compile( pKeyValues, source.m_nCRC, source.m_nSize, image );
+
+	pKeyValues->deleteThis();
+	return bOk;
+}
+
+void CKeyValuesImage::WriteCache( IFileSystem *filesystem, const Source_t &source, CUtlBuffer &image )
+{
+	char szDir[MAX_PATH];
+	Q_ExtractFilePath( source.m_szCacheFile, szDir, sizeof( szDir ) );
+	filesystem->CreateDirHierarchy( szDir, KVIMAGE_CACHE_PATH_ID );
+
+	// Another process may have the cache file mapped, so it's never rewritten in place. The
+	// image is written under a name only this thread uses and renamed over it, which leaves
+	// existing mappings with the old file.
+	char szTempFile[MAX_PATH];
+	Q_snprintf( szTempFile, sizeof( szTempFile ), "%s.%x.tmp", source.m_szCacheFile, (unsigned int)ThreadGetCurrentId() );
+
+	if ( !filesystem->WriteFile( szTempFile, KVIMAGE_CACHE_PATH_ID, image ) )
+	{
+		DevMsg( "CKeyValuesImage: couldn't write %s\n", szTempFile );
+		return;
+	}
+
+	if ( !filesystem->RenameFile( szTempFile, source.m_szCacheFile, KVIMAGE_CACHE_PATH_ID ) )
+	{
+		// Some platforms won't rename over an existing file, in which case another process has
+		// just written the same image
+		if ( !filesystem->FileExists( source.m_szCacheFile, KVIMAGE_CACHE_PATH_ID ) )
+		{
+			DevMsg( "CKeyValuesImage: couldn't rename %s to %s\n", szTempFile, source.m_szCacheFile );
+		}
+		filesystem->RemoveFile( szTempFile, KVIMAGE_CACHE_PATH_ID );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Maps a cache file read only
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::MapFile( const char *pFullPath )
+{
+	Assert( !m_pMapping );
+
+#if defined( _WIN32 ) && !defined( _X360 )
+	HANDLE hFile = CreateFileA( pFullPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	DWORD nSize = GetFileSize( hFile, NULL );
+	HANDLE hMapping = ( nSize != INVALID_FILE_SIZE && nSize > 0 ) ? CreateFileMappingA( hFile, NULL, PAGE_READONLY, 0, 0, NULL ) : NULL;
+	void *pView = hMapping ? MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+
+	// the view keeps the file mapped
+	if ( hMapping )
+	{
+		CloseHandle( hMapping );
+	}
+	CloseHandle( hFile );
+
+	if ( !pView )
+		return false;
+
+	m_pMapping = pView;
+	m_nMappingSize = (int)nSize;
+	return true;
+#elif defined( POSIX )
+	int fd = open( pFullPath, O_RDONLY );
+	if ( fd < 0 )
+		return false;
+
+	struct stat st;
+	void *pView = MAP_FAILED;
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+	{
+		pView = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	}
+	close( fd );
+
+	if ( pView == MAP_FAILED )
+		return false;
+
+	m_pMapping = pView;
+	m_nMappingSize = (int)st.st_size;
+	return true;
+#else
+	return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Uses an image if it was compiled from the given text
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::UseImage( const void *pImage, int nSize, const Source_t &source )
+{
+	return Init( pImage, nSize ) && m_pHeader->m_nSourceCRC == source.m_nCRC && m_pHeader->m_nSourceSize == source.m_nSize;
+}
+
+void CKeyValuesImage::TakeImage( CUtlBuffer &image )
+{
+	m_pMemory = malloc( image.TellPut() );
+	memcpy( m_pMemory, image.Base(), image.TellPut() );
+	Verify( Init( m_pMemory, image.TellPut() ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads a text file as an image, through the cache
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::LoadFromFile( IFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	Clear();
+
+	Source_t source;
+	if ( !ReadSource( filesystem, resourceName, pathID, source ) )
+		return false;
+
+	if ( source.m_bCacheable )
+	{
+		// Map the cached image where the filesystem can give us a real file, read it otherwise
+		char szFullPath[MAX_PATH];
+		if ( filesystem->RelativePathToFullPath( source.m_szCacheFile, KVIMAGE_CACHE_PATH_ID, szFullPath, sizeof( szFullPath ) ) && MapFile( szFullPath ) )
+		{
+			if ( UseImage( m_pMapping, m_nMappingSize, source ) )
+				return true;
+
+			Clear();
+		}
+
+		CUtlBuffer cached;
+		if ( filesystem->ReadFile( source.m_szCacheFile, KVIMAGE_CACHE_PATH_ID, cached ) && UseImage( cached.Base(), cached.TellPut(), source ) )
+		{
+			TakeImage( cached );
+			return true;
+		}
+	}
+
+	CUtlBuffer image;
+	if ( !CompileSource( filesystem, resourceName, pathID, source, image ) )
+		return false;
+
+	if ( source.m_bCacheable )
+	{
+		WriteCache( filesystem, source, image );
+	}
+
+	TakeImage( image );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes sure the cache has an image of a text file
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::UpdateCache( IFileSystem *filesystem, const char *resourceName, const char *pathID, bool *pbCompiled )
+{
+	if ( pbCompiled )
+	{
+		*pbCompiled = false;
+	}
+
+	Source_t source;
+	if ( !ReadSource( filesystem, resourceName, pathID, source ) || !source.m_bCacheable )
+		return false;
+
+	if ( filesystem->FileExists( source.m_szCacheFile, KVIMAGE_CACHE_PATH_ID ) )
+		return true;
+
+	CUtlBuffer image;
+	if ( !CompileSource( filesystem, resourceName, pathID, source, image ) )
+		return false;
+
+	WriteCache( filesystem, source, image );
+
+	if ( pbCompiled )
+	{
+		*pbCompiled = true;
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesView
+//-----------------------------------------------------------------------------
+const KVImageNode_t &CKeyValuesView::Node() const
+{
+	Assert( IsValid() );
+	return m_pImage->GetNode( m_iNode );
+}
+
+const char *CKeyValuesView::GetName() const
+{
+	return IsValid() ? m_pImage->GetString( Node().m_nName ) : "";
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds a key by name, or by a "sub/key" path
+//-----------------------------------------------------------------------------
+CKeyValuesView CKeyValuesView::FindKey( const char *keyName ) const
+{
+	if ( !IsValid() )
+		return CKeyValuesView();
+
+	// return the current key if a NULL subkey is asked for
+	if ( !keyName || !keyName[0] )
+		return *this;
+
+	// look for '/' characters deliminating sub fields
+	char szBuf[256];
+	const char *subStr = strchr( keyName, '/' );
+	const char *searchStr = keyName;
+	if ( subStr )
+	{
+		int size = Min( (int)( subStr - keyName + 1 ), (int)V_ARRAYSIZE( szBuf ) );
+		V_strncpy( szBuf, keyName, size );
+		searchStr = szBuf;
+	}
+
+	uint32 nHash = KVImageNameHash( searchStr );
+	for ( int iChild = Node().m_nFirstChild; iChild != KVIMAGE_NO_NODE; iChild = m_pImage->GetNode( iChild ).m_nNextPeer )
+	{
+		const KVImageNode_t &child = m_pImage->GetNode( iChild );
+		if ( child.m_nNameHash == nHash && !Q_stricmp( m_pImage->GetString( child.m_nName ), searchStr ) )
+		{
+			CKeyValuesView dat( m_pImage, iChild );
+			return subStr ? dat.FindKey( subStr + 1 ) : dat;
+		}
+	}
+
+	return CKeyValuesView();
+}
+
+CKeyValuesView CKeyValuesView::GetFirstSubKey() const
+{
+	return IsValid() ? CKeyValuesView( m_pImage, Node().m_nFirstChild ) : CKeyValuesView();
+}
+
+CKeyValuesView CKeyValuesView::GetNextKey() const
+{
+	return IsValid() ? CKeyValuesView( m_pImage, Node().m_nNextPeer ) : CKeyValuesView();
+}
+
+CKeyValuesView CKeyValuesView::GetFirstTrueSubKey() const
+{
+	CKeyValuesView ret = GetFirstSubKey();
+	while ( ret.IsValid() && ret.Node().m_nType != KeyValues::TYPE_NONE )
+		ret = ret.GetNextKey();
+
+	return ret;
+}
+
+CKeyValuesView CKeyValuesView::GetNextTrueSubKey() const
+{
+	CKeyValuesView ret = GetNextKey();
+	while ( ret.IsValid() && ret.Node().m_nType != KeyValues::TYPE_NONE )
+		ret = ret.GetNextKey();
+
+	return ret;
+}
+
+CKeyValuesView CKeyValuesView::GetFirstValue() const
+{
+	CKeyValuesView ret = GetFirstSubKey();
+	while ( ret.IsValid() && ret.Node().m_nType == KeyValues::TYPE_NONE )
+		ret = ret.GetNextKey();
+
+	return ret;
+}
+
+CKeyValuesView CKeyValuesView::GetNextValue() const
+{
+	CKeyValuesView ret = GetNextKey();
+	while ( ret.IsValid() && ret.Node().m_nType == KeyValues::TYPE_NONE )
+		ret = ret.GetNextKey();
+
+	return ret;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Data access, following the conversions in the KeyValues getters
+//-----------------------------------------------------------------------------
+int CKeyValuesView::GetInt( const char *keyName, int defaultValue ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() )
+	{
+		const KVImageNode_t &node = dat.Node();
+		switch ( node.m_nType )
+		{
+		case KeyValues::TYPE_STRING:
+			return atoi( m_pImage->GetString( node.m_nString ) );
+		case KeyValues::TYPE_FLOAT:
+			return (int)node.m_flFloat;
+		case KeyValues::TYPE_UINT64:
+			// can't convert, since it would lose data
+			Assert(0);
+			return 0;
+		case KeyValues::TYPE_INT:
+		default:
+			return node.m_nInt;
+		};
+	}
+	return defaultValue;
+}
+
+uint64 CKeyValuesView::GetUint64( const char *keyName, uint64 defaultValue ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() )
+	{
+		const KVImageNode_t &node = dat.Node();
+		switch ( node.m_nType )
+		{
+		case KeyValues::TYPE_STRING:
+			return (uint64)Q_atoi64( m_pImage->GetString( node.m_nString ) );
+		case KeyValues::TYPE_FLOAT:
+			return (int)node.m_flFloat;
+		case KeyValues::TYPE_UINT64:
+			return node.m_nUint64;
+		case KeyValues::TYPE_INT:
+		default:
+			return node.m_nInt;
+		};
+	}
+	return defaultValue;
+}
+
+float CKeyValuesView::GetFloat( const char *keyName, float defaultValue ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() )
+	{
+		const KVImageNode_t &node = dat.Node();
+		switch ( node.m_nType )
+		{
+		case KeyValues::TYPE_STRING:
+			return (float)atof( m_pImage->GetString( node.m_nString ) );
+		case KeyValues::TYPE_FLOAT:
+			return node.m_flFloat;
+		case KeyValues::TYPE_INT:
+			return (float)node.m_nInt;
+		case KeyValues::TYPE_UINT64:
+			return (float)node.m_nUint64;
+		default:
+			return 0.0f;
+		};
+	}
+	return defaultValue;
+}
+
+const char *CKeyValuesView::GetString( const char *keyName, const char *defaultValue ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() && dat.Node().m_nString != -1 )
+		return m_pImage->GetString( dat.Node().m_nString );
+
+	return defaultValue;
+}
+
+bool CKeyValuesView::GetBool( const char *keyName, bool defaultValue, bool* optGotDefault ) const
+{
+	bool bFound = FindKey( keyName ).IsValid();
+	if ( optGotDefault )
+	{
+		*optGotDefault = !bFound;
+	}
+
+	return bFound ? 0 != GetInt( keyName, 0 ) : defaultValue;
+}
+
+Color CKeyValuesView::GetColor( const char *keyName ) const
+{
+	Color color(0, 0, 0, 0);
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() )
+	{
+		const KVImageNode_t &node = dat.Node();
+		if ( node.m_nType == KeyValues::TYPE_COLOR )
+		{
+			color[0] = node.m_Color[0];
+			color[1] = node.m_Color[1];
+			color[2] = node.m_Color[2];
+			color[3] = node.m_Color[3];
+		}
+		else if ( node.m_nType == KeyValues::TYPE_FLOAT )
+		{
+			color[0] = node.m_flFloat;
+		}
+		else if ( node.m_nType == KeyValues::TYPE_INT )
+		{
+			color[0] = node.m_nInt;
+		}
+		else if ( node.m_nType == KeyValues::TYPE_STRING )
+		{
+			// parse the colors out of the string
+			float a = 0.0f, b = 0.0f, c = 0.0f, d = 0.0f;
+			sscanf( m_pImage->GetString( node.m_nString ), "%f %f %f %f", &a, &b, &c, &d );
+			color[0] = (unsigned char)a;
+			color[1] = (unsigned char)b;
+			color[2] = (unsigned char)c;
+			color[3] = (unsigned char)d;
+		}
+	}
+	return color;
+}
+
+bool CKeyValuesView::IsEmpty( const char *keyName ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( !dat.IsValid() )
+		return true;
+
+	return dat.Node().m_nType == KeyValues::TYPE_NONE && dat.Node().m_nFirstChild == KVIMAGE_NO_NODE;
+}
+
+KeyValues::types_t CKeyValuesView::GetDataType( const char *keyName ) const
+{
+	CKeyValuesView dat = FindKey( keyName );
+	if ( dat.IsValid() )
+		return (KeyValues::types_t)dat.Node().m_nType;
+
+	return KeyValues::TYPE_NONE;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Heap copy of this key and everything below it
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesView::MakeKeyValues() const
+{
+	if ( !IsValid() )
+		return NULL;
+
+	const KVImageNode_t &node = Node();
+	KeyValues *pKey = new KeyValues( GetName() );
+
+	switch ( node.m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+		pKey->SetString( NULL, GetString() );
+		break;
+	case KeyValues::TYPE_INT:
+		pKey->SetInt( NULL, node.m_nInt );
+		break;
+	case KeyValues::TYPE_FLOAT:
+		pKey->SetFloat( NULL, node.m_flFloat );
+		break;
+	case KeyValues::TYPE_UINT64:
+		pKey->SetUint64( NULL, node.m_nUint64 );
+		break;
+	case KeyValues::TYPE_COLOR:
+		pKey->SetColor( NULL, GetColor() );
+		break;
+	default:
+		break;
+	}
+
+	KeyValues *pLastChild = NULL;
+	for ( CKeyValuesView child = GetFirstSubKey(); child.IsValid(); child = child.GetNextKey() )
+	{
+		KeyValues *pChild = child.MakeKeyValues();
+		pKey->AddSubkeyUsingKnownLastChild( pChild, pLastChild );
+		pLastChild = pChild;
+	}
+
+	return pKey;
+}
@@ -15,6 +15,7 @@
 #include "stringpool.h"
 #include "utlhashtable.h"
 #include "utlstring.h"
+#include "generichash.h"
 
 // Ensure that everybody has the right compiler version installed. The version
 // number can be obtained by looking at the compiler output when you type 'cl'
@@ -44,7 +45,7 @@
 // globals
 //-----------------------------------------------------------------------------
 
-CUtlSymbolTableMT* CUtlSymbol::s_pSymbolTable = 0; 
+CUtlSymbolTableHashed* CUtlSymbol::s_pSymbolTable = 0; 
 bool CUtlSymbol::s_bAllowStaticSymbolTable = true;
 
 
@@ -63,7 +64,7 @@ void CUtlSymbol::Initialize()
 	static bool symbolsInitialized = false;
 	if (!symbolsInitialized)
 	{
-		s_pSymbolTable = new CUtlSymbolTableMT;
+		s_pSymbolTable = new CUtlSymbolTableHashed;
 		symbolsInitialized = true;
 	}
 }
@@ -83,7 +84,7 @@ public:
 
 static CCleanupUtlSymbolTable g_CleanupSymbolTable;
 
-CUtlSymbolTableMT* CUtlSymbol::CurrTable()
+CUtlSymbolTableHashed* CUtlSymbol::CurrTable()
 {
 	Initialize();
 	return s_pSymbolTable; 
@@ -288,6 +289,242 @@ void CUtlSymbolTable::RemoveAll()
 }
 
 
+//-----------------------------------------------------------------------------
+// Hashed symbol table
+//-----------------------------------------------------------------------------
+
+#define SYMBOL_HASH_SEED		0x3C6EF372
+#define SYMBOL_HASH_TAG_MASK	0xFFFF0000
+#define SYMBOL_SLOT_ID_MASK		0x0000FFFF
+
+CUtlSymbolTableHashed::CUtlSymbolTableHashed( int growSize, int initSize, bool caseInsensitive ) :
+	m_nSymbols( 0 ), m_bInsensitive( caseInsensitive ), m_StringPools( 8 )
+{
+	// keep the table at most half full
+	m_nInitialSlots = 64;
+	while ( m_nInitialSlots < initSize * 2 )
+	{
+		m_nInitialSlots <<= 1;
+	}
+
+	memset( m_pEntryBlocks, 0, sizeof( m_pEntryBlocks ) );
+	m_pTable = AllocTable( m_nInitialSlots );
+}
+
+CUtlSymbolTableHashed::~CUtlSymbolTableHashed()
+{
+	RemoveAll();
+	free( m_pTable );
+}
+
+uint32 CUtlSymbolTableHashed::HashSymbolString( const char *pString ) const
+{
+	// HashString() is only 16 bits, the slots want a full 32 bit hash
+	if ( m_bInsensitive )
+		return MurmurHash2LowerCase( pString, SYMBOL_HASH_SEED );
+
+	return MurmurHash2( pString, V_strlen( pString ), SYMBOL_HASH_SEED );
+}
+
+CUtlSymbolTableHashed::SlotTable_t *CUtlSymbolTableHashed::AllocTable( int nSlots )
+{
+	Assert( ( nSlots & ( nSlots - 1 ) ) == 0 );
+
+	SlotTable_t *pTable = (SlotTable_t *)malloc( sizeof( SlotTable_t ) + ( nSlots - 1 ) * sizeof( uint32 ) );
+	pTable->m_nMask = nSlots - 1;
+	memset( pTable->m_nSlots, 0, nSlots * sizeof( uint32 ) );
+	return pTable;
+}
+
+void CUtlSymbolTableHashed::InsertIntoTable( SlotTable_t *pTable, UtlSymId_t id, uint32 nHash )
+{
+	uint32 i = nHash & pTable->m_nMask;
+	while ( pTable->m_nSlots[i] )
+	{
+		i = ( i + 1 ) & pTable->m_nMask;
+	}
+
+	// One aligned store, a lookup sees either the empty slot or the finished one
+	*(volatile uint32 *)&pTable->m_nSlots[i] = ( nHash & SYMBOL_HASH_TAG_MASK ) | ( id + 1 );
+}
+
+CUtlSymbol CUtlSymbolTableHashed::FindInTable( const SlotTable_t *pTable, const char *pString, uint32 nHash ) const
+{
+	uint32 nTag = nHash & SYMBOL_HASH_TAG_MASK;
+
+	for ( uint32 i = nHash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		uint32 nSlot = *(volatile const uint32 *)&pTable->m_nSlots[i];
+		if ( !nSlot )
+			return CUtlSymbol();
+
+		if ( ( nSlot & SYMBOL_HASH_TAG_MASK ) != nTag )
+			continue;
+
+		UtlSymId_t id = (UtlSymId_t)( ( nSlot & SYMBOL_SLOT_ID_MASK ) - 1 );
+		const Entry_t *pEntry = GetEntry( id );
+		if ( pEntry->m_nHash != nHash )
+			continue;
+
+		if ( !( m_bInsensitive ? V_stricmp( pEntry->m_String, pString ) : V_strcmp( pEntry->m_String, pString ) ) )
+			return CUtlSymbol( id );
+	}
+}
+
+CUtlSymbolTableHashed::Entry_t *CUtlSymbolTableHashed::AllocEntry( const char *pString, uint32 nHash )
+{
+	int len = V_strlen( pString ) + 1;
+
+	// keep the hashes aligned
+	int size = AlignValue( (int)offsetof( Entry_t, m_String ) + len, (int)sizeof( uint32 ) );
+
+	StringPool_t *pPool = m_StringPools.Count() ? m_StringPools.Tail() : NULL;
+	if ( !pPool || ( pPool->m_TotalLen - pPool->m_SpaceUsed ) < size )
+	{
+		int newPoolSize = max( size, MIN_STRING_POOL_SIZE );
+		pPool = (StringPool_t*)malloc( sizeof( StringPool_t ) + newPoolSize - 1 );
+		pPool->m_TotalLen = newPoolSize;
+		pPool->m_SpaceUsed = 0;
+		m_StringPools.AddToTail( pPool );
+	}
+
+	Entry_t *pEntry = (Entry_t *)&pPool->m_Data[pPool->m_SpaceUsed];
+	pPool->m_SpaceUsed += size;
+
+	pEntry->m_nHash = nHash;
+	memcpy( pEntry->m_String, pString, len );
+	return pEntry;
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds the symbol for pString, without locking
+//-----------------------------------------------------------------------------
+
+CUtlSymbol CUtlSymbolTableHashed::Find( const char* pString ) const
+{
+	if ( !pString )
+		return CUtlSymbol();
+
+	return FindInTable( m_pTable, pString, HashSymbolString( pString ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds and/or creates a symbol based on the string
+//-----------------------------------------------------------------------------
+
+CUtlSymbol CUtlSymbolTableHashed::AddString( const char* pString )
+{
+	if ( !pString )
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+
+	uint32 nHash = HashSymbolString( pString );
+	CUtlSymbol id = FindInTable( m_pTable, pString, nHash );
+	if ( id.IsValid() )
+		return id;
+
+	AUTO_LOCK( m_AddMutex );
+
+	// Another thread may have added it while we waited
+	id = FindInTable( m_pTable, pString, nHash );
+	if ( id.IsValid() )
+		return id;
+
+	int iSymbol = m_nSymbols;
+	if ( iSymbol >= UTL_INVAL_SYMBOL )
+	{
+		AssertMsg( 0, "CUtlSymbolTableHashed: out of symbols\n" );
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+	}
+
+	Entry_t **pBlock = m_pEntryBlocks[ iSymbol >> ENTRY_BLOCK_BITS ];
+	if ( !pBlock )
+	{
+		pBlock = (Entry_t **)malloc( ENTRY_BLOCK_SIZE * sizeof( Entry_t * ) );
+		m_pEntryBlocks[ iSymbol >> ENTRY_BLOCK_BITS ] = pBlock;
+	}
+	pBlock[ iSymbol & ( ENTRY_BLOCK_SIZE - 1 ) ] = AllocEntry( pString, nHash );
+
+	// The entry has to be visible before any slot that refers to it
+	ThreadMemoryBarrier();
+
+	SlotTable_t *pTable = m_pTable;
+	if ( ( iSymbol + 1 ) * 2 > (int)( pTable->m_nMask + 1 ) )
+	{
+		// Grow into a new table, lookups carry on in the old one until it's published
+		SlotTable_t *pNewTable = AllocTable( ( pTable->m_nMask + 1 ) * 2 );
+		for ( int i = 0; i <= iSymbol; i++ )
+		{
+			InsertIntoTable( pNewTable, (UtlSymId_t)i, GetEntry( (UtlSymId_t)i )->m_nHash );
+		}
+
+		ThreadMemoryBarrier();
+		m_pTable = pNewTable;
+		m_RetiredTables.AddToTail( pTable );
+	}
+	else
+	{
+		InsertIntoTable( pTable, (UtlSymId_t)iSymbol, nHash );
+	}
+
+	ThreadMemoryBarrier();
+	m_nSymbols = iSymbol + 1;
+
+	return CUtlSymbol( (UtlSymId_t)iSymbol );
+}
+
+
+//-----------------------------------------------------------------------------
+// Look up the string associated with a particular symbol
+//-----------------------------------------------------------------------------
+
+const char* CUtlSymbolTableHashed::String( CUtlSymbol id ) const
+{
+	if ( !id.IsValid() )
+		return "";
+
+	Assert( (UtlSymId_t)id < m_nSymbols );
+	return GetEntry( id )->m_String;
+}
+
+
+//-----------------------------------------------------------------------------
+// Remove all symbols in the table.
+//-----------------------------------------------------------------------------
+
+void CUtlSymbolTableHashed::RemoveAll()
+{
+	AUTO_LOCK( m_AddMutex );
+
+	for ( int i = 0; i < MAX_ENTRY_BLOCKS; i++ )
+	{
+		free( m_pEntryBlocks[i] );
+		m_pEntryBlocks[i] = NULL;
+	}
+
+	for ( int i = 0; i < m_StringPools.Count(); i++ )
+	{
+		free( m_StringPools[i] );
+	}
+	m_StringPools.RemoveAll();
+
+	for ( int i = 0; i < m_RetiredTables.Count(); i++ )
+	{
+		free( m_RetiredTables[i] );
+	}
+	m_RetiredTables.RemoveAll();
+
+	if ( m_nSymbols )
+	{
+		free( m_pTable );
+		m_pTable = AllocTable( m_nInitialSlots );
+	}
+
+	m_nSymbols = 0;
+}
+
+
 
 class CUtlFilenameSymbolTable::HashTable : public CUtlStableHashtable<CUtlConstString>
 {